@@ -8,6 +8,10 @@
 // Make sure to free p_buffer yourself allocated from filesystem_read_file_to_buffer.
 // Make sure to call filesystem_enum_free_mem with your fs_tree_node once finished with it.
 
+// File watches are serviced on a background thread, with inotify on linux and mtime polling elsewhere.
+// Changes are batched until files have been quiet for a short time and only files whose mtime or size actually
+// changed are reported. Callbacks are made from filesystem_watch_dispatch on the calling thread.
+
 // Implemented with:
 //      win32 (windows)
 //      dirent (mac, ios, linux)
@@ -26,6 +30,8 @@ namespace pen
         u32           num_children = 0;
     };
 
+    typedef void (*filesystem_watch_callback)(const c8* filename, void* user_data);
+
     bool       filesystem_file_exists(const c8* filename);
     pen_error  filesystem_read_file_to_buffer(const c8* filename, void** p_buffer, u32& buffer_size);
     pen_error  filesystem_getmtime(const c8* filename, u32& mtime_out);
@@ -38,4 +44,8 @@ namespace pen
     const c8** filesystem_get_user_directory(s32& directory_depth); // returns array of directories like the above
     s32        filesystem_exclude_slash_depth();
 
+    u32  filesystem_watch_add(const c8* filename, filesystem_watch_callback callback, void* user_data);
+    void filesystem_watch_remove(u32 watch);
+    u32  filesystem_watch_dispatch(); // returns the number of callbacks made, cheap when nothing has changed
+
 } // namespace pen
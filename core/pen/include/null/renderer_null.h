@@ -0,0 +1,40 @@
+// renderer_null.h
+// Copyright 2014 - 2023 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Null renderer backend, no gpu work is done and every direct call is counted.
+// Used by headless tools and benchmarks to measure the command stream the front end produces.
+// Counters are written by whichever thread dispatches the command buffer, read them from that thread.
+
+#pragma once
+
+#include "types.h"
+
+namespace pen
+{
+    struct null_renderer_stats
+    {
+        u64 commands = 0;
+        u64 draws = 0;
+        u64 draws_indexed = 0;
+        u64 draws_instanced = 0;
+        u64 dispatches = 0;
+        u64 shader_binds = 0;
+        u64 input_layout_binds = 0;
+        u64 vertex_buffer_binds = 0;
+        u64 index_buffer_binds = 0;
+        u64 constant_buffer_binds = 0;
+        u64 texture_binds = 0;
+        u64 state_binds = 0; // raster, blend, depth stencil, viewport, scissor
+        u64 target_binds = 0;
+        u64 clears = 0;
+        u64 buffer_updates = 0;
+        u64 buffer_update_bytes = 0;
+        u64 resources_created = 0;
+        u64 resources_released = 0;
+        u64 presents = 0;
+    };
+
+    const null_renderer_stats& null_renderer_get_stats();
+    void                       null_renderer_reset_stats();
+} // namespace pen
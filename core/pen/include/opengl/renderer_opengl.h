@@ -0,0 +1,35 @@
+// renderer_opengl.h
+// Copyright 2014 - 2023 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// OpenGL backend specific queries.
+// Buffers created with PEN_CPU_ACCESS_WRITE are updated through a persistently mapped ring when ARB_buffer_storage is
+// available and by orphaning otherwise. Binding state is shadowed so redundant gl calls are skipped.
+// Stats are written on the render thread, read them there or tolerate tearing.
+
+#pragma once
+
+#include "types.h"
+
+namespace pen
+{
+    struct gl_buffer_stats
+    {
+        bool persistent_mapping = false; // ring in use, false when falling back to orphaning
+        u64  ring_size = 0;
+        u64  ring_bytes = 0;      // total bytes written into the ring
+        u64  ring_overflows = 0;  // updates which did not fit in the frame region and were orphaned
+        u64  orphans = 0;         // glBufferData orphan and refill, every update without the ring
+        u64  dynamic_updates = 0; // renderer_update_buffer calls on dynamic buffers
+        u64  fence_waits = 0;     // frames where the cpu had to wait for the gpu to release a region
+    };
+
+    struct gl_state_stats
+    {
+        u64 calls_issued = 0;   // binding calls which changed gl state
+        u64 calls_filtered = 0; // binding calls skipped because the state was already set
+    };
+
+    const gl_buffer_stats& renderer_opengl_get_buffer_stats();
+    const gl_state_stats&  renderer_opengl_get_state_stats();
+} // namespace pen
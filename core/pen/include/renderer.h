@@ -26,6 +26,7 @@
 #define PEN_CAPS_TEXTURE_CUBE_ARRAY (1 << 4)
 #define PEN_CAPS_BACKBUFFER_BGRA (1 << 5)
 #define PEN_CAPS_VUP (1 << 6) // opengl viewport y-up
+#define PEN_CAPS_CONSTANT_BUFFER_OFFSET (1 << 7) // renderer_set_constant_buffer can bind at an offset
 
 // Texture format caps
 #define PEN_CAPS_TEX_FORMAT_BC1 (1 << 31)
@@ -368,6 +369,42 @@ namespace pen
         float padding_0, padding_1;
     };
 
+    struct renderer_stats
+    {
+        u64 frames_in_flight = 0;      // presented frames the gpu has not reported complete
+        u64 pending_releases = 0;      // released resources waiting for the gpu to finish with them
+        u64 pending_releases_peak = 0;
+        u64 resources_released = 0;
+
+        // user thread to render thread pipelining
+        u64 frames_presented = 0;
+        u32 max_frames_in_flight = 1;      // frames the user thread may queue ahead of the render thread
+        u32 queued_frames = 0;             // consumed by the user thread and not yet presented
+        u64 cmd_buffer_stalls = 0;         // times the user thread waited for space in the command buffer
+        u64 cmd_lists_submitted = 0;
+        u64 cmd_list_commands = 0;         // commands recorded on any thread and submitted in command lists
+        f64 user_wait_ms = 0.0;            // user thread blocked for a frame slot last frame
+        f64 present_interval_ms = 0.0;     // present to present on the render thread
+        f64 present_interval_avg_ms = 0.0;
+        f64 input_to_present_ms = 0.0;     // from the start of the user frame, where input is read, to its present
+        f64 input_to_present_avg_ms = 0.0;
+    };
+
+    struct capture_info
+    {
+        u32 num_frames;  // complete frames in the capture
+        u32 start_frame; // frames before start_frame only create and release resources and set buffer contents
+        u32 width;       // backbuffer size when the capture began
+        u32 height;
+    };
+
+    struct dynamic_cbuffer
+    {
+        u32   handle; // bind with renderer_set_constant_buffer passing offset
+        u32   offset;
+        void* cpu_ptr; // write before the next renderer_set_constant_buffer call, valid until renderer_present
+    };
+
     // general accessors
     const c8*            renderer_get_shader_platform();
     bool                 renderer_viewport_vup();
@@ -380,6 +417,20 @@ namespace pen
     void renderer_test_run();
     void renderer_test_enable();
 
+    // command stream capture, enable before renderer_init to capture everything needed to replay in a new process.
+    // resource commands are recorded from init, all commands from start_frame. -capture <filename> -capture_start <n>
+    // -capture_frames <n> on the command line does the same.
+    void renderer_capture_enable(const c8* filename, u32 start_frame, u32 num_frames);
+    void renderer_capture_parse_args(s32 argc, c8** argv);
+
+    // replay submits captured frames through the command buffer like any other commands, with the same window size
+    // and nothing else created after renderer_init, so resource handles match. close after the last frame is consumed
+    bool renderer_replay_open(const c8* filename, capture_info& info);
+    u32  renderer_replay_frame(u32 frame); // returns the number of commands submitted, ends with a present
+    f64  renderer_replay_frame_time_ms(u32 frame); // time of the frames present since the capture began
+    void renderer_replay_end_loop(); // releases what frames from start_frame created, before replaying them again
+    void renderer_replay_close();
+
     // public-api will buffer all commands for dispatch on dedicated thread
     void       renderer_new_frame();
     void       renderer_set_current_ctx(render_ctx ctx);
@@ -397,7 +448,7 @@ namespace pen
     void       renderer_set_vertex_buffers(u32* buffer_indices, u32 num_buffers, u32 start_slot, const u32* strides,
                                            const u32* offsets);
     void       renderer_set_index_buffer(u32 buffer_index, u32 format, u32 offset);
-    void       renderer_set_constant_buffer(u32 buffer_index, u32 unit, u32 flags);
+    void       renderer_set_constant_buffer(u32 buffer_index, u32 unit, u32 flags, u32 offset = 0);
     void       renderer_set_structured_buffer(u32 buffer_index, u32 unit, u32 flags);
     void       renderer_update_buffer(u32 buffer_index, const void* data, u32 data_size, u32 offset = 0);
     u32        renderer_create_texture(const texture_creation_params& tcp);
@@ -429,7 +480,7 @@ namespace pen
     void       renderer_present();
     void       renderer_push_perf_marker(const c8* name);
     void       renderer_pop_perf_marker();
-    void       renderer_replace_resource(u32 dest, u32 src, e_renderer_resource type);
+    void       renderer_replace_resource(u32 dest, u32 src, e_renderer_resource type); // src handle is consumed
     void       renderer_release_shader(u32 shader_index, u32 shader_type);
     void       renderer_release_clear_state(u32 clear_state);
     void       renderer_release_buffer(u32 buffer_index);
@@ -443,6 +494,18 @@ namespace pen
     void       renderer_consume_cmd_buffer();
     void       renderer_update_queries();
     void       renderer_get_present_time(f32& cpu_ms, f32& gpu_ms);
+    void       renderer_set_max_frames_in_flight(u32 frames); // 1 - 3, applied at the next consume
+    const renderer_stats& renderer_get_stats(); // written on the render and user threads, tolerate tearing
+    dynamic_cbuffer renderer_alloc_dynamic_cbuffer(u32 size); // per draw constants from a ring reset each frame
+
+    // command lists, renderer calls made on a thread between begin and end are recorded into the list instead of the
+    // command buffer, so independent work can be recorded on worker threads. lists are submitted in order from the
+    // user thread. resource creation is sent to the command buffer immediately, so handles are valid in every list.
+    u32  renderer_create_cmd_list();
+    void renderer_release_cmd_list(u32 cmd_list);
+    void renderer_begin_cmd_list(u32 cmd_list); // binds the list to the calling thread, clears previous contents
+    void renderer_end_cmd_list();
+    void renderer_submit_cmd_list(u32 cmd_list); // user thread, once all lists have ended
 
     namespace direct
     {
@@ -473,10 +536,14 @@ namespace pen
         void renderer_set_vertex_buffers(u32* buffer_indices, u32 num_buffers, u32 start_slot, const u32* strides,
                                          const u32* offsets);
         void renderer_set_index_buffer(u32 buffer_index, u32 format, u32 offset);
-        void renderer_set_constant_buffer(u32 buffer_index, u32 unit, u32 flags);
+        void renderer_set_constant_buffer(u32 buffer_index, u32 unit, u32 flags, u32 offset);
         void renderer_set_structured_buffer(u32 buffer_index, u32 unit, u32 flags);
         void renderer_update_buffer(u32 buffer_index, const void* data, u32 data_size, u32 offset);
 
+        // for dynamic buffers sub allocated per frame, a write at offset 0 starts new contents and later writes
+        // append to them, ranges draws have been issued with are never rewritten within a frame
+        void renderer_update_buffer_no_overwrite(u32 buffer_index, const void* data, u32 data_size, u32 offset);
+
         // textures
         void renderer_create_texture(const texture_creation_params& tcp, u32 resource_slot);
         void renderer_create_sampler(const sampler_creation_params& scp, u32 resource_slot);
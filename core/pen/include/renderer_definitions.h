@@ -64,7 +64,8 @@ enum texture_format
     PEN_TEX_FORMAT_BC2_UNORM,
     PEN_TEX_FORMAT_BC3_UNORM,
     PEN_TEX_FORMAT_BC4_UNORM,
-    PEN_TEX_FORMAT_BC5_UNORM
+    PEN_TEX_FORMAT_BC5_UNORM,
+    PEN_TEX_FORMAT_BC7_UNORM
 };
 
 enum clear_bits
@@ -44,6 +44,7 @@ namespace pen
     void         _renderer_resize_backbuffer(u32 width, u32 height);
     void         _renderer_resize_managed_targets();
     u64          _renderer_frame_index();
+    u64          _renderer_completed_frame_index(); // frames before this index have completed on the gpu
     u64          _renderer_resize_index();
     shared_flags _renderer_flags();
     void         _renderer_set_viewport_ratio(const viewport& v);
@@ -55,6 +56,7 @@ namespace pen
     // thread safe utilities
     viewport _renderer_resolve_viewport_ratio(const viewport& v);
     rect     _renderer_resolve_scissor_ratio(const rect& r);
+    void     _renderer_frame_completed(u64 frame_index); // backends report when the gpu finishes a frame
 
     // virtual interface for render backends
     class render_backend
@@ -18,6 +18,7 @@ namespace pen
     typedef void (*completion_callback)(void*);
     typedef void* (*dispatch_thread)(void*);
     typedef loop_t (*single_thread_update_func)();
+    typedef void (*parallel_for_func)(u32 start, u32 end, void* user_data);
 
     // A Job is just a thread with some user data, a callback
     // and some syncronisation semaphores
@@ -30,6 +31,7 @@ namespace pen
         semaphore*          p_sem_exit = nullptr;
         semaphore*          p_sem_terminated = nullptr;
         completion_callback p_completion_callback = nullptr;
+        bool                blocks_on_consume = false; // jobs_terminate_all posts p_sem_consume to wake it for exit
 
         f32 thread_time;
     };
@@ -71,6 +73,14 @@ namespace pen
     void jobs_create_single_thread_update(single_thread_update_func func);
     void jobs_run_single_threaded();
 
+    // Worker pool
+    // splits [0, count) into chunks of grain items and runs func across a lazily created pool of worker threads.
+    // the calling thread takes part and the call returns when all items are complete.
+    // nested calls or calls while the pool is busy run serially on the calling thread.
+    void jobs_parallel_for(u32 count, u32 grain, parallel_for_func func, void* user_data);
+    u32  jobs_get_num_workers();
+    u32  jobs_get_thread_index(); // 0 for any non worker thread, 1 - num_workers for pool threads
+
     // Mutex
     mutex* mutex_create();
     void   mutex_destroy(mutex* p_mutex);
@@ -142,6 +142,35 @@ inline f16 float_to_half(f32 f)
     return v.ui | sign;
 }
 
+inline f32 half_to_float(f16 h)
+{
+    union bits {
+        float    f;
+        uint32_t ui;
+    };
+
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+
+    bits v;
+    if (exponent == 0x1f)
+    {
+        v.ui = sign | 0x7F800000 | (mantissa << 13); // inf, nan
+    }
+    else if (exponent != 0)
+    {
+        v.ui = sign | ((exponent + 112) << 23) | (mantissa << 13); // rebias 15 to 127
+    }
+    else
+    {
+        v.f = (float)mantissa * (1.0f / 16777216.0f); // zero or subnormal, mantissa * 2^-24
+        v.ui |= sign;
+    }
+
+    return v.f;
+}
+
 // Minimal amount of macros that are handy to have evrywhere
 // For making texture formats ('D' 'X' 'T' '1') etc
 #define PEN_FOURCC(ch0, ch1, ch2, ch3)                                                                                       \
@@ -0,0 +1,40 @@
+// renderer_vulkan.h
+// Copyright 2014 - 2023 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Vulkan backend specific queries.
+// Buffers and images are sub allocated from large device memory blocks per memory type, linear and optimal
+// resources are kept in separate blocks. Descriptor sets are cached by content across frames with lru eviction.
+// Stats are written on the render thread, read them there or tolerate tearing.
+
+#pragma once
+
+#include "types.h"
+
+namespace pen
+{
+    struct vulkan_memory_stats
+    {
+        static const u32 k_max_memory_types = 32; // VK_MAX_MEMORY_TYPES
+
+        u64 device_allocations = 0;    // live vkAllocateMemory calls, blocks and dedicated
+        u64 dedicated_allocations = 0; // resources too large to share a block
+        u64 sub_allocations = 0;       // live resources placed in a block
+        u64 bytes_reserved = 0;        // total size of all device memory allocations
+        u64 bytes_used = 0;            // bytes in use by resources including alignment padding
+        u64 bytes_reserved_per_type[k_max_memory_types] = {0};
+        u64 bytes_used_per_type[k_max_memory_types] = {0};
+    };
+
+    struct vulkan_descriptor_stats
+    {
+        u64 cached_sets = 0; // live descriptor sets in the cache
+        u64 hits = 0;        // binds which reused a cached set
+        u64 misses = 0;      // binds which allocated and wrote a new set
+        u64 writes = 0;      // descriptors written
+        u64 evictions = 0;
+    };
+
+    const vulkan_memory_stats&     renderer_vulkan_get_memory_stats();
+    const vulkan_descriptor_stats& renderer_vulkan_get_descriptor_stats();
+} // namespace pen
@@ -58,7 +58,8 @@ namespace
     ID3D11RenderTargetView* s_backbuffer_rtv = nullptr;
     ID3D11DeviceContext*    s_immediate_context = nullptr;
     ID3D11DeviceContext1*   s_immediate_context_1 = nullptr;
-    u64                     s_frame = 0; // to remove
+    bool                    s_cbuffer_offsets = false; // d3d11.1 offset binds and no overwrite maps of cbuffers
+    u64                     s_frame = 0;               // to remove
 
     D3D11_FILL_MODE to_d3d11_fill_mode(u32 pen_fill_mode)
     {
@@ -230,6 +231,8 @@ namespace
                 return DXGI_FORMAT_BC4_UNORM;
             case PEN_TEX_FORMAT_BC5_UNORM:
                 return DXGI_FORMAT_BC5_UNORM;
+            case PEN_TEX_FORMAT_BC7_UNORM:
+                return DXGI_FORMAT_BC7_UNORM;
         }
         // unsupported / unimplemented texture type
         PEN_ASSERT(0);
@@ -683,6 +686,55 @@ namespace pen
         s_immediate_context->Begin(s_perf.disjoint_query[s_perf.buf]);
     }
 
+    // an event query per presented frame reports gpu completion so released resources can be freed once unused
+    static const u32 k_max_frame_events = 8;
+
+    struct frame_event
+    {
+        ID3D11Query* query = nullptr;
+        u64          frame = 0;
+    };
+    static frame_event s_frame_events[k_max_frame_events];
+    static u32         s_frame_event_head = 0;
+    static u32         s_num_frame_events = 0;
+
+    void end_frame_event(u64 frame)
+    {
+        // the driver throttles well before this, wait rather than lose track of a frame
+        bool wait = s_num_frame_events == k_max_frame_events;
+
+        // report every frame already complete
+        while (s_num_frame_events > 0)
+        {
+            frame_event& fe = s_frame_events[s_frame_event_head];
+
+            BOOL    done = FALSE;
+            HRESULT hr = s_immediate_context->GetData(fe.query, &done, sizeof(BOOL), D3D11_ASYNC_GETDATA_DONOTFLUSH);
+            while (wait && hr == S_FALSE)
+                hr = s_immediate_context->GetData(fe.query, &done, sizeof(BOOL), 0);
+
+            if (hr == S_FALSE)
+                break;
+
+            wait = false;
+            _renderer_frame_completed(fe.frame);
+
+            s_frame_event_head = (s_frame_event_head + 1) % k_max_frame_events;
+            s_num_frame_events--;
+        }
+
+        frame_event& fe = s_frame_events[(s_frame_event_head + s_num_frame_events) % k_max_frame_events];
+        if (!fe.query)
+        {
+            static D3D11_QUERY_DESC desc = {D3D11_QUERY_EVENT, 0};
+            CHECK_CALL(s_device->CreateQuery(&desc, &fe.query));
+        }
+
+        s_immediate_context->End(fe.query);
+        fe.frame = frame;
+        s_num_frame_events++;
+    }
+
     //--------------------------------------------------------------------------------------
     //  COMMON API
     //--------------------------------------------------------------------------------------
@@ -987,6 +1039,7 @@ namespace pen
     {
         // Just present
         s_swap_chain->Present(0, 0);
+        end_frame_event(_renderer_frame_index());
 
         if (s_frame > 0)
             renderer_pop_perf_marker();
@@ -1808,8 +1861,38 @@ namespace pen
         s_immediate_context->OMSetBlendState(_res_pool[blend_state_index].blend_state, NULL, 0xffffffff);
     }
 
-    void direct::renderer_set_constant_buffer(u32 buffer_index, u32 unit, u32 flags)
+    void direct::renderer_set_constant_buffer(u32 buffer_index, u32 unit, u32 flags, u32 offset)
     {
+        if (offset > 0)
+        {
+            // offsets need d3d11.1, in shader constants of 16 bytes and multiples of 16 constants. the front end only
+            // passes them when PEN_CAPS_CONSTANT_BUFFER_OFFSET is set
+            PEN_ASSERT(s_cbuffer_offsets && (offset & 255) == 0);
+            if (!s_cbuffer_offsets)
+                return;
+
+            ID3D11Buffer* buf = _res_pool[buffer_index].generic_buffer.buf;
+
+            D3D11_BUFFER_DESC desc;
+            buf->GetDesc(&desc);
+
+            UINT first = offset / 16;
+            UINT num = ((desc.ByteWidth - offset) / 16) & ~15;
+            if (num > 4096)
+                num = 4096;
+
+            if (flags & pen::CBUFFER_BIND_PS)
+                s_immediate_context_1->PSSetConstantBuffers1(unit, 1, &buf, &first, &num);
+
+            if (flags & pen::CBUFFER_BIND_VS)
+                s_immediate_context_1->VSSetConstantBuffers1(unit, 1, &buf, &first, &num);
+
+            if (flags & pen::CBUFFER_BIND_CS)
+                s_immediate_context_1->CSSetConstantBuffers1(unit, 1, &buf, &first, &num);
+
+            return;
+        }
+
         if (flags & pen::CBUFFER_BIND_PS)
         {
             s_immediate_context->PSSetConstantBuffers(unit, 1, &_res_pool[buffer_index].generic_buffer.buf);
@@ -1880,6 +1963,27 @@ namespace pen
         s_immediate_context->Unmap(_res_pool[buffer_index].generic_buffer.buf, 0);
     }
 
+    void direct::renderer_update_buffer_no_overwrite(u32 buffer_index, const void* data, u32 data_size, u32 offset)
+    {
+        // discard renames the buffer for new contents, appends must not touch ranges already drawn with
+        PEN_ASSERT(offset == 0 || s_cbuffer_offsets);
+
+        D3D11_MAP                map = offset == 0 ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE;
+        D3D11_MAPPED_SUBRESOURCE mapped_res = {0};
+
+        HRESULT hr = s_immediate_context->Map(_res_pool[buffer_index].generic_buffer.buf, 0, map, 0, &mapped_res);
+        if (FAILED(hr))
+        {
+            PEN_LOG("[error] renderer : failed to map buffer %i for update\n", buffer_index);
+            return;
+        }
+
+        void* p_data = (void*)((size_t)mapped_res.pData + offset);
+        memcpy(p_data, data, data_size);
+
+        s_immediate_context->Unmap(_res_pool[buffer_index].generic_buffer.buf, 0);
+    }
+
     void direct::renderer_read_back_resource(const resource_read_back_params& rrbp)
     {
         D3D11_MAPPED_SUBRESOURCE mapped_res = {0};
@@ -2143,7 +2247,7 @@ namespace pen
             direct::renderer_set_resolve_targets(target, 0);
 
             direct::renderer_update_buffer(res.constant_buffer, &cbuf, sizeof(cbuf), 0);
-            direct::renderer_set_constant_buffer(res.constant_buffer, 0, pen::CBUFFER_BIND_PS);
+            direct::renderer_set_constant_buffer(res.constant_buffer, 0, pen::CBUFFER_BIND_PS, 0);
 
             pen::viewport vp = {0.0f, 0.0f, w, h, 0.0f, 1.0f};
             direct::renderer_set_viewport(vp);
@@ -2191,28 +2295,11 @@ namespace pen
 
     void direct::renderer_replace_resource(u32 dest, u32 src, e_renderer_resource type)
     {
-        switch (type)
-        {
-            case RESOURCE_TEXTURE:
-                direct::renderer_release_texture(dest);
-                break;
-            case RESOURCE_BUFFER:
-                direct::renderer_release_buffer(dest);
-                break;
-            case RESOURCE_VERTEX_SHADER:
-                direct::renderer_release_shader(dest, PEN_SHADER_TYPE_VS);
-                break;
-            case RESOURCE_PIXEL_SHADER:
-                direct::renderer_release_shader(dest, PEN_SHADER_TYPE_PS);
-                break;
-            case RESOURCE_RENDER_TARGET:
-                direct::renderer_release_render_target(dest);
-                break;
-            default:
-                break;
-        }
-
-        _res_pool[dest] = _res_pool[src];
+        // swap so src holds the previous resource, the front end releases it once the gpu has finished with it
+        resource_allocation prev;
+        memcpy(&prev, &_res_pool[dest], sizeof(resource_allocation));
+        memcpy(&_res_pool[dest], &_res_pool[src], sizeof(resource_allocation));
+        memcpy(&_res_pool[src], &prev, sizeof(resource_allocation));
     }
 
     //--------------------------------------------------------------------------------------
@@ -2400,6 +2487,14 @@ namespace pen
                                                           reinterpret_cast<void**>(&s_immediate_context_1));
             }
 
+            // 11.1 runtimes on 11.0 hardware may not support either, the front end then avoids offsets
+            D3D11_FEATURE_DATA_D3D11_OPTIONS options = {};
+            if (s_immediate_context_1 && SUCCEEDED(s_device->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options,
+                                                                                  sizeof(options))))
+            {
+                s_cbuffer_offsets = options.ConstantBufferOffsetting && options.MapNoOverwriteOnDynamicConstantBuffer;
+            }
+
             DXGI_SWAP_CHAIN_DESC1 sd;
             ZeroMemory(&sd, sizeof(sd));
             sd.Width = width;
@@ -2504,6 +2599,9 @@ namespace pen
         s_renderer_info.caps |= PEN_CAPS_DEPTH_CLAMP;
         s_renderer_info.caps |= PEN_CAPS_COMPUTE;
         s_renderer_info.caps |= PEN_CAPS_TEXTURE_CUBE_ARRAY;
+
+        if (s_cbuffer_offsets)
+            s_renderer_info.caps |= PEN_CAPS_CONSTANT_BUFFER_OFFSET;
     }
 
     const renderer_info& renderer_get_info()
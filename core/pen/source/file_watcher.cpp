@@ -0,0 +1,392 @@
+// file_watcher.cpp
+// Copyright 2014 - 2023 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+#include "console.h"
+#include "file_system.h"
+#include "str/Str.h"
+#include "threads.h"
+#include "timer.h"
+
+#include <algorithm>
+#include <sys/stat.h>
+#include <vector>
+
+#if PEN_PLATFORM_LINUX
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+using namespace pen;
+
+namespace
+{
+    // changes to a file restart the quiet period, tools often write a file several times or write then rename
+    static const u32 k_debounce_ms = 100;
+    static const u32 k_poll_interval_ms = 250; // mtime polling, where there is no os notification
+
+    struct file_stamp
+    {
+        u64  mtime_ns = 0;
+        u64  size = 0;
+        bool exists = false;
+    };
+
+    struct watched_file
+    {
+        Str                       path;
+        Str                       dir;
+        Str                       name; // path without dir, as reported in directory events
+        file_stamp                committed; // contents the last callback was made for
+        file_stamp                observed;  // last seen when polling, changes restart the quiet period
+        filesystem_watch_callback callback = nullptr;
+        void*                     user_data = nullptr;
+        bool                      alive = false;
+        bool                      dirty = false; // touched since the last batch, compared with committed when quiet
+    };
+
+    struct watched_dir
+    {
+        Str path;
+        s32 wd = -1;
+    };
+
+    struct file_watcher
+    {
+        std::vector<watched_file> files;
+        std::vector<watched_dir>  dirs;
+        std::vector<u32>          free_files;
+        std::vector<u32>          ready; // files changed in a completed batch, waiting for dispatch
+        pen::mutex*               lock = nullptr;
+        a_bool                    has_ready = {false};
+        f64                       last_event_ms = 0.0;
+        bool                      pending = false; // dirty files waiting for the quiet period
+        s32                       inotify_fd = -1;
+    };
+    file_watcher s_watcher;
+
+    bool get_file_stamp(const c8* path, file_stamp& stamp)
+    {
+        stamp = file_stamp();
+
+#if PEN_PLATFORM_WIN32
+        struct _stat64 s;
+        if (_stat64(path, &s) != 0)
+            return false;
+
+        stamp.mtime_ns = (u64)s.st_mtime * 1000000000ull;
+#else
+        struct stat s;
+        if (stat(path, &s) != 0)
+            return false;
+
+#if PEN_PLATFORM_OSX || PEN_PLATFORM_IOS
+        stamp.mtime_ns = (u64)s.st_mtimespec.tv_sec * 1000000000ull + (u64)s.st_mtimespec.tv_nsec;
+#else
+        stamp.mtime_ns = (u64)s.st_mtim.tv_sec * 1000000000ull + (u64)s.st_mtim.tv_nsec;
+#endif
+#endif
+        stamp.size = (u64)s.st_size;
+        stamp.exists = true;
+        return true;
+    }
+
+    bool stamp_changed(const file_stamp& a, const file_stamp& b)
+    {
+        return a.exists != b.exists || a.mtime_ns != b.mtime_ns || a.size != b.size;
+    }
+
+    void split_path(const Str& path, Str& dir, Str& name)
+    {
+        s32 slash = -1;
+        for (s32 i = 0; i < (s32)path.length(); ++i)
+            if (path[i] == '/' || path[i] == '\\')
+                slash = i;
+
+        if (slash < 0)
+        {
+            dir = ".";
+            name = path;
+            return;
+        }
+
+        dir = "";
+        dir.append(path.c_str(), path.c_str() + slash);
+        name = path.c_str() + slash + 1;
+    }
+
+    void mark_dirty(watched_file& f)
+    {
+        f.dirty = true;
+        s_watcher.pending = true;
+        s_watcher.last_event_ms = pen::get_time_ms();
+    }
+
+    void complete_batch()
+    {
+        // called with the lock held once files have been quiet for the debounce time
+        if (!s_watcher.pending || pen::get_time_ms() - s_watcher.last_event_ms < k_debounce_ms)
+            return;
+
+        for (u32 i = 0; i < (u32)s_watcher.files.size(); ++i)
+        {
+            watched_file& f = s_watcher.files[i];
+            if (!f.alive || !f.dirty)
+                continue;
+
+            f.dirty = false;
+
+            // events fire for writes which leave a file as it was, only report real changes
+            file_stamp current;
+            get_file_stamp(f.path.c_str(), current);
+            if (!stamp_changed(current, f.committed))
+                continue;
+
+            f.committed = current;
+            s_watcher.ready.push_back(i);
+        }
+
+        s_watcher.pending = false;
+
+        if (!s_watcher.ready.empty())
+            s_watcher.has_ready = true;
+    }
+
+#if PEN_PLATFORM_LINUX
+    void watch_dir(const Str& dir)
+    {
+        // directories are watched rather than files, so files replaced by rename are still seen
+        for (auto& d : s_watcher.dirs)
+            if (d.path == dir)
+                return;
+
+        watched_dir wd;
+        wd.path = dir;
+        wd.wd = inotify_add_watch(s_watcher.inotify_fd, dir.c_str(),
+                                  IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE | IN_ATTRIB);
+
+        if (wd.wd < 0)
+            PEN_LOG("[file watcher] unable to watch %s", dir.c_str());
+
+        s_watcher.dirs.push_back(wd);
+    }
+
+    void read_events()
+    {
+        alignas(inotify_event) c8 buf[4096];
+        for (;;)
+        {
+            ssize_t len = read(s_watcher.inotify_fd, buf, sizeof(buf));
+            if (len <= 0)
+                return;
+
+            pen::mutex_lock(s_watcher.lock);
+
+            for (c8* p = buf; p < buf + len;)
+            {
+                inotify_event* ev = (inotify_event*)p;
+                p += sizeof(inotify_event) + ev->len;
+
+                if (ev->len == 0)
+                    continue;
+
+                for (auto& d : s_watcher.dirs)
+                {
+                    if (d.wd != ev->wd)
+                        continue;
+
+                    for (auto& f : s_watcher.files)
+                        if (f.alive && f.name == ev->name && f.dir == d.path)
+                            mark_dirty(f);
+                }
+            }
+
+            pen::mutex_unlock(s_watcher.lock);
+        }
+    }
+
+    void* watcher_thread_func(void* params)
+    {
+        for (;;)
+        {
+            // block until something changes, or the quiet period of a pending batch ends
+            s32 timeout = -1;
+            pen::mutex_lock(s_watcher.lock);
+            if (s_watcher.pending)
+            {
+                f64 elapsed = pen::get_time_ms() - s_watcher.last_event_ms;
+                timeout = elapsed >= k_debounce_ms ? 0 : (s32)(k_debounce_ms - elapsed) + 1;
+            }
+            pen::mutex_unlock(s_watcher.lock);
+
+            pollfd pfd = {s_watcher.inotify_fd, POLLIN, 0};
+            if (poll(&pfd, 1, timeout) > 0)
+                read_events();
+
+            pen::mutex_lock(s_watcher.lock);
+            complete_batch();
+            pen::mutex_unlock(s_watcher.lock);
+        }
+
+        return PEN_THREAD_OK;
+    }
+#endif
+
+    void* poll_thread_func(void* params)
+    {
+        // no os notification, compare stamps on this thread so the user thread does not pay for it
+        for (;;)
+        {
+            pen::mutex_lock(s_watcher.lock);
+            bool pending = s_watcher.pending;
+            pen::mutex_unlock(s_watcher.lock);
+
+            pen::thread_sleep_ms(pending ? k_debounce_ms : k_poll_interval_ms);
+
+            pen::mutex_lock(s_watcher.lock);
+
+            for (auto& f : s_watcher.files)
+            {
+                if (!f.alive)
+                    continue;
+
+                file_stamp current;
+                get_file_stamp(f.path.c_str(), current);
+                if (stamp_changed(current, f.observed))
+                {
+                    f.observed = current;
+                    mark_dirty(f);
+                }
+            }
+
+            complete_batch();
+
+            pen::mutex_unlock(s_watcher.lock);
+        }
+
+        return PEN_THREAD_OK;
+    }
+
+    bool watcher_init()
+    {
+        s_watcher.lock = pen::mutex_create();
+
+        dispatch_thread thread_func = poll_thread_func;
+
+#if PEN_PLATFORM_LINUX
+        s_watcher.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (s_watcher.inotify_fd >= 0)
+            thread_func = watcher_thread_func;
+        else
+            PEN_LOG("[file watcher] inotify unavailable, polling for changes");
+#endif
+
+        // single threaded builds have no hot loading
+#if !PEN_SINGLE_THREADED
+        pen::thread_create(thread_func, 64 * 1024, nullptr, e_thread_start_flags::detached);
+#endif
+        return true;
+    }
+
+    void watcher_init_once()
+    {
+        static bool initialised = watcher_init();
+        PEN_UNUSED(initialised);
+    }
+} // namespace
+
+namespace pen
+{
+    u32 filesystem_watch_add(const c8* filename, filesystem_watch_callback callback, void* user_data)
+    {
+        watcher_init_once();
+
+        watched_file f;
+        f.path = filename;
+        f.callback = callback;
+        f.user_data = user_data;
+        f.alive = true;
+        split_path(f.path, f.dir, f.name);
+        get_file_stamp(filename, f.committed);
+        f.observed = f.committed;
+
+        pen::mutex_lock(s_watcher.lock);
+
+        u32 index;
+        if (!s_watcher.free_files.empty())
+        {
+            index = s_watcher.free_files.back();
+            s_watcher.free_files.pop_back();
+            s_watcher.files[index] = f;
+        }
+        else
+        {
+            index = (u32)s_watcher.files.size();
+            s_watcher.files.push_back(f);
+        }
+
+#if PEN_PLATFORM_LINUX
+        if (s_watcher.inotify_fd >= 0)
+            watch_dir(f.dir);
+#endif
+
+        pen::mutex_unlock(s_watcher.lock);
+
+        return index;
+    }
+
+    void filesystem_watch_remove(u32 watch)
+    {
+        pen::mutex_lock(s_watcher.lock);
+
+        if (watch < s_watcher.files.size() && s_watcher.files[watch].alive)
+        {
+            s_watcher.files[watch].alive = false;
+            s_watcher.files[watch].dirty = false;
+            s_watcher.free_files.push_back(watch);
+
+            // the slot can be reused before the next dispatch, so drop changes queued for this watch
+            auto& ready = s_watcher.ready;
+            ready.erase(std::remove(ready.begin(), ready.end(), watch), ready.end());
+            s_watcher.has_ready = !ready.empty();
+        }
+
+        pen::mutex_unlock(s_watcher.lock);
+    }
+
+    u32 filesystem_watch_dispatch()
+    {
+        // nothing to do until the watcher thread completes a batch
+        if (!s_watcher.has_ready)
+            return 0;
+
+        struct change
+        {
+            Str                       path;
+            filesystem_watch_callback callback;
+            void*                     user_data;
+        };
+        std::vector<change> changes;
+
+        pen::mutex_lock(s_watcher.lock);
+
+        for (u32 i : s_watcher.ready)
+        {
+            const watched_file& f = s_watcher.files[i];
+            if (f.alive)
+                changes.push_back({f.path, f.callback, f.user_data});
+        }
+
+        s_watcher.ready.clear();
+        s_watcher.has_ready = false;
+
+        pen::mutex_unlock(s_watcher.lock);
+
+        // outside of the lock, callbacks may add or remove watches
+        for (auto& c : changes)
+            c.callback(c.path.c_str(), c.user_data);
+
+        return (u32)changes.size();
+    }
+} // namespace pen
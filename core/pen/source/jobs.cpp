@@ -7,7 +7,10 @@
 #include "renderer.h"
 #include "threads.h"
 
+#include <thread>
+
 #define MAX_THREADS 32 // lazy fixed sized array to avoid any thread saftey issues
+#define MAX_WORKERS 16
 
 using namespace pen;
 
@@ -16,6 +19,82 @@ namespace
     job                        s_jt[MAX_THREADS];
     u32                        s_num_active_threads = 0;
     single_thread_update_func* s_single_thread_funcs = nullptr;
+
+    struct parallel_for_job
+    {
+        parallel_for_func func = nullptr;
+        void*             user_data = nullptr;
+        u32               count = 0;
+        u32               grain = 1;
+        a_u32             next = {0};
+    };
+
+    struct worker_pool
+    {
+        thread*          workers[MAX_WORKERS];
+        u32              num_workers = 0;
+        semaphore*       sem_start = nullptr;
+        semaphore*       sem_done = nullptr;
+        mutex*           busy = nullptr;
+        parallel_for_job job;
+    };
+    worker_pool s_pool;
+
+#if !PEN_SINGLE_THREADED
+    thread_local u32 s_thread_index = 0;
+
+    void run_parallel_for_chunks(parallel_for_job& pj)
+    {
+        for (;;)
+        {
+            u32 start = pj.next.fetch_add(pj.grain);
+            if (start >= pj.count)
+                break;
+
+            u32 end = std::min<u32>(start + pj.grain, pj.count);
+            pj.func(start, end, pj.user_data);
+        }
+    }
+
+    void* worker_thread_func(void* params)
+    {
+        s_thread_index = (u32)(size_t)params;
+
+        for (;;)
+        {
+            semaphore_wait(s_pool.sem_start);
+            run_parallel_for_chunks(s_pool.job);
+            semaphore_post(s_pool.sem_done, 1);
+        }
+
+        return nullptr;
+    }
+
+    bool worker_pool_init()
+    {
+        // leave a core for the user thread which takes part in each parallel_for
+        u32 hw = std::thread::hardware_concurrency();
+        u32 num_workers = std::min<u32>(hw > 1 ? hw - 1 : 1, MAX_WORKERS);
+
+        s_pool.sem_start = semaphore_create(0, num_workers);
+        s_pool.sem_done = semaphore_create(0, num_workers);
+        s_pool.busy = mutex_create();
+
+        for (u32 i = 0; i < num_workers; ++i)
+            s_pool.workers[i] = thread_create(worker_thread_func, 1024 * 1024, (void*)(size_t)(i + 1),
+                                              e_thread_start_flags::detached);
+
+        s_pool.num_workers = num_workers;
+        return true;
+    }
+
+    void worker_pool_init_once()
+    {
+        // thread safe lazy init on first use
+        static bool initialised = worker_pool_init();
+        PEN_UNUSED(initialised);
+    }
+#endif
 } // namespace
 
 namespace pen
@@ -52,7 +131,10 @@ namespace pen
         // remove threads in reverse order
         for (s32 i = s_num_active_threads - 1; i >= 0; --i)
         {
+            // wake jobs which block waiting for work so they see the exit, others use consume to sync
             pen::semaphore_post(s_jt[i].p_sem_exit, 1);
+            if (s_jt[i].blocks_on_consume)
+                pen::semaphore_post(s_jt[i].p_sem_consume, 1);
             if (pen::semaphore_try_wait(s_jt[i].p_sem_terminated))
             {
                 s_num_active_threads--;
@@ -79,4 +161,71 @@ namespace pen
             ((single_thread_update_func)s_single_thread_funcs[i])();
         }
     }
+
+#if PEN_SINGLE_THREADED
+    void jobs_parallel_for(u32 count, u32 grain, parallel_for_func func, void* user_data)
+    {
+        if (count > 0)
+            func(0, count, user_data);
+    }
+
+    u32 jobs_get_num_workers()
+    {
+        return 0;
+    }
+
+    u32 jobs_get_thread_index()
+    {
+        return 0;
+    }
+#else
+    void jobs_parallel_for(u32 count, u32 grain, parallel_for_func func, void* user_data)
+    {
+        if (count == 0)
+            return;
+
+        grain = std::max<u32>(grain, 1);
+        u32 num_chunks = (count + grain - 1) / grain;
+
+        worker_pool_init_once();
+
+        // too small to split, or the pool is already running a job (nested or concurrent call)
+        if (num_chunks == 1 || !mutex_try_lock(s_pool.busy))
+        {
+            func(0, count, user_data);
+            return;
+        }
+
+        parallel_for_job& pj = s_pool.job;
+        pj.func = func;
+        pj.user_data = user_data;
+        pj.count = count;
+        pj.grain = grain;
+        pj.next = 0;
+
+        u32 num_wake = std::min<u32>(s_pool.num_workers, num_chunks - 1);
+        for (u32 i = 0; i < num_wake; ++i)
+            semaphore_post(s_pool.sem_start, 1);
+
+        run_parallel_for_chunks(pj);
+
+        // every woken worker must check in before the job can be reused
+        for (u32 i = 0; i < num_wake; ++i)
+            semaphore_wait(s_pool.sem_done);
+
+        mutex_unlock(s_pool.busy);
+    }
+
+    u32 jobs_get_num_workers()
+    {
+        worker_pool_init_once();
+
+        return s_pool.num_workers;
+    }
+
+    u32 jobs_get_thread_index()
+    {
+        return s_thread_index;
+    }
+#endif
 } // namespace pen
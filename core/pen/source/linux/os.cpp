@@ -227,6 +227,9 @@ namespace
             }
         }
 
+        pen::renderer_capture_parse_args(argc, argv);
+        pen::renderer_set_max_frames_in_flight(s_creation_params.max_frames_in_flight);
+
         // inits renderer and loops in wait for jobs, calling os update
         renderer_init(nullptr, true, s_creation_params.max_renderer_commands);
 
@@ -172,6 +172,7 @@ namespace // internal structs and static vars
         void          init(id<MTLBuffer>* bufs, u32 num_buffers, u32 buffer_size, u32 options, u32 bind_flags);
         void          release();
         void          update(const void* data, u32 data_size, u32 offset);
+        void          update_no_overwrite(const void* data, u32 data_size, u32 offset);
     };
 
     struct resource
@@ -312,6 +313,28 @@ namespace // internal structs and static vars
 
         _frame_writes++;
     }
+
+    void dynamic_buffer::update_no_overwrite(const void* data, u32 data_size, u32 offset)
+    {
+        // new contents swap to the buffer for this frame, appends are written in place after ranges drawn with
+        auto& db = dynamic_buffers;
+        if (offset == 0)
+        {
+            u32 cur_frame = _renderer_frame_index();
+            if (cur_frame != db._frame)
+            {
+                db._frame = cur_frame;
+                db.swap_buffers();
+            }
+        }
+
+        u8* pdata = (u8*)[db.backbuffer() contents];
+        memcpy(pdata + offset, data, data_size);
+
+        // reads come from the backbuffer at offset 0
+        frame = _renderer_frame_index();
+        _frame_writes = 1;
+    }
 }
 
 namespace // pen consts -> metal consts
@@ -394,6 +417,8 @@ namespace // pen consts -> metal consts
                 return MTLPixelFormatBC4_RUnorm;
             case PEN_TEX_FORMAT_BC5_UNORM:
                 return MTLPixelFormatBC5_RGUnorm;
+            case PEN_TEX_FORMAT_BC7_UNORM:
+                return MTLPixelFormatBC7_RGBAUnorm;
 #endif
         }
 
@@ -1107,9 +1132,11 @@ namespace pen
                 info.caps |= PEN_CAPS_TEX_FORMAT_BC3;
                 info.caps |= PEN_CAPS_TEX_FORMAT_BC4;
                 info.caps |= PEN_CAPS_TEX_FORMAT_BC5;
+                info.caps |= PEN_CAPS_TEX_FORMAT_BC7;
                 info.caps |= PEN_CAPS_COMPUTE;
                 info.caps |= PEN_CAPS_TEXTURE_CUBE_ARRAY;
                 info.caps |= PEN_CAPS_BACKBUFFER_BGRA;
+                info.caps |= PEN_CAPS_CONSTANT_BUFFER_OFFSET;
             }
         }
 
@@ -1527,13 +1554,14 @@ namespace pen
             ib.size_bytes = index_size_bytes(format);
         }
 
-        inline void _set_buffer(u32 buffer_index, u32 resource_slot, u32 flags)
+        inline void _set_buffer(u32 buffer_index, u32 resource_slot, u32 flags, u32 offset = 0)
         {
             if (buffer_index == 0)
                 return;
 
             size_t        bind_offset = 0;
             id<MTLBuffer> buf = _res_pool.get(buffer_index).buffer.read(bind_offset);
+            bind_offset += offset;
 
             if (flags & pen::CBUFFER_BIND_VS)
             {
@@ -1555,9 +1583,9 @@ namespace pen
             }
         }
 
-        void renderer_set_constant_buffer(u32 buffer_index, u32 unit, u32 flags)
+        void renderer_set_constant_buffer(u32 buffer_index, u32 unit, u32 flags, u32 offset)
         {
-            _set_buffer(buffer_index, unit, flags);
+            _set_buffer(buffer_index, unit, flags, offset);
         }
 
         void renderer_set_structured_buffer(u32 buffer_index, u32 unit, u32 flags)
@@ -1572,6 +1600,13 @@ namespace pen
             r.buffer.update(data, data_size, offset);
         }
 
+        void renderer_update_buffer_no_overwrite(u32 buffer_index, const void* data, u32 data_size, u32 offset)
+        {
+            resource& r = _res_pool.get(buffer_index);
+
+            r.buffer.update_no_overwrite(data, data_size, offset);
+        }
+
         pen_inline texture_resource create_texture_internal(const texture_creation_params& tcp, u32 resource_slot, bool track)
         {
             // resolve backbuffer ratio dimensions and track if necessary
@@ -2124,7 +2159,7 @@ namespace pen
                 direct::renderer_set_resolve_targets(target, 0);
 
                 direct::renderer_update_buffer(res.constant_buffer, &cbuf, sizeof(cbuf), 0);
-                direct::renderer_set_constant_buffer(res.constant_buffer, 0, pen::CBUFFER_BIND_PS);
+                direct::renderer_set_constant_buffer(res.constant_buffer, 0, pen::CBUFFER_BIND_PS, 0);
 
                 pen::viewport vp = {0.0f, 0.0f, w, h, 0.0f, 1.0f};
                 direct::renderer_set_viewport(vp);
@@ -2266,8 +2301,10 @@ namespace pen
             static std::atomic<u32> waits = {0};
             waits++;
 
+            u64 frame = _renderer_frame_index();
             [_state.cmd_buffer addCompletedHandler:^(id<MTLCommandBuffer> cb) {
               g_gpu_total = 69;
+              _renderer_frame_completed(frame);
               waits--;
             }];
 
@@ -2291,28 +2328,11 @@ namespace pen
 
         void renderer_replace_resource(u32 dest, u32 src, e_renderer_resource type)
         {
-            switch (type)
-            {
-                case RESOURCE_TEXTURE:
-                    direct::renderer_release_texture(dest);
-                    break;
-                case RESOURCE_BUFFER:
-                    direct::renderer_release_buffer(dest);
-                    break;
-                case RESOURCE_VERTEX_SHADER:
-                    direct::renderer_release_shader(dest, PEN_SHADER_TYPE_VS);
-                    break;
-                case RESOURCE_PIXEL_SHADER:
-                    direct::renderer_release_shader(dest, PEN_SHADER_TYPE_PS);
-                    break;
-                case RESOURCE_RENDER_TARGET:
-                    direct::renderer_release_render_target(dest);
-                    break;
-                default:
-                    break;
-            }
-
+            // swap so src holds the previous resource, the front end releases it once the gpu has finished with it
+            resource prev;
+            memcpy(&prev, &_res_pool[dest], sizeof(resource));
             memcpy(&_res_pool[dest], &_res_pool[src], sizeof(resource));
+            memcpy(&_res_pool[src], &prev, sizeof(resource));
         }
 
         void renderer_release_shader(u32 shader_index, u32 shader_type)
@@ -0,0 +1,408 @@
+// renderer_null.cpp
+// Copyright 2014 - 2023 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+#include "renderer_null.h"
+#include "console.h"
+#include "renderer.h"
+#include "renderer_shared.h"
+
+using namespace pen;
+
+namespace
+{
+    null_renderer_stats s_stats;
+    renderer_info       s_renderer_info;
+} // namespace
+
+namespace pen
+{
+    a_u64 g_gpu_total;
+
+    const null_renderer_stats& null_renderer_get_stats()
+    {
+        return s_stats;
+    }
+
+    void null_renderer_reset_stats()
+    {
+        s_stats = {};
+    }
+
+    const renderer_info& renderer_get_info()
+    {
+        return s_renderer_info;
+    }
+
+    const c8* renderer_get_shader_platform()
+    {
+        // shaders are loaded and discarded, share the glsl data so tools can run against existing builds
+        return "glsl";
+    }
+
+    bool renderer_viewport_vup()
+    {
+        return false;
+    }
+
+    bool renderer_depth_0_to_1()
+    {
+        return false;
+    }
+
+    u32 direct::renderer_initialise(void*, u32, u32)
+    {
+        s_renderer_info.api_version = "null";
+        s_renderer_info.shader_version = "glsl";
+        s_renderer_info.renderer = "null";
+        s_renderer_info.vendor = "pmtech";
+        s_renderer_info.renderer_cmd = "-renderer null";
+        s_renderer_info.caps = PEN_CAPS_TEXTURE_MULTISAMPLE | PEN_CAPS_DEPTH_CLAMP | PEN_CAPS_COMPUTE |
+                               PEN_CAPS_TEX_FORMAT_BC1 | PEN_CAPS_TEX_FORMAT_BC2 | PEN_CAPS_TEX_FORMAT_BC3 |
+                               PEN_CAPS_TEX_FORMAT_BC4 | PEN_CAPS_TEX_FORMAT_BC5 | PEN_CAPS_TEX_FORMAT_BC7 |
+                               PEN_CAPS_CONSTANT_BUFFER_OFFSET;
+
+        return PEN_ERR_OK;
+    }
+
+    void direct::renderer_shutdown()
+    {
+    }
+
+    void direct::renderer_sync()
+    {
+    }
+
+    void direct::renderer_new_frame()
+    {
+        _renderer_new_frame();
+    }
+
+    void direct::renderer_end_frame()
+    {
+    }
+
+    void direct::renderer_retain()
+    {
+    }
+
+    void direct::renderer_create_clear_state(const clear_state& cs, u32 resource_slot)
+    {
+        s_stats.commands++;
+        s_stats.resources_created++;
+    }
+
+    void direct::renderer_clear(u32 clear_state_index, u32 colour_slice, u32 depth_slice)
+    {
+        s_stats.commands++;
+        s_stats.clears++;
+    }
+
+    void direct::renderer_clear_texture(u32 clear_state_index, u32 texture)
+    {
+        s_stats.commands++;
+        s_stats.clears++;
+    }
+
+    void direct::renderer_load_shader(const pen::shader_load_params& params, u32 resource_slot)
+    {
+        s_stats.commands++;
+        s_stats.resources_created++;
+    }
+
+    void direct::renderer_set_shader(u32 shader_index, u32 shader_type)
+    {
+        s_stats.commands++;
+        s_stats.shader_binds++;
+    }
+
+    void direct::renderer_create_input_layout(const input_layout_creation_params& params, u32 resource_slot)
+    {
+        s_stats.commands++;
+        s_stats.resources_created++;
+    }
+
+    void direct::renderer_set_input_layout(u32 layout_index)
+    {
+        s_stats.commands++;
+        s_stats.input_layout_binds++;
+    }
+
+    void direct::renderer_link_shader_program(const shader_link_params& params, u32 resource_slot)
+    {
+        s_stats.commands++;
+        s_stats.resources_created++;
+    }
+
+    void direct::renderer_create_buffer(const buffer_creation_params& params, u32 resource_slot)
+    {
+        s_stats.commands++;
+        s_stats.resources_created++;
+    }
+
+    void direct::renderer_set_vertex_buffers(u32* buffer_indices, u32 num_buffers, u32 start_slot, const u32* strides,
+                                             const u32* offsets)
+    {
+        s_stats.commands++;
+        s_stats.vertex_buffer_binds++;
+    }
+
+    void direct::renderer_set_index_buffer(u32 buffer_index, u32 format, u32 offset)
+    {
+        s_stats.commands++;
+        s_stats.index_buffer_binds++;
+    }
+
+    void direct::renderer_set_constant_buffer(u32 buffer_index, u32 unit, u32 flags, u32 offset)
+    {
+        s_stats.commands++;
+        s_stats.constant_buffer_binds++;
+    }
+
+    void direct::renderer_set_structured_buffer(u32 buffer_index, u32 unit, u32 flags)
+    {
+        s_stats.commands++;
+        s_stats.constant_buffer_binds++;
+    }
+
+    void direct::renderer_update_buffer(u32 buffer_index, const void* data, u32 data_size, u32 offset)
+    {
+        s_stats.commands++;
+        s_stats.buffer_updates++;
+        s_stats.buffer_update_bytes += data_size;
+    }
+
+    void direct::renderer_update_buffer_no_overwrite(u32 buffer_index, const void* data, u32 data_size, u32 offset)
+    {
+        s_stats.commands++;
+        s_stats.buffer_updates++;
+        s_stats.buffer_update_bytes += data_size;
+    }
+
+    void direct::renderer_create_texture(const texture_creation_params& tcp, u32 resource_slot)
+    {
+        s_stats.commands++;
+        s_stats.resources_created++;
+    }
+
+    void direct::renderer_create_sampler(const sampler_creation_params& scp, u32 resource_slot)
+    {
+        s_stats.commands++;
+        s_stats.resources_created++;
+    }
+
+    void direct::renderer_set_texture(u32 texture_index, u32 sampler_index, u32 unit, u32 bind_flags)
+    {
+        s_stats.commands++;
+        s_stats.texture_binds++;
+    }
+
+    void direct::renderer_create_raster_state(const raster_state_creation_params& rscp, u32 resource_slot)
+    {
+        s_stats.commands++;
+        s_stats.resources_created++;
+    }
+
+    void direct::renderer_set_raster_state(u32 raster_state_index)
+    {
+        s_stats.commands++;
+        s_stats.state_binds++;
+    }
+
+    void direct::renderer_set_viewport(const viewport& vp)
+    {
+        s_stats.commands++;
+        s_stats.state_binds++;
+    }
+
+    void direct::renderer_set_scissor_rect(const rect& r)
+    {
+        s_stats.commands++;
+        s_stats.state_binds++;
+    }
+
+    void direct::renderer_create_blend_state(const blend_creation_params& bcp, u32 resource_slot)
+    {
+        s_stats.commands++;
+        s_stats.resources_created++;
+    }
+
+    void direct::renderer_set_blend_state(u32 blend_state_index)
+    {
+        s_stats.commands++;
+        s_stats.state_binds++;
+    }
+
+    void direct::renderer_create_depth_stencil_state(const depth_stencil_creation_params& dscp, u32 resource_slot)
+    {
+        s_stats.commands++;
+        s_stats.resources_created++;
+    }
+
+    void direct::renderer_set_depth_stencil_state(u32 depth_stencil_state)
+    {
+        s_stats.commands++;
+        s_stats.state_binds++;
+    }
+
+    void direct::renderer_set_stencil_ref(u8 ref)
+    {
+        s_stats.commands++;
+        s_stats.state_binds++;
+    }
+
+    void direct::renderer_draw(u32 vertex_count, u32 start_vertex, u32 primitive_topology)
+    {
+        s_stats.commands++;
+        s_stats.draws++;
+    }
+
+    void direct::renderer_draw_indexed(u32 index_count, u32 start_index, u32 base_vertex, u32 primitive_topology)
+    {
+        s_stats.commands++;
+        s_stats.draws_indexed++;
+    }
+
+    void direct::renderer_draw_indexed_instanced(u32 instance_count, u32 start_instance, u32 index_count, u32 start_index,
+                                                 u32 base_vertex, u32 primitive_topology)
+    {
+        s_stats.commands++;
+        s_stats.draws_instanced++;
+    }
+
+    void direct::renderer_draw_auto()
+    {
+        s_stats.commands++;
+        s_stats.draws++;
+    }
+
+    void direct::renderer_dispatch_compute(uint3 grid, uint3 num_threads)
+    {
+        s_stats.commands++;
+        s_stats.dispatches++;
+    }
+
+    void direct::renderer_create_render_target(const texture_creation_params& tcp, u32 resource_slot, bool track)
+    {
+        s_stats.commands++;
+        s_stats.resources_created++;
+
+        if (track)
+            _renderer_track_managed_render_target(tcp, resource_slot);
+    }
+
+    void direct::renderer_set_targets(const u32* const colour_targets, u32 num_colour_targets, u32 depth_target,
+                                      u32 colour_slice, u32 depth_slice)
+    {
+        s_stats.commands++;
+        s_stats.target_binds++;
+    }
+
+    void direct::renderer_set_resolve_targets(u32 colour_target, u32 depth_target)
+    {
+        s_stats.commands++;
+        s_stats.target_binds++;
+    }
+
+    void direct::renderer_set_stream_out_target(u32 buffer_index)
+    {
+        s_stats.commands++;
+        s_stats.target_binds++;
+    }
+
+    void direct::renderer_resolve_target(u32 target, e_msaa_resolve_type type, resolve_resources res)
+    {
+        s_stats.commands++;
+    }
+
+    void direct::renderer_read_back_resource(const resource_read_back_params& rrbp)
+    {
+        // nothing to read back, callbacks are never invoked
+        s_stats.commands++;
+    }
+
+    void direct::renderer_present()
+    {
+        s_stats.commands++;
+        s_stats.presents++;
+
+        // nothing is in flight, resources can be released as soon as the frame is presented
+        _renderer_frame_completed(_renderer_frame_index());
+        _renderer_end_frame();
+    }
+
+    void direct::renderer_push_perf_marker(const c8* name)
+    {
+    }
+
+    void direct::renderer_pop_perf_marker()
+    {
+    }
+
+    void direct::renderer_replace_resource(u32 dest, u32 src, e_renderer_resource type)
+    {
+        s_stats.commands++;
+    }
+
+    void direct::renderer_release_shader(u32 shader_index, u32 shader_type)
+    {
+        s_stats.commands++;
+        s_stats.resources_released++;
+    }
+
+    void direct::renderer_release_clear_state(u32 clear_state)
+    {
+        s_stats.commands++;
+        s_stats.resources_released++;
+    }
+
+    void direct::renderer_release_buffer(u32 buffer_index)
+    {
+        s_stats.commands++;
+        s_stats.resources_released++;
+    }
+
+    void direct::renderer_release_texture(u32 texture_index)
+    {
+        s_stats.commands++;
+        s_stats.resources_released++;
+    }
+
+    void direct::renderer_release_sampler(u32 sampler)
+    {
+        s_stats.commands++;
+        s_stats.resources_released++;
+    }
+
+    void direct::renderer_release_raster_state(u32 raster_state_index)
+    {
+        s_stats.commands++;
+        s_stats.resources_released++;
+    }
+
+    void direct::renderer_release_blend_state(u32 blend_state)
+    {
+        s_stats.commands++;
+        s_stats.resources_released++;
+    }
+
+    void direct::renderer_release_render_target(u32 render_target)
+    {
+        s_stats.commands++;
+        s_stats.resources_released++;
+
+        _renderer_untrack_managed_render_target(render_target);
+    }
+
+    void direct::renderer_release_input_layout(u32 input_layout)
+    {
+        s_stats.commands++;
+        s_stats.resources_released++;
+    }
+
+    void direct::renderer_release_depth_stencil_state(u32 depth_stencil_state)
+    {
+        s_stats.commands++;
+        s_stats.resources_released++;
+    }
+} // namespace pen
@@ -13,12 +13,14 @@
 #include "pen.h"
 #include "pen_string.h"
 #include "renderer.h"
+#include "renderer_opengl.h"
 #include "renderer_shared.h"
 #include "str_utilities.h"
 #include "threads.h"
 #include "timer.h"
 
 #include <stdlib.h>
+#include <unordered_map>
 #include <vector>
 
 #ifdef __linux__
@@ -44,6 +46,7 @@
 #define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x00
 #define GL_COMPRESSED_RGBA_S3TC_DXT3_EXT 0x00
 #define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x00
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x00
 #define GL_SRC1_COLOR GL_SRC_COLOR
 #define GL_ONE_MINUS_SRC1_COLOR GL_ONE_MINUS_SRC_COLOR
 #define GL_SRC1_ALPHA GL_SRC_ALPHA
@@ -66,6 +69,10 @@
 #define PEN_GL_MSAA_SUPPORT true
 #endif
 
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C // osx gl3.h stops at 4.1 which does not define bptc
+#endif
+
 #define MAX_VERTEX_BUFFERS 4
 #define MAX_VERTEX_ATTRIBUTES 16
 #define MAX_UNIFORM_BUFFERS 32
@@ -493,7 +500,8 @@ namespace
         {PEN_TEX_FORMAT_R8_UNORM, GL_R8, GL_RED, GL_UNSIGNED_BYTE, GL_COLOR_ATTACHMENT0},
         {PEN_TEX_FORMAT_BC1_UNORM, 0, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, GL_TEXTURE_COMPRESSED, GL_NONE},
         {PEN_TEX_FORMAT_BC2_UNORM, 0, GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, GL_TEXTURE_COMPRESSED, GL_NONE},
-        {PEN_TEX_FORMAT_BC3_UNORM, 0, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, GL_TEXTURE_COMPRESSED, GL_NONE}};
+        {PEN_TEX_FORMAT_BC3_UNORM, 0, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, GL_TEXTURE_COMPRESSED, GL_NONE},
+        {PEN_TEX_FORMAT_BC7_UNORM, 0, GL_COMPRESSED_RGBA_BPTC_UNORM, GL_TEXTURE_COMPRESSED, GL_NONE}};
     const u32 k_num_tex_maps = sizeof(k_tex_format_map) / sizeof(k_tex_format_map[0]);
 
     void to_gl_texture_format(u32 pen_format, u32& sized_format, u32& format, u32& type, u32& attachment)
@@ -774,6 +782,11 @@ namespace
         vertex_attribute* attributes;
         GLuint            vertex_array_handle = 0;
         GLuint            vb_handle = 0;
+        // vertex buffer state last specified in the vao
+        u32    generation = 0;
+        GLuint slot_buffer[MAX_VERTEX_BUFFERS] = {0};
+        u32    slot_stride[MAX_VERTEX_BUFFERS] = {0};
+        size_t slot_offset[MAX_VERTEX_BUFFERS] = {0};
     };
 
     struct raster_state
@@ -830,10 +843,33 @@ namespace
         u32    cs;
         GLuint program;
         GLuint vflip_uniform;
+        f32    vflip_value; // last value set, uniforms are program state
+        bool   texture_units_set;
         u8     uniform_block_location[MAX_UNIFORM_BUFFERS];
         u8     texture_location[MAX_SHADER_TEXTURES];
     };
-    shader_program* s_shader_programs = nullptr;
+    shader_program*                  s_shader_programs = nullptr;
+    std::unordered_map<hash_id, u32> s_program_lookup; // (vs, ps, so, cs) handles to index in s_shader_programs
+
+    hash_id program_key(u32 vs, u32 ps, u32 so, u32 cs)
+    {
+        HashMurmur2A hh;
+        hh.begin();
+        hh.add(vs);
+        hh.add(ps);
+        hh.add(so);
+        hh.add(cs);
+        return hh.end();
+    }
+
+    shader_program* find_program(u32 vs, u32 ps, u32 so, u32 cs)
+    {
+        auto it = s_program_lookup.find(program_key(vs, ps, so, cs));
+        if (it == s_program_lookup.end())
+            return nullptr;
+
+        return &s_shader_programs[it->second];
+    }
 
     struct gl_sampler : public sampler_creation_params
     {
@@ -848,11 +884,18 @@ namespace
         bool compare;
     };
 
+    struct gl_buffer
+    {
+        GLuint handle;  // aliases resource_allocation::handle
+        u32    dynamic; // index + 1 into s_dynamic_buffers, 0 for static buffers
+    };
+
     struct resource_allocation
     {
         u8     asigned_flag;
         GLuint type;
         union {
+            gl_buffer                      buffer;
             clear_state_internal           clear_state;
             ::input_layout*                input_layout;
             ::raster_state                 raster_state;
@@ -895,6 +938,410 @@ namespace
     viewport      s_current_vp;
     context_state s_ctx;
 
+    //
+    // redundant state filtering
+    //
+
+    // shadow of the gl binding state, calls which would not change it are skipped. s_state above tracks pen state
+    // and is reset each frame, this mirrors the gl context which persists. gl calls made outside of these functions
+    // which change a binding must invalidate the shadow.
+    struct gl_state_shadow
+    {
+        GLuint program = 0;
+        GLuint vertex_array = 0;
+        u32    vao_generation = 1; // bumped when buffers are deleted, vaos may reference them
+        u32    active_texture = 0;
+        GLuint texture[MAX_SHADER_TEXTURES] = {0};
+        GLenum texture_target[MAX_SHADER_TEXTURES] = {0};
+        GLuint sampler[MAX_SHADER_TEXTURES] = {0};
+        GLuint ubo[MAX_UNIFORM_BUFFERS] = {0};
+        u32    ubo_offset[MAX_UNIFORM_BUFFERS] = {0};
+        u32    ubo_size[MAX_UNIFORM_BUFFERS] = {0};
+    };
+    gl_state_shadow s_gl;
+    gl_state_stats  s_state_stats;
+
+    bool filter_call(bool redundant)
+    {
+        if (redundant)
+            s_state_stats.calls_filtered++;
+        else
+            s_state_stats.calls_issued++;
+
+        return redundant;
+    }
+
+    void use_program(GLuint program)
+    {
+        if (filter_call(s_gl.program == program))
+            return;
+
+        s_gl.program = program;
+        CHECK_CALL(glUseProgram(program));
+    }
+
+    void bind_vertex_array(GLuint vao)
+    {
+        if (filter_call(s_gl.vertex_array == vao))
+            return;
+
+        s_gl.vertex_array = vao;
+        CHECK_CALL(glBindVertexArray(vao));
+    }
+
+    void active_texture(u32 unit)
+    {
+        if (filter_call(s_gl.active_texture == unit))
+            return;
+
+        s_gl.active_texture = unit;
+        CHECK_CALL(glActiveTexture(GL_TEXTURE0 + unit));
+    }
+
+    // binds to the active texture unit, returns false if the texture was already bound
+    bool bind_texture(GLenum target, GLuint handle)
+    {
+        u32 unit = s_gl.active_texture;
+        if (unit < MAX_SHADER_TEXTURES)
+        {
+            if (filter_call(s_gl.texture[unit] == handle && s_gl.texture_target[unit] == target))
+                return false;
+
+            s_gl.texture[unit] = handle;
+            s_gl.texture_target[unit] = target;
+        }
+
+        CHECK_CALL(glBindTexture(target, handle));
+        return true;
+    }
+
+    void bind_sampler(u32 unit, GLuint sampler)
+    {
+        if (unit < MAX_SHADER_TEXTURES)
+        {
+            if (filter_call(s_gl.sampler[unit] == sampler))
+                return;
+
+            s_gl.sampler[unit] = sampler;
+        }
+
+        CHECK_CALL(glBindSampler(unit, sampler));
+    }
+
+    // size 0 binds the whole buffer
+    void bind_uniform_block(u32 unit, GLuint handle, u32 offset, u32 size)
+    {
+        if (filter_call(s_gl.ubo[unit] == handle && s_gl.ubo_offset[unit] == offset && s_gl.ubo_size[unit] == size))
+            return;
+
+        s_gl.ubo[unit] = handle;
+        s_gl.ubo_offset[unit] = offset;
+        s_gl.ubo_size[unit] = size;
+
+        if (size)
+        {
+            CHECK_CALL(glBindBufferRange(GL_UNIFORM_BUFFER, unit, handle, offset, size));
+        }
+        else
+        {
+            CHECK_CALL(glBindBufferBase(GL_UNIFORM_BUFFER, unit, handle));
+        }
+    }
+
+    // call after binding a texture directly on the active unit
+    void invalidate_active_texture()
+    {
+        if (s_gl.active_texture < MAX_SHADER_TEXTURES)
+            s_gl.texture_target[s_gl.active_texture] = 0;
+    }
+
+    // deleted objects are unbound by gl
+    void invalidate_deleted_texture(GLuint handle)
+    {
+        for (u32 i = 0; i < MAX_SHADER_TEXTURES; ++i)
+            if (s_gl.texture[i] == handle)
+                s_gl.texture_target[i] = 0;
+    }
+
+    void invalidate_deleted_sampler(GLuint handle)
+    {
+        for (u32 i = 0; i < MAX_SHADER_TEXTURES; ++i)
+            if (s_gl.sampler[i] == handle)
+                s_gl.sampler[i] = 0;
+    }
+
+    void invalidate_deleted_buffer(GLuint handle)
+    {
+        for (u32 i = 0; i < MAX_UNIFORM_BUFFERS; ++i)
+            if (s_gl.ubo[i] == handle)
+                s_gl.ubo[i] = 0;
+
+        s_gl.vao_generation++;
+    }
+
+    //
+    // dynamic buffers
+    //
+
+    // buffers with cpu write access keep a shadow copy and are written into a persistently mapped ring with a region
+    // per frame in flight (ARB_buffer_storage), each region is guarded by a fence placed at present. every update takes new
+    // space in the ring so draws already issued keep their data, and binds use the offset of the latest write. without
+    // buffer storage, or when a frame overflows its region, the buffer's own object is orphaned and refilled instead.
+    // set PEN_GL_NO_BUFFER_STORAGE in the environment to force the orphaning path for comparison.
+    const u32 k_ring_frames = 3;
+    const u32 k_ring_frame_size = 4 * 1024 * 1024;
+
+    struct gl_buffer_ring
+    {
+        GLuint handle = 0;
+        u8*    mapped = nullptr;
+        u32    pos = 0; // within the current region
+        u32    region = 0;
+        u64    frame = 0;
+        u32    align = 256;
+        GLsync fences[k_ring_frames] = {0};
+    };
+    gl_buffer_ring s_ring;
+
+    struct gl_dynamic_buffer
+    {
+        u8*    shadow;
+        u32    size;
+        GLuint type;
+        GLuint own_handle;
+        GLuint bound_handle; // ring or own handle holding the latest contents
+        u32    bound_offset;
+        u64    frame; // frame the latest contents were written to the ring
+        u32    resource;
+    };
+    gl_dynamic_buffer* s_dynamic_buffers = nullptr;
+    u32*               s_dynamic_buffers_free = nullptr;
+    u32                s_cbuffer_units[MAX_UNIFORM_BUFFERS] = {0}; // resource bound to each uniform block unit
+    u32                s_cbuffer_offsets[MAX_UNIFORM_BUFFERS] = {0};
+    gl_buffer_stats    s_buffer_stats;
+
+    void create_buffer_ring()
+    {
+#ifdef GLEW_ARB_buffer_storage
+        if (!GLEW_ARB_buffer_storage || getenv("PEN_GL_NO_BUFFER_STORAGE"))
+            return;
+
+        GLint align = 0;
+        CHECK_CALL(glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align));
+        s_ring.align = align > 16 ? (u32)align : 16;
+
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        GLsizeiptr size = k_ring_frame_size * k_ring_frames;
+
+        CHECK_CALL(glGenBuffers(1, &s_ring.handle));
+        CHECK_CALL(glBindBuffer(GL_COPY_WRITE_BUFFER, s_ring.handle));
+        CHECK_CALL(glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags));
+        s_ring.mapped = (u8*)CHECK_CALL(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags));
+        CHECK_CALL(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+
+        if (!s_ring.mapped)
+        {
+            CHECK_CALL(glDeleteBuffers(1, &s_ring.handle));
+            s_ring.handle = 0;
+            return;
+        }
+
+        s_buffer_stats.persistent_mapping = true;
+        s_buffer_stats.ring_size = size;
+#endif
+    }
+
+    // fence the region used this frame and move to the next, waiting for the gpu to finish with it
+    void advance_buffer_ring()
+    {
+        s_ring.frame++;
+
+        if (!s_ring.handle)
+            return;
+
+        s_ring.fences[s_ring.region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        s_ring.region = (s_ring.region + 1) % k_ring_frames;
+        s_ring.pos = 0;
+
+        GLsync& fence = s_ring.fences[s_ring.region];
+        if (!fence)
+            return;
+
+        GLenum r = glClientWaitSync(fence, 0, 0);
+        if (r == GL_TIMEOUT_EXPIRED)
+        {
+            s_buffer_stats.fence_waits++;
+            while (r == GL_TIMEOUT_EXPIRED)
+                r = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+        }
+
+        glDeleteSync(fence);
+        fence = 0;
+    }
+
+    // a fence per presented frame reports gpu completion so released resources can be freed once unused
+    const u32 k_max_frame_fences = 8;
+
+    struct gl_frame_fence
+    {
+        GLsync sync;
+        u64    frame;
+    };
+    gl_frame_fence s_frame_fences[k_max_frame_fences];
+    u32            s_frame_fence_head = 0;
+    u32            s_num_frame_fences = 0;
+
+    void fence_frame(u64 frame)
+    {
+        // the driver throttles well before this, wait rather than lose track of a frame
+        if (s_num_frame_fences == k_max_frame_fences)
+        {
+            gl_frame_fence& oldest = s_frame_fences[s_frame_fence_head];
+            glClientWaitSync(oldest.sync, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        }
+
+        // report every frame already complete without blocking
+        while (s_num_frame_fences > 0)
+        {
+            gl_frame_fence& f = s_frame_fences[s_frame_fence_head];
+            GLenum          r = glClientWaitSync(f.sync, 0, 0);
+            if (r == GL_TIMEOUT_EXPIRED)
+                break;
+
+            _renderer_frame_completed(f.frame);
+            glDeleteSync(f.sync);
+
+            s_frame_fence_head = (s_frame_fence_head + 1) % k_max_frame_fences;
+            s_num_frame_fences--;
+        }
+
+        u32 tail = (s_frame_fence_head + s_num_frame_fences) % k_max_frame_fences;
+        s_frame_fences[tail].sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        s_frame_fences[tail].frame = frame;
+        s_num_frame_fences++;
+    }
+
+    // takes new storage for the contents of a buffer, space in the ring or the buffer's own storage orphaned
+    void reserve_dynamic_buffer(gl_dynamic_buffer& db)
+    {
+        u32 aligned_pos = (s_ring.pos + s_ring.align - 1) & ~(s_ring.align - 1);
+        if (s_ring.handle && aligned_pos + db.size <= k_ring_frame_size)
+        {
+            s_ring.pos = aligned_pos + db.size;
+
+            db.bound_handle = s_ring.handle;
+            db.bound_offset = s_ring.region * k_ring_frame_size + aligned_pos;
+            db.frame = s_ring.frame;
+            return;
+        }
+
+        if (s_ring.handle)
+            s_buffer_stats.ring_overflows++;
+
+        // orphan the old storage so the driver does not have to sync with draws still using it
+        CHECK_CALL(glBindBuffer(db.type, db.own_handle));
+        CHECK_CALL(glBufferData(db.type, db.size, nullptr, GL_DYNAMIC_DRAW));
+        CHECK_CALL(glBindBuffer(db.type, 0));
+
+        db.bound_handle = db.own_handle;
+        db.bound_offset = 0;
+        db.frame = -1;
+
+        s_buffer_stats.orphans++;
+    }
+
+    // writes a range of the shadow copy to the storage the buffer is bound from
+    void write_dynamic_buffer(gl_dynamic_buffer& db, u32 offset, u32 size)
+    {
+        if (db.bound_handle == s_ring.handle)
+        {
+            memcpy(s_ring.mapped + db.bound_offset + offset, db.shadow + offset, size);
+            s_buffer_stats.ring_bytes += size;
+            return;
+        }
+
+        CHECK_CALL(glBindBuffer(db.type, db.own_handle));
+        CHECK_CALL(glBufferSubData(db.type, offset, size, db.shadow + offset));
+        CHECK_CALL(glBindBuffer(db.type, 0));
+    }
+
+    // writes the shadow copy where the gpu can read it
+    void upload_dynamic_buffer(gl_dynamic_buffer& db)
+    {
+        reserve_dynamic_buffer(db);
+        write_dynamic_buffer(db, 0, db.size);
+    }
+
+    // returns the gl buffer and offset holding the latest contents of a buffer resource
+    GLuint get_buffer_binding(u32 buffer_index, u32& offset)
+    {
+        resource_allocation& res = _res_pool[buffer_index];
+
+        offset = 0;
+        if (!res.buffer.dynamic)
+            return res.handle;
+
+        gl_dynamic_buffer& db = s_dynamic_buffers[res.buffer.dynamic - 1];
+
+        // the region holding the last write is about to be reused
+        if (db.bound_handle == s_ring.handle && db.frame + k_ring_frames <= s_ring.frame)
+            upload_dynamic_buffer(db);
+
+        offset = db.bound_offset;
+        return db.bound_handle;
+    }
+
+    void bind_uniform_buffer(u32 unit)
+    {
+        u32 buffer_index = s_cbuffer_units[unit];
+        u32 bind_offset = s_cbuffer_offsets[unit];
+
+        if (!_res_pool[buffer_index].buffer.dynamic)
+        {
+            GLuint handle = _res_pool[buffer_index].handle;
+            if (bind_offset == 0)
+            {
+                bind_uniform_block(unit, handle, 0, 0);
+                return;
+            }
+
+            GLint size = 0;
+            CHECK_CALL(glBindBuffer(GL_COPY_READ_BUFFER, handle));
+            CHECK_CALL(glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &size));
+            CHECK_CALL(glBindBuffer(GL_COPY_READ_BUFFER, 0));
+
+            PEN_ASSERT(bind_offset < (u32)size);
+            bind_uniform_block(unit, handle, bind_offset, (u32)size - bind_offset);
+            return;
+        }
+
+        u32    offset;
+        GLuint handle = get_buffer_binding(buffer_index, offset);
+        u32    size = s_dynamic_buffers[_res_pool[buffer_index].buffer.dynamic - 1].size;
+
+        PEN_ASSERT(bind_offset < size);
+        bind_uniform_block(unit, handle, offset + bind_offset, size - bind_offset);
+    }
+
+    // uniform blocks stay bound across frames, move any pointing at a ring region which is about to be reused
+    void refresh_uniform_buffers()
+    {
+        for (u32 i = 0; i < MAX_UNIFORM_BUFFERS; ++i)
+        {
+            u32 buffer_index = s_cbuffer_units[i];
+            if (!buffer_index || !_res_pool[buffer_index].buffer.dynamic)
+                continue;
+
+            gl_dynamic_buffer& db = s_dynamic_buffers[_res_pool[buffer_index].buffer.dynamic - 1];
+            if (db.bound_handle == s_ring.handle && db.frame + k_ring_frames <= s_ring.frame)
+            {
+                upload_dynamic_buffer(db);
+                bind_uniform_buffer(i);
+            }
+        }
+    }
+
     void _clear_resource_table()
     {
         // reserve resource 0 for NULL binding.
@@ -1042,14 +1489,23 @@ namespace
         program.program = program_id;
         program.vflip_uniform = glGetUniformLocation(program.program, "v_flip");
 
+        program.vflip_value = 0.0f;
+        program.texture_units_set = false;
+
         for (s32 i = 0; i < MAX_UNIFORM_BUFFERS; ++i)
         {
             program.texture_location[i] = INVALID_LOC;
             program.uniform_block_location[i] = INVALID_LOC;
         }
 
+        u32 index = sb_count(s_shader_programs);
         sb_push(s_shader_programs, program);
-        return sb_count(s_shader_programs) - 1;
+
+        // first link of a combination wins, stream out programs are found by so alone
+        hash_id key = so ? program_key(0, 0, so, 0) : program_key(vs, ps, 0, cs);
+        s_program_lookup.emplace(key, index);
+
+        return index;
     }
 } // namespace
 
@@ -1166,8 +1622,12 @@ namespace pen
     void direct::renderer_present()
     {
         pen_gl_swap_buffers();
+        fence_frame(_renderer_frame_index());
         _renderer_end_frame();
 
+        advance_buffer_ring();
+        refresh_uniform_buffers();
+
         s_state = {};
 
 // gpu counters
@@ -1279,6 +1739,39 @@ namespace pen
         CHECK_CALL(glBufferData(gl_bind, params.buffer_size, params.data, usage));
 
         res.type = gl_bind;
+        res.buffer.dynamic = 0;
+
+        if (!(params.cpu_access_flags & PEN_CPU_ACCESS_WRITE) || params.buffer_size == 0)
+            return;
+
+        u32 di;
+        if (sb_count(s_dynamic_buffers_free))
+        {
+            di = sb_last(s_dynamic_buffers_free);
+            stb__sbn(s_dynamic_buffers_free)--;
+        }
+        else
+        {
+            di = sb_count(s_dynamic_buffers);
+            sb_push(s_dynamic_buffers, gl_dynamic_buffer());
+        }
+
+        gl_dynamic_buffer& db = s_dynamic_buffers[di];
+        db.shadow = (u8*)memory_alloc(params.buffer_size);
+        db.size = params.buffer_size;
+        db.type = gl_bind;
+        db.own_handle = res.handle;
+        db.bound_handle = res.handle;
+        db.bound_offset = 0;
+        db.frame = -1;
+        db.resource = resource_slot;
+
+        if (params.data)
+            memcpy(db.shadow, params.data, params.buffer_size);
+        else
+            memset(db.shadow, 0, params.buffer_size);
+
+        res.buffer.dynamic = di + 1;
     }
 
     void direct::renderer_link_shader_program(const shader_link_params& params, u32 resource_slot)
@@ -1294,7 +1787,7 @@ namespace pen
             return;
 
         GLuint prog = linked_program->program;
-        glUseProgram(linked_program->program);
+        use_program(linked_program->program);
 
         // build lookup tables for uniform buffers and texture samplers
         for (u32 i = 0; i < params.num_constants; ++i)
@@ -1355,16 +1848,7 @@ namespace pen
 #if GL_ARB_compute_shader
         // look for linked cs program
         u32             cs = _res_pool[s_live_state.compute_shader].handle;
-        shader_program* linked_program = nullptr;
-        u32             num_shaders = sb_count(s_shader_programs);
-        for (s32 i = 0; i < num_shaders; ++i)
-        {
-            if (s_shader_programs[i].cs == cs)
-            {
-                linked_program = &s_shader_programs[i];
-                break;
-            }
-        }
+        shader_program* linked_program = find_program(0, 0, 0, cs);
 
         // link if we need to on the fly
         if (linked_program == nullptr)
@@ -1373,7 +1857,7 @@ namespace pen
             linked_program = &s_shader_programs[index];
         }
 
-        glUseProgram(linked_program->program);
+        use_program(linked_program->program);
         CHECK_CALL(glDispatchCompute(grid.x / num_threads.x, grid.y / num_threads.y, grid.z / num_threads.z));
         glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
         glBindImageTexture(0, 0, 0, 0, 0, 0, 0);
@@ -1430,6 +1914,19 @@ namespace pen
         s_state.index_format = to_gl_index_format(format);
     }
 
+    // sampler uniforms are program state, they only need setting once
+    void set_program_texture_units(shader_program* program)
+    {
+        if (filter_call(program->texture_units_set))
+            return;
+
+        for (s32 i = 0; i < MAX_UNIFORM_BUFFERS; ++i)
+            if (program->texture_location[i] != INVALID_LOC)
+                CHECK_CALL(glUniform1i(program->texture_location[i], i));
+
+        program->texture_units_set = true;
+    }
+
     void bind_state(u32 primitive_topology)
     {
         // bind shaders
@@ -1443,16 +1940,7 @@ namespace pen
             shader_program* linked_program = nullptr;
 
             u32 so_handle = _res_pool[s_state.stream_out_shader].handle;
-
-            u32 num_shaders = sb_count(s_shader_programs);
-            for (s32 i = 0; i < num_shaders; ++i)
-            {
-                if (s_shader_programs[i].so == so_handle)
-                {
-                    linked_program = &s_shader_programs[i];
-                    break;
-                }
-            }
+            linked_program = find_program(0, 0, so_handle, 0);
 
             if (linked_program == nullptr)
             {
@@ -1460,12 +1948,8 @@ namespace pen
                 PEN_ASSERT(0);
             }
 
-            CHECK_CALL(glUseProgram(linked_program->program));
-
-            // constant buffers and texture locations
-            for (s32 i = 0; i < MAX_UNIFORM_BUFFERS; ++i)
-                if (linked_program->texture_location[i] != INVALID_LOC)
-                    CHECK_CALL(glUniform1i(linked_program->texture_location[i], i));
+            use_program(linked_program->program);
+            set_program_texture_units(linked_program);
 
             CHECK_CALL(glEnable(GL_RASTERIZER_DISCARD));
         }
@@ -1484,15 +1968,7 @@ namespace pen
                 auto vs_handle = _res_pool[s_state.vertex_shader].handle;
                 auto ps_handle = _res_pool[s_state.pixel_shader].handle;
 
-                u32 num_shaders = sb_count(s_shader_programs);
-                for (s32 i = 0; i < num_shaders; ++i)
-                {
-                    if (s_shader_programs[i].vs == vs_handle && s_shader_programs[i].ps == ps_handle)
-                    {
-                        linked_program = &s_shader_programs[i];
-                        break;
-                    }
-                }
+                linked_program = find_program(vs_handle, ps_handle, 0, 0);
 
                 if (linked_program == nullptr)
                 {
@@ -1500,19 +1976,19 @@ namespace pen
                     linked_program = &s_shader_programs[index];
                 }
 
-                CHECK_CALL(glUseProgram(linked_program->program));
-
-                // constant buffers and texture locations
-                for (s32 i = 0; i < MAX_UNIFORM_BUFFERS; ++i)
-                    if (linked_program->texture_location[i] != INVALID_LOC)
-                        CHECK_CALL(glUniform1i(linked_program->texture_location[i], i));
+                use_program(linked_program->program);
+                set_program_texture_units(linked_program);
 
                 // we need to flip all geometry that is rendered into render targets to be consistent with d3d
                 float v_flip = 1.0f;
                 if (!s_live_state.backbuffer_bound)
                     v_flip = -1.0f;
 
-                glUniform1f(linked_program->vflip_uniform, v_flip);
+                if (!filter_call(linked_program->vflip_value == v_flip))
+                {
+                    linked_program->vflip_value = v_flip;
+                    glUniform1f(linked_program->vflip_uniform, v_flip);
+                }
             }
         }
 
@@ -1525,14 +2001,34 @@ namespace pen
                 CHECK_CALL(glGenVertexArrays(1, &input_res->vertex_array_handle));
             }
 
-            CHECK_CALL(glBindVertexArray(input_res->vertex_array_handle));
+            bind_vertex_array(input_res->vertex_array_handle);
+
+            // vertex buffers which were deleted may still be referenced by the vao
+            if (input_res->generation != s_gl.vao_generation)
+            {
+                input_res->generation = s_gl.vao_generation;
+                memset(input_res->slot_buffer, 0, sizeof(input_res->slot_buffer));
+            }
 
             for (s32 v = 0; v < s_live_state.num_bound_vertex_buffers; ++v)
             {
                 s_state.vertex_buffer[v] = s_live_state.vertex_buffer[v];
                 s_state.vertex_buffer_stride[v] = s_live_state.vertex_buffer_stride[v];
 
-                auto& res = _res_pool[s_state.vertex_buffer[v]].handle;
+                u32    ring_offset;
+                GLuint res = get_buffer_binding(s_state.vertex_buffer[v], ring_offset);
+
+                // attribute pointers are vao state, skip the slot if nothing changed since they were specified
+                u32    stride = s_state.vertex_buffer_stride[v];
+                size_t slot_offset = stride * s_state.base_vertex + ring_offset;
+                if (filter_call(input_res->slot_buffer[v] == res && input_res->slot_stride[v] == stride &&
+                                input_res->slot_offset[v] == slot_offset))
+                    continue;
+
+                input_res->slot_buffer[v] = res;
+                input_res->slot_stride[v] = stride;
+                input_res->slot_offset[v] = slot_offset;
+
                 CHECK_CALL(glBindBuffer(GL_ARRAY_BUFFER, res));
 
                 u32 num_attribs = sb_count(input_res->attributes);
@@ -1546,12 +2042,11 @@ namespace pen
 
                     CHECK_CALL(glEnableVertexAttribArray(attribute.location));
 
-                    u32 base_vertex_offset = s_state.vertex_buffer_stride[v] * s_state.base_vertex;
+                    size_t attrib_offset = attribute.offset + slot_offset;
 
                     CHECK_CALL(glVertexAttribPointer(attribute.location, attribute.num_elements, attribute.type,
-                                                     attribute.type == GL_UNSIGNED_BYTE ? true : false,
-                                                     s_state.vertex_buffer_stride[v],
-                                                     (void*)(attribute.offset + base_vertex_offset)));
+                                                     attribute.type == GL_UNSIGNED_BYTE ? true : false, stride,
+                                                     (void*)attrib_offset));
 
                     CHECK_CALL(glVertexAttribDivisor(attribute.location, attribute.step_rate));
                 }
@@ -1663,10 +2158,11 @@ namespace pen
         primitive_topology = PEN_GLES_WIREFRAME_TOPOLOGY(primitive_topology);
 
         // bind index buffer -this must always be re-bound
-        GLuint res = _res_pool[s_state.index_buffer].handle;
+        u32    ring_offset;
+        GLuint res = get_buffer_binding(s_state.index_buffer, ring_offset);
         CHECK_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, res));
 
-        void* offset = (void*)(size_t)(start_index * 2);
+        void* offset = (void*)(size_t)(start_index * 2 + ring_offset);
 
         CHECK_CALL(glDrawElementsBaseVertex(primitive_topology, index_count, s_state.index_format, offset, base_vertex));
     }
@@ -1681,11 +2177,12 @@ namespace pen
         primitive_topology = PEN_GLES_WIREFRAME_TOPOLOGY(primitive_topology);
 
         // bind index buffer -this must always be re-bound
-        GLuint res = _res_pool[s_state.index_buffer].handle;
+        u32    ring_offset;
+        GLuint res = get_buffer_binding(s_state.index_buffer, ring_offset);
         CHECK_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, res));
 
         // todo this needs to check index size 32 or 16 bit
-        void* offset = (void*)(size_t)(start_index * 2);
+        void* offset = (void*)(size_t)(start_index * 2 + ring_offset);
 
         CHECK_CALL(glDrawElementsInstancedBaseVertex(primitive_topology, index_count, s_state.index_format, offset,
                                                      instance_count, base_vertex));
@@ -1751,6 +2248,7 @@ namespace pen
         GLuint handle;
         CHECK_CALL(glGenTextures(1, &handle));
         CHECK_CALL(glBindTexture(texture_target, handle));
+        invalidate_active_texture();
 
         if (base_texture_target == GL_TEXTURE_3D)
         {
@@ -2160,7 +2658,7 @@ namespace pen
             CHECK_CALL(glBindFramebuffer(GL_FRAMEBUFFER, fbos[1]));
 
             direct::renderer_update_buffer(res.constant_buffer, &cbuf, sizeof(cbuf), 0);
-            direct::renderer_set_constant_buffer(res.constant_buffer, 0, pen::CBUFFER_BIND_PS);
+            direct::renderer_set_constant_buffer(res.constant_buffer, 0, pen::CBUFFER_BIND_PS, 0);
 
             viewport vp = {0.0f, 0.0f, w, h, 0.0f, 1.0f};
             direct::renderer_set_viewport(vp);
@@ -2270,9 +2768,10 @@ namespace pen
 
         resource_allocation& res = _res_pool[texture_index];
 
-        CHECK_CALL(glActiveTexture(GL_TEXTURE0 + unit));
+        active_texture(unit);
 
-        u32 max_mip = 0;
+        u32  max_mip = 0;
+        bool bound = false;
         u32 target = _res_pool[texture_index].texture.target;
 
 #if GL_ARB_compute_shader
@@ -2281,12 +2780,12 @@ namespace pen
         {
             if (unit == 0)
             {
-                glBindTexture(GL_TEXTURE_2D, res.texture.handle);
+                bind_texture(GL_TEXTURE_2D, res.texture.handle);
                 CHECK_CALL(glBindImageTexture(unit, res.texture.handle, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8));
             }
             else
             {
-                glBindTexture(GL_TEXTURE_2D, res.texture.handle);
+                bind_texture(GL_TEXTURE_2D, res.texture.handle);
                 CHECK_CALL(glBindImageTexture(unit, res.texture.handle, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8));
             }
             return;
@@ -2295,7 +2794,7 @@ namespace pen
 
         if (res.type == RES_TEXTURE || res.type == RES_TEXTURE_3D)
         {
-            CHECK_CALL(glBindTexture(target, res.texture.handle));
+            bound = bind_texture(target, res.texture.handle);
             max_mip = res.texture.max_mip_level;
         }
         else
@@ -2304,7 +2803,7 @@ namespace pen
             if (bind_flags & TEXTURE_BIND_MSAA)
             {
                 target = GL_TEXTURE_2D_MULTISAMPLE;
-                CHECK_CALL(glBindTexture(target, res.render_target.texture_msaa.handle));
+                bound = bind_texture(target, res.render_target.texture_msaa.handle);
                 max_mip = res.render_target.texture_msaa.max_mip_level;
 
                 // auto mip map
@@ -2316,7 +2815,7 @@ namespace pen
             }
             else
             {
-                CHECK_CALL(glBindTexture(target, res.render_target.texture.handle));
+                bound = bind_texture(target, res.render_target.texture.handle);
                 max_mip = res.render_target.texture.max_mip_level;
 
                 // auto mip map
@@ -2331,7 +2830,7 @@ namespace pen
         // unbind sampler typically this is for cs texture binds, they dont need a sampler
         if (sampler_index == 0)
         {
-            glBindSampler(unit, 0);
+            bind_sampler(unit, 0);
             return;
         }
 
@@ -2349,7 +2848,11 @@ namespace pen
         }
 #endif
 
-        glBindSampler(unit, sampler_object);
+        bind_sampler(unit, sampler_object);
+
+        // texture parameters were set when it was bound here last
+        if (filter_call(!bound))
+            return;
 
         if (target == GL_TEXTURE_2D_ARRAY)
             CHECK_CALL(glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, 0));
@@ -2464,10 +2967,13 @@ namespace pen
         }
     }
 
-    void direct::renderer_set_constant_buffer(u32 buffer_index, u32 unit, u32 flags)
+    void direct::renderer_set_constant_buffer(u32 buffer_index, u32 unit, u32 flags, u32 offset)
     {
-        resource_allocation& res = _res_pool[buffer_index];
-        CHECK_CALL(glBindBufferBase(GL_UNIFORM_BUFFER, unit, res.handle));
+        PEN_ASSERT(unit < MAX_UNIFORM_BUFFERS);
+
+        s_cbuffer_units[unit] = buffer_index;
+        s_cbuffer_offsets[unit] = offset;
+        bind_uniform_buffer(unit);
     }
 
     void direct::renderer_set_structured_buffer(u32 buffer_index, u32 unit, u32 flags)
@@ -2481,6 +2987,24 @@ namespace pen
         if (res.type == 0 || data_size == 0)
             return;
 
+        if (res.buffer.dynamic)
+        {
+            gl_dynamic_buffer& db = s_dynamic_buffers[res.buffer.dynamic - 1];
+            PEN_ASSERT(offset + data_size <= db.size);
+
+            memcpy(db.shadow + offset, data, data_size);
+            upload_dynamic_buffer(db);
+
+            s_buffer_stats.dynamic_updates++;
+
+            // uniform blocks are bound by range, point any using this buffer at the new contents
+            for (u32 i = 0; i < MAX_UNIFORM_BUFFERS; ++i)
+                if (s_cbuffer_units[i] == buffer_index)
+                    bind_uniform_buffer(i);
+
+            return;
+        }
+
         CHECK_CALL(glBindBuffer(res.type, res.handle));
 
 #ifndef PEN_GLES3
@@ -2499,6 +3023,35 @@ namespace pen
         CHECK_CALL(glBindBuffer(res.type, 0));
     }
 
+    void direct::renderer_update_buffer_no_overwrite(u32 buffer_index, const void* data, u32 data_size, u32 offset)
+    {
+        resource_allocation& res = _res_pool[buffer_index];
+        if (res.type == 0 || data_size == 0)
+            return;
+
+        if (!res.buffer.dynamic)
+        {
+            direct::renderer_update_buffer(buffer_index, data, data_size, offset);
+            return;
+        }
+
+        gl_dynamic_buffer& db = s_dynamic_buffers[res.buffer.dynamic - 1];
+        PEN_ASSERT(offset + data_size <= db.size);
+
+        // new contents take new storage once, appended ranges are written in place
+        if (offset == 0)
+            reserve_dynamic_buffer(db);
+
+        memcpy(db.shadow + offset, data, data_size);
+        write_dynamic_buffer(db, offset, data_size);
+
+        s_buffer_stats.dynamic_updates++;
+
+        for (u32 i = 0; i < MAX_UNIFORM_BUFFERS; ++i)
+            if (s_cbuffer_units[i] == buffer_index)
+                bind_uniform_buffer(i);
+    }
+
     void update_backbuffer_texture()
     {
     }
@@ -2576,6 +3129,7 @@ namespace pen
                 target_handle = res.render_target.texture.handle;
 
             CHECK_CALL(glBindTexture(GL_TEXTURE_2D, res.texture.handle));
+            invalidate_active_texture();
 
             void* data = memory_alloc(rrbp.data_size);
             CHECK_CALL(glGetTexImage(GL_TEXTURE_2D, 0, format, type, data));
@@ -2644,14 +3198,29 @@ namespace pen
     {
         resource_allocation& res = _res_pool[buffer_index];
         CHECK_CALL(glDeleteBuffers(1, &res.handle));
+        invalidate_deleted_buffer(res.handle);
+
+        if (res.buffer.dynamic)
+        {
+            u32 di = res.buffer.dynamic - 1;
+            memory_free(s_dynamic_buffers[di].shadow);
+            s_dynamic_buffers[di] = gl_dynamic_buffer();
+            sb_push(s_dynamic_buffers_free, di);
+        }
+
+        for (u32 i = 0; i < MAX_UNIFORM_BUFFERS; ++i)
+            if (s_cbuffer_units[i] == buffer_index)
+                s_cbuffer_units[i] = 0;
 
         res.handle = 0;
+        res.buffer.dynamic = 0;
     }
 
     void direct::renderer_release_texture(u32 texture_index)
     {
         resource_allocation& res = _res_pool[texture_index];
         CHECK_CALL(glDeleteTextures(1, &res.handle));
+        invalidate_deleted_texture(res.handle);
 
         res.handle = 0;
     }
@@ -2686,11 +3255,13 @@ namespace pen
         if (res.render_target.texture.handle > 0)
         {
             CHECK_CALL(glDeleteTextures(1, &res.render_target.texture.handle));
+            invalidate_deleted_texture(res.render_target.texture.handle);
         }
 
         if (res.render_target.texture_msaa.handle > 0)
         {
             CHECK_CALL(glDeleteTextures(1, &res.render_target.texture_msaa.handle));
+            invalidate_deleted_texture(res.render_target.texture_msaa.handle);
         }
 
         delete res.render_target.tcp;
@@ -2709,6 +3280,8 @@ namespace pen
         resource_allocation& res = _res_pool[sampler];
         glDeleteSamplers(1, &res.sampler_object.sampler);
         glDeleteSamplers(1, &res.sampler_object.depth_sampler);
+        invalidate_deleted_sampler(res.sampler_object.sampler);
+        invalidate_deleted_sampler(res.sampler_object.depth_sampler);
     }
 
     void direct::renderer_release_depth_stencil_state(u32 depth_stencil_state)
@@ -2724,28 +3297,11 @@ namespace pen
 
     void direct::renderer_replace_resource(u32 dest, u32 src, e_renderer_resource type)
     {
-        switch (type)
-        {
-            case RESOURCE_TEXTURE:
-                direct::renderer_release_texture(dest);
-                break;
-            case RESOURCE_BUFFER:
-                direct::renderer_release_buffer(dest);
-                break;
-            case RESOURCE_VERTEX_SHADER:
-                direct::renderer_release_shader(dest, PEN_SHADER_TYPE_VS);
-                break;
-            case RESOURCE_PIXEL_SHADER:
-                direct::renderer_release_shader(dest, PEN_SHADER_TYPE_PS);
-                break;
-            case RESOURCE_RENDER_TARGET:
-                direct::renderer_release_render_target(dest);
-                break;
-            default:
-                break;
-        }
-
-        _res_pool[dest] = _res_pool[src];
+        // swap so src holds the previous resource, the front end releases it once the gpu has finished with it
+        resource_allocation prev;
+        memcpy(&prev, &_res_pool[dest], sizeof(resource_allocation));
+        memcpy(&_res_pool[dest], &_res_pool[src], sizeof(resource_allocation));
+        memcpy(&_res_pool[src], &prev, sizeof(resource_allocation));
     }
 
     static renderer_info s_renderer_info;
@@ -2785,7 +3341,10 @@ namespace pen
 
         // gles base fbo is not 0
         glGetIntegerv(GL_FRAMEBUFFER_BINDING, &s_backbuffer_fbo);
+
+        create_buffer_ring();
         s_renderer_info.caps |= PEN_CAPS_VUP;
+        s_renderer_info.caps |= PEN_CAPS_CONSTANT_BUFFER_OFFSET; // uniform blocks bind by range
 
 #ifndef PEN_GLES3
         // opengl caps
@@ -2798,6 +3357,18 @@ namespace pen
             s_renderer_info.caps |= PEN_CAPS_TEXTURE_CUBE_ARRAY;
         if (major >= 4 && minor >= 6)
             s_renderer_info.caps |= PEN_CAPS_COMPUTE;
+
+        // bc7 is core from 4.2, earlier contexts (osx 4.1) may still expose it as an extension
+        bool  bptc = major > 4 || (major == 4 && minor >= 2);
+        GLint num_extensions = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &num_extensions);
+        for (GLint i = 0; i < num_extensions && !bptc; ++i)
+        {
+            const c8* ext = (const c8*)glGetStringi(GL_EXTENSIONS, i);
+            bptc = pen::string_compare(ext, "GL_ARB_texture_compression_bptc") == 0;
+        }
+        if (bptc)
+            s_renderer_info.caps |= PEN_CAPS_TEX_FORMAT_BC7;
 #endif
         return PEN_ERR_OK;
     }
@@ -2807,6 +3378,16 @@ namespace pen
         return s_renderer_info;
     }
 
+    const gl_buffer_stats& renderer_opengl_get_buffer_stats()
+    {
+        return s_buffer_stats;
+    }
+
+    const gl_state_stats& renderer_opengl_get_state_stats()
+    {
+        return s_state_stats;
+    }
+
     void direct::renderer_shutdown()
     {
         // todo device / stray resource shutdown
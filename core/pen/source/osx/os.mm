@@ -268,6 +268,7 @@ void pen_window_resize()
 void run()
 {
     // enters render loop and wait for jobs, will call os_update
+    pen::renderer_set_max_frames_in_flight(s_ctx.creation_params.max_frames_in_flight);
     pen::renderer_init(nullptr, true, s_ctx.creation_params.max_renderer_commands);
 }
 #endif
@@ -590,6 +591,8 @@ namespace
                 }
             }
 
+            pen::renderer_capture_parse_args(argc, argv);
+
             [NSApplication sharedApplication];
 
             id dg = [app_delegate shared_delegate];
@@ -3,6 +3,8 @@
 // License: https://github.com/polymonster/pmtech/blob/master/license.md
 
 #include <fstream>
+#include <stdio.h>
+#include <unordered_map>
 
 #include "console.h"
 #include "data_struct.h"
@@ -29,7 +31,7 @@ using namespace pen;
 #if PEN_SINGLE_THREADED
 #define add_cmd(cmd) exec_cmd(cmd)
 #else
-#define add_cmd(cmd) _ctx->cmd_buffer.put(cmd)
+#define add_cmd(cmd) put_cmd(cmd)
 #endif
 
 namespace
@@ -92,7 +94,9 @@ namespace
         CMD_PUSH_PERF_MARKER,
         CMD_POP_PERF_MARKER,
         CMD_DISPATCH_COMPUTE,
-        CMD_SET_STENCIL_REF
+        CMD_SET_STENCIL_REF,
+        CMD_BEGIN_CAPTURE,
+        CMD_UPDATE_BUFFER_NO_OVERWRITE
     };
 
     struct set_shader_cmd
@@ -172,6 +176,7 @@ namespace
         u32 buffer_index;
         u32 unit;
         u32 flags;
+        u32 offset;
     };
 
     struct update_buffer_cmd
@@ -239,6 +244,7 @@ namespace
             c8*                              name;
             compute_dispatch_params          cs_dispatch;
             u8                               stencil_ref;
+            f64                              frame_start_ms;
         };
 
         renderer_cmd(){};
@@ -254,12 +260,234 @@ namespace
         pen::semaphore*           continue_semaphore = nullptr;
         pen::slot_resources       renderer_slot_resources;
         ring_buffer<renderer_cmd> cmd_buffer;
-        ring_buffer<renderer_cmd> release_cmd_buffer;
+        renderer_cmd*             release_queue = nullptr; // render thread only, ordered by frame
         u32*                      free_slots = nullptr;
-        a_s32                     wait;
+        a_s32                     wait;                   // frames consumed by the user thread and not presented
+        u32                       frames_in_flight = 0;   // frame slots issued, when the render thread waits for jobs
+        f64                       frame_start_ms = 0.0;   // when the current user thread frame began
     };
     static fe_render_ctx* _ctx;
     static render_ctx     _main_ctx;
+    static renderer_stats s_stats;
+
+    // the user thread can queue up to max frames in flight in the command buffer ahead of the render thread, each
+    // frame is a segment ending in present. more frames trade input latency for throughput when either thread stalls
+    static const u32 k_max_frames_in_flight = 3;
+    static a_u32     s_max_frames_in_flight = {1};
+
+    // command lists are recorded by the front end and copied into the command buffer on submit. while any thread
+    // is recording, everything which writes to the command buffer or allocates front end resources takes the lock
+    struct cmd_list
+    {
+        renderer_cmd* cmds = nullptr;
+        bool          alive = false;
+    };
+
+    struct cmd_list_ctx
+    {
+        cmd_list*   lists = nullptr;
+        u32*        free_lists = nullptr;
+        pen::mutex* lock = nullptr;
+        a_u32       recording = {0}; // threads with a list bound
+    };
+    static cmd_list_ctx s_cmd_lists;
+
+#if !PEN_SINGLE_THREADED
+    static thread_local u32 t_cmd_list = PEN_INVALID_HANDLE;
+
+    bool cmd_list_bound()
+    {
+        return is_valid(t_cmd_list);
+    }
+
+    bool cmd_list_lock()
+    {
+        if (s_cmd_lists.recording == 0)
+            return false;
+
+        pen::mutex_lock(s_cmd_lists.lock);
+        return true;
+    }
+
+    void cmd_list_unlock(bool locked)
+    {
+        if (locked)
+            pen::mutex_unlock(s_cmd_lists.lock);
+    }
+#else
+    bool cmd_list_bound()
+    {
+        return false;
+    }
+
+    bool cmd_list_lock()
+    {
+        return false;
+    }
+
+    void cmd_list_unlock(bool locked)
+    {
+    }
+#endif
+
+    bool cmd_creates_resource(u32 command_index)
+    {
+        switch (command_index)
+        {
+            case CMD_LOAD_SHADER:
+            case CMD_LINK_SHADER:
+            case CMD_CREATE_INPUT_LAYOUT:
+            case CMD_CREATE_BUFFER:
+            case CMD_CREATE_TEXTURE:
+            case CMD_CREATE_SAMPLER:
+            case CMD_CREATE_RASTER_STATE:
+            case CMD_CREATE_BLEND_STATE:
+            case CMD_CREATE_DEPTH_STENCIL_STATE:
+            case CMD_CREATE_RENDER_TARGET:
+            case CMD_CREATE_SO_SHADER:
+            case CMD_CREATE_CLEAR_STATE:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    u32 next_resource_slot()
+    {
+        bool locked = cmd_list_lock();
+        u32  slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
+        cmd_list_unlock(locked);
+        return slot;
+    }
+
+#if !PEN_SINGLE_THREADED
+    void put_cmd(const renderer_cmd& cmd)
+    {
+        // creation goes straight to the command buffer so the handle can be used by any list submitted this frame
+        if (cmd_list_bound() && !cmd_creates_resource(cmd.command_index))
+        {
+            sb_push(s_cmd_lists.lists[t_cmd_list].cmds, cmd);
+            return;
+        }
+
+        bool locked = cmd_list_lock();
+
+        // the ring does not check for overflow and the render thread may be executing the slot behind get_pos, wait
+        // for space rather than overwrite commands of queued frames
+        ring_buffer<renderer_cmd>& cb = _ctx->cmd_buffer;
+        u32                        capacity = (u32)cb._capacity;
+        if ((cb.get_pos + capacity - cb.put_pos - 1) % capacity < 2)
+        {
+            s_stats.cmd_buffer_stalls++;
+            while ((cb.get_pos + capacity - cb.put_pos - 1) % capacity < 2)
+                pen::thread_sleep_us(100);
+        }
+
+        cb.put(cmd);
+
+        cmd_list_unlock(locked);
+    }
+#endif
+
+    // command stream capture, records are the raw renderer_cmd followed by its payloads as size prefixed blobs
+    static const u32 k_capture_magic = 0x444d4350; // PCMD
+    static const u32 k_capture_version = 2;
+
+    struct capture_header
+    {
+        u32 magic;
+        u32 version;
+        u32 cmd_size; // sizeof(renderer_cmd), captures only replay on builds with the same layout
+        u32 start_frame;
+        u32 width;
+        u32 height;
+    };
+
+    struct capture_record
+    {
+        u32 size; // bytes following the record, padded to keep records 8 byte aligned
+        u32 command_index;
+        f64 time_ms; // since the capture began
+    };
+
+    struct capture_update
+    {
+        u32 offset;
+        u32 size;
+        u8* data;
+    };
+
+    struct capture_ctx
+    {
+        Str         filename;
+        u32         start_frame = 0;
+        u32         num_frames = 0;
+        bool        armed = false;
+        FILE*       file = nullptr;
+        pen::timer* timer = nullptr;
+        u32         frame = 0;
+        u8*         scratch = nullptr;
+
+        // only the latest contents of a buffer are needed before start_frame
+        std::unordered_map<u32, capture_update*> pending_updates;
+    };
+    static capture_ctx s_capture;
+
+    struct replay_resource
+    {
+        u32 slot;
+        u32 release_cmd;
+        u32 shader_type;
+    };
+
+    struct replay_ctx
+    {
+        u8*              data = nullptr;
+        u32*             records = nullptr;   // offset of each capture_record in data
+        u32*             frames = nullptr;    // first record of each frame, plus one past the last frame
+        replay_resource* resources = nullptr; // created from start_frame on and not released yet
+        capture_header   header;
+    };
+    static replay_ctx s_replay;
+
+    // per draw constants are sub allocated from chunks, each a dynamic cbuffer written with no overwrite updates.
+    // allocations are flushed to the render thread in one update when a chunk with unflushed data is bound, the
+    // cpu copy has a region per frame the render thread can still be reading, and one for the frame being written.
+    static const u32 k_dynamic_cbuffer_chunk_size = 256 * 1024;
+    static const u32 k_dynamic_cbuffer_range = 64 * 1024; // max cbuffer size, chunks are padded to bind it anywhere
+    static const u32 k_dynamic_cbuffer_align = 256;
+    static const u32 k_dynamic_cbuffer_frames = k_max_frames_in_flight + 1;
+
+    struct dynamic_cbuffer_chunk
+    {
+        u32 handle;
+        u32 pos;     // bytes allocated this frame
+        u32 flushed; // bytes submitted to the render thread this frame
+        u8* cpu;     // k_dynamic_cbuffer_frames regions of k_dynamic_cbuffer_chunk_size
+    };
+
+    // without PEN_CAPS_CONSTANT_BUFFER_OFFSET each allocation is bound as a whole cbuffer of its own, buffers are
+    // reused in allocation order every frame and written with a discard update, the chunks only hold the cpu copy
+    struct dynamic_cbuffer_discard
+    {
+        u32 handle;
+        u32 size; // of the buffer
+        u8* data; // allocation in the chunk cpu region
+        u32 data_size;
+    };
+
+    struct dynamic_cbuffer_ring
+    {
+        dynamic_cbuffer_chunk*   chunks = nullptr;
+        dynamic_cbuffer_discard* discards = nullptr;
+        u32                      chunk = 0;
+        u32                      region = 0;
+        u32                      num_discards = 0;     // used this frame
+        u32                      flushed_discards = 0; // submitted to the render thread this frame
+        s32                      offsets = -1;         // offset binding supported, read from caps on first use
+        bool                     unflushed = false;
+    };
+    static dynamic_cbuffer_ring s_dynamic_cbuffers;
 
 } // namespace
 
@@ -267,6 +495,12 @@ namespace pen
 {
     void end_frame_internal();
     void new_frame_internal();
+    void dynamic_cbuffer_new_frame();
+
+    const renderer_stats& renderer_get_stats()
+    {
+        return s_stats;
+    }
 
     void renderer_get_present_time(f32& cpu_ms, f32& gpu_ms)
     {
@@ -276,10 +510,414 @@ namespace pen
         gpu_ms = (f64)g_gpu_total / 1000.0 / 1000.0;
     }
 
+    void renderer_set_max_frames_in_flight(u32 frames)
+    {
+        s_max_frames_in_flight = std::min<u32>(std::max<u32>(frames, 1), k_max_frames_in_flight);
+    }
+
+    f64 smooth_ms(f64 avg, f64 ms)
+    {
+        // over roughly the last 20 frames
+        return avg > 0.0 ? avg + (ms - avg) * 0.05 : ms;
+    }
+
+    void frame_stats(f64 frame_start_ms)
+    {
+        f64 latency = get_time_ms() - frame_start_ms;
+
+        s_stats.frames_presented++;
+        s_stats.queued_frames = std::max<s32>(_ctx->wait, 0);
+        s_stats.present_interval_ms = _ctx->present_time;
+        s_stats.present_interval_avg_ms = smooth_ms(s_stats.present_interval_avg_ms, _ctx->present_time);
+        s_stats.input_to_present_ms = latency;
+        s_stats.input_to_present_avg_ms = smooth_ms(s_stats.input_to_present_avg_ms, latency);
+    }
+
+    //
+    // command stream capture
+    //
+
+    void capture_bytes(const void* data, u32 size)
+    {
+        if (size == 0)
+            return;
+
+        u8* dst = sb_add(s_capture.scratch, (s32)size);
+        memcpy(dst, data, size);
+    }
+
+    void capture_blob(const void* data, u32 size)
+    {
+        if (!data)
+            size = 0;
+
+        capture_bytes(&size, sizeof(u32));
+        capture_bytes(data, size);
+    }
+
+    void capture_string(const c8* str)
+    {
+        capture_blob(str, str ? string_length(str) + 1 : 0);
+    }
+
+    void capture_write(const renderer_cmd& cmd)
+    {
+        if (s_capture.scratch)
+            stb__sbn(s_capture.scratch) = 0;
+
+        capture_bytes(&cmd, sizeof(renderer_cmd));
+
+        // deep copy payloads, in the order replay_payload reads them
+        switch (cmd.command_index)
+        {
+            case CMD_LOAD_SHADER:
+            {
+                const shader_load_params& slp = cmd.shader_load;
+                capture_blob(slp.byte_code, slp.byte_code_size);
+                capture_blob(slp.so_decl_entries, sizeof(stream_out_decl_entry) * slp.so_num_entries);
+                if (slp.so_decl_entries)
+                    for (u32 i = 0; i < slp.so_num_entries; ++i)
+                        capture_string(slp.so_decl_entries[i].semantic_name);
+            }
+            break;
+
+            case CMD_LINK_SHADER:
+            {
+                const shader_link_params& slp = cmd.link_params;
+                capture_blob(slp.constants, sizeof(constant_layout_desc) * slp.num_constants);
+                for (u32 i = 0; i < slp.num_constants; ++i)
+                    capture_string(slp.constants[i].name);
+
+                u32 num_so = slp.stream_out_names ? slp.num_stream_out_names : 0;
+                capture_bytes(&num_so, sizeof(u32));
+                for (u32 i = 0; i < num_so; ++i)
+                    capture_string(slp.stream_out_names[i]);
+            }
+            break;
+
+            case CMD_CREATE_INPUT_LAYOUT:
+            {
+                const input_layout_creation_params& ilp = cmd.create_input_layout;
+                capture_blob(ilp.vs_byte_code, ilp.vs_byte_code_size);
+                capture_blob(ilp.input_layout, sizeof(input_layout_desc) * ilp.num_elements);
+                for (u32 i = 0; i < ilp.num_elements; ++i)
+                    capture_string(ilp.input_layout[i].semantic_name);
+            }
+            break;
+
+            case CMD_CREATE_BUFFER:
+                capture_blob(cmd.create_buffer.data, cmd.create_buffer.buffer_size);
+                break;
+
+            case CMD_SET_VERTEX_BUFFER:
+            {
+                u32 size = sizeof(u32) * cmd.set_vertex_buffer.num_buffers;
+                capture_blob(cmd.set_vertex_buffer.buffer_indices, size);
+                capture_blob(cmd.set_vertex_buffer.strides, size);
+                capture_blob(cmd.set_vertex_buffer.offsets, size);
+            }
+            break;
+
+            case CMD_CREATE_TEXTURE:
+                capture_blob(cmd.create_texture.data, cmd.create_texture.data_size);
+                break;
+
+            case CMD_CREATE_BLEND_STATE:
+                capture_blob(cmd.create_blend_state.render_targets,
+                             sizeof(render_target_blend) * cmd.create_blend_state.num_render_targets);
+                break;
+
+            case CMD_UPDATE_BUFFER:
+            case CMD_UPDATE_BUFFER_NO_OVERWRITE:
+                capture_blob(cmd.update_buffer.data, cmd.update_buffer.data_size);
+                break;
+
+            case CMD_CREATE_DEPTH_STENCIL_STATE:
+                capture_blob(cmd.p_create_depth_stencil_state, sizeof(depth_stencil_creation_params));
+                break;
+
+            case CMD_PUSH_PERF_MARKER:
+                capture_string(cmd.name);
+                break;
+
+            default:
+                break;
+        }
+
+        s32 pad = (8 - (sb_count(s_capture.scratch) & 7)) & 7;
+        sb_add(s_capture.scratch, pad);
+
+        capture_record rec;
+        rec.size = sb_count(s_capture.scratch);
+        rec.command_index = cmd.command_index;
+        rec.time_ms = timer_elapsed_ms(s_capture.timer);
+
+        fwrite(&rec, sizeof(capture_record), 1, s_capture.file);
+        fwrite(s_capture.scratch, rec.size, 1, s_capture.file);
+    }
+
+    void capture_defer_update(const renderer_cmd& cmd)
+    {
+        const update_buffer_cmd& ub = cmd.update_buffer;
+        capture_update*&         updates = s_capture.pending_updates[ub.buffer_index];
+
+        // drop earlier updates this one overwrites, keeping the order of any partial overlaps
+        u32 n = 0;
+        u32 count = sb_count(updates);
+        for (u32 i = 0; i < count; ++i)
+        {
+            capture_update& u = updates[i];
+            if (u.offset >= ub.offset && u.offset + u.size <= ub.offset + ub.data_size)
+                memory_free(u.data);
+            else
+                updates[n++] = u;
+        }
+
+        if (updates)
+            stb__sbn(updates) = n;
+
+        capture_update nu;
+        nu.offset = ub.offset;
+        nu.size = ub.data_size;
+        nu.data = (u8*)memory_alloc(ub.data_size);
+        memcpy(nu.data, ub.data, ub.data_size);
+        sb_push(updates, nu);
+    }
+
+    void capture_drop_updates(u32 buffer_index)
+    {
+        auto it = s_capture.pending_updates.find(buffer_index);
+        if (it == s_capture.pending_updates.end())
+            return;
+
+        capture_update* updates = it->second;
+        u32             count = sb_count(updates);
+        for (u32 i = 0; i < count; ++i)
+            memory_free(updates[i].data);
+
+        sb_free(updates);
+        s_capture.pending_updates.erase(it);
+    }
+
+    void capture_flush_updates(u32 buffer_index)
+    {
+        auto it = s_capture.pending_updates.find(buffer_index);
+        if (it == s_capture.pending_updates.end())
+            return;
+
+        capture_update* updates = it->second;
+        u32             count = sb_count(updates);
+        for (u32 i = 0; i < count; ++i)
+        {
+            renderer_cmd cmd;
+            cmd.command_index = CMD_UPDATE_BUFFER;
+            cmd.update_buffer.buffer_index = buffer_index;
+            cmd.update_buffer.data = updates[i].data;
+            cmd.update_buffer.data_size = updates[i].size;
+            cmd.update_buffer.offset = updates[i].offset;
+            capture_write(cmd);
+        }
+
+        capture_drop_updates(buffer_index);
+    }
+
+    void capture_flush_all_updates()
+    {
+        while (!s_capture.pending_updates.empty())
+            capture_flush_updates(s_capture.pending_updates.begin()->first);
+    }
+
+    bool capture_state_cmd(u32 command_index)
+    {
+        // commands which change resources, kept for the frames before start_frame
+        switch (command_index)
+        {
+            case CMD_NEW_FRAME:
+            case CMD_PRESENT:
+            case CMD_LOAD_SHADER:
+            case CMD_LINK_SHADER:
+            case CMD_CREATE_INPUT_LAYOUT:
+            case CMD_CREATE_BUFFER:
+            case CMD_CREATE_TEXTURE:
+            case CMD_CREATE_SAMPLER:
+            case CMD_CREATE_RASTER_STATE:
+            case CMD_CREATE_BLEND_STATE:
+            case CMD_CREATE_DEPTH_STENCIL_STATE:
+            case CMD_CREATE_RENDER_TARGET:
+            case CMD_CREATE_CLEAR_STATE:
+            case CMD_REPLACE_RESOURCE:
+            case CMD_RELEASE_SHADER:
+            case CMD_RELEASE_BUFFER:
+            case CMD_RELEASE_TEXTURE_2D:
+            case CMD_RELEASE_RASTER_STATE:
+            case CMD_RELEASE_BLEND_STATE:
+            case CMD_RELEASE_RENDER_TARGET:
+            case CMD_RELEASE_INPUT_LAYOUT:
+            case CMD_RELEASE_SAMPLER:
+            case CMD_RELEASE_PROGRAM:
+            case CMD_RELEASE_CLEAR_STATE:
+            case CMD_RELEASE_DEPTH_STENCIL_STATE:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    void capture_begin()
+    {
+        s_capture.file = fopen(s_capture.filename.c_str(), "wb");
+        if (!s_capture.file)
+        {
+            PEN_LOG("[error] capture: failed to open %s\n", s_capture.filename.c_str());
+            return;
+        }
+
+        capture_header hdr;
+        hdr.magic = k_capture_magic;
+        hdr.version = k_capture_version;
+        hdr.cmd_size = sizeof(renderer_cmd);
+        hdr.start_frame = s_capture.start_frame;
+        hdr.width = pen_window.width;
+        hdr.height = pen_window.height;
+        fwrite(&hdr, sizeof(capture_header), 1, s_capture.file);
+
+        s_capture.frame = 0;
+        s_capture.timer = timer_create();
+        timer_start(s_capture.timer);
+
+        PEN_LOG("capture: recording %u frames from frame %u to %s\n", s_capture.num_frames, s_capture.start_frame,
+                s_capture.filename.c_str());
+    }
+
+    void capture_end()
+    {
+        for (auto& pu : s_capture.pending_updates)
+        {
+            u32 count = sb_count(pu.second);
+            for (u32 i = 0; i < count; ++i)
+                memory_free(pu.second[i].data);
+            sb_free(pu.second);
+        }
+        s_capture.pending_updates.clear();
+
+        fclose(s_capture.file);
+        s_capture.file = nullptr;
+
+        sb_free(s_capture.scratch);
+        s_capture.scratch = nullptr;
+
+        timer_destroy(s_capture.timer);
+        s_capture.timer = nullptr;
+
+        PEN_LOG("capture: written %s\n", s_capture.filename.c_str());
+    }
+
+    void capture_cmd(const renderer_cmd& cmd)
+    {
+        // read back call backs point into the capturing process and can not be replayed
+        if (cmd.command_index == CMD_MAP_RESOURCE)
+            return;
+
+        if (s_capture.frame < s_capture.start_frame)
+        {
+            if (cmd.command_index == CMD_UPDATE_BUFFER)
+            {
+                capture_defer_update(cmd);
+                return;
+            }
+
+            if (!capture_state_cmd(cmd.command_index))
+                return;
+
+            if (cmd.command_index == CMD_RELEASE_BUFFER)
+            {
+                capture_drop_updates(cmd.command_data_index);
+            }
+            else if (cmd.command_index == CMD_REPLACE_RESOURCE)
+            {
+                capture_flush_updates(cmd.replace_resource_params.dest_handle);
+                capture_flush_updates(cmd.replace_resource_params.src_handle);
+            }
+        }
+
+        capture_write(cmd);
+
+        if (cmd.command_index != CMD_PRESENT)
+            return;
+
+        s_capture.frame++;
+        if (s_capture.frame == s_capture.start_frame)
+            capture_flush_all_updates();
+
+        if (s_capture.frame >= s_capture.start_frame + s_capture.num_frames)
+            capture_end();
+    }
+
+    // released resources may still be used by frames in flight, they wait in the release queue until the backend
+    // reports the gpu has completed the frame they were released in
+    void defer_release(const renderer_cmd& cmd)
+    {
+        renderer_cmd& rc = *sb_add(_ctx->release_queue, 1);
+        rc = cmd;
+        rc.frame_index = _renderer_frame_index();
+
+        s_stats.pending_releases = sb_count(_ctx->release_queue);
+        s_stats.pending_releases_peak = std::max<u64>(s_stats.pending_releases_peak, s_stats.pending_releases);
+    }
+
+    void exec_release(const renderer_cmd& cmd)
+    {
+        switch (cmd.command_index)
+        {
+            case CMD_RELEASE_SHADER:
+                direct::renderer_release_shader(cmd.set_shader.shader_index, cmd.set_shader.shader_type);
+                break;
+
+            case CMD_RELEASE_BUFFER:
+                direct::renderer_release_buffer(cmd.command_data_index);
+                break;
+
+            case CMD_RELEASE_TEXTURE_2D:
+                direct::renderer_release_texture(cmd.command_data_index);
+                break;
+
+            case CMD_RELEASE_RASTER_STATE:
+                direct::renderer_release_raster_state(cmd.command_data_index);
+                break;
+
+            case CMD_RELEASE_BLEND_STATE:
+                direct::renderer_release_blend_state(cmd.command_data_index);
+                break;
+
+            case CMD_RELEASE_CLEAR_STATE:
+                direct::renderer_release_clear_state(cmd.command_data_index);
+                break;
+
+            case CMD_RELEASE_RENDER_TARGET:
+                direct::renderer_release_render_target(cmd.command_data_index);
+                break;
+
+            case CMD_RELEASE_INPUT_LAYOUT:
+                direct::renderer_release_input_layout(cmd.command_data_index);
+                break;
+
+            case CMD_RELEASE_SAMPLER:
+                direct::renderer_release_sampler(cmd.command_data_index);
+                break;
+
+            case CMD_RELEASE_DEPTH_STENCIL_STATE:
+                direct::renderer_release_depth_stencil_state(cmd.command_data_index);
+                break;
+        }
+    }
+
     void exec_cmd(const renderer_cmd& cmd)
     {
         //PEN_LOG("CMD %i", cmd.command_index);
 
+        if (s_capture.file)
+            capture_cmd(cmd);
+
         switch (cmd.command_index)
         {
             case CMD_NEW_FRAME:
@@ -296,6 +934,7 @@ namespace pen
                 end_frame_internal();
                 _ctx->present_time = timer_elapsed_ms(_ctx->present_timer);
                 timer_start(_ctx->present_timer);
+                frame_stats(cmd.frame_start_ms);
                 break;
 
             case CMD_LOAD_SHADER:
@@ -403,19 +1042,16 @@ namespace pen
                 break;
 
             case CMD_RELEASE_SHADER:
-                direct::renderer_release_shader(cmd.set_shader.shader_index, cmd.set_shader.shader_type);
-                break;
-
             case CMD_RELEASE_BUFFER:
-                direct::renderer_release_buffer(cmd.command_data_index);
-                break;
-
             case CMD_RELEASE_TEXTURE_2D:
-                direct::renderer_release_texture(cmd.command_data_index);
-                break;
-
             case CMD_RELEASE_RASTER_STATE:
-                direct::renderer_release_raster_state(cmd.command_data_index);
+            case CMD_RELEASE_BLEND_STATE:
+            case CMD_RELEASE_CLEAR_STATE:
+            case CMD_RELEASE_RENDER_TARGET:
+            case CMD_RELEASE_INPUT_LAYOUT:
+            case CMD_RELEASE_SAMPLER:
+            case CMD_RELEASE_DEPTH_STENCIL_STATE:
+                defer_release(cmd);
                 break;
 
             case CMD_CREATE_BLEND_STATE:
@@ -429,7 +1065,7 @@ namespace pen
 
             case CMD_SET_CONSTANT_BUFFER:
                 direct::renderer_set_constant_buffer(cmd.set_buffer.buffer_index, cmd.set_buffer.unit,
-                                                     cmd.set_buffer.flags);
+                                                     cmd.set_buffer.flags, cmd.set_buffer.offset);
                 break;
 
             case CMD_SET_STRUCTURED_BUFFER:
@@ -465,30 +1101,6 @@ namespace pen
                                              cmd.set_targets.array_index, cmd.set_targets.array_index);
                 break;
 
-            case CMD_RELEASE_BLEND_STATE:
-                direct::renderer_release_blend_state(cmd.command_data_index);
-                break;
-
-            case CMD_RELEASE_CLEAR_STATE:
-                direct::renderer_release_clear_state(cmd.command_data_index);
-                break;
-
-            case CMD_RELEASE_RENDER_TARGET:
-                direct::renderer_release_render_target(cmd.command_data_index);
-                break;
-
-            case CMD_RELEASE_INPUT_LAYOUT:
-                direct::renderer_release_input_layout(cmd.command_data_index);
-                break;
-
-            case CMD_RELEASE_SAMPLER:
-                direct::renderer_release_sampler(cmd.command_data_index);
-                break;
-
-            case CMD_RELEASE_DEPTH_STENCIL_STATE:
-                direct::renderer_release_depth_stencil_state(cmd.command_data_index);
-                break;
-
             case CMD_SET_SO_TARGET:
                 direct::renderer_set_stream_out_target(cmd.command_data_index);
                 break;
@@ -507,9 +1119,38 @@ namespace pen
                 break;
 
             case CMD_REPLACE_RESOURCE:
-                direct::renderer_replace_resource(cmd.replace_resource_params.dest_handle,
-                                                  cmd.replace_resource_params.src_handle, cmd.replace_resource_params.type);
-                break;
+            {
+                const replace_resource& rr = cmd.replace_resource_params;
+                direct::renderer_replace_resource(rr.dest_handle, rr.src_handle, rr.type);
+
+                // backends swap, src now holds the previous dest resource which frames in flight may still use.
+                // releasing it through the queue also frees the src slot so streaming replacement does not leak
+                renderer_cmd rc;
+                rc.resource_slot = rr.src_handle;
+                rc.command_data_index = rr.src_handle;
+
+                switch (rr.type)
+                {
+                    case RESOURCE_TEXTURE:
+                        rc.command_index = CMD_RELEASE_TEXTURE_2D;
+                        break;
+                    case RESOURCE_BUFFER:
+                        rc.command_index = CMD_RELEASE_BUFFER;
+                        break;
+                    case RESOURCE_RENDER_TARGET:
+                        rc.command_index = CMD_RELEASE_RENDER_TARGET;
+                        break;
+                    default:
+                        rc.command_index = CMD_RELEASE_SHADER;
+                        rc.set_shader.shader_index = rr.src_handle;
+                        rc.set_shader.shader_type =
+                            rr.type == RESOURCE_VERTEX_SHADER ? PEN_SHADER_TYPE_VS : PEN_SHADER_TYPE_PS;
+                        break;
+                }
+
+                defer_release(rc);
+            }
+            break;
 
             case CMD_CREATE_CLEAR_STATE:
                 direct::renderer_create_clear_state(cmd.clear_state_params, cmd.resource_slot);
@@ -530,6 +1171,17 @@ namespace pen
             case CMD_SET_STENCIL_REF:
                 direct::renderer_set_stencil_ref(cmd.stencil_ref);
                 break;
+
+            case CMD_BEGIN_CAPTURE:
+                if (!s_capture.file)
+                    capture_begin();
+                break;
+
+            case CMD_UPDATE_BUFFER_NO_OVERWRITE:
+                // data points into the dynamic cbuffer ring and is not freed
+                direct::renderer_update_buffer_no_overwrite(cmd.update_buffer.buffer_index, cmd.update_buffer.data,
+                                                            cmd.update_buffer.data_size, cmd.update_buffer.offset);
+                break;
         }
     }
 
@@ -545,19 +1197,32 @@ namespace pen
     void renderer_consume_cmd_buffer()
     {
 #if !PEN_SINGLE_THREADED
-        while (_ctx->wait > 0)
-            pen::thread_sleep_ms(1);
-
         if (_ctx->consume_semaphore)
         {
+            // take a frame slot, the render thread returns one each present
+            f64 wait_start = get_time_ms();
+
             semaphore_post(_ctx->consume_semaphore, 1);
             semaphore_wait(_ctx->continue_semaphore);
+
+            s_stats.user_wait_ms = get_time_ms() - wait_start;
         }
 
+        // issue or take back slots to match max frames in flight, only when the render thread waits for jobs
+        u32 max_frames = s_max_frames_in_flight;
+        for (; _ctx->frames_in_flight && _ctx->frames_in_flight < max_frames; _ctx->frames_in_flight++)
+            semaphore_post(_ctx->continue_semaphore, 1);
+
+        for (; _ctx->frames_in_flight > max_frames; _ctx->frames_in_flight--)
+            semaphore_wait(_ctx->continue_semaphore);
+
+        s_stats.max_frames_in_flight = _ctx->frames_in_flight ? _ctx->frames_in_flight : 1;
+
         // sync on window surface
         direct::renderer_sync();
         _ctx->wait++;
 #endif
+        _ctx->frame_start_ms = get_time_ms();
     }
 
     void new_frame_internal()
@@ -577,26 +1242,35 @@ namespace pen
 
     void end_frame_internal()
     {
-        // check the release cmd_buffer.. we need to wait a few frames before releasing resources
-        // so they arent in flight on the gpu
-        static const u32 k_waitFrames = 6;
-        for (;;)
+        // release resources the gpu has finished with, the queue is in frame order
+        u64 completed = _renderer_completed_frame_index();
+        u32 num = sb_count(_ctx->release_queue);
+        u32 released = 0;
+        for (; released < num; ++released)
         {
-            renderer_cmd* cmd = _ctx->release_cmd_buffer.check();
-            u64           cf = pen::_renderer_frame_index();
-            if (!cmd || cf - cmd->frame_index < k_waitFrames)
+            const renderer_cmd& cmd = _ctx->release_queue[released];
+            if (cmd.frame_index >= completed)
                 break;
 
-            cmd = _ctx->release_cmd_buffer.get();
-            if (cmd->resource_slot)
+            if (cmd.resource_slot)
             {
-                if (cmd)
-                    exec_cmd(*cmd);
-
-                sb_push(_ctx->free_slots, cmd->resource_slot);
+                exec_release(cmd);
+                sb_push(_ctx->free_slots, cmd.resource_slot);
             }
         }
 
+        if (released > 0)
+        {
+            u32 remaining = num - released;
+            memmove(_ctx->release_queue, _ctx->release_queue + released, remaining * sizeof(renderer_cmd));
+            stb__sbn(_ctx->release_queue) = remaining;
+        }
+
+        u64 frame = _renderer_frame_index();
+        s_stats.frames_in_flight = frame > completed ? frame - completed : 0;
+        s_stats.pending_releases = sb_count(_ctx->release_queue);
+        s_stats.resources_released += released;
+
         direct::renderer_end_frame();
         semaphore_post(_ctx->continue_semaphore, 1);
         _ctx->wait--;
@@ -714,12 +1388,11 @@ namespace pen
     {
         fe_render_ctx* new_ctx = new fe_render_ctx();
         new_ctx->cmd_buffer.create(max_commands);
-        new_ctx->release_cmd_buffer.create(1024);
         new_ctx->present_timer = timer_create();
         timer_start(new_ctx->present_timer);
         new_ctx->present_time = 0.0f;
         new_ctx->consume_semaphore = semaphore_create(0, 1);
-        new_ctx->continue_semaphore = semaphore_create(0, 1);
+        new_ctx->continue_semaphore = semaphore_create(0, k_max_frames_in_flight + 1);
         slot_resources_init(&new_ctx->renderer_slot_resources, 2048);
 
         return (render_ctx*)new_ctx;
@@ -743,8 +1416,24 @@ namespace pen
 
         init_resolve_resources(_ctx);
 
+        // resources created during init are recreated by the replaying process, so begin capture after them
+        if (s_capture.armed)
+        {
+            s_capture.armed = false;
+
+            renderer_cmd cmd;
+            cmd.command_index = CMD_BEGIN_CAPTURE;
+            add_cmd(cmd);
+        }
+
+        _ctx->frame_start_ms = get_time_ms();
+
         if (wait_for_jobs)
+        {
+            // renderer_wait_for_jobs issues the first frame slot
+            _ctx->frames_in_flight = 1;
             renderer_wait_for_jobs();
+        }
     }
 
     // graphics test
@@ -936,7 +1625,10 @@ namespace pen
 
         renderer_cmd cmd;
         cmd.command_index = CMD_PRESENT;
+        cmd.frame_start_ms = _ctx->frame_start_ms;
         add_cmd(cmd);
+
+        dynamic_cbuffer_new_frame();
     }
 
     u32 renderer_load_shader(const shader_load_params& params)
@@ -965,7 +1657,7 @@ namespace pen
             memcpy(cmd.shader_load.so_decl_entries, params.so_decl_entries, entries_size);
         }
 
-        u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
+        u32 resource_slot = next_resource_slot();
         cmd.resource_slot = resource_slot;
 
         add_cmd(cmd);
@@ -1015,7 +1707,7 @@ namespace pen
             }
         }
 
-        u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
+        u32 resource_slot = next_resource_slot();
         cmd.resource_slot = resource_slot;
 
         add_cmd(cmd);
@@ -1055,7 +1747,7 @@ namespace pen
 
         memcpy(cmd.create_input_layout.input_layout, params.input_layout, input_layouts_size);
 
-        u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
+        u32 resource_slot = next_resource_slot();
         cmd.resource_slot = resource_slot;
 
         add_cmd(cmd);
@@ -1087,7 +1779,7 @@ namespace pen
             memcpy(cmd.create_buffer.data, params.data, params.buffer_size);
         }
 
-        u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
+        u32 resource_slot = next_resource_slot();
         cmd.resource_slot = resource_slot;
 
         add_cmd(cmd);
@@ -1191,7 +1883,7 @@ namespace pen
 
         memcpy(&cmd.create_render_target, (void*)&tcp, sizeof(texture_creation_params));
 
-        u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
+        u32 resource_slot = next_resource_slot();
         cmd.resource_slot = resource_slot;
 
         add_cmd(cmd);
@@ -1230,7 +1922,7 @@ namespace pen
             cmd.create_texture.data = nullptr;
         }
 
-        u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
+        u32 resource_slot = next_resource_slot();
         cmd.resource_slot = resource_slot;
 
         add_cmd(cmd);
@@ -1246,7 +1938,7 @@ namespace pen
 
         memcpy(&cmd.create_sampler, (void*)&scp, sizeof(sampler_creation_params));
 
-        u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
+        u32 resource_slot = next_resource_slot();
         cmd.resource_slot = resource_slot;
 
         add_cmd(cmd);
@@ -1276,7 +1968,7 @@ namespace pen
 
         memcpy(&cmd.create_raster_state, (void*)&rscp, sizeof(raster_state_creation_params));
 
-        u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
+        u32 resource_slot = next_resource_slot();
         cmd.resource_slot = resource_slot;
 
         add_cmd(cmd);
@@ -1284,85 +1976,339 @@ namespace pen
         return resource_slot;
     }
 
-    void renderer_set_raster_state(u32 rasterizer_state_index)
+    void renderer_set_raster_state(u32 rasterizer_state_index)
+    {
+        renderer_cmd cmd;
+
+        cmd.command_index = CMD_SET_RASTER_STATE;
+
+        cmd.command_data_index = rasterizer_state_index;
+
+        add_cmd(cmd);
+    }
+
+    void renderer_set_viewport(const viewport& vp)
+    {
+        renderer_cmd cmd;
+        cmd.command_index = CMD_SET_VIEWPORT;
+        memcpy(&cmd.set_viewport, (void*)&vp, sizeof(viewport));
+        add_cmd(cmd);
+    }
+
+    void renderer_set_scissor_rect(const rect& r)
+    {
+        renderer_cmd cmd;
+        cmd.command_index = CMD_SET_SCISSOR_RECT;
+        memcpy(&cmd.set_rect, (void*)&r, sizeof(rect));
+        add_cmd(cmd);
+    }
+
+    void renderer_set_viewport_ratio(const viewport& vp)
+    {
+        renderer_cmd cmd;
+        cmd.command_index = CMD_SET_VIEWPORT_RATIO;
+        memcpy(&cmd.set_viewport, (void*)&vp, sizeof(viewport));
+        add_cmd(cmd);
+    }
+
+    void renderer_set_scissor_rect_ratio(const rect& r)
+    {
+        renderer_cmd cmd;
+        cmd.command_index = CMD_SET_SCISSOR_RECT_RATIO;
+        memcpy(&cmd.set_rect, (void*)&r, sizeof(rect));
+        add_cmd(cmd);
+    }
+
+    u32 renderer_create_blend_state(const blend_creation_params& bcp)
+    {
+        renderer_cmd cmd;
+
+        cmd.command_index = CMD_CREATE_BLEND_STATE;
+
+        memcpy(&cmd.create_blend_state, (void*)&bcp, sizeof(blend_creation_params));
+
+        // alloc and copy the render targets blend modes. to save space in the cmd buffer
+        u32   render_target_modes_size = sizeof(render_target_blend) * bcp.num_render_targets;
+        void* mem = memory_alloc(render_target_modes_size);
+        cmd.create_blend_state.render_targets = (render_target_blend*)mem;
+
+        memcpy(cmd.create_blend_state.render_targets, (void*)bcp.render_targets, render_target_modes_size);
+
+        u32 resource_slot = next_resource_slot();
+        cmd.resource_slot = resource_slot;
+
+        add_cmd(cmd);
+
+        return resource_slot;
+    }
+
+    void renderer_set_blend_state(u32 blend_state_index)
+    {
+        renderer_cmd cmd;
+
+        cmd.command_index = CMD_SET_BLEND_STATE;
+
+        cmd.command_data_index = blend_state_index;
+
+        add_cmd(cmd);
+    }
+
+    void dynamic_cbuffer_flush(u32 buffer_index)
+    {
+        dynamic_cbuffer_ring& ring = s_dynamic_cbuffers;
+
+        // allocations with a buffer each are all submitted, d3d discards on an update at offset 0
+        for (u32 i = ring.flushed_discards; i < ring.num_discards; ++i)
+        {
+            dynamic_cbuffer_discard& d = ring.discards[i];
+
+            renderer_cmd cmd;
+            cmd.command_index = CMD_UPDATE_BUFFER_NO_OVERWRITE;
+            cmd.update_buffer.buffer_index = d.handle;
+            cmd.update_buffer.data = d.data;
+            cmd.update_buffer.data_size = d.data_size;
+            cmd.update_buffer.offset = 0;
+            add_cmd(cmd);
+        }
+        ring.flushed_discards = ring.num_discards;
+
+        // submit everything allocated from the chunk so far in one update, or from every chunk for an invalid handle
+        bool unflushed = false;
+        u32  num_chunks = sb_count(ring.chunks);
+        for (u32 i = 0; i < num_chunks; ++i)
+        {
+            dynamic_cbuffer_chunk& c = ring.chunks[i];
+            if (!is_valid(c.handle))
+            {
+                c.flushed = c.pos;
+                continue;
+            }
+
+            if ((c.handle == buffer_index || !is_valid(buffer_index)) && c.pos > c.flushed)
+            {
+                renderer_cmd cmd;
+                cmd.command_index = CMD_UPDATE_BUFFER_NO_OVERWRITE;
+                cmd.update_buffer.buffer_index = c.handle;
+                cmd.update_buffer.data = c.cpu + ring.region * k_dynamic_cbuffer_chunk_size + c.flushed;
+                cmd.update_buffer.data_size = c.pos - c.flushed;
+                cmd.update_buffer.offset = c.flushed;
+                add_cmd(cmd);
+
+                c.flushed = c.pos;
+            }
+
+            unflushed |= c.pos > c.flushed;
+        }
+
+        ring.unflushed = unflushed;
+    }
+
+    void dynamic_cbuffer_new_frame()
+    {
+        dynamic_cbuffer_ring& ring = s_dynamic_cbuffers;
+
+        u32 num_chunks = sb_count(ring.chunks);
+        for (u32 i = 0; i < num_chunks; ++i)
+        {
+            ring.chunks[i].pos = 0;
+            ring.chunks[i].flushed = 0;
+        }
+
+        ring.chunk = 0;
+        ring.region = (ring.region + 1) % k_dynamic_cbuffer_frames;
+        ring.num_discards = 0;
+        ring.flushed_discards = 0;
+        ring.unflushed = false;
+    }
+
+    dynamic_cbuffer renderer_alloc_dynamic_cbuffer(u32 size)
+    {
+        PEN_ASSERT(size > 0 && size <= k_dynamic_cbuffer_range);
+
+        dynamic_cbuffer_ring& ring = s_dynamic_cbuffers;
+
+        u32 aligned_size = (size + k_dynamic_cbuffer_align - 1) & ~(k_dynamic_cbuffer_align - 1);
+
+        if (ring.offsets == -1)
+            ring.offsets = (renderer_get_info().caps & PEN_CAPS_CONSTANT_BUFFER_OFFSET) ? 1 : 0;
+
+        bool locked = cmd_list_lock();
+        for (;;)
+        {
+            u32 num_chunks = sb_count(ring.chunks);
+            if (ring.chunk < num_chunks && ring.chunks[ring.chunk].pos + aligned_size > k_dynamic_cbuffer_chunk_size)
+                ring.chunk++;
+
+            if (ring.chunk < num_chunks)
+                break;
+
+            // creating takes the lock, another recording thread may add a chunk meanwhile which is fine to keep
+            cmd_list_unlock(locked);
+
+            buffer_creation_params bcp;
+            bcp.usage_flags = PEN_USAGE_DYNAMIC;
+            bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
+            bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
+            bcp.buffer_size = k_dynamic_cbuffer_chunk_size + k_dynamic_cbuffer_range;
+            bcp.stride = 0;
+            bcp.data = nullptr;
+
+            dynamic_cbuffer_chunk c;
+            c.handle = ring.offsets ? renderer_create_buffer(bcp) : PEN_INVALID_HANDLE;
+            c.pos = 0;
+            c.flushed = 0;
+            c.cpu = (u8*)memory_alloc(k_dynamic_cbuffer_chunk_size * k_dynamic_cbuffer_frames);
+
+            locked = cmd_list_lock();
+            sb_push(ring.chunks, c);
+        }
+
+        dynamic_cbuffer_chunk& c = ring.chunks[ring.chunk];
+
+        dynamic_cbuffer dcb;
+        dcb.handle = c.handle;
+        dcb.offset = c.pos;
+        dcb.cpu_ptr = c.cpu + ring.region * k_dynamic_cbuffer_chunk_size + c.pos;
+
+        c.pos += aligned_size;
+        ring.unflushed = true;
+
+        if (ring.offsets)
+        {
+            cmd_list_unlock(locked);
+            return dcb;
+        }
+
+        // whole buffer fallback, grow the buffer at this position in the frame if it is too small
+        u32 di = ring.num_discards++;
+        if (di == (u32)sb_count(ring.discards))
+        {
+            dynamic_cbuffer_discard d = {PEN_INVALID_HANDLE, 0, nullptr, 0};
+            sb_push(ring.discards, d);
+        }
+
+        ring.discards[di].data = (u8*)dcb.cpu_ptr;
+        ring.discards[di].data_size = size;
+
+        u32 handle = ring.discards[di].handle;
+        if (ring.discards[di].size < aligned_size)
+        {
+            cmd_list_unlock(locked);
+
+            if (is_valid(handle))
+                renderer_release_buffer(handle);
+
+            buffer_creation_params bcp;
+            bcp.usage_flags = PEN_USAGE_DYNAMIC;
+            bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
+            bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
+            bcp.buffer_size = aligned_size;
+            bcp.stride = 0;
+            bcp.data = nullptr;
+            handle = renderer_create_buffer(bcp);
+
+            locked = cmd_list_lock();
+            ring.discards[di].handle = handle;
+            ring.discards[di].size = aligned_size;
+        }
+
+        cmd_list_unlock(locked);
+
+        dcb.handle = handle;
+        dcb.offset = 0;
+        return dcb;
+    }
+
+    u32 renderer_create_cmd_list()
     {
-        renderer_cmd cmd;
+        PEN_ASSERT(s_cmd_lists.recording == 0);
 
-        cmd.command_index = CMD_SET_RASTER_STATE;
+        if (!s_cmd_lists.lock)
+            s_cmd_lists.lock = pen::mutex_create();
 
-        cmd.command_data_index = rasterizer_state_index;
+        u32 index;
+        if (sb_count(s_cmd_lists.free_lists))
+        {
+            index = sb_last(s_cmd_lists.free_lists);
+            stb__sbn(s_cmd_lists.free_lists)--;
+        }
+        else
+        {
+            cmd_list cl;
+            sb_push(s_cmd_lists.lists, cl);
+            index = sb_count(s_cmd_lists.lists) - 1;
+        }
 
-        add_cmd(cmd);
+        s_cmd_lists.lists[index].alive = true;
+        return index;
     }
 
-    void renderer_set_viewport(const viewport& vp)
+    void renderer_release_cmd_list(u32 cmd_list)
     {
-        renderer_cmd cmd;
-        cmd.command_index = CMD_SET_VIEWPORT;
-        memcpy(&cmd.set_viewport, (void*)&vp, sizeof(viewport));
-        add_cmd(cmd);
-    }
+        PEN_ASSERT(s_cmd_lists.recording == 0);
 
-    void renderer_set_scissor_rect(const rect& r)
-    {
-        renderer_cmd cmd;
-        cmd.command_index = CMD_SET_SCISSOR_RECT;
-        memcpy(&cmd.set_rect, (void*)&r, sizeof(rect));
-        add_cmd(cmd);
+        auto& cl = s_cmd_lists.lists[cmd_list];
+        sb_free(cl.cmds);
+        cl.cmds = nullptr;
+        cl.alive = false;
+
+        sb_push(s_cmd_lists.free_lists, cmd_list);
     }
 
-    void renderer_set_viewport_ratio(const viewport& vp)
+    void renderer_begin_cmd_list(u32 cmd_list)
     {
-        renderer_cmd cmd;
-        cmd.command_index = CMD_SET_VIEWPORT_RATIO;
-        memcpy(&cmd.set_viewport, (void*)&vp, sizeof(viewport));
-        add_cmd(cmd);
+        auto& cl = s_cmd_lists.lists[cmd_list];
+        PEN_ASSERT(cl.alive);
+
+        // keep the allocation, lists record a similar amount each frame
+        if (cl.cmds)
+            stb__sbn(cl.cmds) = 0;
+
+#if !PEN_SINGLE_THREADED
+        PEN_ASSERT(!cmd_list_bound());
+        t_cmd_list = cmd_list;
+        s_cmd_lists.recording++;
+#endif
     }
 
-    void renderer_set_scissor_rect_ratio(const rect& r)
+    void renderer_end_cmd_list()
     {
-        renderer_cmd cmd;
-        cmd.command_index = CMD_SET_SCISSOR_RECT_RATIO;
-        memcpy(&cmd.set_rect, (void*)&r, sizeof(rect));
-        add_cmd(cmd);
+#if !PEN_SINGLE_THREADED
+        PEN_ASSERT(cmd_list_bound());
+        t_cmd_list = PEN_INVALID_HANDLE;
+        s_cmd_lists.recording--;
+#endif
     }
 
-    u32 renderer_create_blend_state(const blend_creation_params& bcp)
+    void renderer_submit_cmd_list(u32 cmd_list)
     {
-        renderer_cmd cmd;
-
-        cmd.command_index = CMD_CREATE_BLEND_STATE;
-
-        memcpy(&cmd.create_blend_state, (void*)&bcp, sizeof(blend_creation_params));
+        // single threaded builds execute commands as they are recorded, so lists are always empty
+        PEN_ASSERT(s_cmd_lists.recording == 0);
 
-        // alloc and copy the render targets blend modes. to save space in the cmd buffer
-        u32   render_target_modes_size = sizeof(render_target_blend) * bcp.num_render_targets;
-        void* mem = memory_alloc(render_target_modes_size);
-        cmd.create_blend_state.render_targets = (render_target_blend*)mem;
+        auto& cl = s_cmd_lists.lists[cmd_list];
+        u32   num_cmds = sb_count(cl.cmds);
+        if (num_cmds == 0)
+            return;
 
-        memcpy(cmd.create_blend_state.render_targets, (void*)bcp.render_targets, render_target_modes_size);
+        // per draw constants written while recording
+        if (s_dynamic_cbuffers.unflushed)
+            dynamic_cbuffer_flush(PEN_INVALID_HANDLE);
 
-        u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
-        cmd.resource_slot = resource_slot;
+        for (u32 i = 0; i < num_cmds; ++i)
+            add_cmd(cl.cmds[i]);
 
-        add_cmd(cmd);
+        stb__sbn(cl.cmds) = 0;
 
-        return resource_slot;
+        s_stats.cmd_lists_submitted++;
+        s_stats.cmd_list_commands += num_cmds;
     }
 
-    void renderer_set_blend_state(u32 blend_state_index)
+    void renderer_set_constant_buffer(u32 buffer_index, u32 unit, u32 flags, u32 offset)
     {
-        renderer_cmd cmd;
+        // recorded lists are flushed on submit, when every thread has finished writing
+        if (s_dynamic_cbuffers.unflushed && !cmd_list_bound())
+            dynamic_cbuffer_flush(buffer_index);
 
-        cmd.command_index = CMD_SET_BLEND_STATE;
-
-        cmd.command_data_index = blend_state_index;
-
-        add_cmd(cmd);
-    }
-
-    void renderer_set_constant_buffer(u32 buffer_index, u32 unit, u32 flags)
-    {
         renderer_cmd cmd;
 
         cmd.command_index = CMD_SET_CONSTANT_BUFFER;
@@ -1370,6 +2316,7 @@ namespace pen
         cmd.set_buffer.buffer_index = buffer_index;
         cmd.set_buffer.unit = unit;
         cmd.set_buffer.flags = flags;
+        cmd.set_buffer.offset = offset;
 
         add_cmd(cmd);
     }
@@ -1383,6 +2330,7 @@ namespace pen
         cmd.set_buffer.buffer_index = buffer_index;
         cmd.set_buffer.unit = unit;
         cmd.set_buffer.flags = flags;
+        cmd.set_buffer.offset = 0;
 
         add_cmd(cmd);
     }
@@ -1416,7 +2364,7 @@ namespace pen
 
         memcpy(cmd.p_create_depth_stencil_state, &dscp, sizeof(depth_stencil_creation_params));
 
-        u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
+        u32 resource_slot = next_resource_slot();
         cmd.resource_slot = resource_slot;
 
         add_cmd(cmd);
@@ -1466,12 +2414,11 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RELEASE_SHADER;
-        cmd.frame_index = pen::_renderer_frame_index();
         cmd.resource_slot = shader_index;
         cmd.set_shader.shader_index = shader_index;
         cmd.set_shader.shader_type = shader_type;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_release_buffer(u32 buffer_index)
@@ -1479,11 +2426,10 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RELEASE_BUFFER;
-        cmd.frame_index = pen::_renderer_frame_index();
         cmd.resource_slot = buffer_index;
         cmd.command_data_index = buffer_index;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_release_texture(u32 texture_index)
@@ -1493,9 +2439,8 @@ namespace pen
         cmd.command_index = CMD_RELEASE_TEXTURE_2D;
         cmd.resource_slot = texture_index;
         cmd.command_data_index = texture_index;
-        cmd.frame_index = pen::_renderer_frame_index();
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_release_blend_state(u32 blend_state)
@@ -1503,11 +2448,10 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RELEASE_BLEND_STATE;
-        cmd.frame_index = pen::_renderer_frame_index();
         cmd.resource_slot = blend_state;
         cmd.command_data_index = blend_state;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_release_render_target(u32 render_target)
@@ -1515,11 +2459,10 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RELEASE_RENDER_TARGET;
-        cmd.frame_index = pen::_renderer_frame_index();
         cmd.resource_slot = render_target;
         cmd.command_data_index = render_target;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_release_clear_state(u32 clear_state)
@@ -1527,11 +2470,10 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RELEASE_CLEAR_STATE;
-        cmd.frame_index = pen::_renderer_frame_index();
         cmd.resource_slot = clear_state;
         cmd.command_data_index = clear_state;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_release_input_layout(u32 input_layout)
@@ -1539,11 +2481,10 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RELEASE_INPUT_LAYOUT;
-        cmd.frame_index = pen::_renderer_frame_index();
         cmd.resource_slot = input_layout;
         cmd.command_data_index = input_layout;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_release_sampler(u32 sampler)
@@ -1551,11 +2492,10 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RELEASE_SAMPLER;
-        cmd.frame_index = pen::_renderer_frame_index();
         cmd.resource_slot = sampler;
         cmd.command_data_index = sampler;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_release_depth_stencil_state(u32 depth_stencil_state)
@@ -1563,11 +2503,10 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RELEASE_DEPTH_STENCIL_STATE;
-        cmd.frame_index = pen::_renderer_frame_index();
         cmd.resource_slot = depth_stencil_state;
         cmd.command_data_index = depth_stencil_state;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_release_raster_state(u32 raster_state_index)
@@ -1578,7 +2517,7 @@ namespace pen
         cmd.resource_slot = raster_state_index;
         cmd.command_data_index = raster_state_index;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_cmd(cmd);
     }
 
     void renderer_set_stream_out_target(u32 buffer_index)
@@ -1649,7 +2588,7 @@ namespace pen
     {
         renderer_cmd cmd;
 
-        u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
+        u32 resource_slot = next_resource_slot();
 
         cmd.command_index = CMD_CREATE_CLEAR_STATE;
         cmd.clear_state_params = cs;
@@ -1678,7 +2617,7 @@ namespace pen
 
         // make copy of string to be able to use temporaries
         u32 len = string_length(name);
-        cmd.name = (c8*)memory_alloc(len);
+        cmd.name = (c8*)memory_alloc(len + 1);
         memcpy(cmd.name, name, len);
         cmd.name[len] = '\0';
 
@@ -1693,4 +2632,380 @@ namespace pen
 
         add_cmd(cmd);
     }
+
+    //
+    // command stream capture and replay
+    //
+
+    void renderer_capture_enable(const c8* filename, u32 start_frame, u32 num_frames)
+    {
+        s_capture.filename = filename;
+        s_capture.start_frame = start_frame;
+        s_capture.num_frames = std::max<u32>(num_frames, 1);
+
+        // before init the capture is armed and begins once the renderers own resources are created
+        if (!_ctx)
+        {
+            s_capture.armed = true;
+            return;
+        }
+
+        renderer_cmd cmd;
+        cmd.command_index = CMD_BEGIN_CAPTURE;
+        add_cmd(cmd);
+    }
+
+    void renderer_capture_parse_args(s32 argc, c8** argv)
+    {
+        const c8* filename = nullptr;
+        u32       start_frame = 0;
+        u32       num_frames = 1;
+
+        for (s32 i = 1; i + 1 < argc; ++i)
+        {
+            if (strcmp(argv[i], "-capture") == 0)
+                filename = argv[i + 1];
+            else if (strcmp(argv[i], "-capture_start") == 0)
+                start_frame = atoi(argv[i + 1]);
+            else if (strcmp(argv[i], "-capture_frames") == 0)
+                num_frames = atoi(argv[i + 1]);
+        }
+
+        if (filename)
+            renderer_capture_enable(filename, start_frame, num_frames);
+    }
+
+    const u8* replay_blob(const u8*& p, u32& size)
+    {
+        memcpy(&size, p, sizeof(u32));
+        p += sizeof(u32);
+
+        const u8* data = size ? p : nullptr;
+        p += size;
+        return data;
+    }
+
+    void* replay_blob_copy(const u8*& p)
+    {
+        // exec_cmd frees payloads, so each replayed command gets its own copy
+        u32       size = 0;
+        const u8* data = replay_blob(p, size);
+        if (!data)
+            return nullptr;
+
+        void* copy = memory_alloc(size);
+        memcpy(copy, data, size);
+        return copy;
+    }
+
+    c8* replay_string(const u8*& p)
+    {
+        // strings the backends do not free point into the capture data, valid until renderer_replay_close
+        u32 size = 0;
+        return (c8*)replay_blob(p, size);
+    }
+
+    void replay_payload(renderer_cmd& cmd, const u8* p)
+    {
+        switch (cmd.command_index)
+        {
+            case CMD_LOAD_SHADER:
+            {
+                shader_load_params& slp = cmd.shader_load;
+                slp.byte_code = replay_blob_copy(p);
+                slp.so_decl_entries = (stream_out_decl_entry*)replay_blob_copy(p);
+                if (slp.so_decl_entries)
+                    for (u32 i = 0; i < slp.so_num_entries; ++i)
+                        slp.so_decl_entries[i].semantic_name = replay_string(p);
+            }
+            break;
+
+            case CMD_LINK_SHADER:
+            {
+                shader_link_params& slp = cmd.link_params;
+                slp.constants = (constant_layout_desc*)replay_blob_copy(p);
+                for (u32 i = 0; i < slp.num_constants; ++i)
+                    slp.constants[i].name = (c8*)replay_blob_copy(p);
+
+                u32 num_so = 0;
+                memcpy(&num_so, p, sizeof(u32));
+                p += sizeof(u32);
+
+                slp.stream_out_names = nullptr;
+                if (num_so)
+                {
+                    slp.stream_out_names = (c8**)memory_alloc(sizeof(c8*) * num_so);
+                    for (u32 i = 0; i < num_so; ++i)
+                        slp.stream_out_names[i] = (c8*)replay_blob_copy(p);
+                }
+            }
+            break;
+
+            case CMD_CREATE_INPUT_LAYOUT:
+            {
+                input_layout_creation_params& ilp = cmd.create_input_layout;
+                ilp.vs_byte_code = replay_blob_copy(p);
+                ilp.input_layout = (input_layout_desc*)replay_blob_copy(p);
+                for (u32 i = 0; i < ilp.num_elements; ++i)
+                    ilp.input_layout[i].semantic_name = replay_string(p);
+            }
+            break;
+
+            case CMD_CREATE_BUFFER:
+                cmd.create_buffer.data = replay_blob_copy(p);
+                break;
+
+            case CMD_SET_VERTEX_BUFFER:
+                cmd.set_vertex_buffer.buffer_indices = (u32*)replay_blob_copy(p);
+                cmd.set_vertex_buffer.strides = (u32*)replay_blob_copy(p);
+                cmd.set_vertex_buffer.offsets = (u32*)replay_blob_copy(p);
+                break;
+
+            case CMD_CREATE_TEXTURE:
+                cmd.create_texture.data = replay_blob_copy(p);
+                break;
+
+            case CMD_CREATE_RENDER_TARGET:
+                cmd.create_render_target.data = nullptr;
+                break;
+
+            case CMD_CREATE_BLEND_STATE:
+                cmd.create_blend_state.render_targets = (render_target_blend*)replay_blob_copy(p);
+                break;
+
+            case CMD_UPDATE_BUFFER:
+                cmd.update_buffer.data = replay_blob_copy(p);
+                break;
+
+            case CMD_UPDATE_BUFFER_NO_OVERWRITE:
+            {
+                // not freed by exec_cmd, point into the capture data
+                u32 size = 0;
+                cmd.update_buffer.data = (void*)replay_blob(p, size);
+            }
+            break;
+
+            case CMD_CREATE_DEPTH_STENCIL_STATE:
+                cmd.p_create_depth_stencil_state = (depth_stencil_creation_params*)replay_blob_copy(p);
+                break;
+
+            case CMD_PUSH_PERF_MARKER:
+                cmd.name = replay_string(p);
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    bool renderer_replay_open(const c8* filename, capture_info& info)
+    {
+        renderer_replay_close();
+
+        void* data = nullptr;
+        u32   size = 0;
+        if (filesystem_read_file_to_buffer(filename, &data, size) != PEN_ERR_OK)
+        {
+            PEN_LOG("[error] replay: failed to read %s\n", filename);
+            return false;
+        }
+
+        s_replay.data = (u8*)data;
+
+        bool valid = size >= sizeof(capture_header);
+        if (valid)
+        {
+            memcpy(&s_replay.header, data, sizeof(capture_header));
+            valid = s_replay.header.magic == k_capture_magic && s_replay.header.version == k_capture_version &&
+                    s_replay.header.cmd_size == sizeof(renderer_cmd);
+        }
+
+        if (!valid)
+        {
+            PEN_LOG("[error] replay: %s is not a capture from a compatible build\n", filename);
+            renderer_replay_close();
+            return false;
+        }
+
+        // index records and split frames at present, the partial frame of an interrupted capture is dropped
+        sb_push(s_replay.frames, 0);
+
+        u32 pos = sizeof(capture_header);
+        while (pos + sizeof(capture_record) <= size)
+        {
+            capture_record rec;
+            memcpy(&rec, s_replay.data + pos, sizeof(capture_record));
+            if (pos + sizeof(capture_record) + rec.size > size)
+                break;
+
+            sb_push(s_replay.records, pos);
+            pos += sizeof(capture_record) + rec.size;
+
+            if (rec.command_index == CMD_PRESENT)
+                sb_push(s_replay.frames, sb_count(s_replay.records));
+        }
+
+        info.num_frames = sb_count(s_replay.frames) - 1;
+        info.start_frame = std::min<u32>(s_replay.header.start_frame, info.num_frames);
+        info.width = s_replay.header.width;
+        info.height = s_replay.header.height;
+
+        return info.num_frames > 0;
+    }
+
+    f64 renderer_replay_frame_time_ms(u32 frame)
+    {
+        PEN_ASSERT(frame + 1 < (u32)sb_count(s_replay.frames));
+
+        capture_record rec;
+        u32            last = s_replay.frames[frame + 1] - 1;
+        memcpy(&rec, s_replay.data + s_replay.records[last], sizeof(capture_record));
+        return rec.time_ms;
+    }
+
+    // frames from start_frame on are looped, resources they create are recreated with the same handles each loop
+    void replay_track_resource(const renderer_cmd& cmd)
+    {
+        u32 release_cmd = 0;
+        u32 release_slot = 0;
+        switch (cmd.command_index)
+        {
+            case CMD_LOAD_SHADER:
+                release_cmd = CMD_RELEASE_SHADER;
+                break;
+            case CMD_CREATE_INPUT_LAYOUT:
+                release_cmd = CMD_RELEASE_INPUT_LAYOUT;
+                break;
+            case CMD_CREATE_BUFFER:
+                release_cmd = CMD_RELEASE_BUFFER;
+                break;
+            case CMD_CREATE_TEXTURE:
+                release_cmd = CMD_RELEASE_TEXTURE_2D;
+                break;
+            case CMD_CREATE_SAMPLER:
+                release_cmd = CMD_RELEASE_SAMPLER;
+                break;
+            case CMD_CREATE_RASTER_STATE:
+                release_cmd = CMD_RELEASE_RASTER_STATE;
+                break;
+            case CMD_CREATE_BLEND_STATE:
+                release_cmd = CMD_RELEASE_BLEND_STATE;
+                break;
+            case CMD_CREATE_DEPTH_STENCIL_STATE:
+                release_cmd = CMD_RELEASE_DEPTH_STENCIL_STATE;
+                break;
+            case CMD_CREATE_RENDER_TARGET:
+                release_cmd = CMD_RELEASE_RENDER_TARGET;
+                break;
+            case CMD_CREATE_CLEAR_STATE:
+                release_cmd = CMD_RELEASE_CLEAR_STATE;
+                break;
+            case CMD_REPLACE_RESOURCE:
+                release_slot = cmd.replace_resource_params.src_handle;
+                break;
+            case CMD_RELEASE_SHADER:
+            case CMD_RELEASE_BUFFER:
+            case CMD_RELEASE_TEXTURE_2D:
+            case CMD_RELEASE_RASTER_STATE:
+            case CMD_RELEASE_BLEND_STATE:
+            case CMD_RELEASE_CLEAR_STATE:
+            case CMD_RELEASE_RENDER_TARGET:
+            case CMD_RELEASE_INPUT_LAYOUT:
+            case CMD_RELEASE_SAMPLER:
+            case CMD_RELEASE_DEPTH_STENCIL_STATE:
+                release_slot = cmd.resource_slot;
+                break;
+            default:
+                return;
+        }
+
+        if (release_cmd)
+        {
+            replay_resource rr;
+            rr.slot = cmd.resource_slot;
+            rr.release_cmd = release_cmd;
+            rr.shader_type = release_cmd == CMD_RELEASE_SHADER ? cmd.shader_load.type : 0;
+            sb_push(s_replay.resources, rr);
+            return;
+        }
+
+        // released by the captured frames already
+        u32 num = sb_count(s_replay.resources);
+        for (u32 i = 0; i < num; ++i)
+        {
+            if (s_replay.resources[i].slot != release_slot)
+                continue;
+
+            s_replay.resources[i] = s_replay.resources[num - 1];
+            stb__sbn(s_replay.resources)--;
+            break;
+        }
+    }
+
+    u32 renderer_replay_frame(u32 frame)
+    {
+        PEN_ASSERT(frame + 1 < (u32)sb_count(s_replay.frames));
+
+        u32 start = s_replay.frames[frame];
+        u32 end = s_replay.frames[frame + 1];
+        for (u32 i = start; i < end; ++i)
+        {
+            const u8* p = s_replay.data + s_replay.records[i] + sizeof(capture_record);
+
+            renderer_cmd cmd;
+            memcpy(&cmd, p, sizeof(renderer_cmd));
+            replay_payload(cmd, p + sizeof(renderer_cmd));
+
+            // latency is measured in this process
+            if (cmd.command_index == CMD_PRESENT)
+                cmd.frame_start_ms = _ctx->frame_start_ms;
+
+            if (frame >= s_replay.header.start_frame)
+                replay_track_resource(cmd);
+
+            add_cmd(cmd);
+        }
+
+        return end - start;
+    }
+
+    void renderer_replay_end_loop()
+    {
+        u32 num = sb_count(s_replay.resources);
+        for (u32 i = 0; i < num; ++i)
+        {
+            const replay_resource& rr = s_replay.resources[i];
+
+            renderer_cmd cmd;
+            cmd.command_index = rr.release_cmd;
+            cmd.resource_slot = rr.slot;
+            cmd.command_data_index = rr.slot;
+
+            if (rr.release_cmd == CMD_RELEASE_SHADER)
+            {
+                cmd.set_shader.shader_index = rr.slot;
+                cmd.set_shader.shader_type = rr.shader_type;
+            }
+
+            add_cmd(cmd);
+        }
+
+        if (s_replay.resources)
+            stb__sbn(s_replay.resources) = 0;
+    }
+
+    void renderer_replay_close()
+    {
+        memory_free(s_replay.data);
+        s_replay.data = nullptr;
+
+        sb_free(s_replay.records);
+        s_replay.records = nullptr;
+
+        sb_free(s_replay.frames);
+        s_replay.frames = nullptr;
+
+        sb_free(s_replay.resources);
+        s_replay.resources = nullptr;
+    }
 } // namespace pen
@@ -24,6 +24,7 @@ namespace
         managed_rt*                  managed_rts = nullptr;
         u32                          flags = 0;
         a_u64                        frame_index = {0};
+        a_u64                        completed_frame_index = {0};
         a_u64                        resize_index = {0};
         a_u8                         resized = {0};
         pen::stretchy_dynamic_buffer dynamic_cbuffer;
@@ -181,6 +182,26 @@ namespace pen
         return pen_atomic_load(s_shared_ctx.frame_index);
     }
 
+    u64 _renderer_completed_frame_index()
+    {
+        return pen_atomic_load(s_shared_ctx.completed_frame_index);
+    }
+
+    void _renderer_frame_completed(u64 frame_index)
+    {
+        // completion can be reported from driver threads, keep the latest
+#if PEN_SINGLE_THREADED
+        s_shared_ctx.completed_frame_index = std::max<u64>(s_shared_ctx.completed_frame_index, frame_index + 1);
+#else
+        u64 completed = pen_atomic_load(s_shared_ctx.completed_frame_index);
+        while (completed < frame_index + 1)
+        {
+            if (s_shared_ctx.completed_frame_index.compare_exchange_weak(completed, frame_index + 1))
+                break;
+        }
+#endif
+    }
+
     u64 _renderer_resize_index()
     {
         return pen_atomic_load(s_shared_ctx.resize_index);
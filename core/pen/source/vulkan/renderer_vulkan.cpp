@@ -4,15 +4,21 @@
 
 #include "console.h"
 #include "data_struct.h"
+#include "file_system.h"
 #include "hash.h"
+#include "os.h"
 #include "renderer.h"
 #include "renderer_shared.h"
+#include "renderer_vulkan.h"
 
 #include "vulkan/vulkan.h"
 #ifdef _WIN32
 #include "vulkan/vulkan_win32.h"
 #endif
 
+#include <stdio.h>
+#include <unordered_map>
+
 #define CHECK_CALL(C)                                                                                                        \
     {                                                                                                                        \
         VkResult r = (C);                                                                                                    \
@@ -25,6 +31,7 @@ using namespace pen;
 
 #define NBB 3                          // num "back buffers" / swap chains / inflight command buffers
 #define GLSL_TEXTURE_BINDING_OFFSET 32 // set in pmfx shader, d3d style register(t0) binds to 32+
+#define MAX_BINDING_SLOTS 128          // cbuffers 0-31, textures 32+
 
 namespace
 {
@@ -186,6 +193,7 @@ namespace
             case PEN_TEX_FORMAT_BC3_UNORM:
             case PEN_TEX_FORMAT_BC4_UNORM:
             case PEN_TEX_FORMAT_BC5_UNORM:
+            case PEN_TEX_FORMAT_BC7_UNORM:
                 return true;
         }
         return false;
@@ -363,6 +371,8 @@ namespace
                 return VK_FORMAT_BC4_UNORM_BLOCK;
             case PEN_TEX_FORMAT_BC5_UNORM:
                 return VK_FORMAT_BC5_UNORM_BLOCK;
+            case PEN_TEX_FORMAT_BC7_UNORM:
+                return VK_FORMAT_BC7_UNORM_BLOCK;
             case PEN_TEX_FORMAT_D24_UNORM_S8_UINT:
                 return VK_FORMAT_D24_UNORM_S8_UINT;
             case PEN_TEX_FORMAT_D32_FLOAT:
@@ -403,6 +413,7 @@ namespace
         VkImage*                         swap_chain_images = nullptr;
         VkCommandPool                    cmd_pool;
         VkCommandBuffer*                 cmd_bufs = nullptr;
+        VkCommandBuffer*                 cmd_bufs_upload = nullptr;
         VkCommandPool                    cmd_pool_compute;
         VkCommandBuffer*                 cmd_buf_compute = nullptr;
         u32                              ii = 0; // image index 0 - NBB, next = (ii + i) % NBB
@@ -410,12 +421,694 @@ namespace
         VkSemaphore                      sem_render_finished[NBB];
         VkFence                          fences[NBB];
         VkFence                          compute_fences[NBB];
+        u64                              fence_frames[NBB] = {0}; // frame index + 1 submitted with each fence
         VkPhysicalDeviceMemoryProperties mem_properties;
-        VkDescriptorPool                 descriptor_pool[NBB];
+        VkPhysicalDeviceProperties       properties;
+        VkPipelineCache                  pipeline_cache = VK_NULL_HANDLE;
+        VkDescriptorPool                 descriptor_pool;
         u32                              submit_flags = 0;
     };
     vulkan_context _ctx;
 
+    u32 get_mem_type(u32 filter, VkMemoryPropertyFlags properties);
+
+    //
+    // device memory sub allocator
+    //
+
+    // two level segregated fit (tlsf) over large device memory blocks, o(1) allocate and free with eager coalescing.
+    // there is a heap per memory type for linear resources (buffers) and another for optimal images, so neighbouring
+    // resources in a block are always the same kind and bufferImageGranularity never applies.
+    namespace e_vk_mem_pool
+    {
+        enum vk_mem_pool_t
+        {
+            linear,
+            optimal,
+            count
+        };
+    }
+
+    const u32          k_tlsf_sl_log2 = 4;
+    const u32          k_tlsf_sl_count = 1 << k_tlsf_sl_log2;
+    const u32          k_tlsf_small_log2 = 8;
+    const VkDeviceSize k_tlsf_small_size = 1 << k_tlsf_small_log2; // sizes below are linearly spaced in fl 0
+    const u32          k_tlsf_fl_count = 64 - k_tlsf_small_log2 + 1;
+    const VkDeviceSize k_mem_block_size = 64 * 1024 * 1024;
+    const u32          k_mem_null = (u32)-1;
+
+    struct vk_allocation
+    {
+        VkDeviceMemory mem;
+        VkDeviceSize   offset;
+        VkDeviceSize   size;
+        u8*            mapped; // host visible blocks stay mapped for their lifetime, points at offset
+        u32            block;
+        u32            node; // k_mem_null for dedicated allocations
+    };
+
+    struct vk_mem_node
+    {
+        VkDeviceSize offset;
+        VkDeviceSize size;
+        u32          block;
+        u32          prev_phys; // neighbours in the same block
+        u32          next_phys;
+        u32          prev_free; // free list for the size class
+        u32          next_free;
+        bool         free;
+    };
+
+    struct vk_mem_block
+    {
+        VkDeviceMemory mem;
+        VkDeviceSize   size;
+        u8*            mapped;
+        u32            memory_type;
+        u32            pool;
+        u32            num_allocations;
+        bool           dedicated;
+    };
+
+    struct vk_mem_heap
+    {
+        u64 fl_map = 0;
+        u32 sl_map[k_tlsf_fl_count] = {0};
+        u32 heads[k_tlsf_fl_count][k_tlsf_sl_count];
+        u32 num_blocks = 0;
+
+        vk_mem_heap()
+        {
+            for (u32 f = 0; f < k_tlsf_fl_count; ++f)
+                for (u32 s = 0; s < k_tlsf_sl_count; ++s)
+                    heads[f][s] = k_mem_null;
+        }
+    };
+
+    vk_mem_heap         s_mem_heaps[VK_MAX_MEMORY_TYPES][e_vk_mem_pool::count];
+    vk_mem_block*       s_mem_blocks = nullptr;
+    u32*                s_mem_free_blocks = nullptr;
+    vk_mem_node*        s_mem_nodes = nullptr;
+    u32*                s_mem_free_nodes = nullptr;
+    vulkan_memory_stats s_mem_stats;
+
+    u32 msb_index(u64 v)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return 63 - __builtin_clzll(v);
+#else
+        u32 i = 0;
+        while (v >>= 1)
+            ++i;
+        return i;
+#endif
+    }
+
+    u32 lsb_index(u64 v)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctzll(v);
+#else
+        u32 i = 0;
+        while (!(v & 1))
+        {
+            v >>= 1;
+            ++i;
+        }
+        return i;
+#endif
+    }
+
+    void tlsf_mapping(VkDeviceSize size, u32& fl, u32& sl)
+    {
+        if (size < k_tlsf_small_size)
+        {
+            fl = 0;
+            sl = (u32)(size / (k_tlsf_small_size / k_tlsf_sl_count));
+            return;
+        }
+
+        u32 t = msb_index(size);
+        sl = (u32)(size >> (t - k_tlsf_sl_log2)) ^ k_tlsf_sl_count;
+        fl = t - k_tlsf_small_log2 + 1;
+    }
+
+    u32 mem_node_alloc()
+    {
+        if (sb_count(s_mem_free_nodes))
+        {
+            u32 n = sb_last(s_mem_free_nodes);
+            stb__sbn(s_mem_free_nodes)--;
+            return n;
+        }
+
+        sb_push(s_mem_nodes, vk_mem_node());
+        return sb_count(s_mem_nodes) - 1;
+    }
+
+    void tlsf_insert(vk_mem_heap& heap, u32 n)
+    {
+        vk_mem_node& node = s_mem_nodes[n];
+
+        u32 fl, sl;
+        tlsf_mapping(node.size, fl, sl);
+
+        node.free = true;
+        node.prev_free = k_mem_null;
+        node.next_free = heap.heads[fl][sl];
+
+        if (node.next_free != k_mem_null)
+            s_mem_nodes[node.next_free].prev_free = n;
+
+        heap.heads[fl][sl] = n;
+        heap.fl_map |= 1ull << fl;
+        heap.sl_map[fl] |= 1 << sl;
+    }
+
+    void tlsf_remove(vk_mem_heap& heap, u32 n)
+    {
+        vk_mem_node& node = s_mem_nodes[n];
+
+        u32 fl, sl;
+        tlsf_mapping(node.size, fl, sl);
+
+        if (node.prev_free != k_mem_null)
+            s_mem_nodes[node.prev_free].next_free = node.next_free;
+        else
+            heap.heads[fl][sl] = node.next_free;
+
+        if (node.next_free != k_mem_null)
+            s_mem_nodes[node.next_free].prev_free = node.prev_free;
+
+        if (heap.heads[fl][sl] == k_mem_null)
+        {
+            heap.sl_map[fl] &= ~(1 << sl);
+            if (!heap.sl_map[fl])
+                heap.fl_map &= ~(1ull << fl);
+        }
+
+        node.free = false;
+    }
+
+    u32 tlsf_find(vk_mem_heap& heap, VkDeviceSize size)
+    {
+        // round up to the next size class so any node in the list found is large enough
+        if (size >= k_tlsf_small_size)
+            size += (1ull << (msb_index(size) - k_tlsf_sl_log2)) - 1;
+        else
+            size += (k_tlsf_small_size / k_tlsf_sl_count) - 1;
+
+        u32 fl, sl;
+        tlsf_mapping(size, fl, sl);
+
+        if (fl >= k_tlsf_fl_count)
+            return k_mem_null;
+
+        u32 sl_map = heap.sl_map[fl] & (~0u << sl);
+        if (!sl_map)
+        {
+            u64 fl_map = fl + 1 < 64 ? heap.fl_map & (~0ull << (fl + 1)) : 0;
+            if (!fl_map)
+                return k_mem_null;
+
+            fl = lsb_index(fl_map);
+            sl_map = heap.sl_map[fl];
+        }
+
+        return heap.heads[fl][lsb_index(sl_map)];
+    }
+
+    // split the tail of n from size into a new free node
+    void tlsf_split(vk_mem_heap& heap, u32 n, VkDeviceSize size)
+    {
+        u32          r = mem_node_alloc();
+        vk_mem_node& node = s_mem_nodes[n];
+        vk_mem_node& rem = s_mem_nodes[r];
+
+        rem.offset = node.offset + size;
+        rem.size = node.size - size;
+        rem.block = node.block;
+        rem.prev_phys = n;
+        rem.next_phys = node.next_phys;
+
+        if (node.next_phys != k_mem_null)
+            s_mem_nodes[node.next_phys].prev_phys = r;
+
+        node.next_phys = r;
+        node.size = size;
+
+        tlsf_insert(heap, r);
+    }
+
+    // merges b into a, b must follow a physically
+    void tlsf_merge(u32 a, u32 b)
+    {
+        vk_mem_node& na = s_mem_nodes[a];
+        vk_mem_node& nb = s_mem_nodes[b];
+
+        na.size += nb.size;
+        na.next_phys = nb.next_phys;
+
+        if (nb.next_phys != k_mem_null)
+            s_mem_nodes[nb.next_phys].prev_phys = a;
+
+        sb_push(s_mem_free_nodes, b);
+    }
+
+    u32 mem_block_create(u32 memory_type, u32 pool, VkDeviceSize size, bool dedicated)
+    {
+        VkMemoryAllocateInfo alloc_info = {};
+        alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        alloc_info.allocationSize = size;
+        alloc_info.memoryTypeIndex = memory_type;
+
+        VkDeviceMemory mem;
+        if (vkAllocateMemory(_ctx.device, &alloc_info, nullptr, &mem) != VK_SUCCESS)
+            return k_mem_null;
+
+        vk_mem_block block = {};
+        block.mem = mem;
+        block.size = size;
+        block.memory_type = memory_type;
+        block.pool = pool;
+        block.dedicated = dedicated;
+
+        if (_ctx.mem_properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+            CHECK_CALL(vkMapMemory(_ctx.device, mem, 0, VK_WHOLE_SIZE, 0, (void**)&block.mapped));
+
+        u32 b;
+        if (sb_count(s_mem_free_blocks))
+        {
+            b = sb_last(s_mem_free_blocks);
+            stb__sbn(s_mem_free_blocks)--;
+            s_mem_blocks[b] = block;
+        }
+        else
+        {
+            b = sb_count(s_mem_blocks);
+            sb_push(s_mem_blocks, block);
+        }
+
+        s_mem_stats.device_allocations++;
+        s_mem_stats.bytes_reserved += size;
+        s_mem_stats.bytes_reserved_per_type[memory_type] += size;
+
+        if (dedicated)
+        {
+            s_mem_stats.dedicated_allocations++;
+            return b;
+        }
+
+        // the whole block starts as one free node
+        u32          n = mem_node_alloc();
+        vk_mem_node& node = s_mem_nodes[n];
+        node.offset = 0;
+        node.size = size;
+        node.block = b;
+        node.prev_phys = k_mem_null;
+        node.next_phys = k_mem_null;
+
+        vk_mem_heap& heap = s_mem_heaps[memory_type][pool];
+        heap.num_blocks++;
+        tlsf_insert(heap, n);
+
+        return b;
+    }
+
+    void mem_block_destroy(u32 b)
+    {
+        vk_mem_block& block = s_mem_blocks[b];
+
+        if (block.mapped)
+            vkUnmapMemory(_ctx.device, block.mem);
+
+        vkFreeMemory(_ctx.device, block.mem, nullptr);
+
+        s_mem_stats.device_allocations--;
+        s_mem_stats.bytes_reserved -= block.size;
+        s_mem_stats.bytes_reserved_per_type[block.memory_type] -= block.size;
+
+        if (block.dedicated)
+            s_mem_stats.dedicated_allocations--;
+        else
+            s_mem_heaps[block.memory_type][block.pool].num_blocks--;
+
+        block.mem = VK_NULL_HANDLE;
+        sb_push(s_mem_free_blocks, b);
+    }
+
+    vk_allocation mem_alloc(const VkMemoryRequirements& req, VkMemoryPropertyFlags props, u32 pool)
+    {
+        u32 memory_type = get_mem_type(req.memoryTypeBits, props);
+
+        vk_allocation alloc = {};
+        alloc.node = k_mem_null;
+
+        VkDeviceSize size = req.size;
+        VkDeviceSize align = std::max<VkDeviceSize>(req.alignment, 1);
+
+        s_mem_stats.bytes_used += size;
+        s_mem_stats.bytes_used_per_type[memory_type] += size;
+
+        // large resources get their own allocation rather than fragmenting the blocks
+        if (size > k_mem_block_size / 2)
+        {
+            alloc.block = mem_block_create(memory_type, pool, size, true);
+            PEN_ASSERT(alloc.block != k_mem_null);
+
+            vk_mem_block& block = s_mem_blocks[alloc.block];
+            alloc.mem = block.mem;
+            alloc.size = size;
+            alloc.mapped = block.mapped;
+            return alloc;
+        }
+
+        vk_mem_heap& heap = s_mem_heaps[memory_type][pool];
+
+        // worst case padding to reach alignment is align - 1
+        VkDeviceSize search = size + align - 1;
+
+        u32 n = tlsf_find(heap, search);
+        if (n == k_mem_null)
+        {
+            mem_block_create(memory_type, pool, k_mem_block_size, false);
+            n = tlsf_find(heap, search);
+        }
+        PEN_ASSERT(n != k_mem_null);
+
+        tlsf_remove(heap, n);
+
+        // alignment padding at the front goes back in the free lists
+        VkDeviceSize offset = s_mem_nodes[n].offset;
+        VkDeviceSize pad = ((offset + align - 1) & ~(align - 1)) - offset;
+        if (pad)
+        {
+            u32 p = n;
+            tlsf_split(heap, p, pad);
+            n = s_mem_nodes[p].next_phys;
+            tlsf_remove(heap, n);
+            tlsf_insert(heap, p);
+        }
+
+        if (s_mem_nodes[n].size > size)
+            tlsf_split(heap, n, size);
+
+        const vk_mem_node& node = s_mem_nodes[n];
+        vk_mem_block&      block = s_mem_blocks[node.block];
+        block.num_allocations++;
+
+        alloc.mem = block.mem;
+        alloc.offset = node.offset;
+        alloc.size = node.size;
+        alloc.mapped = block.mapped ? block.mapped + node.offset : nullptr;
+        alloc.block = node.block;
+        alloc.node = n;
+
+        s_mem_stats.sub_allocations++;
+
+        return alloc;
+    }
+
+    void mem_free(vk_allocation& alloc)
+    {
+        if (!alloc.mem)
+            return;
+
+        vk_mem_block& block = s_mem_blocks[alloc.block];
+        s_mem_stats.bytes_used -= alloc.size;
+        s_mem_stats.bytes_used_per_type[block.memory_type] -= alloc.size;
+
+        if (block.dedicated)
+        {
+            mem_block_destroy(alloc.block);
+            alloc = {};
+            return;
+        }
+
+        vk_mem_heap& heap = s_mem_heaps[block.memory_type][block.pool];
+        s_mem_stats.sub_allocations--;
+        block.num_allocations--;
+
+        // coalesce with free neighbours
+        u32 n = alloc.node;
+
+        u32 next = s_mem_nodes[n].next_phys;
+        if (next != k_mem_null && s_mem_nodes[next].free)
+        {
+            tlsf_remove(heap, next);
+            tlsf_merge(n, next);
+        }
+
+        u32 prev = s_mem_nodes[n].prev_phys;
+        if (prev != k_mem_null && s_mem_nodes[prev].free)
+        {
+            tlsf_remove(heap, prev);
+            tlsf_merge(prev, n);
+            n = prev;
+        }
+
+        // keep one block per heap around to avoid thrashing on alloc / free
+        if (block.num_allocations == 0 && heap.num_blocks > 1)
+        {
+            sb_push(s_mem_free_nodes, n);
+            mem_block_destroy(alloc.block);
+        }
+        else
+        {
+            tlsf_insert(heap, n);
+        }
+
+        alloc = {};
+    }
+
+    void mem_destroy_all()
+    {
+        u32 num_blocks = sb_count(s_mem_blocks);
+        for (u32 b = 0; b < num_blocks; ++b)
+            if (s_mem_blocks[b].mem)
+                mem_block_destroy(b);
+
+        sb_free(s_mem_blocks);
+        sb_free(s_mem_free_blocks);
+        sb_free(s_mem_nodes);
+        sb_free(s_mem_free_nodes);
+        s_mem_blocks = nullptr;
+        s_mem_free_blocks = nullptr;
+        s_mem_nodes = nullptr;
+        s_mem_free_nodes = nullptr;
+
+        for (u32 t = 0; t < VK_MAX_MEMORY_TYPES; ++t)
+            for (u32 p = 0; p < e_vk_mem_pool::count; ++p)
+                s_mem_heaps[t][p] = vk_mem_heap();
+    }
+
+    //
+    // staging ring
+    //
+
+    // uploads to device local buffers are written into a persistently mapped ring with a segment per frame in flight.
+    // copies are batched into an upload command buffer submitted ahead of the frame's graphics work, so a buffer
+    // created or updated during a frame is ready for every draw in it. uploads which do not fit in the segment get a
+    // temporary staging buffer released when the fence of the frame that copied from it is next waited on. uploads
+    // outside of new_frame / present, such as at start up, always take the temporary path.
+    const VkDeviceSize k_staging_frame_size = 8 * 1024 * 1024;
+
+    struct vk_upload_copy
+    {
+        VkBuffer     src;
+        VkBuffer     dst;
+        VkBufferCopy region;
+    };
+
+    struct vk_staging_buffer
+    {
+        VkBuffer      buf;
+        vk_allocation mem;
+    };
+
+    struct vk_staging_ring
+    {
+        vk_staging_buffer  ring = {};
+        VkDeviceSize       pos = k_staging_frame_size; // within the current frame segment, full outside of a frame
+        vk_upload_copy*    copies = nullptr;
+        VkBufferCopy*      regions = nullptr;
+        vk_staging_buffer* pending = nullptr; // overflow buffers not yet submitted
+        vk_staging_buffer* overflow[NBB] = {nullptr};
+    };
+    vk_staging_ring s_staging;
+
+    vk_staging_buffer create_staging_buffer(VkDeviceSize size)
+    {
+        VkBufferCreateInfo info = {};
+        info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        info.size = size;
+        info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        vk_staging_buffer sb;
+        CHECK_CALL(vkCreateBuffer(_ctx.device, &info, nullptr, &sb.buf));
+
+        VkMemoryRequirements req;
+        vkGetBufferMemoryRequirements(_ctx.device, sb.buf, &req);
+
+        sb.mem = mem_alloc(req, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                           e_vk_mem_pool::linear);
+        CHECK_CALL(vkBindBufferMemory(_ctx.device, sb.buf, sb.mem.mem, sb.mem.offset));
+
+        return sb;
+    }
+
+    void destroy_staging_buffer(vk_staging_buffer& sb)
+    {
+        vkDestroyBuffer(_ctx.device, sb.buf, nullptr);
+        mem_free(sb.mem);
+    }
+
+    void stage_upload(VkBuffer dst, VkDeviceSize dst_offset, const void* data, VkDeviceSize size)
+    {
+        if (!s_staging.ring.buf)
+            s_staging.ring = create_staging_buffer(k_staging_frame_size * NBB);
+
+        vk_upload_copy copy;
+        copy.dst = dst;
+        copy.region.dstOffset = dst_offset;
+        copy.region.size = size;
+
+        VkDeviceSize pos = (s_staging.pos + 15) & ~(VkDeviceSize)15;
+        if (pos + size <= k_staging_frame_size)
+        {
+            copy.src = s_staging.ring.buf;
+            copy.region.srcOffset = k_staging_frame_size * _ctx.ii + pos;
+            memcpy(s_staging.ring.mem.mapped + copy.region.srcOffset, data, (size_t)size);
+
+            s_staging.pos = pos + size;
+        }
+        else
+        {
+            vk_staging_buffer sb = create_staging_buffer(size);
+            memcpy(sb.mem.mapped, data, (size_t)size);
+            sb_push(s_staging.pending, sb);
+
+            copy.src = sb.buf;
+            copy.region.srcOffset = 0;
+        }
+
+        sb_push(s_staging.copies, copy);
+    }
+
+    // records pending copies, returns null if there is nothing to upload this frame
+    VkCommandBuffer flush_uploads()
+    {
+        u32 num_copies = sb_count(s_staging.copies);
+        if (num_copies == 0)
+            return VK_NULL_HANDLE;
+
+        VkCommandBuffer cmd = _ctx.cmd_bufs_upload[_ctx.ii];
+
+        VkCommandBufferBeginInfo begin_info = {};
+        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        CHECK_CALL(vkBeginCommandBuffer(cmd, &begin_info));
+
+        // earlier submissions may still be reading the destinations, copies must wait for those reads to finish
+        VkMemoryBarrier war_barrier = {};
+        war_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        war_barrier.srcAccessMask = 0;
+        war_barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(cmd,
+                             VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                                 VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &war_barrier, 0, nullptr, 0, nullptr);
+
+        // consecutive copies between the same pair of buffers go in a single call
+        for (u32 i = 0; i < num_copies;)
+        {
+            const vk_upload_copy& first = s_staging.copies[i];
+
+            if (s_staging.regions)
+                stb__sbn(s_staging.regions) = 0;
+
+            u32 j = i;
+            for (; j < num_copies; ++j)
+            {
+                if (s_staging.copies[j].src != first.src || s_staging.copies[j].dst != first.dst)
+                    break;
+
+                sb_push(s_staging.regions, s_staging.copies[j].region);
+            }
+
+            vkCmdCopyBuffer(cmd, first.src, first.dst, j - i, s_staging.regions);
+            i = j;
+        }
+
+        // make the copies visible to anything submitted after on this queue
+        VkMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+                                VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                                 VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        CHECK_CALL(vkEndCommandBuffer(cmd));
+
+        stb__sbn(s_staging.copies) = 0;
+
+        u32 num_pending = sb_count(s_staging.pending);
+        for (u32 i = 0; i < num_pending; ++i)
+            sb_push(s_staging.overflow[_ctx.ii], s_staging.pending[i]);
+
+        if (s_staging.pending)
+            stb__sbn(s_staging.pending) = 0;
+
+        // the segment is in flight until new frame waits on its fence, later uploads take the overflow path
+        s_staging.pos = k_staging_frame_size;
+        return cmd;
+    }
+
+    // called once the fence for the current frame has been waited on
+    void reset_staging_frame()
+    {
+        s_staging.pos = 0;
+
+        vk_staging_buffer* overflow = s_staging.overflow[_ctx.ii];
+        u32                num_overflow = sb_count(overflow);
+        for (u32 i = 0; i < num_overflow; ++i)
+            destroy_staging_buffer(overflow[i]);
+
+        if (overflow)
+            stb__sbn(overflow) = 0;
+    }
+
+    void destroy_staging()
+    {
+        u32 num_pending = sb_count(s_staging.pending);
+        for (u32 i = 0; i < num_pending; ++i)
+            destroy_staging_buffer(s_staging.pending[i]);
+
+        sb_free(s_staging.pending);
+
+        for (u32 i = 0; i < NBB; ++i)
+        {
+            u32 num_overflow = sb_count(s_staging.overflow[i]);
+            for (u32 j = 0; j < num_overflow; ++j)
+                destroy_staging_buffer(s_staging.overflow[i][j]);
+
+            sb_free(s_staging.overflow[i]);
+        }
+
+        if (s_staging.ring.buf)
+            destroy_staging_buffer(s_staging.ring);
+
+        sb_free(s_staging.copies);
+        sb_free(s_staging.regions);
+        s_staging = vk_staging_ring();
+    }
+
     struct pen_binding
     {
         u32              stage;
@@ -436,6 +1129,7 @@ namespace
                 u32 bind_flags;
             };
         };
+        u32 offset = 0; // uniform buffers bound part way in
     };
 
     struct vk_pass_cache
@@ -445,8 +1139,8 @@ namespace
         VkAttachmentReference* colour_attachments = nullptr;
         VkAttachmentReference* depth_attachments = nullptr;
     };
-    hash_id*       s_pass_cache_hash = nullptr;
-    vk_pass_cache* s_pass_cache = nullptr;
+    vk_pass_cache*                   s_pass_cache = nullptr;
+    std::unordered_map<hash_id, u32> s_pass_lookup; // pass hash to index in s_pass_cache
 
     struct vk_pipeline_cache
     {
@@ -454,8 +1148,8 @@ namespace
         VkDescriptorSetLayout descriptor_set_layout = VK_NULL_HANDLE;
         VkPipelineLayout      pipeline_layout = VK_NULL_HANDLE;
     };
-    hash_id*           s_pipeline_cache_hash = nullptr;
-    vk_pipeline_cache* s_pipeline_cache = nullptr;
+    vk_pipeline_cache*               s_pipeline_cache = nullptr;
+    std::unordered_map<hash_id, u32> s_pipeline_lookup; // pipeline hash to index in s_pipeline_cache
 
     enum e_shd
     {
@@ -471,7 +1165,7 @@ namespace
     struct read_back_request
     {
         VkBuffer                  buf;
-        VkDeviceMemory            mem;
+        vk_allocation             mem;
         resource_read_back_params params;
         u32                       frame;
     };
@@ -500,56 +1194,82 @@ namespace
         u32          blend = -1;
         VkRenderPass pass;
         pen_binding* bindings = nullptr;
+        u8           binding_lookup[MAX_BINDING_SLOTS] = {0}; // slot to index + 1 in bindings
         // vulkan cached state
         VkPipelineLayout                 pipeline_layout;
         VkVertexInputBindingDescription* vertex_input_bindings = nullptr;
         VkDescriptorSetLayout            descriptor_set_layout;
-        u32                              descriptor_set_index;
         u32                              pipeline_index = -1;
         // resource readbacks must wait until cmd buf completion
         read_back_request* read_back_requests = nullptr;
     };
     pen_state _state;
 
-    struct descriptor_set_alloc
+    void clear_bindings()
     {
-        VkDescriptorSet set;
-        u64             frame;
-    };
-    descriptor_set_alloc* s_descriptor_sets = nullptr;
+        u32 nb = sb_count(_state.bindings);
+        for (u32 i = 0; i < nb; ++i)
+            _state.binding_lookup[_state.bindings[i].slot] = 0;
+
+        sb_free(_state.bindings);
+        _state.bindings = nullptr;
+    }
+
+    hash_id binding_layout_hash()
+    {
+        // pipelines own their descriptor set layout, so the layout of the bindings is part of the pipeline state
+        HashMurmur2A hh;
+        hh.begin();
+
+        u32 nb = sb_count(_state.bindings);
+        for (u32 i = 0; i < nb; ++i)
+        {
+            hh.add(_state.bindings[i].slot);
+            hh.add(_state.bindings[i].descriptor_type);
+            hh.add(_state.bindings[i].stage);
+        }
+
+        return hh.end();
+    }
 
     struct vulkan_texture
     {
         VkImageView              image_view;
         VkImage                  image;
         VkFormat                 format;
-        VkDeviceMemory           mem = 0;
+        vk_allocation            mem;
         texture_creation_params* tcp;
         VkImageLayout            layout;
         bool                     compute_shader_write = false;
     };
 
+    // static buffers live in device local memory and are written through the staging ring.
+    // dynamic buffers are a single persistently mapped allocation with a slice per frame in flight, a slice is
+    // brought up to date from the latest write the first time it is used in a frame.
     struct vulkan_buffer
     {
-        VkBuffer       buf[NBB];
-        VkDeviceMemory mem[NBB];
-        u32            size;
-        bool           dynamic;
+        VkBuffer      buf;
+        vk_allocation mem;
+        u32           size;
+        u32           stride; // slice size, aligned for uniform buffer offsets
+        bool          dynamic;
+        u32           latest; // slice holding the most recent write
+        u32           version;
+        u32           slice_version[NBB];
 
-        VkBuffer& get_buffer()
+        VkDeviceSize frame_offset()
         {
-            if (dynamic)
-                return buf[_ctx.ii];
+            if (!dynamic)
+                return 0;
 
-            return buf[0];
-        }
-
-        VkDeviceMemory& get_mem()
-        {
-            if (dynamic)
-                return mem[_ctx.ii];
+            u32 ii = _ctx.ii;
+            if (slice_version[ii] != version)
+            {
+                memcpy(mem.mapped + (VkDeviceSize)stride * ii, mem.mapped + (VkDeviceSize)stride * latest, size);
+                slice_version[ii] = version;
+            }
 
-            return mem[0];
+            return (VkDeviceSize)stride * ii;
         }
     };
 
@@ -622,9 +1342,8 @@ namespace
         }
 
         sb_free(s_pass_cache);
-        sb_free(s_pass_cache_hash);
         s_pass_cache = nullptr;
-        s_pass_cache_hash = nullptr;
+        s_pass_lookup.clear();
 
         // pipelines
         pc = sb_count(s_pipeline_cache);
@@ -636,9 +1355,98 @@ namespace
         }
 
         sb_free(s_pipeline_cache);
-        sb_free(s_pipeline_cache_hash);
         s_pipeline_cache = nullptr;
-        s_pipeline_cache_hash = nullptr;
+        s_pipeline_lookup.clear();
+    }
+
+    // the driver pipeline cache is saved on shutdown and reloaded on the next run so pipelines compiled before are
+    // cheap to create again, a file written by a different device or driver version is ignored.
+    Str pipeline_cache_filename()
+    {
+        Str fn = pen_window.window_title;
+        fn.append("_vk_pipeline_cache.bin");
+        return fn;
+    }
+
+    bool validate_pipeline_cache_data(const void* data, u32 size)
+    {
+        // VkPipelineCacheHeaderVersionOne
+        struct header
+        {
+            u32 header_size;
+            u32 header_version;
+            u32 vendor_id;
+            u32 device_id;
+            u8  uuid[VK_UUID_SIZE];
+        };
+
+        if (size < sizeof(header))
+            return false;
+
+        header h;
+        memcpy(&h, data, sizeof(header));
+
+        if (h.header_size < sizeof(header) || h.header_size > size)
+            return false;
+
+        if (h.header_version != VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+            return false;
+
+        if (h.vendor_id != _ctx.properties.vendorID || h.device_id != _ctx.properties.deviceID)
+            return false;
+
+        return memcmp(h.uuid, _ctx.properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+    }
+
+    void create_pipeline_cache()
+    {
+        void* data = nullptr;
+        u32   size = 0;
+
+        Str fn = pipeline_cache_filename();
+        if (pen::filesystem_read_file_to_buffer(fn.c_str(), &data, size) == PEN_ERR_OK)
+        {
+            if (!validate_pipeline_cache_data(data, size))
+            {
+                PEN_LOG("[vulkan] discarding pipeline cache %s, it is from another device or driver\n", fn.c_str());
+                size = 0;
+            }
+        }
+
+        VkPipelineCacheCreateInfo info = {};
+        info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        info.initialDataSize = size;
+        info.pInitialData = size ? data : nullptr;
+
+        CHECK_CALL(vkCreatePipelineCache(_ctx.device, &info, nullptr, &_ctx.pipeline_cache));
+
+        pen::memory_free(data);
+    }
+
+    void destroy_pipeline_cache()
+    {
+        size_t size = 0;
+        vkGetPipelineCacheData(_ctx.device, _ctx.pipeline_cache, &size, nullptr);
+
+        if (size > 0)
+        {
+            void* data = pen::memory_alloc(size);
+            if (vkGetPipelineCacheData(_ctx.device, _ctx.pipeline_cache, &size, data) == VK_SUCCESS)
+            {
+                Str   fn = pen::os_path_for_resource(pipeline_cache_filename().c_str());
+                FILE* fp = fopen(fn.c_str(), "wb");
+                if (fp)
+                {
+                    fwrite(data, 1, size, fp);
+                    fclose(fp);
+                }
+            }
+
+            pen::memory_free(data);
+        }
+
+        vkDestroyPipelineCache(_ctx.device, _ctx.pipeline_cache, nullptr);
+        _ctx.pipeline_cache = VK_NULL_HANDLE;
     }
 
     void destory_swapchain()
@@ -839,6 +1647,12 @@ namespace
 
         CHECK_CALL(vkAllocateCommandBuffers(_ctx.device, &buf_info, _ctx.cmd_bufs));
 
+        // staging copies are recorded separately and submitted ahead of the frame
+        for (u32 i = 0; i < buf_info.commandBufferCount; ++i)
+            sb_push(_ctx.cmd_bufs_upload, VkCommandBuffer());
+
+        CHECK_CALL(vkAllocateCommandBuffers(_ctx.device, &buf_info, _ctx.cmd_bufs_upload));
+
         // allocate command buffer for compute
         VkCommandPoolCreateInfo compute_pool_info = {};
         compute_pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
@@ -862,25 +1676,21 @@ namespace
 
     void create_descriptor_set_pools(u32 size)
     {
-        // one large pool for all descriptor sets to be allocated from
+        // one large pool for all descriptor sets, sets are cached across frames and freed individually on eviction
 
-        VkDescriptorPoolSize pool_sizes[] = {{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, size},
-                                             {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, size},
+        VkDescriptorPoolSize pool_sizes[] = {{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, size * 8},
+                                             {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, size * 4},
                                              {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, size},
-                                             {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, size}};
-
-        u32 max_sets = 0;
-        for (auto& ps : pool_sizes)
-            max_sets += ps.descriptorCount;
+                                             {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, size * 4}};
 
         VkDescriptorPoolCreateInfo pool_info = {};
         pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
         pool_info.poolSizeCount = PEN_ARRAY_SIZE(pool_sizes);
         pool_info.pPoolSizes = &pool_sizes[0];
-        pool_info.maxSets = max_sets;
+        pool_info.maxSets = size;
 
-        for (u32 i = 0; i < NBB; ++i)
-            CHECK_CALL(vkCreateDescriptorPool(_ctx.device, &pool_info, nullptr, &_ctx.descriptor_pool[i]));
+        CHECK_CALL(vkCreateDescriptorPool(_ctx.device, &pool_info, nullptr, &_ctx.descriptor_pool));
     }
 
     // quick dirty functions for testing, better having a pool of these to burn through
@@ -1189,7 +1999,9 @@ namespace
 
         // to query memory type
         vkGetPhysicalDeviceMemoryProperties(_ctx.physical_device, &_ctx.mem_properties);
+        vkGetPhysicalDeviceProperties(_ctx.physical_device, &_ctx.properties);
 
+        create_pipeline_cache();
         create_command_buffers();
 
         create_sync_primitives();
@@ -1297,15 +2109,12 @@ namespace
             return;
 
         // check in pass hashes
-        u32 pcc = sb_count(s_pass_cache);
-        for (u32 i = 0; i < pcc; ++i)
+        auto it = s_pass_lookup.find(ph);
+        if (it != s_pass_lookup.end())
         {
-            if (s_pass_cache_hash[i] == ph)
-            {
-                // found exisiting
-                begin_pass_from_cache(s_pass_cache[i], ph);
-                return;
-            }
+            // found exisiting
+            begin_pass_from_cache(s_pass_cache[it->second], ph);
+            return;
         }
 
         // begin building a new pipeline
@@ -1438,7 +2247,7 @@ namespace
         // add new pass into pass cache
         u32 pc_idx = sb_count(s_pass_cache);
         sb_push(s_pass_cache, vk_pass_cache());
-        sb_push(s_pass_cache_hash, ph);
+        s_pass_lookup[ph] = pc_idx;
         vk_pass_cache& vk_pc = s_pass_cache[pc_idx];
         vk_pc.pass = pass;
 
@@ -1521,6 +2330,7 @@ namespace
         hh.add(_state.input_layout);
         hh.add(_state.raster);
         hh.add(_state.depth_stencil_state);
+        hh.add(binding_layout_hash());
         hash_id ph = hh.end();
 
         // already bound
@@ -1528,15 +2338,12 @@ namespace
             return;
 
         // check in pipeline hashes
-        u32 plc = sb_count(s_pipeline_cache);
-        for (u32 i = 0; i < plc; ++i)
+        auto it = s_pipeline_lookup.find(ph);
+        if (it != s_pipeline_lookup.end())
         {
-            if (s_pipeline_cache_hash[i] == ph)
-            {
-                // found exisiting
-                bind_pipeline_from_cache(s_pipeline_cache[i], VK_PIPELINE_BIND_POINT_GRAPHICS, ph, i);
-                return;
-            }
+            // found exisiting
+            bind_pipeline_from_cache(s_pipeline_cache[it->second], VK_PIPELINE_BIND_POINT_GRAPHICS, ph, it->second);
+            return;
         }
 
         // create new pipeline
@@ -1683,7 +2490,7 @@ namespace
         info.basePipelineHandle = VK_NULL_HANDLE;
 
         VkPipeline pipeline;
-        CHECK_CALL(vkCreateGraphicsPipelines(_ctx.device, VK_NULL_HANDLE, 1, &info, nullptr, &pipeline));
+        CHECK_CALL(vkCreateGraphicsPipelines(_ctx.device, _ctx.pipeline_cache, 1, &info, nullptr, &pipeline));
 
         vk_pipeline_cache new_pipeline;
         new_pipeline.pipeline = pipeline;
@@ -1691,8 +2498,8 @@ namespace
         new_pipeline.descriptor_set_layout = descriptor_set_layout;
 
         u32 idx = sb_count(s_pipeline_cache);
-        sb_push(s_pipeline_cache_hash, ph);
         sb_push(s_pipeline_cache, new_pipeline);
+        s_pipeline_lookup[ph] = idx;
 
         bind_pipeline_from_cache(s_pipeline_cache[idx], VK_PIPELINE_BIND_POINT_GRAPHICS, ph, idx);
     }
@@ -1706,6 +2513,7 @@ namespace
         HashMurmur2A hh;
         hh.begin();
         hh.add(_state.shader[e_shd::compute]);
+        hh.add(binding_layout_hash());
         hash_id ph = hh.end();
 
         // already bound
@@ -1713,15 +2521,12 @@ namespace
             return;
 
         // check in pipeline hashes
-        u32 plc = sb_count(s_pipeline_cache);
-        for (u32 i = 0; i < plc; ++i)
+        auto it = s_pipeline_lookup.find(ph);
+        if (it != s_pipeline_lookup.end())
         {
-            if (s_pipeline_cache_hash[i] == ph)
-            {
-                // found exisiting
-                bind_pipeline_from_cache(s_pipeline_cache[i], VK_PIPELINE_BIND_POINT_COMPUTE, ph, i);
-                return;
-            }
+            // found exisiting
+            bind_pipeline_from_cache(s_pipeline_cache[it->second], VK_PIPELINE_BIND_POINT_COMPUTE, ph, it->second);
+            return;
         }
 
         // layout
@@ -1740,7 +2545,7 @@ namespace
         info.stage = compute_shader_info;
 
         VkPipeline pipeline;
-        CHECK_CALL(vkCreateComputePipelines(_ctx.device, VK_NULL_HANDLE, 1, &info, nullptr, &pipeline));
+        CHECK_CALL(vkCreateComputePipelines(_ctx.device, _ctx.pipeline_cache, 1, &info, nullptr, &pipeline));
 
         vk_pipeline_cache new_pipeline;
         new_pipeline.pipeline = pipeline;
@@ -1748,12 +2553,220 @@ namespace
         new_pipeline.descriptor_set_layout = descriptor_set_layout;
 
         u32 idx = sb_count(s_pipeline_cache);
-        sb_push(s_pipeline_cache_hash, ph);
         sb_push(s_pipeline_cache, new_pipeline);
+        s_pipeline_lookup[ph] = idx;
 
         bind_pipeline_from_cache(s_pipeline_cache[idx], VK_PIPELINE_BIND_POINT_COMPUTE, ph, idx);
     }
 
+    //
+    // descriptor set cache
+    //
+
+    // descriptor sets are cached by the content of their bindings and reused across frames, so a draw only writes
+    // descriptors the first time a combination of resources is seen. dynamic buffers are bound as dynamic uniform
+    // buffers with the frame slice passed as a dynamic offset, which keeps their sets valid from frame to frame.
+    // sets are kept in lru order and evicted from the tail once no frame in flight can reference them. each buffer,
+    // texture or sampler handle has a generation which is part of the hash, releasing one bumps its generation so
+    // only the sets referencing it stop matching and age out of the lru.
+    const u32 k_descriptor_cache_size = 4096;
+    const u32 k_max_uniform_range = 64 * 1024; // as d3d, buffers sub allocated per draw are padded to bind this range
+    const u32 k_descriptor_cache_headroom = 256;
+
+    struct vk_descriptor_cache_entry
+    {
+        hash_id         hash;
+        VkDescriptorSet set;
+        u64             frame;
+        u32             prev;
+        u32             next;
+    };
+
+    struct vk_descriptor_cache
+    {
+        vk_descriptor_cache_entry*       entries = nullptr;
+        u32*                             free_list = nullptr;
+        std::unordered_map<hash_id, u32> lookup;
+        u32                              head = -1; // most recently used
+        u32                              tail = -1;
+        u32                              count = 0;
+        u64                              frame = 0;
+        u32*                             generations = nullptr; // per resource handle
+    };
+    vk_descriptor_cache     s_descriptor_cache;
+    vulkan_descriptor_stats s_descriptor_stats;
+
+    void descriptor_cache_unlink(u32 i)
+    {
+        vk_descriptor_cache&       dc = s_descriptor_cache;
+        vk_descriptor_cache_entry& e = dc.entries[i];
+
+        if (is_valid(e.prev))
+            dc.entries[e.prev].next = e.next;
+        else
+            dc.head = e.next;
+
+        if (is_valid(e.next))
+            dc.entries[e.next].prev = e.prev;
+        else
+            dc.tail = e.prev;
+    }
+
+    void descriptor_cache_push_head(u32 i)
+    {
+        vk_descriptor_cache&       dc = s_descriptor_cache;
+        vk_descriptor_cache_entry& e = dc.entries[i];
+
+        e.prev = -1;
+        e.next = dc.head;
+
+        if (is_valid(dc.head))
+            dc.entries[dc.head].prev = i;
+        else
+            dc.tail = i;
+
+        dc.head = i;
+    }
+
+    // frees least recently used sets which are no longer in flight, returns false if none could be freed
+    bool descriptor_cache_evict(u32 target_count)
+    {
+        vk_descriptor_cache& dc = s_descriptor_cache;
+
+        bool evicted = false;
+        while (dc.count > target_count && is_valid(dc.tail))
+        {
+            u32                        i = dc.tail;
+            vk_descriptor_cache_entry& e = dc.entries[i];
+
+            if (e.frame + NBB > dc.frame)
+                break;
+
+            auto it = dc.lookup.find(e.hash);
+            if (it != dc.lookup.end() && it->second == i)
+                dc.lookup.erase(it);
+
+            vkFreeDescriptorSets(_ctx.device, _ctx.descriptor_pool, 1, &e.set);
+
+            descriptor_cache_unlink(i);
+            sb_push(dc.free_list, i);
+            dc.count--;
+
+            s_descriptor_stats.evictions++;
+            evicted = true;
+        }
+
+        s_descriptor_stats.cached_sets = dc.count;
+        return evicted;
+    }
+
+    VkDescriptorSet descriptor_cache_alloc(hash_id h)
+    {
+        vk_descriptor_cache& dc = s_descriptor_cache;
+
+        if (dc.count >= k_descriptor_cache_size)
+            descriptor_cache_evict(k_descriptor_cache_size - k_descriptor_cache_headroom);
+
+        VkDescriptorSetAllocateInfo alloc_info = {};
+        alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        alloc_info.descriptorPool = _ctx.descriptor_pool;
+        alloc_info.descriptorSetCount = 1;
+        alloc_info.pSetLayouts = &_state.descriptor_set_layout;
+
+        VkDescriptorSet set = VK_NULL_HANDLE;
+        VkResult        r = vkAllocateDescriptorSets(_ctx.device, &alloc_info, &set);
+        if (r == VK_ERROR_OUT_OF_POOL_MEMORY || r == VK_ERROR_FRAGMENTED_POOL)
+        {
+            // pool sizes are per descriptor type, make room and try again
+            u32 target = dc.count > k_descriptor_cache_headroom ? dc.count - k_descriptor_cache_headroom : 0;
+            if (descriptor_cache_evict(target))
+                r = vkAllocateDescriptorSets(_ctx.device, &alloc_info, &set);
+        }
+        PEN_ASSERT(r == VK_SUCCESS);
+
+        u32 i;
+        if (sb_count(dc.free_list))
+        {
+            i = sb_last(dc.free_list);
+            stb__sbn(dc.free_list)--;
+        }
+        else
+        {
+            i = sb_count(dc.entries);
+            sb_push(dc.entries, vk_descriptor_cache_entry());
+        }
+
+        vk_descriptor_cache_entry& e = dc.entries[i];
+        e.hash = h;
+        e.set = set;
+        e.frame = dc.frame;
+
+        descriptor_cache_push_head(i);
+        dc.lookup[h] = i;
+        dc.count++;
+
+        s_descriptor_stats.cached_sets = dc.count;
+        return set;
+    }
+
+    VkDescriptorSet descriptor_cache_find(hash_id h)
+    {
+        vk_descriptor_cache& dc = s_descriptor_cache;
+
+        auto it = dc.lookup.find(h);
+        if (it == dc.lookup.end())
+            return VK_NULL_HANDLE;
+
+        u32                        i = it->second;
+        vk_descriptor_cache_entry& e = dc.entries[i];
+
+        e.frame = dc.frame;
+        descriptor_cache_unlink(i);
+        descriptor_cache_push_head(i);
+
+        return e.set;
+    }
+
+    void descriptor_cache_new_frame()
+    {
+        vk_descriptor_cache& dc = s_descriptor_cache;
+        dc.frame++;
+
+        if (dc.count > k_descriptor_cache_size - k_descriptor_cache_headroom)
+            descriptor_cache_evict(k_descriptor_cache_size - k_descriptor_cache_headroom);
+    }
+
+    u32 descriptor_cache_generation(u32 resource)
+    {
+        vk_descriptor_cache& dc = s_descriptor_cache;
+        return resource < sb_count(dc.generations) ? dc.generations[resource] : 0;
+    }
+
+    void descriptor_cache_invalidate(u32 resource)
+    {
+        vk_descriptor_cache& dc = s_descriptor_cache;
+
+        u32 count = sb_count(dc.generations);
+        if (resource >= count)
+        {
+            sb_add(dc.generations, resource + 1 - count);
+            memset(&dc.generations[count], 0x0, (resource + 1 - count) * sizeof(u32));
+        }
+
+        dc.generations[resource]++;
+        _state.hdescriptors = 0;
+    }
+
+    void destroy_descriptor_cache()
+    {
+        // sets are released with the pool
+        sb_free(s_descriptor_cache.entries);
+        sb_free(s_descriptor_cache.free_list);
+        sb_free(s_descriptor_cache.generations);
+        s_descriptor_cache = vk_descriptor_cache();
+        s_descriptor_stats.cached_sets = 0;
+    }
+
     void bind_descriptor_sets(VkCommandBuffer cmd_buf, VkPipelineBindPoint bind_point)
     {
         // cache / invalidate
@@ -1765,16 +2778,15 @@ namespace
         if (h == _state.hdescriptors)
             return;
 
-        // allocate a descriptor set
-        VkDescriptorSet             descriptor_set = 0;
-        VkDescriptorSetAllocateInfo alloc_info = {};
-        alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-        alloc_info.descriptorPool = _ctx.descriptor_pool[_ctx.ii];
-        alloc_info.descriptorSetCount = 1;
-        alloc_info.pSetLayouts = &_state.descriptor_set_layout;
-        CHECK_CALL(vkAllocateDescriptorSets(_ctx.device, &alloc_info, &descriptor_set));
+        VkDescriptorBufferInfo buf_info[MAX_BINDING_SLOTS];
+        VkDescriptorImageInfo  image_info[MAX_BINDING_SLOTS];
+        u32                    dynamic_slot[MAX_BINDING_SLOTS];
+        u32                    dynamic_offset[MAX_BINDING_SLOTS];
+        u32                    num_dynamic = 0;
 
-        _state.descriptor_set_index++;
+        // resolve resources and hash the set contents
+        HashMurmur2A hh;
+        hh.begin();
 
         for (u32 i = 0; i < nb; ++i)
         {
@@ -1782,29 +2794,45 @@ namespace
             if (pb.index == 0)
                 continue;
 
-            VkWriteDescriptorSet descriptor_write = {};
-
-            descriptor_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            descriptor_write.dstSet = descriptor_set;
-            descriptor_write.dstBinding = pb.slot;
-            descriptor_write.dstArrayElement = 0;
-            descriptor_write.descriptorType = pb.descriptor_type;
-            descriptor_write.descriptorCount = 1;
-
-            VkDescriptorImageInfo  image_info = {};
-            VkDescriptorBufferInfo buf_info = {};
+            hh.add(pb.slot);
+            hh.add(pb.descriptor_type);
+            hh.add(pb.stage);
 
             switch (pb.descriptor_type)
             {
                 case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+                case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC:
                 {
                     vulkan_buffer& vb = _res_pool.get(pb.index).buffer;
+                    PEN_ASSERT(pb.offset < vb.size);
 
-                    buf_info.buffer = vb.get_buffer();
-                    buf_info.offset = 0;
-                    buf_info.range = vb.size;
+                    // dynamic buffers take the offset with the slice, sets are shared by offsets with the same range
+                    bool         dynamic = pb.descriptor_type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+                    VkDeviceSize range = std::min<VkDeviceSize>(vb.size - pb.offset, k_max_uniform_range);
 
-                    descriptor_write.pBufferInfo = &buf_info;
+                    buf_info[i].buffer = vb.buf;
+                    buf_info[i].offset = dynamic ? 0 : pb.offset;
+                    buf_info[i].range = std::min<VkDeviceSize>(range, _ctx.properties.limits.maxUniformBufferRange);
+
+                    hh.add(pb.index);
+                    hh.add(descriptor_cache_generation(pb.index));
+                    hh.add(vb.buf);
+                    hh.add(buf_info[i].offset);
+                    hh.add(buf_info[i].range);
+
+                    if (dynamic)
+                    {
+                        // offsets are consumed in binding number order
+                        u32 j = num_dynamic++;
+                        for (; j > 0 && dynamic_slot[j - 1] > pb.slot; --j)
+                        {
+                            dynamic_slot[j] = dynamic_slot[j - 1];
+                            dynamic_offset[j] = dynamic_offset[j - 1];
+                        }
+
+                        dynamic_slot[j] = pb.slot;
+                        dynamic_offset[j] = (u32)vb.frame_offset() + pb.offset;
+                    }
                 }
                 break;
                 case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
@@ -1824,19 +2852,66 @@ namespace
                         }
                     }
 
-                    image_info.imageLayout = vt.layout;
-                    image_info.imageView = _res_pool[pb.index].texture.image_view;
-                    image_info.sampler = _res_pool[pb.sampler_index].sampler;
-
-                    descriptor_write.pImageInfo = &image_info;
+                    image_info[i].imageLayout = vt.layout;
+                    image_info[i].imageView = vt.image_view;
+                    image_info[i].sampler = _res_pool[pb.sampler_index].sampler;
+
+                    hh.add(pb.index);
+                    hh.add(descriptor_cache_generation(pb.index));
+                    hh.add(pb.sampler_index);
+                    hh.add(descriptor_cache_generation(pb.sampler_index));
+                    hh.add(image_info[i].imageLayout);
+                    hh.add(image_info[i].imageView);
+                    hh.add(image_info[i].sampler);
                 }
                 break;
             }
+        }
+
+        hash_id content = hh.end();
+
+        VkDescriptorSet descriptor_set = descriptor_cache_find(content);
+        if (descriptor_set)
+        {
+            s_descriptor_stats.hits++;
+        }
+        else
+        {
+            descriptor_set = descriptor_cache_alloc(content);
+            s_descriptor_stats.misses++;
+
+            VkWriteDescriptorSet writes[MAX_BINDING_SLOTS];
+            u32                  num_writes = 0;
+
+            for (u32 i = 0; i < nb; ++i)
+            {
+                pen_binding& pb = _state.bindings[i];
+                if (pb.index == 0)
+                    continue;
+
+                VkWriteDescriptorSet& descriptor_write = writes[num_writes++];
+                descriptor_write = {};
+
+                descriptor_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                descriptor_write.dstSet = descriptor_set;
+                descriptor_write.dstBinding = pb.slot;
+                descriptor_write.dstArrayElement = 0;
+                descriptor_write.descriptorType = pb.descriptor_type;
+                descriptor_write.descriptorCount = 1;
+
+                if (pb.descriptor_type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER ||
+                    pb.descriptor_type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC)
+                    descriptor_write.pBufferInfo = &buf_info[i];
+                else
+                    descriptor_write.pImageInfo = &image_info[i];
+            }
 
-            vkUpdateDescriptorSets(_ctx.device, 1, &descriptor_write, 0, nullptr);
+            vkUpdateDescriptorSets(_ctx.device, num_writes, writes, 0, nullptr);
+            s_descriptor_stats.writes += num_writes;
         }
 
-        vkCmdBindDescriptorSets(cmd_buf, bind_point, _state.pipeline_layout, 0, 1, &descriptor_set, 0, nullptr);
+        vkCmdBindDescriptorSets(cmd_buf, bind_point, _state.pipeline_layout, 0, 1, &descriptor_set, num_dynamic,
+                                dynamic_offset);
 
         _state.hdescriptors = h;
     }
@@ -1851,7 +2926,8 @@ namespace pen
     {
         s_renderer_info.caps = PEN_CAPS_TEXTURE_MULTISAMPLE | PEN_CAPS_DEPTH_CLAMP | PEN_CAPS_GPU_TIMER | PEN_CAPS_COMPUTE |
                                PEN_CAPS_TEX_FORMAT_BC1 | PEN_CAPS_TEX_FORMAT_BC2 | PEN_CAPS_TEX_FORMAT_BC3 |
-                               PEN_CAPS_TEX_FORMAT_BC4 | PEN_CAPS_TEX_FORMAT_BC5 | PEN_CAPS_BACKBUFFER_BGRA;
+                               PEN_CAPS_TEX_FORMAT_BC4 | PEN_CAPS_TEX_FORMAT_BC5 | PEN_CAPS_TEX_FORMAT_BC7 |
+                               PEN_CAPS_BACKBUFFER_BGRA | PEN_CAPS_CONSTANT_BUFFER_OFFSET;
 
         s_renderer_info.renderer = "Vulkan";
         return s_renderer_info;
@@ -1872,6 +2948,16 @@ namespace pen
         return false;
     }
 
+    const vulkan_memory_stats& renderer_vulkan_get_memory_stats()
+    {
+        return s_mem_stats;
+    }
+
+    const vulkan_descriptor_stats& renderer_vulkan_get_descriptor_stats()
+    {
+        return s_descriptor_stats;
+    }
+
     namespace direct
     {
         void new_frame(u32 next_frame)
@@ -1887,6 +2973,8 @@ namespace pen
             vkWaitForFences(_ctx.device, 1, &_ctx.fences[_ctx.ii], VK_TRUE, (s32)-1);
             vkResetFences(_ctx.device, 1, &_ctx.fences[_ctx.ii]);
 
+            reset_staging_frame();
+
             if (_ctx.submit_flags & SUBMIT_COMPUTE)
             {
                 // Use a fence to ensure that compute command buffer has finished executing before using it again
@@ -1895,12 +2983,15 @@ namespace pen
                 _ctx.submit_flags = 0;
             }
 
+            // submissions complete in order, so everything up to the frame last using these fences is done
+            if (_ctx.fence_frames[_ctx.ii])
+                _renderer_frame_completed(_ctx.fence_frames[_ctx.ii] - 1);
+
             CHECK_CALL(vkBeginCommandBuffer(_ctx.cmd_bufs[_ctx.ii], &begin_info));
 
             _ctx.submit_flags |= SUBMIT_GRAPHICS;
 
-            vkResetDescriptorPool(_ctx.device, _ctx.descriptor_pool[next_frame], 0);
-            _state.descriptor_set_index = 0;
+            descriptor_cache_new_frame();
         }
 
         u32 renderer_initialise(void* params, u32 bb_res, u32 bb_depth_res)
@@ -1952,11 +3043,14 @@ namespace pen
             if (_ctx.enable_validation)
                 destroy_debug_messenger();
 
-            for (u32 i = 0; i < NBB; ++i)
-                vkDestroyDescriptorPool(_ctx.device, _ctx.descriptor_pool[i], nullptr);
+            vkDestroyDescriptorPool(_ctx.device, _ctx.descriptor_pool, nullptr);
+            destroy_descriptor_cache();
 
             destroy_caches();
+            destroy_pipeline_cache();
             destory_swapchain();
+            destroy_staging();
+            mem_destroy_all();
 
             vkDestroyCommandPool(_ctx.device, _ctx.cmd_pool, nullptr);
             vkDestroySurfaceKHR(_ctx.instance, _ctx.surface, nullptr);
@@ -2052,7 +3146,7 @@ namespace pen
         }
 
         static void _create_buffer_internal(VkBufferUsageFlags usage, VkMemoryPropertyFlags mem_props, void* data,
-                                            u32 buffer_size, VkBuffer& buf, VkDeviceMemory& mem)
+                                            u32 buffer_size, VkBuffer& buf, vk_allocation& mem)
         {
             VkBufferCreateInfo info = {};
             info.size = buffer_size;
@@ -2065,20 +3159,13 @@ namespace pen
             VkMemoryRequirements req;
             vkGetBufferMemoryRequirements(_ctx.device, buf, &req);
 
-            VkMemoryAllocateInfo alloc_info = {};
-            alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-            alloc_info.allocationSize = req.size;
-            alloc_info.memoryTypeIndex = get_mem_type(req.memoryTypeBits, mem_props);
-
-            CHECK_CALL(vkAllocateMemory(_ctx.device, &alloc_info, nullptr, &mem));
-            CHECK_CALL(vkBindBufferMemory(_ctx.device, buf, mem, 0));
+            mem = mem_alloc(req, mem_props, e_vk_mem_pool::linear);
+            CHECK_CALL(vkBindBufferMemory(_ctx.device, buf, mem.mem, mem.offset));
 
             if (data)
             {
-                void* map_data = nullptr;
-                vkMapMemory(_ctx.device, mem, 0, buffer_size, 0, &map_data);
-                memcpy(map_data, data, (size_t)buffer_size);
-                vkUnmapMemory(_ctx.device, mem);
+                PEN_ASSERT(mem.mapped);
+                memcpy(mem.mapped, data, (size_t)buffer_size);
             }
         }
 
@@ -2087,20 +3174,34 @@ namespace pen
             _res_pool.insert({}, resource_slot);
             vulkan_buffer& res = _res_pool.get(resource_slot).buffer;
             res.size = params.buffer_size;
+            res.dynamic = params.cpu_access_flags & PEN_CPU_ACCESS_WRITE;
+            res.latest = 0;
+            res.version = 0;
+            memset(res.slice_version, 0, sizeof(res.slice_version));
 
-            u32 c = 1;
-            res.dynamic = false;
-            if (params.cpu_access_flags & PEN_CPU_ACCESS_WRITE)
+            VkBufferUsageFlags usage = to_vk_buffer_usage(params.bind_flags);
+
+            if (res.dynamic)
             {
-                res.dynamic = true;
-                c = NBB;
-            }
+                VkDeviceSize align = _ctx.properties.limits.minUniformBufferOffsetAlignment;
+                res.stride = (u32)((params.buffer_size + align - 1) & ~(align - 1));
 
-            for (u32 i = 0; i < c; ++i)
+                VkMemoryPropertyFlags props = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+                _create_buffer_internal(usage, props, nullptr, res.stride * NBB, res.buf, res.mem);
+
+                if (params.data)
+                    for (u32 i = 0; i < NBB; ++i)
+                        memcpy(res.mem.mapped + (VkDeviceSize)res.stride * i, params.data, params.buffer_size);
+            }
+            else
             {
-                _create_buffer_internal(to_vk_buffer_usage(params.bind_flags),
-                                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                                        params.data, params.buffer_size, res.buf[i], res.mem[i]);
+                res.stride = params.buffer_size;
+
+                _create_buffer_internal(usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                        nullptr, params.buffer_size, res.buf, res.mem);
+
+                if (params.data)
+                    stage_upload(res.buf, 0, params.data, params.buffer_size);
             }
         }
 
@@ -2117,15 +3218,16 @@ namespace pen
             static VkDeviceSize _offsets[8];
             for (u32 i = 0; i < num_buffers; ++i)
             {
-                _bufs[i] = _res_pool.get(buffer_indices[i]).buffer.get_buffer();
-                _offsets[i] = offsets[i];
+                vulkan_buffer& vb = _res_pool.get(buffer_indices[i]).buffer;
+                _bufs[i] = vb.buf;
+                _offsets[i] = vb.frame_offset() + offsets[i];
 
-                VkVertexInputBindingDescription vb;
-                vb.binding = i;
-                vb.inputRate = i == 0 ? VK_VERTEX_INPUT_RATE_VERTEX : VK_VERTEX_INPUT_RATE_INSTANCE;
-                vb.stride = strides[i];
+                VkVertexInputBindingDescription vib;
+                vib.binding = i;
+                vib.inputRate = i == 0 ? VK_VERTEX_INPUT_RATE_VERTEX : VK_VERTEX_INPUT_RATE_INSTANCE;
+                vib.stride = strides[i];
 
-                sb_push(_state.vertex_input_bindings, vb);
+                sb_push(_state.vertex_input_bindings, vib);
             }
 
             vkCmdBindVertexBuffers(_ctx.cmd_bufs[_ctx.ii], start_slot, num_buffers, _bufs, _offsets);
@@ -2133,36 +3235,39 @@ namespace pen
 
         void renderer_set_index_buffer(u32 buffer_index, u32 format, u32 offset)
         {
-            VkBuffer buf = _res_pool.get(buffer_index).buffer.get_buffer();
-            vkCmdBindIndexBuffer(_ctx.cmd_bufs[_ctx.ii], buf, offset, to_vk_index_type(format));
+            vulkan_buffer& vb = _res_pool.get(buffer_index).buffer;
+            vkCmdBindIndexBuffer(_ctx.cmd_bufs[_ctx.ii], vb.buf, vb.frame_offset() + offset, to_vk_index_type(format));
         }
 
         inline void _set_binding(const pen_binding& b)
         {
-            u32 num = sb_count(_state.bindings);
-            for (u32 i = 0; i < num; ++i)
+            PEN_ASSERT(b.slot < MAX_BINDING_SLOTS);
+
+            u8 i = _state.binding_lookup[b.slot];
+            if (i)
             {
-                if (_state.bindings[i].slot == b.slot && _state.bindings[i].descriptor_type == b.descriptor_type)
-                {
-                    _state.bindings[i] = b;
-                    return;
-                }
+                _state.bindings[i - 1] = b;
+                return;
             }
 
             sb_push(_state.bindings, b);
+            _state.binding_lookup[b.slot] = (u8)sb_count(_state.bindings);
         }
 
-        void renderer_set_constant_buffer(u32 buffer_index, u32 unit, u32 flags)
+        void renderer_set_constant_buffer(u32 buffer_index, u32 unit, u32 flags, u32 offset)
         {
             if (buffer_index == 0)
                 return;
 
             pen_binding b;
             b.descriptor_type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            if (_res_pool.get(buffer_index).buffer.dynamic)
+                b.descriptor_type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
             b.stage = to_vk_stage(flags);
             b.index = buffer_index;
             b.slot = unit;
             b.bind_flags = flags;
+            b.offset = offset;
 
             _set_binding(b);
         }
@@ -2176,12 +3281,51 @@ namespace pen
             if (data_size == 0)
                 return;
 
-            VkDeviceMemory mem = _res_pool.get(buffer_index).buffer.get_mem();
+            vulkan_buffer& vb = _res_pool.get(buffer_index).buffer;
+            PEN_ASSERT(offset + data_size <= vb.size);
+
+            if (!vb.dynamic)
+            {
+                stage_upload(vb.buf, offset, data, data_size);
+                return;
+            }
+
+            // this frames slice must hold the latest contents before a partial write
+            if (offset > 0 || data_size < vb.size)
+                vb.frame_offset();
+
+            u32 ii = _ctx.ii;
+            memcpy(vb.mem.mapped + (VkDeviceSize)vb.stride * ii + offset, data, (size_t)data_size);
+
+            vb.version++;
+            vb.slice_version[ii] = vb.version;
+            vb.latest = ii;
+        }
+
+        void renderer_update_buffer_no_overwrite(u32 buffer_index, const void* data, u32 data_size, u32 offset)
+        {
+            if (data_size == 0)
+                return;
+
+            vulkan_buffer& vb = _res_pool.get(buffer_index).buffer;
+            PEN_ASSERT(offset + data_size <= vb.size);
+
+            if (!vb.dynamic)
+            {
+                stage_upload(vb.buf, offset, data, data_size);
+                return;
+            }
+
+            // new contents make this frames slice the latest without copying the old ones in, appends follow them
+            u32 ii = _ctx.ii;
+            if (offset == 0)
+            {
+                vb.version++;
+                vb.slice_version[ii] = vb.version;
+                vb.latest = ii;
+            }
 
-            void* map_data;
-            vkMapMemory(_ctx.device, mem, 0, data_size, 0, &map_data);
-            memcpy(map_data, data, (size_t)data_size);
-            vkUnmapMemory(_ctx.device, mem);
+            memcpy(vb.mem.mapped + (VkDeviceSize)vb.stride * ii + offset, data, (size_t)data_size);
         }
 
         void renderer_create_texture(const texture_creation_params& tcp, u32 resource_slot)
@@ -2218,13 +3362,8 @@ namespace pen
             VkMemoryRequirements req;
             vkGetImageMemoryRequirements(_ctx.device, vt.image, &req);
 
-            VkMemoryAllocateInfo alloc_info = {};
-            alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-            alloc_info.allocationSize = req.size;
-            alloc_info.memoryTypeIndex = get_mem_type(req.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-            CHECK_CALL(vkAllocateMemory(_ctx.device, &alloc_info, nullptr, &vt.mem));
-            CHECK_CALL(vkBindImageMemory(_ctx.device, vt.image, vt.mem, 0));
+            vt.mem = mem_alloc(req, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, e_vk_mem_pool::optimal);
+            CHECK_CALL(vkBindImageMemory(_ctx.device, vt.image, vt.mem.mem, vt.mem.offset));
 
             VkImageAspectFlags aspect = to_vk_image_aspect(vt.tcp->format);
 
@@ -2252,8 +3391,8 @@ namespace pen
 
             if (vt.tcp->data)
             {
-                VkBuffer       buf;
-                VkDeviceMemory mem;
+                VkBuffer      buf;
+                vk_allocation mem;
                 _create_buffer_internal(VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
                                         vt.tcp->data, vt.tcp->data_size, buf, mem);
@@ -2279,7 +3418,7 @@ namespace pen
                 _transition_image(vt.image, vt.format, aspect, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, target_layout);
 
                 vkDestroyBuffer(_ctx.device, buf, nullptr);
-                vkFreeMemory(_ctx.device, mem, nullptr);
+                mem_free(mem);
             }
             else if (!(vt.tcp->bind_flags & PEN_BIND_RENDER_TARGET) && !(vt.tcp->bind_flags & PEN_BIND_DEPTH_STENCIL))
             {
@@ -2512,8 +3651,7 @@ namespace pen
 
             _ctx.submit_flags |= SUBMIT_COMPUTE;
 
-            sb_free(_state.bindings);
-            _state.bindings = nullptr;
+            clear_bindings();
         }
 
         void renderer_create_render_target(const texture_creation_params& tcp, u32 resource_slot, bool track)
@@ -2524,8 +3662,7 @@ namespace pen
         void renderer_set_targets(const u32* const colour_targets, u32 num_colour_targets, u32 depth_target, u32 colour_face,
                                   u32 depth_face)
         {
-            sb_free(_state.bindings);
-            _state.bindings = nullptr;
+            clear_bindings();
 
             sb_clear(_state.colour_attachments);
             _state.colour_attachments = nullptr;
@@ -2616,15 +3753,12 @@ namespace pen
 
                 u32 data_size = rr.params.depth_pitch;
 
-                void* map_data;
                 void* out_data = pen::memory_alloc(data_size);
-                vkMapMemory(_ctx.device, rr.mem, 0, data_size, 0, &map_data);
-                memcpy(out_data, map_data, (size_t)data_size);
-                vkUnmapMemory(_ctx.device, rr.mem);
+                memcpy(out_data, rr.mem.mapped, (size_t)data_size);
 
                 //clean up vk mem
                 vkDestroyBuffer(_ctx.device, rr.buf, nullptr);
-                vkFreeMemory(_ctx.device, rr.mem, nullptr);
+                mem_free(rr.mem);
 
                 rr.params.call_back_function(out_data, rr.params.row_pitch, rr.params.depth_pitch, rr.params.block_size);
 
@@ -2653,10 +3787,20 @@ namespace pen
                 CHECK_CALL(vkQueueSubmit(_ctx.compute_queue, 1, &compute_submit_info, _ctx.compute_fences[_ctx.ii]));
             }
 
+            // staging copies go first in the same submission
+            VkCommandBuffer cmd_bufs[2];
+            u32             num_cmd_bufs = 0;
+
+            VkCommandBuffer upload = flush_uploads();
+            if (upload)
+                cmd_bufs[num_cmd_bufs++] = upload;
+
+            cmd_bufs[num_cmd_bufs++] = _ctx.cmd_bufs[_ctx.ii];
+
             VkSubmitInfo info = {};
             info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-            info.commandBufferCount = 1;
-            info.pCommandBuffers = &_ctx.cmd_bufs[_ctx.ii];
+            info.commandBufferCount = num_cmd_bufs;
+            info.pCommandBuffers = cmd_bufs;
 
             // wait
             VkSemaphore          sem_wait[] = {_ctx.sem_img_avail[_ctx.ii]};
@@ -2672,6 +3816,7 @@ namespace pen
             info.signalSemaphoreCount = 1;
 
             CHECK_CALL(vkQueueSubmit(_ctx.graphics_queue, 1, &info, _ctx.fences[_ctx.ii]));
+            _ctx.fence_frames[_ctx.ii] = _renderer_frame_index() + 1;
 
             VkSwapchainKHR   swapChains[] = {_ctx.swap_chain};
             VkPresentInfoKHR present = {};
@@ -2691,6 +3836,7 @@ namespace pen
             {
                 g_window_resize = 0;
                 vkDeviceWaitIdle(_ctx.device);
+                _renderer_frame_completed(_renderer_frame_index());
                 create_swapchain();
                 next_frame = 0;
             }
@@ -2711,6 +3857,14 @@ namespace pen
 
         void renderer_replace_resource(u32 dest, u32 src, e_renderer_resource type)
         {
+            // swap so src holds the previous resource, the front end releases it once the gpu has finished with it
+            resource_allocation prev;
+            memcpy(&prev, &_res_pool[dest], sizeof(resource_allocation));
+            memcpy(&_res_pool[dest], &_res_pool[src], sizeof(resource_allocation));
+            memcpy(&_res_pool[src], &prev, sizeof(resource_allocation));
+
+            descriptor_cache_invalidate(dest);
+            descriptor_cache_invalidate(src);
         }
 
         void renderer_release_shader(u32 shader_index, u32 shader_type)
@@ -2727,13 +3881,11 @@ namespace pen
         void renderer_release_buffer(u32 buffer_index)
         {
             vulkan_buffer& buf = _res_pool.get(buffer_index).buffer;
-            u32            c = buf.dynamic ? NBB : 1;
 
-            for (u32 i = 0; i < c; ++i)
-            {
-                vkDestroyBuffer(_ctx.device, buf.buf[i], nullptr);
-                vkFreeMemory(_ctx.device, buf.mem[i], nullptr);
-            }
+            vkDestroyBuffer(_ctx.device, buf.buf, nullptr);
+            mem_free(buf.mem);
+
+            descriptor_cache_invalidate(buffer_index);
         }
 
         void renderer_release_texture(u32 texture_index)
@@ -2742,12 +3894,15 @@ namespace pen
 
             vkDestroyImage(_ctx.device, vt.image, nullptr);
             vkDestroyImageView(_ctx.device, vt.image_view, nullptr);
-            vkFreeMemory(_ctx.device, vt.mem, nullptr);
+            mem_free(vt.mem);
+
+            descriptor_cache_invalidate(texture_index);
         }
 
         void renderer_release_sampler(u32 sampler)
         {
             vkDestroySampler(_ctx.device, _res_pool.get(sampler).sampler, nullptr);
+            descriptor_cache_invalidate(sampler);
         }
 
         void renderer_release_raster_state(u32 raster_state_index)
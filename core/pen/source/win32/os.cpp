@@ -149,6 +149,8 @@ namespace
             pen::renderer_test_enable();
         }
 
+        pen::renderer_capture_parse_args(__argc, __argv);
+
         window_params wp;
         wp.cmdshow = nCmdShow;
         wp.hinstance = hInstance;
@@ -159,6 +161,7 @@ namespace
         // renderer_init will enter a loop wait for rendering commands, and call os update
         HWND hwnd = (HWND)pen::window_get_primary_display_handle();
         create_ctx(hwnd);
+        pen::renderer_set_max_frames_in_flight(s_ctx.creation_params.max_frames_in_flight);
         pen::renderer_init((void*)&hwnd, true, s_ctx.creation_params.max_renderer_commands);
 
         return s_ctx.return_code;
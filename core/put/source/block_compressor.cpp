@@ -0,0 +1,1225 @@
+// block_compressor.cpp
+// Copyright 2014 - 2023 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+#include "block_compressor.h"
+
+#include "dev_ui.h"
+
+#include "console.h"
+#include "data_struct.h"
+#include "memory.h"
+#include "threads.h"
+#include "timer.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#if __SSE2__ || __AVX2__ || __AVX__
+#include <immintrin.h>
+#define BC_SIMD_SSE 1
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define BC_SIMD_NEON 1
+#endif
+
+namespace put
+{
+    namespace
+    {
+        static const u32 k_grain_blocks = 256;         // blocks encoded by each job
+        static const u32 k_parallel_blocks = 1024;     // fewer blocks than this are encoded on the calling thread
+        static const u32 k_all_pixels = 0xffff;        // pixel masks, bit per pixel of a block
+        static const u32 k_bc7_mode6 = 1 << 6;         // mode is unary, 6 zero bits then a one
+        static const f32 k_rgb_weights[4] = {1.0f, 1.0f, 1.0f, 0.0f};
+        static const f32 k_rgba_weights[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+        static const u32 k_bc7_weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+        struct bc_block
+        {
+            f32 px[4][16]; // channel major rgba, 0-255
+            u8  rgba[16][4];
+        };
+
+        struct bc_image
+        {
+            u32 src_offset;
+            u32 dst_offset;
+            u32 width;
+            u32 height;
+            u32 first_row; // of blocks, counted over all images
+        };
+
+        struct bc_job
+        {
+            const u8*       src;
+            u8*             dst;
+            const bc_image* images;
+            u32             num_images;
+            u32             src_format;
+            u32             bc_format;
+            u32             block_bytes;
+            bc_preset       preset;
+            bool            simd;
+        };
+
+        struct bit_writer
+        {
+            u8* out;
+            u32 pos;
+
+            void write(u32 v, u32 bits)
+            {
+                for (u32 i = 0; i < bits; ++i, ++pos)
+                    out[pos >> 3] |= ((v >> i) & 1) << (pos & 7);
+            }
+        };
+
+        struct bit_reader
+        {
+            const u8* in;
+            u32       pos;
+
+            u32 read(u32 bits)
+            {
+                u32 v = 0;
+                for (u32 i = 0; i < bits; ++i, ++pos)
+                    v |= ((in[pos >> 3] >> (pos & 7)) & 1) << i;
+                return v;
+            }
+        };
+
+        u32 get_src_texel_size(u32 format)
+        {
+            switch (format)
+            {
+                case PEN_TEX_FORMAT_RGBA8_UNORM:
+                case PEN_TEX_FORMAT_BGRA8_UNORM:
+                case PEN_TEX_FORMAT_R32_FLOAT:
+                    return 4;
+                case PEN_TEX_FORMAT_R8_UNORM:
+                    return 1;
+            }
+
+            return 0;
+        }
+
+        u32 get_block_bytes(u32 bc_format)
+        {
+            return bc_format == PEN_TEX_FORMAT_BC1_UNORM || bc_format == PEN_TEX_FORMAT_BC4_UNORM ? 8 : 16;
+        }
+
+        const c8* get_format_name(u32 format)
+        {
+            switch (format)
+            {
+                case PEN_TEX_FORMAT_BC1_UNORM:
+                    return "BC1";
+                case PEN_TEX_FORMAT_BC3_UNORM:
+                    return "BC3";
+                case PEN_TEX_FORMAT_BC4_UNORM:
+                    return "BC4";
+                case PEN_TEX_FORMAT_BC5_UNORM:
+                    return "BC5";
+                case PEN_TEX_FORMAT_BC7_UNORM:
+                    return "BC7";
+            }
+
+            return "unknown";
+        }
+
+        f32 clamp_unorm(f32 v)
+        {
+            return std::min(std::max(v, 0.0f), 255.0f);
+        }
+
+        void fetch_block(const bc_job& job, const bc_image& img, u32 bx, u32 by, bc_block& b)
+        {
+            // edge blocks of images which are not a multiple of 4 repeat the last row and column
+            u32       ts = get_src_texel_size(job.src_format);
+            const u8* src = job.src + img.src_offset;
+
+            for (u32 y = 0; y < 4; ++y)
+            {
+                for (u32 x = 0; x < 4; ++x)
+                {
+                    u32       sx = std::min(bx * 4 + x, img.width - 1);
+                    u32       sy = std::min(by * 4 + y, img.height - 1);
+                    const u8* p = src + (sy * img.width + sx) * ts;
+                    u8*       c = b.rgba[y * 4 + x];
+
+                    switch (job.src_format)
+                    {
+                        case PEN_TEX_FORMAT_RGBA8_UNORM:
+                            memcpy(c, p, 4);
+                            break;
+                        case PEN_TEX_FORMAT_BGRA8_UNORM:
+                            c[0] = p[2];
+                            c[1] = p[1];
+                            c[2] = p[0];
+                            c[3] = p[3];
+                            break;
+                        case PEN_TEX_FORMAT_R8_UNORM:
+                            c[0] = p[0];
+                            c[1] = c[2] = 0;
+                            c[3] = 255;
+                            break;
+                        case PEN_TEX_FORMAT_R32_FLOAT:
+                        {
+                            f32 f;
+                            memcpy(&f, p, 4);
+                            c[0] = (u8)(clamp_unorm(f * 255.0f) + 0.5f);
+                            c[1] = c[2] = 0;
+                            c[3] = 255;
+                        }
+                        break;
+                    }
+                }
+            }
+
+            for (u32 i = 0; i < 16; ++i)
+                for (u32 c = 0; c < 4; ++c)
+                    b.px[c][i] = (f32)b.rgba[i][c];
+        }
+
+        //
+        // endpoint and index fitting shared by all formats
+        //
+
+        f32 fit_indices(const bc_block& b, const f32 (*palette)[4], u32 n, const f32* w, u32 mask, u8* indices,
+                        bool simd)
+        {
+            // nearest palette entry for each pixel by weighted squared distance, returns the error of masked pixels
+            f32 err = 0.0f;
+            u32 i = 0;
+
+            if (simd)
+            {
+#if BC_SIMD_SSE
+                __m128 wr = _mm_set1_ps(w[0]);
+                __m128 wg = _mm_set1_ps(w[1]);
+                __m128 wb = _mm_set1_ps(w[2]);
+                __m128 wa = _mm_set1_ps(w[3]);
+
+                for (; i < 16; i += 4)
+                {
+                    __m128 pr = _mm_loadu_ps(&b.px[0][i]);
+                    __m128 pg = _mm_loadu_ps(&b.px[1][i]);
+                    __m128 pb = _mm_loadu_ps(&b.px[2][i]);
+                    __m128 pa = _mm_loadu_ps(&b.px[3][i]);
+
+                    __m128 best = _mm_set1_ps(FLT_MAX);
+                    __m128 best_i = _mm_setzero_ps();
+                    for (u32 e = 0; e < n; ++e)
+                    {
+                        __m128 dr = _mm_sub_ps(pr, _mm_set1_ps(palette[e][0]));
+                        __m128 dg = _mm_sub_ps(pg, _mm_set1_ps(palette[e][1]));
+                        __m128 db = _mm_sub_ps(pb, _mm_set1_ps(palette[e][2]));
+                        __m128 da = _mm_sub_ps(pa, _mm_set1_ps(palette[e][3]));
+
+                        __m128 d = _mm_mul_ps(_mm_mul_ps(dr, dr), wr);
+                        d = _mm_add_ps(d, _mm_mul_ps(_mm_mul_ps(dg, dg), wg));
+                        d = _mm_add_ps(d, _mm_mul_ps(_mm_mul_ps(db, db), wb));
+                        d = _mm_add_ps(d, _mm_mul_ps(_mm_mul_ps(da, da), wa));
+
+                        __m128 closer = _mm_cmplt_ps(d, best);
+                        best = _mm_min_ps(d, best);
+                        best_i = _mm_or_ps(_mm_and_ps(closer, _mm_set1_ps((f32)e)), _mm_andnot_ps(closer, best_i));
+                    }
+
+                    f32 be[4], bi[4];
+                    _mm_storeu_ps(be, best);
+                    _mm_storeu_ps(bi, best_i);
+                    for (u32 j = 0; j < 4; ++j)
+                    {
+                        indices[i + j] = (u8)bi[j];
+                        if (mask & (1 << (i + j)))
+                            err += be[j];
+                    }
+                }
+#elif BC_SIMD_NEON
+                for (; i < 16; i += 4)
+                {
+                    float32x4_t pr = vld1q_f32(&b.px[0][i]);
+                    float32x4_t pg = vld1q_f32(&b.px[1][i]);
+                    float32x4_t pb = vld1q_f32(&b.px[2][i]);
+                    float32x4_t pa = vld1q_f32(&b.px[3][i]);
+
+                    float32x4_t best = vdupq_n_f32(FLT_MAX);
+                    float32x4_t best_i = vdupq_n_f32(0.0f);
+                    for (u32 e = 0; e < n; ++e)
+                    {
+                        float32x4_t dr = vsubq_f32(pr, vdupq_n_f32(palette[e][0]));
+                        float32x4_t dg = vsubq_f32(pg, vdupq_n_f32(palette[e][1]));
+                        float32x4_t db = vsubq_f32(pb, vdupq_n_f32(palette[e][2]));
+                        float32x4_t da = vsubq_f32(pa, vdupq_n_f32(palette[e][3]));
+
+                        float32x4_t d = vmulq_n_f32(vmulq_f32(dr, dr), w[0]);
+                        d = vmlaq_n_f32(d, vmulq_f32(dg, dg), w[1]);
+                        d = vmlaq_n_f32(d, vmulq_f32(db, db), w[2]);
+                        d = vmlaq_n_f32(d, vmulq_f32(da, da), w[3]);
+
+                        uint32x4_t closer = vcltq_f32(d, best);
+                        best = vminq_f32(d, best);
+                        best_i = vbslq_f32(closer, vdupq_n_f32((f32)e), best_i);
+                    }
+
+                    f32 be[4], bi[4];
+                    vst1q_f32(be, best);
+                    vst1q_f32(bi, best_i);
+                    for (u32 j = 0; j < 4; ++j)
+                    {
+                        indices[i + j] = (u8)bi[j];
+                        if (mask & (1 << (i + j)))
+                            err += be[j];
+                    }
+                }
+#endif
+            }
+
+            for (; i < 16; ++i)
+            {
+                f32 best = FLT_MAX;
+                for (u32 e = 0; e < n; ++e)
+                {
+                    f32 d = 0.0f;
+                    for (u32 c = 0; c < 4; ++c)
+                    {
+                        f32 dc = b.px[c][i] - palette[e][c];
+                        d += dc * dc * w[c];
+                    }
+
+                    if (d < best)
+                    {
+                        best = d;
+                        indices[i] = (u8)e;
+                    }
+                }
+
+                if (mask & (1 << i))
+                    err += best;
+            }
+
+            return err;
+        }
+
+        void fit_endpoints(const bc_block& b, u32 first, u32 channels, u32 mask, bc_preset preset, f32* lo, f32* hi)
+        {
+            // bounding box for fast, otherwise the extent of the pixels along their principal axis
+            f32 mean[4] = {0};
+            f32 mn[4] = {FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX};
+            f32 mx[4] = {0};
+            u32 count = 0;
+
+            for (u32 i = 0; i < 16; ++i)
+            {
+                if (!(mask & (1 << i)))
+                    continue;
+
+                for (u32 c = 0; c < channels; ++c)
+                {
+                    f32 v = b.px[first + c][i];
+                    mean[c] += v;
+                    mn[c] = std::min(mn[c], v);
+                    mx[c] = std::max(mx[c], v);
+                }
+                count++;
+            }
+
+            if (count == 0)
+            {
+                memset(lo, 0, channels * sizeof(f32));
+                memset(hi, 0, channels * sizeof(f32));
+                return;
+            }
+
+            memcpy(lo, mn, channels * sizeof(f32));
+            memcpy(hi, mx, channels * sizeof(f32));
+
+            if (preset == e_bc_preset::fast || channels == 1)
+                return;
+
+            for (u32 c = 0; c < channels; ++c)
+                mean[c] /= (f32)count;
+
+            f32 cov[4][4] = {{0}};
+            for (u32 i = 0; i < 16; ++i)
+            {
+                if (!(mask & (1 << i)))
+                    continue;
+
+                f32 d[4];
+                for (u32 c = 0; c < channels; ++c)
+                    d[c] = b.px[first + c][i] - mean[c];
+
+                for (u32 r = 0; r < channels; ++r)
+                    for (u32 c = 0; c < channels; ++c)
+                        cov[r][c] += d[r] * d[c];
+            }
+
+            // power iteration from the bounding box diagonal
+            f32 axis[4];
+            for (u32 c = 0; c < channels; ++c)
+                axis[c] = mx[c] - mn[c];
+
+            for (u32 it = 0; it < 8; ++it)
+            {
+                f32 v[4] = {0};
+                f32 norm = 0.0f;
+                for (u32 r = 0; r < channels; ++r)
+                {
+                    for (u32 c = 0; c < channels; ++c)
+                        v[r] += cov[r][c] * axis[c];
+                    norm = std::max(norm, fabsf(v[r]));
+                }
+
+                if (norm < 1e-6f)
+                    break;
+
+                for (u32 c = 0; c < channels; ++c)
+                    axis[c] = v[c] / norm;
+            }
+
+            f32 len = 0.0f;
+            for (u32 c = 0; c < channels; ++c)
+                len += axis[c] * axis[c];
+
+            if (len < 1e-12f)
+                return; // flat block, the bounding box is a point
+
+            f32 tmin = FLT_MAX;
+            f32 tmax = -FLT_MAX;
+            for (u32 i = 0; i < 16; ++i)
+            {
+                if (!(mask & (1 << i)))
+                    continue;
+
+                f32 t = 0.0f;
+                for (u32 c = 0; c < channels; ++c)
+                    t += (b.px[first + c][i] - mean[c]) * axis[c];
+
+                tmin = std::min(tmin, t);
+                tmax = std::max(tmax, t);
+            }
+
+            for (u32 c = 0; c < channels; ++c)
+            {
+                lo[c] = clamp_unorm(mean[c] + axis[c] * tmin / len);
+                hi[c] = clamp_unorm(mean[c] + axis[c] * tmax / len);
+            }
+        }
+
+        bool refine_endpoints(const bc_block& b, u32 first, u32 channels, u32 mask, const u8* indices, const f32* t,
+                              f32* lo, f32* hi)
+        {
+            // least squares endpoints for the chosen indices, t is the interpolation weight of each index
+            f32 aa = 0.0f, bb = 0.0f, ab = 0.0f;
+            f32 ax[4] = {0}, bx[4] = {0};
+
+            for (u32 i = 0; i < 16; ++i)
+            {
+                if (!(mask & (1 << i)))
+                    continue;
+
+                f32 ti = t[indices[i]];
+                f32 si = 1.0f - ti;
+                aa += si * si;
+                bb += ti * ti;
+                ab += si * ti;
+
+                for (u32 c = 0; c < channels; ++c)
+                {
+                    ax[c] += si * b.px[first + c][i];
+                    bx[c] += ti * b.px[first + c][i];
+                }
+            }
+
+            f32 det = aa * bb - ab * ab;
+            if (fabsf(det) < 1e-6f)
+                return false;
+
+            f32 inv = 1.0f / det;
+            for (u32 c = 0; c < channels; ++c)
+            {
+                lo[c] = clamp_unorm((ax[c] * bb - bx[c] * ab) * inv);
+                hi[c] = clamp_unorm((bx[c] * aa - ax[c] * ab) * inv);
+            }
+
+            return true;
+        }
+
+        //
+        // bc1 colour, used by bc1 and bc3
+        //
+
+        u16 pack_565(const f32* c)
+        {
+            u32 r = (u32)(c[0] * 31.0f / 255.0f + 0.5f);
+            u32 g = (u32)(c[1] * 63.0f / 255.0f + 0.5f);
+            u32 b = (u32)(c[2] * 31.0f / 255.0f + 0.5f);
+            return (u16)((r << 11) | (g << 5) | b);
+        }
+
+        void unpack_565(u16 v, f32* c)
+        {
+            u32 r = (v >> 11) & 31;
+            u32 g = (v >> 5) & 63;
+            u32 b = v & 31;
+            c[0] = (f32)((r << 3) | (r >> 2));
+            c[1] = (f32)((g << 2) | (g >> 4));
+            c[2] = (f32)((b << 3) | (b >> 2));
+            c[3] = 255.0f;
+        }
+
+        void colour_palette(u16 c0, u16 c1, f32 (*pal)[4])
+        {
+            unpack_565(c0, pal[0]);
+            unpack_565(c1, pal[1]);
+
+            if (c0 > c1)
+            {
+                for (u32 c = 0; c < 4; ++c)
+                {
+                    pal[2][c] = floorf((2.0f * pal[0][c] + pal[1][c]) / 3.0f);
+                    pal[3][c] = floorf((pal[0][c] + 2.0f * pal[1][c]) / 3.0f);
+                }
+            }
+            else
+            {
+                // 3 colours and transparent black
+                for (u32 c = 0; c < 4; ++c)
+                {
+                    pal[2][c] = floorf((pal[0][c] + pal[1][c]) * 0.5f);
+                    pal[3][c] = 0.0f;
+                }
+            }
+        }
+
+        f32 encode_colour(const bc_block& b, bc_preset preset, bool punch_through, u8* out, bool simd)
+        {
+            // 3 colour mode with transparent black when punch_through and any pixel has alpha < 128
+            u32 opaque = 0;
+            for (u32 i = 0; i < 16; ++i)
+                if (!punch_through || b.rgba[i][3] >= 128)
+                    opaque |= 1 << i;
+
+            bool three = opaque != k_all_pixels;
+
+            f32 lo[4], hi[4];
+            fit_endpoints(b, 0, 3, opaque, preset, lo, hi);
+
+            static const f32 t4[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+            static const f32 t3[4] = {0.0f, 1.0f, 0.5f, 0.0f};
+
+            f32 best_err = FLT_MAX;
+            u32 iterations = preset == e_bc_preset::high ? 3 : 1;
+            for (u32 it = 0; it < iterations; ++it)
+            {
+                u16 c0 = pack_565(hi);
+                u16 c1 = pack_565(lo);
+
+                // the endpoint order selects the mode, 4 colours when c0 > c1
+                if (three ? c0 > c1 : c0 < c1)
+                    std::swap(c0, c1);
+
+                f32 pal[4][4];
+                colour_palette(c0, c1, pal);
+
+                // equal endpoints decode in 3 colour mode, keep away from the transparent index
+                u32 n = three || c0 == c1 ? 3 : 4;
+
+                u8  indices[16];
+                f32 err = fit_indices(b, pal, n, k_rgb_weights, opaque, indices, simd);
+
+                if (err < best_err)
+                {
+                    best_err = err;
+
+                    u32 bits = 0;
+                    for (u32 i = 0; i < 16; ++i)
+                        bits |= (u32)((opaque & (1 << i)) ? indices[i] : 3) << (i * 2);
+
+                    memcpy(out, &c0, 2);
+                    memcpy(out + 2, &c1, 2);
+                    memcpy(out + 4, &bits, 4);
+                }
+
+                if (it + 1 < iterations)
+                {
+                    // refined endpoints map index 0 to lo, 1 to hi
+                    u32 mask = opaque;
+                    for (u32 i = 0; i < 16; ++i)
+                        if (three && indices[i] == 3)
+                            mask &= ~(1 << i);
+
+                    f32 rlo[4], rhi[4];
+                    if (!refine_endpoints(b, 0, 3, mask, indices, three ? t3 : t4, rlo, rhi))
+                        break;
+
+                    memcpy(lo, rlo, sizeof(f32) * 3);
+                    memcpy(hi, rhi, sizeof(f32) * 3);
+                }
+            }
+
+            return best_err;
+        }
+
+        //
+        // bc4 single channel, used by bc3 alpha, bc4 and bc5
+        //
+
+        void alpha_palette(u32 a0, u32 a1, f32* pal)
+        {
+            pal[0] = (f32)a0;
+            pal[1] = (f32)a1;
+
+            if (a0 > a1)
+            {
+                for (u32 i = 1; i < 7; ++i)
+                    pal[i + 1] = (f32)(((7 - i) * a0 + i * a1 + 3) / 7);
+            }
+            else
+            {
+                for (u32 i = 1; i < 5; ++i)
+                    pal[i + 1] = (f32)(((5 - i) * a0 + i * a1 + 2) / 5);
+
+                pal[6] = 0.0f;
+                pal[7] = 255.0f;
+            }
+        }
+
+        f32 fit_alpha(const f32* v, u32 a0, u32 a1, u8* indices)
+        {
+            f32 pal[8];
+            alpha_palette(a0, a1, pal);
+
+            f32 err = 0.0f;
+            for (u32 i = 0; i < 16; ++i)
+            {
+                f32 best = FLT_MAX;
+                for (u32 e = 0; e < 8; ++e)
+                {
+                    f32 d = (v[i] - pal[e]) * (v[i] - pal[e]);
+                    if (d < best)
+                    {
+                        best = d;
+                        indices[i] = (u8)e;
+                    }
+                }
+                err += best;
+            }
+
+            return err;
+        }
+
+        f32 encode_alpha(const bc_block& b, u32 channel, bc_preset preset, u8* out)
+        {
+            const f32* v = b.px[channel];
+
+            // interpolation weight of each index in both modes, fixed 0 and 255 are not refined
+            static const f32 t8[8] = {0.0f,        1.0f,        1.0f / 7.0f, 2.0f / 7.0f,
+                                      3.0f / 7.0f, 4.0f / 7.0f, 5.0f / 7.0f, 6.0f / 7.0f};
+            static const f32 t6[8] = {0.0f, 1.0f, 0.2f, 0.4f, 0.6f, 0.8f, 0.0f, 0.0f};
+
+            f32 mn = 255.0f, mx = 0.0f;
+            f32 mn6 = 255.0f, mx6 = 0.0f; // without the values 6 colour mode has exactly
+            for (u32 i = 0; i < 16; ++i)
+            {
+                mn = std::min(mn, v[i]);
+                mx = std::max(mx, v[i]);
+                if (v[i] > 0.0f && v[i] < 255.0f)
+                {
+                    mn6 = std::min(mn6, v[i]);
+                    mx6 = std::max(mx6, v[i]);
+                }
+            }
+
+            if (mn6 > mx6)
+                mn6 = mx6 = mn;
+
+            u32 iterations = preset == e_bc_preset::high ? 2 : 1;
+            u32 num_modes = preset == e_bc_preset::fast ? 1 : 2;
+
+            f32 best_err = FLT_MAX;
+            u32 best_a0 = 0, best_a1 = 0;
+            u8  best_indices[16] = {0};
+
+            for (u32 mode = 0; mode < num_modes; ++mode)
+            {
+                bool eight = mode == 0;
+                f32  lo = eight ? mn : mn6;
+                f32  hi = eight ? mx : mx6;
+
+                for (u32 it = 0; it < iterations; ++it)
+                {
+                    u32 a_lo = (u32)(lo + 0.5f);
+                    u32 a_hi = (u32)(hi + 0.5f);
+
+                    // a0 > a1 selects 8 interpolated values, otherwise 6 with 0 and 255
+                    u32 a0 = eight ? a_hi : a_lo;
+                    u32 a1 = eight ? a_lo : a_hi;
+                    if (eight && a0 == a1)
+                        a0 = std::min<u32>(a0 + 1, 255), a1 = a0 == 255 ? 254 : a1;
+
+                    u8  indices[16];
+                    f32 err = fit_alpha(v, a0, a1, indices);
+                    if (err < best_err)
+                    {
+                        best_err = err;
+                        best_a0 = a0;
+                        best_a1 = a1;
+                        memcpy(best_indices, indices, 16);
+                    }
+
+                    if (it + 1 == iterations)
+                        break;
+
+                    u32 mask = 0;
+                    for (u32 i = 0; i < 16; ++i)
+                        if (eight || indices[i] < 6)
+                            mask |= 1 << i;
+
+                    f32 r0, r1;
+                    if (!refine_endpoints(b, channel, 1, mask, indices, eight ? t8 : t6, &r0, &r1))
+                        break;
+
+                    // index 0 is a0
+                    lo = eight ? r1 : r0;
+                    hi = eight ? r0 : r1;
+                    if (lo > hi)
+                        std::swap(lo, hi);
+                }
+            }
+
+            out[0] = (u8)best_a0;
+            out[1] = (u8)best_a1;
+
+            u64 bits = 0;
+            for (u32 i = 0; i < 16; ++i)
+                bits |= (u64)best_indices[i] << (i * 3);
+
+            for (u32 i = 0; i < 6; ++i)
+                out[2 + i] = (u8)(bits >> (i * 8));
+
+            return best_err;
+        }
+
+        //
+        // bc7 mode 6, one subset of rgba with 7 bit endpoints, a p bit each and 4 bit indices
+        //
+
+        u32 quantise_bc7(f32 v, u32 p)
+        {
+            s32 q = (s32)floorf((v - (f32)p) * 0.5f + 0.5f);
+            return (u32)std::min<s32>(std::max<s32>(q, 0), 127);
+        }
+
+        u32 best_pbit(const f32* e)
+        {
+            f32 err[2] = {0.0f, 0.0f};
+            for (u32 p = 0; p < 2; ++p)
+            {
+                for (u32 c = 0; c < 4; ++c)
+                {
+                    f32 d = (f32)((quantise_bc7(e[c], p) << 1) | p) - e[c];
+                    err[p] += d * d;
+                }
+            }
+
+            return err[1] < err[0] ? 1 : 0;
+        }
+
+        void bc7_palette(const u32* q0, u32 p0, const u32* q1, u32 p1, f32 (*pal)[4])
+        {
+            for (u32 c = 0; c < 4; ++c)
+            {
+                u32 e0 = (q0[c] << 1) | p0;
+                u32 e1 = (q1[c] << 1) | p1;
+                for (u32 i = 0; i < 16; ++i)
+                    pal[i][c] = (f32)(((64 - k_bc7_weights[i]) * e0 + k_bc7_weights[i] * e1 + 32) >> 6);
+            }
+        }
+
+        f32 encode_bc7(const bc_block& b, bc_preset preset, u8* out, bool simd)
+        {
+            f32 lo[4], hi[4];
+            fit_endpoints(b, 0, 4, k_all_pixels, preset, lo, hi);
+
+            f32 t[16];
+            for (u32 i = 0; i < 16; ++i)
+                t[i] = (f32)k_bc7_weights[i] / 64.0f;
+
+            f32 best_err = FLT_MAX;
+            u32 best_q0[4], best_q1[4], best_p0 = 0, best_p1 = 0;
+            u8  best_indices[16];
+
+            u32 iterations = preset == e_bc_preset::high ? 2 : 1;
+            for (u32 it = 0; it < iterations; ++it)
+            {
+                // high searches all p bit pairs, otherwise each endpoint takes the p bit closest to it
+                u32 num_pbits = preset == e_bc_preset::high ? 4 : 1;
+                for (u32 pb = 0; pb < num_pbits; ++pb)
+                {
+                    u32 p0 = num_pbits == 1 ? best_pbit(lo) : pb & 1;
+                    u32 p1 = num_pbits == 1 ? best_pbit(hi) : pb >> 1;
+
+                    u32 q0[4], q1[4];
+                    for (u32 c = 0; c < 4; ++c)
+                    {
+                        q0[c] = quantise_bc7(lo[c], p0);
+                        q1[c] = quantise_bc7(hi[c], p1);
+                    }
+
+                    f32 pal[16][4];
+                    bc7_palette(q0, p0, q1, p1, pal);
+
+                    u8  indices[16];
+                    f32 err = fit_indices(b, pal, 16, k_rgba_weights, k_all_pixels, indices, simd);
+                    if (err < best_err)
+                    {
+                        best_err = err;
+                        memcpy(best_q0, q0, sizeof(q0));
+                        memcpy(best_q1, q1, sizeof(q1));
+                        memcpy(best_indices, indices, 16);
+                        best_p0 = p0;
+                        best_p1 = p1;
+                    }
+                }
+
+                if (it + 1 < iterations && !refine_endpoints(b, 0, 4, k_all_pixels, best_indices, t, lo, hi))
+                    break;
+            }
+
+            // the msb of the first index is implicit 0, swap the endpoints to make it so
+            if (best_indices[0] & 8)
+            {
+                std::swap(best_q0, best_q1);
+                std::swap(best_p0, best_p1);
+                for (u32 i = 0; i < 16; ++i)
+                    best_indices[i] = 15 - best_indices[i];
+            }
+
+            memset(out, 0, 16);
+            bit_writer bw = {out, 0};
+            bw.write(k_bc7_mode6, 7);
+
+            for (u32 c = 0; c < 4; ++c)
+            {
+                bw.write(best_q0[c], 7);
+                bw.write(best_q1[c], 7);
+            }
+
+            bw.write(best_p0, 1);
+            bw.write(best_p1, 1);
+
+            bw.write(best_indices[0], 3);
+            for (u32 i = 1; i < 16; ++i)
+                bw.write(best_indices[i], 4);
+
+            return best_err;
+        }
+
+        void encode_block(const bc_job& job, const bc_block& b, u8* out)
+        {
+            switch (job.bc_format)
+            {
+                case PEN_TEX_FORMAT_BC1_UNORM:
+                    encode_colour(b, job.preset, true, out, job.simd);
+                    break;
+                case PEN_TEX_FORMAT_BC3_UNORM:
+                    encode_alpha(b, 3, job.preset, out);
+                    encode_colour(b, job.preset, false, out + 8, job.simd);
+                    break;
+                case PEN_TEX_FORMAT_BC4_UNORM:
+                    encode_alpha(b, 0, job.preset, out);
+                    break;
+                case PEN_TEX_FORMAT_BC5_UNORM:
+                    encode_alpha(b, 0, job.preset, out);
+                    encode_alpha(b, 1, job.preset, out + 8);
+                    break;
+                case PEN_TEX_FORMAT_BC7_UNORM:
+                    encode_bc7(b, job.preset, out, job.simd);
+                    break;
+            }
+        }
+
+        void encode_rows(u32 start, u32 end, void* user_data)
+        {
+            const bc_job& job = *(const bc_job*)user_data;
+
+            // rows of blocks are numbered over all images, find the image of the first row then walk forward
+            const bc_image* first = job.images;
+            const bc_image* last = job.images + job.num_images;
+            const bc_image* img = std::upper_bound(first, last, start,
+                                                   [](u32 row, const bc_image& i) { return row < i.first_row; }) -
+                                  1;
+
+            bc_block b;
+            for (u32 r = start; r < end; ++r)
+            {
+                while (img + 1 < last && r >= (img + 1)->first_row)
+                    ++img;
+
+                u32 bw = (img->width + 3) / 4;
+                u32 by = r - img->first_row;
+                u8* dst = job.dst + img->dst_offset + by * bw * job.block_bytes;
+
+                for (u32 bx = 0; bx < bw; ++bx)
+                {
+                    fetch_block(job, *img, bx, by, b);
+                    encode_block(job, b, dst + bx * job.block_bytes);
+                }
+            }
+        }
+
+        //
+        // decoding, for quality measurement
+        //
+
+        void decode_colour(const u8* block, u8 rgba[16][4])
+        {
+            u16 c0, c1;
+            u32 bits;
+            memcpy(&c0, block, 2);
+            memcpy(&c1, block + 2, 2);
+            memcpy(&bits, block + 4, 4);
+
+            f32 pal[4][4];
+            colour_palette(c0, c1, pal);
+
+            for (u32 i = 0; i < 16; ++i)
+            {
+                u32 idx = (bits >> (i * 2)) & 3;
+                for (u32 c = 0; c < 3; ++c)
+                    rgba[i][c] = (u8)pal[idx][c];
+
+                rgba[i][3] = (c0 <= c1 && idx == 3) ? 0 : 255;
+            }
+        }
+
+        void decode_alpha(const u8* block, u8 rgba[16][4], u32 channel)
+        {
+            f32 pal[8];
+            alpha_palette(block[0], block[1], pal);
+
+            u64 bits = 0;
+            for (u32 i = 0; i < 6; ++i)
+                bits |= (u64)block[2 + i] << (i * 8);
+
+            for (u32 i = 0; i < 16; ++i)
+                rgba[i][channel] = (u8)pal[(bits >> (i * 3)) & 7];
+        }
+
+        void decode_bc7(const u8* block, u8 rgba[16][4])
+        {
+            bit_reader br = {block, 0};
+            if (br.read(7) != k_bc7_mode6)
+            {
+                PEN_ASSERT_MSG(0, "only bc7 mode 6 blocks are decoded");
+                memset(rgba, 0, 64);
+                return;
+            }
+
+            u32 q0[4], q1[4];
+            for (u32 c = 0; c < 4; ++c)
+            {
+                q0[c] = br.read(7);
+                q1[c] = br.read(7);
+            }
+
+            u32 p0 = br.read(1);
+            u32 p1 = br.read(1);
+
+            f32 pal[16][4];
+            bc7_palette(q0, p0, q1, p1, pal);
+
+            for (u32 i = 0; i < 16; ++i)
+            {
+                u32 idx = br.read(i == 0 ? 3 : 4);
+                for (u32 c = 0; c < 4; ++c)
+                    rgba[i][c] = (u8)pal[idx][c];
+            }
+        }
+
+        u32 get_psnr_channels(u32 bc_format)
+        {
+            switch (bc_format)
+            {
+                case PEN_TEX_FORMAT_BC1_UNORM:
+                    return 3;
+                case PEN_TEX_FORMAT_BC4_UNORM:
+                    return 1;
+                case PEN_TEX_FORMAT_BC5_UNORM:
+                    return 2;
+            }
+
+            return 4;
+        }
+    } // namespace
+
+    bool can_compress_texture(const pen::texture_creation_params& tcp, u32 bc_format)
+    {
+        if (!tcp.data || tcp.pixels_per_block > 1)
+            return false;
+
+        bool rgba = tcp.format == PEN_TEX_FORMAT_RGBA8_UNORM || tcp.format == PEN_TEX_FORMAT_BGRA8_UNORM;
+        switch (bc_format)
+        {
+            case PEN_TEX_FORMAT_BC1_UNORM:
+            case PEN_TEX_FORMAT_BC3_UNORM:
+            case PEN_TEX_FORMAT_BC5_UNORM:
+            case PEN_TEX_FORMAT_BC7_UNORM:
+                return rgba;
+            case PEN_TEX_FORMAT_BC4_UNORM:
+                return get_src_texel_size(tcp.format) != 0;
+        }
+
+        return false;
+    }
+
+    bool compress_texture(pen::texture_creation_params& tcp, u32 bc_format, bc_preset preset, u32 flags)
+    {
+        if (!can_compress_texture(tcp, bc_format))
+            return false;
+
+        u32  ts = get_src_texel_size(tcp.format);
+        u32  bb = get_block_bytes(bc_format);
+        bool volume = tcp.collection_type == pen::TEXTURE_COLLECTION_VOLUME;
+        u32  num_slices = volume ? 1 : tcp.num_arrays;
+        u32  num_mips = std::max<s32>(tcp.num_mips, 1);
+
+        // images in memory order, slices each with a chain of mips, volume mips each with their depth slices
+        std::vector<bc_image> images;
+        u32                   src_offset = 0;
+        u32                   dst_offset = 0;
+        u32                   num_rows = 0;
+        for (u32 s = 0; s < num_slices; ++s)
+        {
+            for (u32 m = 0; m < num_mips; ++m)
+            {
+                u32 w = std::max<u32>(tcp.width >> m, 1);
+                u32 h = std::max<u32>(tcp.height >> m, 1);
+                u32 d = volume ? std::max<u32>(tcp.num_arrays >> m, 1) : 1;
+
+                for (u32 z = 0; z < d; ++z)
+                {
+                    images.push_back({src_offset, dst_offset, w, h, num_rows});
+
+                    src_offset += w * h * ts;
+                    dst_offset += ((w + 3) / 4) * ((h + 3) / 4) * bb;
+                    num_rows += (h + 3) / 4;
+                }
+            }
+        }
+
+        if (src_offset > tcp.data_size)
+        {
+            PEN_LOG("[block compressor] data size %u is smaller than the texture %u", tcp.data_size, src_offset);
+            return false;
+        }
+
+        bc_job job;
+        job.src = (const u8*)tcp.data;
+        job.dst = (u8*)pen::memory_alloc(dst_offset);
+        job.images = images.data();
+        job.num_images = (u32)images.size();
+        job.src_format = tcp.format;
+        job.bc_format = bc_format;
+        job.block_bytes = bb;
+        job.preset = preset;
+        job.simd = !(flags & e_bc_flags::scalar);
+
+        u32 bw = (tcp.width + 3) / 4;
+        if ((flags & e_bc_flags::single_threaded) || num_rows * bw < k_parallel_blocks)
+            encode_rows(0, num_rows, &job);
+        else
+            pen::jobs_parallel_for(num_rows, std::max<u32>(k_grain_blocks / bw, 1), encode_rows, &job);
+
+        tcp.data = job.dst;
+        tcp.data_size = dst_offset;
+        tcp.format = bc_format;
+        tcp.block_size = bb;
+        tcp.pixels_per_block = 4;
+
+        return true;
+    }
+
+    void decompress_block(u32 bc_format, const u8* block, u8 rgba[16][4])
+    {
+        // channels the format does not store decode as 0, alpha as 255
+        for (u32 i = 0; i < 16; ++i)
+        {
+            rgba[i][0] = rgba[i][1] = rgba[i][2] = 0;
+            rgba[i][3] = 255;
+        }
+
+        switch (bc_format)
+        {
+            case PEN_TEX_FORMAT_BC1_UNORM:
+                decode_colour(block, rgba);
+                break;
+            case PEN_TEX_FORMAT_BC3_UNORM:
+                decode_colour(block + 8, rgba);
+                decode_alpha(block, rgba, 3);
+                break;
+            case PEN_TEX_FORMAT_BC4_UNORM:
+                decode_alpha(block, rgba, 0);
+                break;
+            case PEN_TEX_FORMAT_BC5_UNORM:
+                decode_alpha(block, rgba, 0);
+                decode_alpha(block + 8, rgba, 1);
+                break;
+            case PEN_TEX_FORMAT_BC7_UNORM:
+                decode_bc7(block, rgba);
+                break;
+        }
+    }
+
+    bc_benchmark_result* benchmark_block_compression(u32 size, u32 iterations)
+    {
+        static const u32 formats[] = {PEN_TEX_FORMAT_BC1_UNORM, PEN_TEX_FORMAT_BC3_UNORM, PEN_TEX_FORMAT_BC4_UNORM,
+                                      PEN_TEX_FORMAT_BC5_UNORM, PEN_TEX_FORMAT_BC7_UNORM};
+
+        size = PEN_ALIGN(std::max<u32>(size, 4), 4);
+        iterations = std::max<u32>(iterations, 1);
+
+        // smooth gradients and waves with some noise, closer to real content than noise alone
+        pen::texture_creation_params tcp = {};
+        tcp.width = size;
+        tcp.height = size;
+        tcp.num_mips = 1;
+        tcp.num_arrays = 1;
+        tcp.format = PEN_TEX_FORMAT_RGBA8_UNORM;
+        tcp.block_size = 4;
+        tcp.pixels_per_block = 1;
+        tcp.collection_type = pen::TEXTURE_COLLECTION_NONE;
+        tcp.data_size = size * size * 4;
+
+        u8* image = (u8*)pen::memory_alloc(tcp.data_size);
+        u32 seed = 0x9e3779b9;
+        for (u32 y = 0; y < size; ++y)
+        {
+            for (u32 x = 0; x < size; ++x)
+            {
+                seed = seed * 1664525 + 1013904223;
+                f32 u = (f32)x / (f32)size;
+                f32 v = (f32)y / (f32)size;
+                f32 n = (f32)(seed >> 28);
+
+                u8* p = image + (y * size + x) * 4;
+                p[0] = (u8)clamp_unorm(u * 255.0f + n);
+                p[1] = (u8)clamp_unorm((0.5f + 0.5f * sinf(u * 20.0f + v * 7.0f)) * 255.0f);
+                p[2] = (u8)clamp_unorm(v * 200.0f + 55.0f * cosf(u * 13.0f) - n);
+                p[3] = (u8)clamp_unorm((0.5f + 0.5f * sinf(v * 11.0f)) * 255.0f);
+            }
+        }
+        tcp.data = image;
+
+        static const u32 modes[] = {e_bc_flags::scalar | e_bc_flags::single_threaded, e_bc_flags::single_threaded, 0};
+
+        pen::timer*          timer = pen::timer_create();
+        bc_benchmark_result* results = nullptr;
+
+        for (u32 format : formats)
+        {
+            for (u32 preset = 0; preset < e_bc_preset::COUNT; ++preset)
+            {
+                for (u32 mode : modes)
+                {
+                    bc_benchmark_result r;
+                    r.format = format;
+                    r.preset = (bc_preset)preset;
+                    r.flags = mode;
+
+                    pen::texture_creation_params bc = tcp;
+                    for (u32 i = 0; i < iterations; ++i)
+                    {
+                        if (i > 0)
+                            pen::memory_free(bc.data);
+
+                        bc = tcp;
+                        pen::timer_start(timer);
+                        compress_texture(bc, format, (bc_preset)preset, mode);
+                        r.ms += pen::timer_elapsed_ms(timer);
+                    }
+
+                    r.ms /= (f64)iterations;
+                    r.mpixels_per_sec = r.ms > 0.0 ? (f64)(size * size) / (r.ms * 1000.0) : 0.0;
+
+                    // psnr of the last encode over the channels the format stores, bc1 cut out pixels are skipped
+                    u32 channels = get_psnr_channels(format);
+                    f64 sq = 0.0;
+                    u32 count = 0;
+                    u32 bw = size / 4;
+                    for (u32 by = 0; by < size / 4; ++by)
+                    {
+                        for (u32 bx = 0; bx < bw; ++bx)
+                        {
+                            u8 rgba[16][4];
+                            decompress_block(format, (const u8*)bc.data + (by * bw + bx) * bc.block_size, rgba);
+
+                            for (u32 i = 0; i < 16; ++i)
+                            {
+                                const u8* src = image + ((by * 4 + i / 4) * size + bx * 4 + i % 4) * 4;
+                                if (format == PEN_TEX_FORMAT_BC1_UNORM && src[3] < 128)
+                                    continue;
+
+                                for (u32 c = 0; c < channels; ++c)
+                                {
+                                    f64 d = (f64)rgba[i][c] - (f64)src[c];
+                                    sq += d * d;
+                                }
+                                count += channels;
+                            }
+                        }
+                    }
+
+                    f64 mse = count ? sq / (f64)count : 0.0;
+                    r.psnr = mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : 99.0;
+
+                    pen::memory_free(bc.data);
+                    sb_push(results, r);
+                }
+            }
+        }
+
+        pen::memory_free(image);
+        pen::timer_destroy(timer);
+
+        return results;
+    }
+
+    void block_compressor_ui()
+    {
+        static bc_benchmark_result* s_results = nullptr;
+        static s32                  s_size = 1024;
+
+        ImGui::InputInt("Benchmark Size##block_compressor", &s_size);
+        s_size = std::min<s32>(std::max<s32>(s_size, 4), 8192);
+
+        if (ImGui::Button("Benchmark Block Compression"))
+        {
+            sb_free(s_results);
+            s_results = benchmark_block_compression((u32)s_size, 2);
+        }
+
+        static const c8* preset_names[] = {"fast", "normal", "high"};
+
+        u32 num_results = sb_count(s_results);
+        for (u32 i = 0; i < num_results; ++i)
+        {
+            const bc_benchmark_result& r = s_results[i];
+
+            const c8* mode = "simd threaded";
+            if (r.flags & e_bc_flags::scalar)
+                mode = "scalar";
+            else if (r.flags & e_bc_flags::single_threaded)
+                mode = "simd";
+
+            ImGui::Text("%-4s %-6s %-14s %8.2f ms %8.1f Mpixels/s %6.2f db", get_format_name(r.format),
+                        preset_names[r.preset], mode, r.ms, r.mpixels_per_sec, r.psnr);
+        }
+    }
+} // namespace put
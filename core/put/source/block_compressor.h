@@ -0,0 +1,58 @@
+// block_compressor.h
+// Copyright 2014 - 2023 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Cpu bc1, bc3, bc4, bc5 and bc7 encoding for textures generated at runtime. Blocks are encoded from rgba8, bgra8,
+// r8 or r32f (clamped to 0-1) across the job worker pool, palette fitting uses sse or neon. bc7 is encoded in mode 6
+// only, a single rgba subset, which is the usual fast mode. All slices and mips of the input are encoded, volumes
+// slice by slice.
+
+#pragma once
+
+#include "renderer.h"
+#include "types.h"
+
+namespace put
+{
+    namespace e_bc_preset
+    {
+        enum bc_preset_t
+        {
+            fast,   // bounding box endpoints
+            normal, // principal axis endpoints, bc4 tries both palette modes
+            high,   // normal with least squares endpoint refinement, bc7 searches all p bits
+            COUNT
+        };
+    }
+    typedef e_bc_preset::bc_preset_t bc_preset;
+
+    namespace e_bc_flags
+    {
+        enum bc_flags_t
+        {
+            single_threaded = 1 << 0, // run on the calling thread only
+            scalar = 1 << 1           // skip simd kernels, for comparison
+        };
+    }
+
+    struct bc_benchmark_result
+    {
+        u32       format = 0;
+        bc_preset preset = e_bc_preset::normal;
+        u32       flags = 0;
+        f64       ms = 0.0;
+        f64       mpixels_per_sec = 0.0;
+        f64       psnr = 0.0; // db over the channels the format stores
+    };
+
+    // replaces tcp.data with newly allocated blocks and updates format, block size and data size. the input data is
+    // not freed. returns false and leaves tcp unchanged when the source format can not be encoded to bc_format.
+    bool compress_texture(pen::texture_creation_params& tcp, u32 bc_format, bc_preset preset = e_bc_preset::normal,
+                          u32 flags = 0);
+    bool can_compress_texture(const pen::texture_creation_params& tcp, u32 bc_format);
+    void decompress_block(u32 bc_format, const u8* block, u8 rgba[16][4]); // bc7 mode 6 blocks only
+
+    // encodes a size x size test image to each format and preset, results is a stretchy buffer, call sb_free.
+    bc_benchmark_result* benchmark_block_compression(u32 size, u32 iterations);
+    void                 block_compressor_ui();
+} // namespace put
@@ -1514,6 +1514,27 @@ namespace put
                 ImGui::Text("Renderer: %s", ri.renderer);
                 ImGui::Text("Vendor: %s", ri.vendor);
 
+                const pen::renderer_stats& rs = pen::renderer_get_stats();
+                ImGui::Separator();
+                ImGui::Text("Gpu Frames In Flight: %llu", (unsigned long long)rs.frames_in_flight);
+                ImGui::Text("Pending Releases: %llu (peak %llu)", (unsigned long long)rs.pending_releases,
+                            (unsigned long long)rs.pending_releases_peak);
+                ImGui::Text("Resources Released: %llu", (unsigned long long)rs.resources_released);
+
+                ImGui::Separator();
+                s32 max_frames = rs.max_frames_in_flight;
+                if (ImGui::SliderInt("Max Frames In Flight", &max_frames, 1, 3))
+                    pen::renderer_set_max_frames_in_flight(max_frames);
+
+                f64 fps = rs.present_interval_avg_ms > 0.0 ? 1000.0 / rs.present_interval_avg_ms : 0.0;
+                ImGui::Text("Queued Frames: %u", rs.queued_frames);
+                ImGui::Text("Present Interval: %.2fms (avg %.2fms, %.1f fps)", rs.present_interval_ms,
+                            rs.present_interval_avg_ms, fps);
+                ImGui::Text("Input To Present: %.2fms (avg %.2fms)", rs.input_to_present_ms,
+                            rs.input_to_present_avg_ms);
+                ImGui::Text("User Thread Wait: %.2fms", rs.user_wait_ms);
+                ImGui::Text("Command Buffer Stalls: %llu", (unsigned long long)rs.cmd_buffer_stalls);
+
                 ImGui::End();
             }
         }
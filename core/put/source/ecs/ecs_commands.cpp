@@ -0,0 +1,414 @@
+// ecs_commands.cpp
+// Copyright 2014 - 2023 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+#include "ecs/ecs_commands.h"
+#include "ecs/ecs_utilities.h"
+
+#include "console.h"
+#include "data_struct.h"
+#include "threads.h"
+
+#include <algorithm>
+
+namespace put
+{
+    namespace ecs
+    {
+        namespace
+        {
+            // handle = flag | buffer << shift | spawn index
+            const u32 k_deferred_entity_flag = 1u << 31;
+            const u32 k_deferred_buffer_shift = 24;
+            const u32 k_deferred_index_mask = (1 << k_deferred_buffer_shift) - 1;
+
+            struct sorted_cmd
+            {
+                u32 type;
+                u32 entity; // resolved
+                u32 arg;    // resolved parent for reparent
+                u32 buffer;
+                u32 pos;
+            };
+
+            entity_cmd_buffer& begin_record(ecs_scene* scene)
+            {
+                entity_cmd_queue& q = scene->cmd_queue;
+
+                u32 b = pen::jobs_get_thread_index();
+                PEN_ASSERT(b < entity_cmd_queue::k_max_buffers);
+
+                // pool threads own their buffer, everything else shares buffer 0
+                if (b == 0)
+                    pen::mutex_lock(q.lock);
+
+                return q.buffers[b];
+            }
+
+            void end_record(ecs_scene* scene, entity_cmd_buffer& cb)
+            {
+                if (&cb == &scene->cmd_queue.buffers[0])
+                    pen::mutex_unlock(scene->cmd_queue.lock);
+            }
+
+            void record(entity_cmd_buffer& cb, u32 type, u32 entity, u32 arg, const void* data = nullptr, u32 size = 0,
+                        u64 cmp_flags = 0)
+            {
+                entity_cmd cmd;
+                cmd.type = type;
+                cmd.entity = entity;
+                cmd.arg = arg;
+                cmd.data_offset = sb_count(cb.data);
+                cmd.data_size = size;
+                cmd.cmp_flags = cmp_flags;
+
+                if (size)
+                    memcpy(sb_add(cb.data, (s32)size), data, size);
+
+                sb_push(cb.cmds, cmd);
+            }
+
+            u32 resolve(ecs_scene* scene, u32 entity)
+            {
+                if (!is_deferred_entity(entity))
+                    return entity;
+
+                return get_deferred_entity(scene, entity);
+            }
+
+            u32 spawn_entity(ecs_scene* scene, bool append)
+            {
+                if (!append)
+                    return get_new_entity(scene);
+
+                // appended so it lands after its parent and the hierarchy stays in order
+                s32 start, end;
+                get_new_entities_append(scene, 1, start, end);
+
+                scene->names[start] = "";
+                scene->names[start].appendf("entity_%i", start);
+                scene->id_name[start] = PEN_HASH(scene->names[start].c_str());
+                scene->parents[start] = start;
+                set_entity_flags(scene, start, e_cmp::allocated);
+                scene->flags |= e_scene_flags::invalidate_scene_tree;
+
+                return start;
+            }
+
+            void reset_buffer(entity_cmd_buffer& cb)
+            {
+                if (cb.cmds)
+                    stb__sbn(cb.cmds) = 0;
+
+                if (cb.data)
+                    stb__sbn(cb.data) = 0;
+
+                cb.num_spawns = 0;
+            }
+
+            void apply_spawns(ecs_scene* scene)
+            {
+                entity_cmd_queue& q = scene->cmd_queue;
+
+                for (u32 b = 0; b < entity_cmd_queue::k_max_buffers; ++b)
+                {
+                    entity_cmd_buffer& cb = q.buffers[b];
+
+                    // spawn table is reused, 1 marks spawns which will be reparented
+                    if (cb.spawned)
+                        stb__sbn(cb.spawned) = 0;
+
+                    for (u32 i = 0; i < cb.num_spawns; ++i)
+                        sb_push(cb.spawned, 0);
+                }
+
+                for (u32 b = 0; b < entity_cmd_queue::k_max_buffers; ++b)
+                {
+                    entity_cmd_buffer& cb = q.buffers[b];
+
+                    u32 num_cmds = sb_count(cb.cmds);
+                    for (u32 c = 0; c < num_cmds; ++c)
+                    {
+                        const entity_cmd& cmd = cb.cmds[c];
+                        if (cmd.type != e_entity_cmd::reparent || cmd.arg == cmd.entity || !is_valid(cmd.arg))
+                            continue;
+
+                        if (!is_deferred_entity(cmd.entity))
+                            continue;
+
+                        u32                sbi = (cmd.entity & ~k_deferred_entity_flag) >> k_deferred_buffer_shift;
+                        entity_cmd_buffer& sb = q.buffers[sbi];
+                        u32                i = cmd.entity & k_deferred_index_mask;
+                        if (i < (u32)sb_count(sb.spawned))
+                            sb.spawned[i] = 1;
+                    }
+                }
+
+                for (u32 b = 0; b < entity_cmd_queue::k_max_buffers; ++b)
+                {
+                    entity_cmd_buffer& cb = q.buffers[b];
+
+                    u32 num_cmds = sb_count(cb.cmds);
+                    for (u32 c = 0; c < num_cmds; ++c)
+                    {
+                        const entity_cmd& cmd = cb.cmds[c];
+                        if (cmd.type != e_entity_cmd::spawn)
+                            continue;
+
+                        u32 i = cmd.entity & k_deferred_index_mask;
+                        cb.spawned[i] = spawn_entity(scene, cb.spawned[i]);
+                    }
+                }
+            }
+
+            void swap_resolved(ecs_scene* scene, sorted_cmd* cmds, u32 start, u32 end, u32 a, u32 b)
+            {
+                // keeps pending reparents and spawn handles pointing at the right entities after a swap
+                for (u32 i = start; i < end; ++i)
+                {
+                    if (cmds[i].entity == a)
+                        cmds[i].entity = b;
+                    else if (cmds[i].entity == b)
+                        cmds[i].entity = a;
+
+                    if (cmds[i].arg == a)
+                        cmds[i].arg = b;
+                    else if (cmds[i].arg == b)
+                        cmds[i].arg = a;
+                }
+
+                for (u32 buf = 0; buf < entity_cmd_queue::k_max_buffers; ++buf)
+                {
+                    entity_cmd_buffer& cb = scene->cmd_queue.buffers[buf];
+
+                    u32 num_spawned = sb_count(cb.spawned);
+                    for (u32 i = 0; i < num_spawned; ++i)
+                    {
+                        if (cb.spawned[i] == a)
+                            cb.spawned[i] = b;
+                        else if (cb.spawned[i] == b)
+                            cb.spawned[i] = a;
+                    }
+                }
+            }
+        } // namespace
+
+        bool is_deferred_entity(u32 entity)
+        {
+            return is_valid(entity) && (entity & k_deferred_entity_flag);
+        }
+
+        u32 get_deferred_entity(ecs_scene* scene, u32 handle)
+        {
+            PEN_ASSERT(is_deferred_entity(handle));
+
+            u32 b = (handle & ~k_deferred_entity_flag) >> k_deferred_buffer_shift;
+            u32 i = handle & k_deferred_index_mask;
+
+            const entity_cmd_buffer& cb = scene->cmd_queue.buffers[b];
+            if (i >= (u32)sb_count(cb.spawned))
+                return PEN_INVALID_HANDLE;
+
+            return cb.spawned[i];
+        }
+
+        void remap_deferred_entities(ecs_scene* scene, u32 src, u32 num, u32 dst)
+        {
+            // entity indices recorded before the move, spawn handles resolve later and stay as they are
+            auto remap = [src, num, dst](u32& e) {
+                if (!is_deferred_entity(e) && e >= src && e < src + num)
+                    e = e - src + dst;
+            };
+
+            for (u32 b = 0; b < entity_cmd_queue::k_max_buffers; ++b)
+            {
+                entity_cmd_buffer& cb = scene->cmd_queue.buffers[b];
+
+                u32 num_cmds = sb_count(cb.cmds);
+                for (u32 c = 0; c < num_cmds; ++c)
+                {
+                    entity_cmd& cmd = cb.cmds[c];
+                    remap(cmd.entity);
+
+                    if (cmd.type == e_entity_cmd::reparent)
+                        remap(cmd.arg);
+                }
+
+                u32 num_spawned = sb_count(cb.spawned);
+                for (u32 i = 0; i < num_spawned; ++i)
+                    remap(cb.spawned[i]);
+            }
+        }
+
+        u32 defer_spawn_entity(ecs_scene* scene)
+        {
+            entity_cmd_buffer& cb = begin_record(scene);
+
+            u32 b = (u32)(&cb - &scene->cmd_queue.buffers[0]);
+            u32 handle = k_deferred_entity_flag | (b << k_deferred_buffer_shift) | cb.num_spawns++;
+            PEN_ASSERT(cb.num_spawns <= k_deferred_index_mask);
+
+            record(cb, e_entity_cmd::spawn, handle, 0);
+
+            end_record(scene, cb);
+            return handle;
+        }
+
+        void defer_delete_entity(ecs_scene* scene, u32 entity)
+        {
+            entity_cmd_buffer& cb = begin_record(scene);
+            record(cb, e_entity_cmd::destroy, entity, 0);
+            end_record(scene, cb);
+        }
+
+        void defer_set_parent(ecs_scene* scene, u32 entity, u32 parent)
+        {
+            entity_cmd_buffer& cb = begin_record(scene);
+            record(cb, e_entity_cmd::reparent, entity, parent);
+            end_record(scene, cb);
+        }
+
+        void defer_set_component(ecs_scene* scene, u32 entity, u32 cmp_index, const void* data, u32 size, u64 cmp_flags)
+        {
+            entity_cmd_buffer& cb = begin_record(scene);
+            record(cb, e_entity_cmd::set_component, entity, cmp_index, data, size, cmp_flags);
+            end_record(scene, cb);
+        }
+
+        void discard_deferred_commands(ecs_scene* scene)
+        {
+            for (u32 b = 0; b < entity_cmd_queue::k_max_buffers; ++b)
+            {
+                entity_cmd_buffer& cb = scene->cmd_queue.buffers[b];
+                sb_clear(cb.cmds);
+                sb_clear(cb.data);
+                sb_clear(cb.spawned);
+                cb.num_spawns = 0;
+            }
+        }
+
+        u32 apply_deferred_commands(ecs_scene* scene)
+        {
+            entity_cmd_queue& q = scene->cmd_queue;
+
+            u32 total = 0;
+            for (u32 b = 0; b < entity_cmd_queue::k_max_buffers; ++b)
+                total += sb_count(q.buffers[b].cmds);
+
+            if (total == 0)
+                return 0;
+
+            // spawns first in record order so every handle is resolved for the batches that follow
+            apply_spawns(scene);
+
+            static sorted_cmd* s_sorted = nullptr;
+            if (s_sorted)
+                stb__sbn(s_sorted) = 0;
+
+            for (u32 b = 0; b < entity_cmd_queue::k_max_buffers; ++b)
+            {
+                entity_cmd_buffer& cb = q.buffers[b];
+
+                u32 num_cmds = sb_count(cb.cmds);
+                for (u32 c = 0; c < num_cmds; ++c)
+                {
+                    const entity_cmd& cmd = cb.cmds[c];
+                    if (cmd.type == e_entity_cmd::spawn)
+                        continue;
+
+                    sorted_cmd sc;
+                    sc.type = cmd.type;
+                    sc.entity = resolve(scene, cmd.entity);
+                    sc.arg = cmd.type == e_entity_cmd::reparent ? resolve(scene, cmd.arg) : cmd.arg;
+                    sc.buffer = b;
+                    sc.pos = c;
+                    sb_push(s_sorted, sc);
+                }
+            }
+
+            // batch by type, component writes and deletes are grouped by entity, reparents keep record order.
+            // within an entity later records win, ties across threads resolve by buffer index
+            u32 num_sorted = sb_count(s_sorted);
+            std::sort(s_sorted, s_sorted + num_sorted, [](const sorted_cmd& a, const sorted_cmd& b) {
+                if (a.type != b.type)
+                    return a.type < b.type;
+
+                if (a.type != e_entity_cmd::reparent && a.entity != b.entity)
+                    return a.entity < b.entity;
+
+                if (a.buffer != b.buffer)
+                    return a.buffer < b.buffer;
+
+                return a.pos < b.pos;
+            });
+
+            for (u32 i = 0; i < num_sorted; ++i)
+            {
+                sorted_cmd& sc = s_sorted[i];
+                u32         e = sc.entity;
+
+                if (e >= scene->num_entities || !(scene->entities[e] & e_cmp::allocated))
+                    continue;
+
+                switch (sc.type)
+                {
+                    case e_entity_cmd::set_component:
+                    {
+                        const entity_cmd& cmd = q.buffers[sc.buffer].cmds[sc.pos];
+
+                        PEN_ASSERT(cmd.arg < scene->num_components);
+                        generic_cmp_array& cmp = scene->get_component_array(cmd.arg);
+                        PEN_ASSERT(cmp.size == cmd.data_size);
+
+                        memcpy(cmp[e], q.buffers[sc.buffer].data + cmd.data_offset, cmd.data_size);
+                        reindex_entity(scene, e);
+                        add_entity_flags(scene, e, cmd.cmp_flags);
+                    }
+                    break;
+                    case e_entity_cmd::destroy:
+                    {
+                        // duplicates are adjacent after the sort
+                        if (i > 0 && s_sorted[i - 1].type == sc.type && s_sorted[i - 1].entity == e)
+                            continue;
+
+                        delete_entity(scene, e);
+                        scene->flags |= e_scene_flags::invalidate_scene_tree;
+                    }
+                    break;
+                    case e_entity_cmd::reparent:
+                    {
+                        u32 p = sc.arg;
+                        if (p == e || !is_valid(p))
+                        {
+                            scene->parents[e] = e;
+                        }
+                        else
+                        {
+                            if (p >= scene->num_entities || !(scene->entities[p] & e_cmp::allocated))
+                                continue;
+
+                            scene->parents[e] = p;
+
+                            // children must be below parents
+                            if (e < p)
+                            {
+                                swap_entities(scene, p, e);
+                                swap_resolved(scene, s_sorted, i + 1, num_sorted, p, e);
+                            }
+                        }
+
+                        scene->flags |= e_scene_flags::invalidate_scene_tree;
+                    }
+                    break;
+                    default:
+                        break;
+                }
+            }
+
+            for (u32 b = 0; b < entity_cmd_queue::k_max_buffers; ++b)
+                reset_buffer(q.buffers[b]);
+
+            return total;
+        }
+    } // namespace ecs
+} // namespace put
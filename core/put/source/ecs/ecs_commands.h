@@ -0,0 +1,49 @@
+// ecs_commands.h
+// Copyright 2014 - 2023 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Deferred entity commands so gameplay systems and worker jobs can spawn, delete, set components and reparent
+// without racing on the scene soa. Commands are recorded into a buffer per thread and applied in update_scene,
+// after the controller and extension updates, in batches: spawns, set components, deletes then reparents.
+// Recording is safe from any thread except during apply, which runs on the thread calling update_scene.
+
+#pragma once
+
+#include "ecs/ecs_scene.h"
+
+#include <type_traits>
+
+namespace put
+{
+    namespace ecs
+    {
+        // handles returned by defer_spawn_entity can be passed to any defer_ function in place of an entity index
+        u32  defer_spawn_entity(ecs_scene* scene);
+        void defer_delete_entity(ecs_scene* scene, u32 entity);
+        void defer_set_parent(ecs_scene* scene, u32 entity, u32 parent); // parent = entity to unparent, keeps local
+        void defer_set_component(ecs_scene* scene, u32 entity, u32 cmp_index, const void* data, u32 size,
+                                 u64 cmp_flags = 0); // cmp_index as in ecs_scene::get_component_array, pod only
+
+        template <typename T>
+        void defer_set_component(ecs_scene* scene, u32 entity, cmp_array<T> ecs_scene::*cmp, const T& value,
+                                 u64 cmp_flags = 0);
+
+        u32  apply_deferred_commands(ecs_scene* scene); // returns the number of commands applied
+        void discard_deferred_commands(ecs_scene* scene);
+        bool is_deferred_entity(u32 entity);
+        u32  get_deferred_entity(ecs_scene* scene, u32 handle); // entity index of a spawn, valid until the next apply
+        void remap_deferred_entities(ecs_scene* scene, u32 src, u32 num, u32 dst); // [src, src + num) moved to dst
+
+        // inlines
+        template <typename T>
+        void defer_set_component(ecs_scene* scene, u32 entity, cmp_array<T> ecs_scene::*cmp, const T& value,
+                                 u64 cmp_flags)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "deferred components are copied as raw bytes");
+
+            // same offset trick as ecs_scene::num_base_components
+            u32 cmp_index = (u32)(((size_t) & (scene->*cmp)) - ((size_t)&scene->entities)) / sizeof(generic_cmp_array);
+            defer_set_component(scene, entity, cmp_index, &value, sizeof(T), cmp_flags);
+        }
+    } // namespace ecs
+} // namespace put
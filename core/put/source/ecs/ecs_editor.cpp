@@ -230,7 +230,7 @@ namespace put
             scene->transforms[light].translation = vec3f::zero();
             scene->transforms[light].rotation = quat();
             scene->transforms[light].scale = vec3f::one();
-            scene->entities[light] |= e_cmp::light;
+            add_entity_flags(scene, light, e_cmp::light);
             scene->entities[light] |= e_cmp::transform;
             instantiate_model_cbuffer(scene, light);
 
@@ -317,7 +317,7 @@ namespace put
             if (scene->entities[master] & e_cmp::master_instance)
                 return;
 
-            scene->entities[master] |= e_cmp::master_instance;
+            add_entity_flags(scene, master, e_cmp::master_instance);
 
             scene->master_instances[master].num_instances = selection_size;
             scene->master_instances[master].instance_stride = sizeof(cmp_draw_call);
@@ -466,8 +466,6 @@ namespace put
             }
             sb_clear(scene->selection_list);
 
-            initialise_free_list(scene);
-
             scene->flags |= e_scene_flags::invalidate_scene_tree;
         }
 
@@ -827,6 +825,8 @@ namespace put
                 memcpy(cmp[node_index], ns.components[i], cmp.size);
             }
 
+            reindex_entity(scene, node_index);
+
             node_state& us = s_editor_nodes[node_index].action_state[e_editor_actions::undo];
             node_state& rs = s_editor_nodes[node_index].action_state[e_editor_actions::redo];
 
@@ -2401,7 +2401,7 @@ namespace put
                         scene->state_flags[si] &= e_state::no_shadow;
 
                     if (caster_type == 2)
-                        scene->entities[si] |= e_cmp::sdf_shadow;
+                        add_entity_flags(scene, si, e_cmp::sdf_shadow);
                 }
 
                 if (caster_type == CAST_SDF)
@@ -2434,7 +2434,7 @@ namespace put
 
                     u32 nn = ecs::get_new_entity(scene);
 
-                    scene->entities[nn] |= e_cmp::allocated;
+                    add_entity_flags(scene, nn, e_cmp::allocated);
 
                     scene->names[nn] = "node_";
                     scene->names[nn].appendf("%u", nn);
@@ -3173,8 +3173,11 @@ namespace put
                         dc.world_matrix_inv_transpose = mat4::create_identity();
                         dc.v2 = vec4f(scene->lights[n].colour, 1.0f);
 
-                        pen::renderer_update_buffer(scene->cbuffer[n], &dc, sizeof(cmp_draw_call));
-                        pen::renderer_set_constant_buffer(scene->cbuffer[n], 1, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
+                        pen::dynamic_cbuffer cb = pen::renderer_alloc_dynamic_cbuffer(sizeof(cmp_draw_call));
+                        memcpy(cb.cpu_ptr, &dc, sizeof(cmp_draw_call));
+
+                        u32 flags = pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS;
+                        pen::renderer_set_constant_buffer(cb.handle, 1, flags, cb.offset);
                         pen::renderer_set_vertex_buffer(r.vertex_buffer, 0, r.vertex_size, 0);
                         pen::renderer_set_index_buffer(r.index_buffer, r.index_type, 0);
                         pen::renderer_draw_indexed(r.num_indices, 0, 0, PEN_PT_TRIANGLELIST);
@@ -311,7 +311,6 @@ namespace
                     bone_offset -= first_bone_offset;
                     
                     p_geometry->p_skin = (cmp_skin*)pen::memory_alloc(sizeof(cmp_skin));
-                    p_geometry->p_skin->bone_cbuffer = PEN_INVALID_HANDLE;
                     p_geometry->p_skin->bind_shape_matrix = sm.bind_shape_matrix;
                     p_geometry->p_skin->bone_offset = bone_offset;
                     p_geometry->p_skin->num_joints = sm.num_joint_floats / k_matrix_floats;
@@ -429,7 +428,7 @@ namespace
                 texture_name = base_dir;
             }
 
-            p_mat->texture_handles[map_type] = put::load_texture(texture_name.c_str());
+            p_mat->texture_handles[map_type] = put::load_texture_streamed(texture_name.c_str());
         }
 
         s_material_resources.push_back(p_mat);
@@ -484,11 +483,11 @@ namespace
             scene->names[current_node] = node_name;
             scene->geometry_names[current_node] = geometry_name;
 
-            scene->entities[current_node] |= e_cmp::allocated;
+            add_entity_flags(scene, current_node, e_cmp::allocated);
 
             if (scene->id_geometry[current_node] == ID_JOINT)
             {
-                scene->entities[current_node] |= e_cmp::bone;
+                add_entity_flags(scene, current_node, e_cmp::bone);
                 
                 if(root_bone == -1)
                     root_bone = current_node;
@@ -496,7 +495,7 @@ namespace
 
             if (scene->id_name[current_node] == ID_TRAJECTORY)
             {
-                scene->entities[current_node] |= e_cmp::anim_trajectory;
+                add_entity_flags(scene, current_node, e_cmp::anim_trajectory);
                 trajectory_node = current_node;
             }
 
@@ -675,7 +674,7 @@ namespace
                         scene->local_matrices[dest] = mat4::create_identity();
 
                         // child geometry which will inherit any skinning from its parent
-                        scene->entities[dest] |= e_cmp::sub_geometry;
+                        add_entity_flags(scene, dest, e_cmp::sub_geometry);
                     }
 
                     // generate geometry hash
@@ -764,13 +763,13 @@ namespace
                 }
 
             // delete temp root
-            scene->entities[old_root] &= ~e_cmp::allocated;
+            free_entity_range(scene, old_root, 1);
         }
         
         // assign trajectory to root bone if we dont have a dedicated trajectory node
         if(trajectory_node == -1 && root_bone != -1)
         {
-            scene->entities[root_bone] |= e_cmp::anim_trajectory;
+            add_entity_flags(scene, root_bone, e_cmp::anim_trajectory);
         }
 
         // now we have loaded the whole scene fix up any anim controllers
@@ -857,7 +856,7 @@ namespace put
             scene->physics_handles[entity_index] = physics::add_constraint(cp);
             scene->physics_data[entity_index].type = e_physics_type::constraint;
 
-            scene->entities[entity_index] |= e_cmp::constraint;
+            add_entity_flags(scene, entity_index, e_cmp::constraint);
         }
 
         void bake_rigid_body_params(ecs_scene* scene, u32 entity_index)
@@ -927,7 +926,7 @@ namespace put
             }
 
             scene->physics_data[entity_index].type = e_physics_type::rigid_body;
-            scene->entities[s] |= e_cmp::physics;
+            add_entity_flags(scene, s, e_cmp::physics);
         }
 
         using physics::rigid_body_params;
@@ -955,7 +954,7 @@ namespace put
             u32* child_handles = nullptr;
             scene->physics_handles[parent] = physics::add_compound_rb(cbpr, &child_handles);
             scene->physics_data[parent].type = e_physics_type::rigid_body;
-            scene->entities[parent] |= e_cmp::physics;
+            add_entity_flags(scene, parent, e_cmp::physics);
 
             // fixup children
             PEN_ASSERT(sb_count(child_handles) == num_children);
@@ -964,7 +963,7 @@ namespace put
                 u32 ci = children[i];
                 scene->physics_handles[ci] = child_handles[i];
                 scene->physics_data[ci].type = e_physics_type::compound_child;
-                scene->entities[ci] |= e_cmp::physics;
+                add_entity_flags(scene, ci, e_cmp::physics);
             }
         }
 
@@ -973,7 +972,7 @@ namespace put
             if (!(scene->entities[entity_index] & e_cmp::physics))
                 return;
 
-            scene->entities[entity_index] &= ~e_cmp::physics;
+            remove_entity_flags(scene, entity_index, e_cmp::physics);
 
             physics::release_entity(scene->physics_handles[entity_index]);
             scene->physics_handles[entity_index] = PEN_INVALID_HANDLE;
@@ -1003,10 +1002,10 @@ namespace put
 
             scene->geometry_names[entity_index] = gr->geometry_name;
             scene->id_geometry[entity_index] = gr->hash;
-            scene->entities[entity_index] |= e_cmp::geometry;
+            add_entity_flags(scene, entity_index, e_cmp::geometry);
 
             if (gr->p_skin)
-                scene->entities[entity_index] |= e_cmp::skinned;
+                add_entity_flags(scene, entity_index, e_cmp::skinned);
 
             instance->vertex_shader_class = ID_VERTEX_CLASS_BASIC;
             if (scene->entities[entity_index] & e_cmp::skinned)
@@ -1029,14 +1028,13 @@ namespace put
             if (!(scene->entities[entity_index] & e_cmp::geometry))
                 return;
 
-            scene->entities[entity_index] &= ~e_cmp::geometry;
-            scene->entities[entity_index] &= ~e_cmp::material;
+            remove_entity_flags(scene, entity_index, e_cmp::geometry);
+            remove_entity_flags(scene, entity_index, e_cmp::material);
 
             // zero cmp geom
             pen::memory_zero(&scene->geometries[entity_index], sizeof(cmp_geometry));
 
-            // release cbuffer
-            pen::renderer_release_buffer(scene->cbuffer[entity_index]);
+            // draw constants are sub allocated, no longer updated once invalid
             scene->cbuffer[entity_index] = PEN_INVALID_HANDLE;
             scene->geometry_names[entity_index] = "";
 
@@ -1075,14 +1073,13 @@ namespace put
 
         void instantiate_model_cbuffer(ecs_scene* scene, s32 entity_index)
         {
-            pen::buffer_creation_params bcp;
-            bcp.usage_flags = PEN_USAGE_DYNAMIC;
-            bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
-            bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
-            bcp.buffer_size = sizeof(cmp_draw_call);
-            bcp.data = nullptr;
+            // draw constants come from the dynamic cbuffer ring and are re-allocated by every update_scene, this first
+            // allocation marks the entity as having them and is valid until the end of the frame
+            pen::dynamic_cbuffer cb = pen::renderer_alloc_dynamic_cbuffer(sizeof(cmp_draw_call));
+            memcpy(cb.cpu_ptr, &scene->draw_call_data[entity_index], sizeof(cmp_draw_call));
 
-            scene->cbuffer[entity_index] = pen::renderer_create_buffer(bcp);
+            scene->cbuffer[entity_index] = cb.handle;
+            scene->cbuffer_offset[entity_index] = cb.offset;
         }
 
         void instantiate_model_pre_skin_hierarchy(ecs_scene* scene, s32 entity_index)
@@ -1144,8 +1141,8 @@ namespace put
             geom.num_vertices = pre_skin.num_verts;
 
             // set pre-skinned and unset skinned
-            scene->entities[entity_index] |= e_cmp::pre_skinned;
-            scene->entities[entity_index] &= ~e_cmp::skinned;
+            add_entity_flags(scene, entity_index, e_cmp::pre_skinned);
+            remove_entity_flags(scene, entity_index, e_cmp::skinned);
 
             geom.vertex_shader_class = ID_VERTEX_CLASS_BASIC;
         }
@@ -1178,7 +1175,7 @@ namespace put
                 controller.root_joint_ref = ecs::get_ref_from_index(scene, joints_offset);
                 controller.playback_rate = 1.0f;
 
-                scene->entities[entity_index] |= e_cmp::anim_controller;
+                add_entity_flags(scene, entity_index, e_cmp::anim_controller);
             }
         }
 
@@ -1205,7 +1202,7 @@ namespace put
             scene->transforms[entity_index].scale = scale;
             scene->shadows[entity_index].texture_handle = volume_texture;
             scene->shadows[entity_index].sampler_state = pmfx::get_render_state(id_cl, pmfx::e_render_state::sampler);
-            scene->entities[entity_index] |= e_cmp::sdf_shadow;
+            add_entity_flags(scene, entity_index, e_cmp::sdf_shadow);
         }
 
         void instantiate_light(ecs_scene* scene, u32 entity_index)
@@ -1214,7 +1211,7 @@ namespace put
                 return;
 
             // cbuffer for draw call, light volume for editor / deferred etc
-            scene->entities[entity_index] |= e_cmp::light;
+            add_entity_flags(scene, entity_index, e_cmp::light);
             instantiate_model_cbuffer(scene, entity_index);
 
             scene->bounding_volumes[entity_index].min_extents = -vec3f::one();
@@ -1253,7 +1250,7 @@ namespace put
             instantiate_material(&area_light_material, scene, entity_index);
             instantiate_model_cbuffer(scene, entity_index);
 
-            scene->entities[entity_index] |= e_cmp::light;
+            add_entity_flags(scene, entity_index, e_cmp::light);
             scene->lights[entity_index].type = e_light_type::area;
             scene->area_light[entity_index].shader = PEN_INVALID_HANDLE;
         }
@@ -1272,7 +1269,7 @@ namespace put
             instantiate_material(&area_light_material, scene, entity_index);
             instantiate_model_cbuffer(scene, entity_index);
 
-            scene->entities[entity_index] |= e_cmp::light;
+            add_entity_flags(scene, entity_index, e_cmp::light);
             scene->lights[entity_index].type = e_light_type::area_ex;
 
             if (!alr.texture_name.empty())
@@ -1302,7 +1299,7 @@ namespace put
             scene->id_material[entity_index] = mr->hash;
             scene->material_names[entity_index] = mr->material_name;
 
-            scene->entities[entity_index] |= e_cmp::material;
+            add_entity_flags(scene, entity_index, e_cmp::material);
 
             // set defaults
             if (mr->id_shader == 0)
@@ -1401,7 +1398,7 @@ namespace put
                     }
                 }
 
-                scene->entities[entity_index] |= e_cmp::samplers;
+                add_entity_flags(scene, entity_index, e_cmp::samplers);
                 scene->state_flags[entity_index] |= e_state::samplers_initialised;
             }
 
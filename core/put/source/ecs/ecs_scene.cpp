@@ -16,13 +16,21 @@
 #include "pmfx.h"
 #include "str/Str.h"
 #include "str_utilities.h"
+#include "threads.h"
 #include "timer.h"
 
+#include "ecs/ecs_commands.h"
 #include "ecs/ecs_cull.h"
 #include "ecs/ecs_resources.h"
 #include "ecs/ecs_scene.h"
 #include "ecs/ecs_utilities.h"
 
+#if __SSE__
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 using namespace put;
 
 namespace put
@@ -95,32 +103,12 @@ namespace put
             }
         }
 
-        void initialise_free_list(ecs_scene* scene)
-        {
-            scene->free_list_head = nullptr;
-
-            for (s32 i = scene->soa_size - 1; i >= 0; --i)
-            {
-                scene->free_list[i].node = i;
-
-                if (!(scene->entities[i] & e_cmp::allocated))
-                {
-                    free_node_list* l = &scene->free_list[i];
-                    l->next = scene->free_list_head;
-
-                    if (l->next)
-                        l->next->prev = l;
-
-                    scene->free_list_head = l;
-                }
-            }
-
-            if (!scene->free_list_head)
-                PEN_ASSERT(0);
-        }
-
         void resize_scene_buffers(ecs_scene* scene, s32 size)
         {
+            // created with the first buffers, any scene with components can record commands
+            if (!scene->cmd_queue.lock)
+                scene->cmd_queue.lock = pen::mutex_create();
+
             u32 new_size = scene->soa_size + size;
 
             for (u32 i = 0; i < scene->num_components; ++i)
@@ -148,7 +136,157 @@ namespace put
             }
 
             scene->soa_size = new_size;
-            initialise_free_list(scene);
+            rebuild_free_ranges(scene);
+        }
+
+        namespace
+        {
+            // transform is set and consumed within a frame, indexing it would churn every frame
+            const u64 k_unindexed_cmp = e_cmp::transform;
+
+            u32 cmp_bit_index(u64 cmp_flag)
+            {
+                u32 b = 0;
+                while (!(cmp_flag & (1ull << b)))
+                    ++b;
+
+                return b;
+            }
+
+            u32 sorted_lower_bound(const u32* list, u32 count, u32 value)
+            {
+                u32 lo = 0;
+                u32 hi = count;
+                while (lo < hi)
+                {
+                    u32 mid = (lo + hi) / 2;
+                    if (list[mid] < value)
+                        lo = mid + 1;
+                    else
+                        hi = mid;
+                }
+
+                return lo;
+            }
+        } // namespace
+
+        void update_component_index(ecs_scene* scene)
+        {
+            component_index& ci = scene->cmp_index;
+
+            // soa changed, start again from empty
+            if (ci.size != scene->soa_size)
+            {
+                ci.flags = (u64*)pen::memory_realloc(ci.flags, sizeof(u64) * scene->soa_size);
+                pen::memory_zero(ci.flags, sizeof(u64) * scene->soa_size);
+
+                ci.size = scene->soa_size;
+                ci.num_entities = 0;
+                ci.rebuild = 1;
+            }
+
+            // entities past the end are no longer indexed
+            u32 num_entities = (u32)scene->num_entities;
+            for (u32 n = num_entities; n < ci.num_entities; ++n)
+                if (ci.flags[n])
+                    sb_push(ci.dirty, n);
+
+            u32 scan = std::max<u32>(num_entities, ci.num_entities);
+            ci.num_entities = num_entities;
+
+            static const u32 k_max_incremental = 64;
+            u32              num_dirty = sb_count(ci.dirty);
+
+            if (!ci.rebuild && num_dirty <= k_max_incremental)
+            {
+                // few changes, insert / remove into the sorted lists
+                for (u32 d = 0; d < num_dirty; ++d)
+                {
+                    u32 n = ci.dirty[d];
+                    u64 cur = n < num_entities ? scene->entities[n] & ~k_unindexed_cmp : 0;
+                    u64 diff = cur ^ ci.flags[n];
+
+                    for (u32 b = 0; diff; ++b, diff >>= 1)
+                    {
+                        if (!(diff & 1))
+                            continue;
+
+                        u32*& list = ci.entities[b];
+                        u32   count = sb_count(list);
+                        u32   pos = sorted_lower_bound(list, count, n);
+
+                        if (cur & (1ull << b))
+                        {
+                            sb_push(list, n);
+                            memmove(&list[pos + 1], &list[pos], (count - pos) * sizeof(u32));
+                            list[pos] = n;
+                        }
+                        else
+                        {
+                            memmove(&list[pos], &list[pos + 1], (count - pos - 1) * sizeof(u32));
+                            stb__sbn(list)--;
+                        }
+                    }
+
+                    ci.flags[n] = cur;
+                }
+
+                sb_clear(ci.dirty);
+                return;
+            }
+
+            // lots of changes (load, clear, compaction) rebuild all of the lists
+            for (u32 b = 0; b < 64; ++b)
+                if (ci.entities[b])
+                    stb__sbn(ci.entities[b]) = 0;
+
+            for (u32 n = 0; n < scan; ++n)
+            {
+                u64 cur = n < num_entities ? scene->entities[n] & ~k_unindexed_cmp : 0;
+                ci.flags[n] = cur;
+
+                for (u32 b = 0; cur; ++b, cur >>= 1)
+                    if (cur & 1)
+                        sb_push(ci.entities[b], n);
+            }
+
+            sb_clear(ci.dirty);
+            ci.rebuild = 0;
+        }
+
+        void set_entity_flags(ecs_scene* scene, u32 entity, u64 flags)
+        {
+            u64 diff = (scene->entities[entity] ^ flags) & ~k_unindexed_cmp;
+            scene->entities[entity] = flags;
+
+            if (diff)
+                sb_push(scene->cmp_index.dirty, entity);
+        }
+
+        void add_entity_flags(ecs_scene* scene, u32 entity, u64 flags)
+        {
+            set_entity_flags(scene, entity, scene->entities[entity] | flags);
+        }
+
+        void remove_entity_flags(ecs_scene* scene, u32 entity, u64 flags)
+        {
+            set_entity_flags(scene, entity, scene->entities[entity] & ~flags);
+        }
+
+        void reindex_entity(ecs_scene* scene, u32 entity)
+        {
+            sb_push(scene->cmp_index.dirty, entity);
+        }
+
+        void reindex_scene(ecs_scene* scene)
+        {
+            scene->cmp_index.rebuild = 1;
+        }
+
+        u32* get_component_entities(ecs_scene* scene, u64 cmp_flag)
+        {
+            PEN_ASSERT(cmp_flag && !(cmp_flag & (cmp_flag - 1)) && !(cmp_flag & k_unindexed_cmp));
+            return scene->cmp_index.entities[cmp_bit_index(cmp_flag)];
         }
 
         void free_scene_buffers(ecs_scene* scene, bool cmp_mem_only = 0)
@@ -161,6 +299,12 @@ namespace put
 
                 for (s32 i = 0; i < scene->num_entities; ++i)
                     delete_entity_second_pass(scene, i);
+
+                if (is_valid(scene->bone_buffer))
+                    pen::renderer_release_buffer(scene->bone_buffer);
+
+                scene->bone_buffer = PEN_INVALID_HANDLE;
+                scene->bone_buffer_size = 0;
             }
 
             // Free component array memory
@@ -171,6 +315,41 @@ namespace put
                 cmp.data = nullptr;
             }
 
+            u32 num_palettes = sb_count(scene->skin_palettes);
+            for (u32 p = 0; p < num_palettes; ++p)
+                if (is_valid(scene->skin_palettes[p].cbuffer))
+                    pen::renderer_release_buffer(scene->skin_palettes[p].cbuffer);
+
+            sb_clear(scene->skin_palettes);
+            sb_clear(scene->bone_palette);
+
+            // pending commands refer to entities which no longer exist
+            discard_deferred_commands(scene);
+            if (scene->cmd_queue.lock)
+            {
+                pen::mutex_destroy(scene->cmd_queue.lock);
+                scene->cmd_queue.lock = nullptr;
+            }
+
+            pen::memory_free(scene->free_ranges.nodes);
+            scene->free_ranges.nodes = nullptr;
+            scene->free_ranges.leaves = 0;
+
+            component_index& ci = scene->cmp_index;
+            pen::memory_free(ci.flags);
+            ci.flags = nullptr;
+            ci.size = 0;
+            ci.num_entities = 0;
+            sb_clear(ci.dirty);
+
+            for (u32 b = 0; b < 64; ++b)
+            {
+                sb_clear(ci.entities[b]);
+            }
+
+            // pending commands refer to entities which no longer exist
+            discard_deferred_commands(scene);
+
             scene->soa_size = 0;
             scene->num_entities = 0;
         }
@@ -184,8 +363,12 @@ namespace put
                 pen::memory_zero(offset, cmp.size);
             }
 
+            reindex_entity(scene, node_index);
+
             // Annoyingly nodeindex == parent is used to determine if a node is not a child
             scene->parents[node_index] = node_index;
+
+            free_entity_range(scene, node_index, 1);
         }
 
         void delete_entity(ecs_scene* scene, u32 node_index)
@@ -194,14 +377,6 @@ namespace put
             if (is_valid(scene->physics_handles[node_index]))
                 physics::release_entity(scene->physics_handles[node_index]);
 
-            if (is_valid(scene->cbuffer[node_index]))
-                pen::renderer_release_buffer(scene->cbuffer[node_index]);
-                
-            // delete skinng buffers, sub_geomtry share their parents
-            if(!(scene->entities[node_index] & e_cmp::sub_geometry))
-                if (is_valid_non_null(scene->bone_cbuffer[node_index]))
-                    pen::renderer_release_buffer(scene->cbuffer[node_index]);
-
             // zero
             zero_entity_components(scene, node_index);
         }
@@ -212,9 +387,6 @@ namespace put
             if (is_valid(scene->physics_handles[node_index]) && (scene->entities[node_index] & e_cmp::constraint))
                 physics::release_entity(scene->physics_handles[node_index]);
 
-            if (is_valid(scene->cbuffer[node_index]))
-                pen::renderer_release_buffer(scene->cbuffer[node_index]);
-
             if (scene->entities[node_index] & e_cmp::pre_skinned)
             {
                 if (scene->pre_skin[node_index].vertex_buffer)
@@ -252,6 +424,8 @@ namespace put
                 generic_cmp_array& cmp = scene->get_component_array(i);
                 memcpy(cmp[dst], cmp[src], cmp.size);
             }
+
+            reindex_entity(scene, dst);
         }
 
         void swap_entities(ecs_scene* scene, u32 a, s32 b)
@@ -298,6 +472,8 @@ namespace put
                 memcpy(cmp[dst], cmp[src], cmp.size);
             }
 
+            reindex_entity(p_sn, dst);
+
             // assign
             Str blank;
             memcpy(&p_sn->names[dst], &blank, sizeof(Str));
@@ -335,6 +511,10 @@ namespace put
                 if (p_sn->entities[dst] & e_cmp::geometry)
                     instantiate_model_cbuffer(scene, dst);
 
+                // bones are assigned into the shared bone buffer on the next update
+                if (!(p_sn->entities[dst] & e_cmp::sub_geometry))
+                    p_sn->bone_cbuffer[dst] = 0;
+
                 if (p_sn->entities[dst] & e_cmp::material)
                 {
                     p_sn->materials[dst].material_cbuffer = PEN_INVALID_HANDLE;
@@ -356,6 +536,7 @@ namespace put
             svr_main.name = "ecs_render_scene";
             svr_main.id_name = PEN_HASH(svr_main.name.c_str());
             svr_main.render_function = &ecs::render_scene_view;
+            svr_main.flags = e_svr_flags::parallel;
 
             put::scene_view_renderer svr_light_volumes;
             svr_light_volumes.name = "ecs_render_light_volumes";
@@ -366,6 +547,7 @@ namespace put
             svr_shadow_maps.name = "ecs_render_shadow_maps";
             svr_shadow_maps.id_name = PEN_HASH(svr_shadow_maps.name.c_str());
             svr_shadow_maps.render_function = &ecs::render_shadow_views;
+            svr_shadow_maps.flags = e_svr_flags::parallel;
 
             put::scene_view_renderer svr_area_light_textures;
             svr_area_light_textures.name = "ecs_render_area_light_textures";
@@ -376,6 +558,7 @@ namespace put
             svr_omni_shadow_maps.name = "ecs_render_omni_shadow_maps";
             svr_omni_shadow_maps.id_name = PEN_HASH(svr_omni_shadow_maps.name.c_str());
             svr_omni_shadow_maps.render_function = &ecs::render_omni_shadow_views;
+            svr_omni_shadow_maps.flags = e_svr_flags::parallel;
 
             put::scene_view_renderer svr_volume_gi;
             svr_volume_gi.name = "ecs_compute_volume_gi";
@@ -466,8 +649,11 @@ namespace put
 
             u32 count = 0;
             u32 area_light = -1;
-            for (u32 i = 0; i < scene->num_entities; ++i)
+            u32* light_entities = get_component_entities(scene, e_cmp::light);
+            u32  num_light_entities = sb_count(light_entities);
+            for (u32 li = 0; li < num_light_entities; ++li)
             {
+                u32 i = light_entities[li];
                 if (!(scene->entities[i] & e_cmp::light))
                     continue;
 
@@ -492,7 +678,8 @@ namespace put
 
             cmp_area_light& al = scene->area_light[area_light];
 
-            pen::renderer_set_constant_buffer(scene->cbuffer[area_light], 1, pen::CBUFFER_BIND_PS);
+            pen::renderer_set_constant_buffer(scene->cbuffer[area_light], 1, pen::CBUFFER_BIND_PS,
+                                              scene->cbuffer_offset[area_light]);
 
             if (is_valid(al.shader))
             {
@@ -587,27 +774,46 @@ namespace put
                 cb_view = pen::renderer_create_buffer(bcp);
             }
 
-            static mat4 shadow_matrices[e_scene_limits::max_shadow_maps];
-            u32         shadow_index = 0;
-            for (u32 n = 0; n < scene->num_entities; ++n)
+            // bind single light cbuffer for colour shadow maps
+            static u32 cb_light = -1;
+            if (!is_valid(cb_light))
             {
+                pen::buffer_creation_params bcp;
+                bcp.usage_flags = PEN_USAGE_DYNAMIC;
+                bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
+                bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
+                bcp.buffer_size = sizeof(light_data);
+                bcp.data = nullptr;
+
+                cb_light = pen::renderer_create_buffer(bcp);
+            }
+
+            // slices can be recorded concurrently, so the last one builds every matrix rather than reading the others
+            bool upload = view.array_index + 1 >= view.num_arrays;
+            mat4 shadow_matrices[e_scene_limits::max_shadow_maps];
+            for (u32 i = 0; i < e_scene_limits::max_shadow_maps; ++i)
+                shadow_matrices[i] = mat4::create_identity();
+
+            u32  shadow_index = 0;
+            u32* light_entities = get_component_entities(scene, e_cmp::light);
+            u32  num_light_entities = sb_count(light_entities);
+            for (u32 li = 0; li < num_light_entities; ++li)
+            {
+                u32 n = light_entities[li];
                 if (!(scene->entities[n] & e_cmp::light))
                     continue;
 
                 if (!(scene->lights[n].flags & (e_light_flags::shadow_map | e_light_flags::global_illumination)))
                     continue;
 
-                if (shadow_index++ != view.array_index)
+                u32 si = shadow_index++;
+                if (si != view.array_index && !(upload && si < e_scene_limits::max_shadow_maps))
                     continue;
 
                 // create a shadow camera
                 camera cam;
                 shadow_camera_from_entity(cam, scene, n);
 
-                // update view and camera
-                scene_view vv = view;
-                vv.camera = &cam;
-
                 mat4 shadow_vp;
 
                 // handle different clip spaces
@@ -624,27 +830,22 @@ namespace put
                     shadow_vp = cam.proj * cam.view;
                 }
 
+                if (si < e_scene_limits::max_shadow_maps)
+                    shadow_matrices[si] = shadow_vp;
+
+                if (si != view.array_index)
+                    continue;
+
+                // update view and camera
+                scene_view vv = view;
+                vv.camera = &cam;
+
                 pen::renderer_update_buffer(cb_view, &shadow_vp, sizeof(mat4));
-                shadow_matrices[shadow_index - 1] = shadow_vp;
                 vv.cb_view = cb_view;
 
                 // colour shadow maps
                 if (vv.render_flags & pmfx::e_scene_render_flags::forward_lit)
                 {
-                    // bind single light cbuffer
-                    static u32 cb_light = -1;
-                    if (!is_valid(cb_light))
-                    {
-                        pen::buffer_creation_params bcp;
-                        bcp.usage_flags = PEN_USAGE_DYNAMIC;
-                        bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
-                        bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
-                        bcp.buffer_size = sizeof(light_data);
-                        bcp.data = nullptr;
-
-                        cb_light = pen::renderer_create_buffer(bcp);
-                    }
-
                     light_data ld;
                     single_light_from_entity(ld, scene, n);
                     pen::renderer_update_buffer(cb_light, &ld, sizeof(light_data));
@@ -655,7 +856,7 @@ namespace put
             }
 
             // update cbuffer
-            if (is_valid(scene->shadow_map_buffer))
+            if (upload && is_valid(scene->shadow_map_buffer))
             {
                 pen::renderer_update_buffer(scene->shadow_map_buffer, &shadow_matrices[0],
                                             sizeof(mat4) * e_scene_limits::max_shadow_maps);
@@ -680,13 +881,19 @@ namespace put
                 bcp.data = nullptr;
 
                 cb_light = pen::renderer_create_buffer(bcp);
+
+                bcp.buffer_size = sizeof(camera_cbuffer);
+                cam_omni_shadow.cbuffer = pen::renderer_create_buffer(bcp);
             }
 
             u32 target_omni_light_index = view.array_index / 6;
             u32 array_face = view.array_index % 6;
             u32 omni_light_index = 0;
-            for (u32 n = 0; n < scene->num_entities; ++n)
+            u32* light_entities = get_component_entities(scene, e_cmp::light);
+            u32  num_light_entities = sb_count(light_entities);
+            for (u32 li = 0; li < num_light_entities; ++li)
             {
+                u32 n = light_entities[li];
                 if (!(scene->entities[n] & e_cmp::light))
                     continue;
 
@@ -696,10 +903,12 @@ namespace put
                 if (omni_light_index++ != target_omni_light_index)
                     continue;
 
-                cam_omni_shadow.pos = scene->transforms[n].translation;
-                put::camera_create_cubemap(&cam_omni_shadow, 0.1f, scene->lights[n].radius * 2.0f);
-                put::camera_set_cubemap_face(&cam_omni_shadow, array_face);
-                put::camera_update_shader_constants(&cam_omni_shadow);
+                // faces may be recorded concurrently, each with a copy sharing the cbuffer
+                camera cam = cam_omni_shadow;
+                cam.pos = scene->transforms[n].translation;
+                put::camera_create_cubemap(&cam, 0.1f, scene->lights[n].radius * 2.0f);
+                put::camera_set_cubemap_face(&cam, array_face);
+                put::camera_update_shader_constants(&cam);
 
                 light_data ld;
                 single_light_from_entity(ld, scene, n);
@@ -707,8 +916,8 @@ namespace put
                 pen::renderer_set_constant_buffer(cb_light, 10, pen::CBUFFER_BIND_PS);
 
                 scene_view vv = view;
-                vv.camera = &cam_omni_shadow;
-                vv.cb_view = cam_omni_shadow.cbuffer;
+                vv.camera = &cam;
+                vv.cb_view = cam.cbuffer;
 
                 render_scene_view(vv);
             }
@@ -739,8 +948,11 @@ namespace put
             static hash_id id_disable_depth = PEN_HASH("disabled");
             u32            depth_disabled = pmfx::get_render_state(id_disable_depth, pmfx::e_render_state::depth_stencil);
 
-            for (u32 n = 0; n < scene->num_entities; ++n)
+            u32* light_entities = get_component_entities(scene, e_cmp::light);
+            u32  num_light_entities = sb_count(light_entities);
+            for (u32 li = 0; li < num_light_entities; ++li)
             {
+                u32 n = light_entities[li];
                 if (!(scene->entities[n] & e_cmp::light))
                     continue;
 
@@ -805,8 +1017,11 @@ namespace put
                     pen::renderer_set_depth_stencil_state(depth_disabled);
                 }
 
-                pen::renderer_update_buffer(scene->cbuffer[n], &dc, sizeof(cmp_draw_call));
-                pen::renderer_set_constant_buffer(scene->cbuffer[n], 1, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
+                // per view light data, sub allocated rather than updating the entity cbuffer multiple times a frame
+                pen::dynamic_cbuffer cb = pen::renderer_alloc_dynamic_cbuffer(sizeof(cmp_draw_call));
+                memcpy(cb.cpu_ptr, &dc, sizeof(cmp_draw_call));
+
+                pen::renderer_set_constant_buffer(cb.handle, 1, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS, cb.offset);
                 pen::renderer_set_vertex_buffer(r.vertex_buffer, 0, r.vertex_size, 0);
                 pen::renderer_set_index_buffer(r.index_buffer, r.index_type, 0);
                 pen::renderer_draw_indexed(r.num_indices, 0, 0, PEN_PT_TRIANGLELIST);
@@ -862,8 +1077,11 @@ namespace put
 
             // get inv shadow matrices
             u32 i = 0;
-            for (u32 n = 0; n < scene->num_entities; ++n)
+            u32* light_entities = get_component_entities(scene, e_cmp::light);
+            u32  num_light_entities = sb_count(light_entities);
+            for (u32 li = 0; li < num_light_entities; ++li)
             {
+                u32 n = light_entities[li];
                 if (!(scene->entities[n] & e_cmp::light))
                     continue;
 
@@ -898,6 +1116,21 @@ namespace put
             pen::renderer_set_texture(0, 0, 2, pen::TEXTURE_BIND_CS);
         }
 
+        f32 projected_screen_size(const scene_view& view, const cmp_pos_extent& pe)
+        {
+            // diameter of the bounding sphere in pixels, orthographic views cover the whole viewport
+            f32     height = view.viewport ? view.viewport->height : 0.0f;
+            camera* cam = view.camera;
+            if (!cam || cam->fov <= 0.0f)
+                return height;
+
+            f32 radius = pe.extent.w;
+            f32 dist = max(mag(pe.pos.xyz - cam->pos) - radius, cam->near_plane);
+            f32 half_tan = tan(maths::deg_to_rad(cam->fov) * 0.5f);
+
+            return radius * height / (dist * half_tan);
+        }
+
         void render_scene_view(const scene_view& view)
         {
             // PEN_PERF_SCOPE_PRINT(render_scene_view);
@@ -929,8 +1162,11 @@ namespace put
 
             // sdf shadows
             pen::renderer_set_constant_buffer(scene->sdf_shadow_buffer, 5, pen::CBUFFER_BIND_PS);
-            for (u32 n = 0; n < scene->num_entities; ++n)
+            u32* sdf_entities = get_component_entities(scene, e_cmp::sdf_shadow);
+            u32  num_sdf_entities = sb_count(sdf_entities);
+            for (u32 si = 0; si < num_sdf_entities; ++si)
             {
+                u32 n = sdf_entities[si];
                 if (!(scene->entities[n] & e_cmp::sdf_shadow))
                     continue;
 
@@ -1013,7 +1249,8 @@ namespace put
                 // bind skinning
                 if (scene->entities[n] & e_cmp::skinned)
                 {
-                    pen::renderer_set_constant_buffer(scene->bone_cbuffer[n], 2, pen::CBUFFER_BIND_VS);
+                    pen::renderer_set_constant_buffer(scene->bone_cbuffer[n], 2, pen::CBUFFER_BIND_VS,
+                                                      scene->bone_cbuffer_offset[n]);
                 }
 
                 // set material cbs
@@ -1024,17 +1261,26 @@ namespace put
                 }
 
                 // draw call cb
-                pen::renderer_set_constant_buffer(scene->cbuffer[n], 1, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
+                pen::renderer_set_constant_buffer(scene->cbuffer[n], 1, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS,
+                                                  scene->cbuffer_offset[n]);
 
                 // set textures
                 if (p_mat)
                 {
+                    // size on screen decides which mips of streamed textures are needed
+                    f32 screen_size = 0.0f;
+                    if (!(view.render_flags & pmfx::e_scene_render_flags::shadow_map))
+                        screen_size = projected_screen_size(view, scene->pos_extent[n]);
+
                     cmp_samplers& samplers = scene->samplers[n];
                     for (u32 s = 0; s < e_pmfx_constants::max_technique_sampler_bindings; ++s)
                     {
                         if (!samplers.sb[s].handle)
                             continue;
 
+                        if (screen_size > 0.0f)
+                            put::stream_texture_usage(samplers.sb[s].handle, screen_size);
+
                         pen::renderer_set_texture(samplers.sb[s].handle, samplers.sb[s].sampler_state,
                                                   samplers.sb[s].sampler_unit, pen::TEXTURE_BIND_PS);
                     }
@@ -1095,8 +1341,11 @@ namespace put
 
         void update_animations(ecs_scene* scene, f32 dt)
         {
-            for (u32 n = 0; n < scene->num_entities; ++n)
+            u32* controller_entities = get_component_entities(scene, e_cmp::anim_controller);
+            u32  num_controller_entities = sb_count(controller_entities);
+            for (u32 ci = 0; ci < num_controller_entities; ++ci)
             {
+                u32 n = controller_entities[ci];
                 if (!(scene->entities[n] & e_cmp::anim_controller))
                     continue;
 
@@ -1346,8 +1595,11 @@ namespace put
         void reset(ecs_scene* scene)
         {
             // reset physics positions
-            for (s32 i = 0; i < scene->num_entities; ++i)
+            u32* physics_entities = get_component_entities(scene, e_cmp::physics);
+            u32  num_physics_entities = sb_count(physics_entities);
+            for (u32 pi = 0; pi < num_physics_entities; ++pi)
             {
+                s32 i = physics_entities[pi];
                 if (scene->entities[i] & e_cmp::physics)
                 {
                     if (scene->physics_data[i].type != e_physics_type::rigid_body)
@@ -1370,6 +1622,323 @@ namespace put
             }
         }
 
+        // row major a * b, out must not alias a or b
+        pen_inline void mul_mat4(mat4& out, const mat4& a, const mat4& b)
+        {
+#if __SSE__
+            __m128 b0 = _mm_loadu_ps(&b.m[0]);
+            __m128 b1 = _mm_loadu_ps(&b.m[4]);
+            __m128 b2 = _mm_loadu_ps(&b.m[8]);
+            __m128 b3 = _mm_loadu_ps(&b.m[12]);
+
+            for (u32 r = 0; r < 4; ++r)
+            {
+                const f32* ar = &a.m[r * 4];
+                __m128     v = _mm_mul_ps(_mm_set1_ps(ar[0]), b0);
+                v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(ar[1]), b1));
+                v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(ar[2]), b2));
+                v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(ar[3]), b3));
+                _mm_storeu_ps(&out.m[r * 4], v);
+            }
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+            float32x4_t b0 = vld1q_f32(&b.m[0]);
+            float32x4_t b1 = vld1q_f32(&b.m[4]);
+            float32x4_t b2 = vld1q_f32(&b.m[8]);
+            float32x4_t b3 = vld1q_f32(&b.m[12]);
+
+            for (u32 r = 0; r < 4; ++r)
+            {
+                const f32*  ar = &a.m[r * 4];
+                float32x4_t v = vmulq_n_f32(b0, ar[0]);
+                v = vmlaq_n_f32(v, b1, ar[1]);
+                v = vmlaq_n_f32(v, b2, ar[2]);
+                v = vmlaq_n_f32(v, b3, ar[3]);
+                vst1q_f32(&out.m[r * 4], v);
+            }
+#else
+            out = a * b;
+#endif
+        }
+
+        // palettes are sorted by entity
+        skin_palette* find_skin_palette(ecs_scene* scene, u32 entity)
+        {
+            u32 lo = 0;
+            u32 hi = sb_count(scene->skin_palettes);
+            while (lo < hi)
+            {
+                u32 mid = (lo + hi) / 2;
+                u32 e = scene->skin_palettes[mid].entity;
+
+                if (e == entity)
+                    return &scene->skin_palettes[mid];
+
+                if (e < entity)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+
+            return nullptr;
+        }
+
+        // runs on the worker pool, each palette is only written by one job
+        void update_skin_palettes_job(u32 start, u32 end, void* user_data)
+        {
+            ecs_scene* scene = (ecs_scene*)user_data;
+
+            for (u32 p = start; p < end; ++p)
+            {
+                skin_palette& sp = scene->skin_palettes[p];
+                cmp_skin*     skin = scene->geometries[sp.entity].p_skin;
+                mat4*         palette = &scene->bone_palette[sp.offset];
+
+                for (u32 i = 0; i < sp.num_joints; ++i)
+                {
+                    mat4 bm;
+                    mul_mat4(bm, scene->world_matrices[sp.joints_offset + i], skin->joint_bind_matrices[i]);
+
+                    if (memcmp(&bm, &palette[i], sizeof(mat4)) != 0)
+                    {
+                        palette[i] = bm;
+                        sp.dirty = 1;
+                    }
+                }
+            }
+        }
+
+        void update_skinning(ecs_scene* scene)
+        {
+            static skin_palette* palettes = nullptr;
+            static u32*          sub_geometry = nullptr;
+            static u32*          pre_skinned = nullptr;
+
+            sb_clear(palettes);
+            sb_clear(sub_geometry);
+            sb_clear(pre_skinned);
+
+            // gather palette owners, sub geometry shares bones with parent
+            u32* skinned = get_component_entities(scene, e_cmp::skinned);
+            u32* pre_skinned_entities = get_component_entities(scene, e_cmp::pre_skinned);
+            u32  num_skinned = sb_count(skinned);
+            u32  num_pre_skinned_entities = sb_count(pre_skinned_entities);
+
+            // merge the sorted lists so palettes are sorted by entity
+            for (u32 si = 0, pi = 0; si < num_skinned || pi < num_pre_skinned_entities;)
+            {
+                u32 n;
+                if (pi >= num_pre_skinned_entities || (si < num_skinned && skinned[si] < pre_skinned_entities[pi]))
+                {
+                    n = skinned[si++];
+                }
+                else
+                {
+                    n = pre_skinned_entities[pi++];
+                    if (si < num_skinned && skinned[si] == n)
+                        ++si;
+                }
+
+                if (!(scene->entities[n] & (e_cmp::skinned | e_cmp::pre_skinned)))
+                    continue;
+
+                if (scene->entities[n] & e_cmp::pre_skinned)
+                    sb_push(pre_skinned, (u32)n);
+
+                if (scene->entities[n] & e_cmp::sub_geometry)
+                {
+                    sb_push(sub_geometry, (u32)n);
+                    continue;
+                }
+
+                cmp_skin* skin = scene->geometries[n].p_skin;
+                if (!skin)
+                    continue;
+
+                u32 rjr = scene->anim_controller_v2[n].root_joint_ref;
+
+                skin_palette sp;
+                sp.entity = (u32)n;
+                sp.joints_offset = ecs::get_index_from_ref(scene, rjr) + skin->bone_offset;
+                sp.num_joints = skin->num_joints;
+                sp.offset = 0;
+                sp.dirty = 0;
+                sp.cbuffer = PEN_INVALID_HANDLE;
+                sb_push(palettes, sp);
+            }
+
+            // re-pack palettes when entities were added, removed or moved and force a full upload
+            u32  num_palettes = sb_count(palettes);
+            u32  num_prev_palettes = sb_count(scene->skin_palettes);
+            bool repack = num_palettes != num_prev_palettes;
+            for (u32 p = 0; p < num_palettes && !repack; ++p)
+            {
+                const skin_palette& a = palettes[p];
+                const skin_palette& b = scene->skin_palettes[p];
+
+                if (a.entity != b.entity || a.joints_offset != b.joints_offset || a.num_joints != b.num_joints)
+                    repack = true;
+            }
+
+            if (repack)
+            {
+                // both lists are sorted by entity, palettes which still exist keep their fallback buffer
+                for (u32 p = 0, q = 0; q < num_prev_palettes; ++q)
+                {
+                    const skin_palette& prev = scene->skin_palettes[q];
+                    if (!is_valid(prev.cbuffer))
+                        continue;
+
+                    while (p < num_palettes && palettes[p].entity < prev.entity)
+                        ++p;
+
+                    if (p < num_palettes && palettes[p].entity == prev.entity)
+                        palettes[p].cbuffer = prev.cbuffer;
+                    else
+                        pen::renderer_release_buffer(prev.cbuffer);
+                }
+
+                sb_clear(scene->skin_palettes);
+                sb_clear(scene->bone_palette);
+
+                // palettes start on 256 byte boundaries to be bound at an offset into the shared bone buffer
+                u32 offset = 0;
+                for (u32 p = 0; p < num_palettes; ++p)
+                {
+                    palettes[p].offset = offset;
+                    offset += (palettes[p].num_joints + 3) & ~3;
+                    sb_push(scene->skin_palettes, palettes[p]);
+                }
+
+                // padded so a full bone cbuffer bound at the last palette stays in range
+                if (offset > 0)
+                {
+                    sb_add(scene->bone_palette, (s32)(offset + k_max_bones));
+                    pen::memory_zero(scene->bone_palette, sizeof(mat4) * (offset + k_max_bones));
+                }
+            }
+
+            for (u32 p = 0; p < num_palettes; ++p)
+                scene->skin_palettes[p].dirty = repack;
+
+            pen::jobs_parallel_for(num_palettes, 4, update_skin_palettes_job, scene);
+
+            if (pen::renderer_get_info().caps & PEN_CAPS_CONSTANT_BUFFER_OFFSET)
+            {
+                // all palettes live in one buffer, bound at their offset
+                u32  size = sb_count(scene->bone_palette) * sizeof(mat4);
+                bool dirty = false;
+                for (u32 p = 0; p < num_palettes; ++p)
+                    dirty |= scene->skin_palettes[p].dirty != 0;
+
+                if (size > scene->bone_buffer_size)
+                {
+                    if (is_valid(scene->bone_buffer))
+                        pen::renderer_release_buffer(scene->bone_buffer);
+
+                    pen::buffer_creation_params bcp;
+                    bcp.usage_flags = PEN_USAGE_DYNAMIC;
+                    bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
+                    bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
+                    bcp.buffer_size = size;
+                    bcp.data = nullptr;
+
+                    scene->bone_buffer = pen::renderer_create_buffer(bcp);
+                    scene->bone_buffer_size = size;
+                    dirty = true;
+                }
+
+                // uploaded whole when any palette changed, dx11 maps dynamic buffers with discard
+                if (dirty && size > 0)
+                    pen::renderer_update_buffer(scene->bone_buffer, scene->bone_palette, size);
+
+                for (u32 p = 0; p < num_palettes; ++p)
+                {
+                    const skin_palette& sp = scene->skin_palettes[p];
+                    scene->bone_cbuffer[sp.entity] = scene->bone_buffer;
+                    scene->bone_cbuffer_offset[sp.entity] = sp.offset * sizeof(mat4);
+                }
+            }
+            else
+            {
+                // without offset binding each palette has its own buffer, only the joints in use are uploaded
+                for (u32 p = 0; p < num_palettes; ++p)
+                {
+                    skin_palette& sp = scene->skin_palettes[p];
+
+                    if (!is_valid(sp.cbuffer))
+                    {
+                        pen::buffer_creation_params bcp;
+                        bcp.usage_flags = PEN_USAGE_DYNAMIC;
+                        bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
+                        bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
+                        bcp.buffer_size = sizeof(mat4) * k_max_bones;
+                        bcp.data = nullptr;
+
+                        sp.cbuffer = pen::renderer_create_buffer(bcp);
+                        sp.dirty = 1;
+                    }
+
+                    if (sp.dirty && sp.num_joints > 0)
+                        pen::renderer_update_buffer(sp.cbuffer, &scene->bone_palette[sp.offset],
+                                                    sizeof(mat4) * sp.num_joints);
+
+                    scene->bone_cbuffer[sp.entity] = sp.cbuffer;
+                    scene->bone_cbuffer_offset[sp.entity] = 0;
+                }
+            }
+
+            u32 num_sub_geometry = sb_count(sub_geometry);
+            for (u32 i = 0; i < num_sub_geometry; ++i)
+            {
+                u32 n = sub_geometry[i];
+                scene->bone_cbuffer[n] = scene->bone_cbuffer[scene->parents[n]];
+                scene->bone_cbuffer_offset[n] = scene->bone_cbuffer_offset[scene->parents[n]];
+            }
+
+            // stream out pre skinned vertex buffers, the previous output is still valid if the bones did not move
+            static u32 shader = pmfx::load_shader("forward_render");
+
+            static hash_id id_pre_skin[] = {PEN_HASH("pre_skin"), PEN_HASH("pre_skin_position")};
+
+            u32 num_pre_skinned = sb_count(pre_skinned);
+            for (u32 i = 0; i < num_pre_skinned; ++i)
+            {
+                u32 n = pre_skinned[i];
+
+                u32 owner = n;
+                if (scene->entities[n] & e_cmp::sub_geometry)
+                    owner = scene->parents[n];
+
+                skin_palette* sp = find_skin_palette(scene, owner);
+                if (!sp || !sp->dirty)
+                    continue;
+
+                cmp_geometry& geom = scene->geometries[n];
+                cmp_geometry& pos_geom = scene->position_geometries[n];
+                cmp_pre_skin& pre_skin = scene->pre_skin[n];
+
+                // bind shaders, skin position and full vertex buffer
+                u32 pre_skin_target[2] = {geom.vertex_buffer, pos_geom.vertex_buffer};
+
+                for (u32 b = 0; b < 2; ++b)
+                {
+                    // set pre skin technique
+                    pmfx::set_technique_perm(shader, id_pre_skin[b]);
+
+                    // bind stream out targets
+                    pen::renderer_set_stream_out_target(pre_skin_target[b]);
+
+                    pen::renderer_set_vertex_buffer(pre_skin.vertex_buffer, 0, pre_skin.vertex_size, 0);
+                    pen::renderer_set_constant_buffer(scene->bone_cbuffer[n], 2, pen::CBUFFER_BIND_VS,
+                                                      scene->bone_cbuffer_offset[n]);
+
+                    // render point list
+                    pen::renderer_draw(pre_skin.num_verts, 0, PEN_PT_POINTLIST);
+                    pen::renderer_set_stream_out_target(0);
+                }
+            }
+        }
+
         void update_scene(ecs_scene* scene, f32 dt)
         {
             // static anim time to pass into draw calls etc..
@@ -1383,6 +1952,8 @@ namespace put
                 if (scene->controllers[c].funcs.update_func)
                     scene->controllers[c].funcs.update_func(scene->controllers[c], scene, dt);
 
+            update_component_index(scene);
+
             if (scene->flags & e_scene_flags::pause_update)
             {
                 physics::set_paused(1);
@@ -1398,6 +1969,10 @@ namespace put
                 if (scene->extensions[e].funcs.update_func)
                     scene->extensions[e].funcs.update_func(scene->extensions[e], scene, dt);
 
+            // sync point for entity commands deferred by controllers, extensions and jobs
+            if (apply_deferred_commands(scene))
+                update_component_index(scene);
+
             static pen::timer* timer = pen::timer_create();
             pen::timer_start(timer);
 
@@ -1556,6 +2131,9 @@ namespace put
             }
 
             // Forward light buffer
+            u32* light_entities = get_component_entities(scene, e_cmp::light);
+            u32  num_light_entities = sb_count(light_entities);
+
             static forward_light_buffer light_buffer;
             s32                         pos = 0;
             s32                         num_lights = 0;
@@ -1564,8 +2142,9 @@ namespace put
 
             // directional lights
             s32 num_directions_lights = 0;
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            for (u32 li = 0; li < num_light_entities; ++li)
             {
+                size_t n = light_entities[li];
                 if (!(scene->entities[n] & e_cmp::light))
                     continue;
 
@@ -1594,8 +2173,9 @@ namespace put
 
             // point lights
             s32 num_point_lights = 0;
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            for (u32 li = 0; li < num_light_entities; ++li)
             {
+                size_t n = light_entities[li];
                 if (!(scene->entities[n] & e_cmp::light))
                     continue;
 
@@ -1627,8 +2207,9 @@ namespace put
 
             // spot lights
             s32 num_spot_lights = 0;
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            for (u32 li = 0; li < num_light_entities; ++li)
             {
+                size_t n = light_entities[li];
                 if (num_lights >= e_scene_limits::max_forward_lights)
                     break;
 
@@ -1681,8 +2262,9 @@ namespace put
             u32 num_constant_colour_area_lights = 0;
             u32 num_textured_area_lights = 0;
             // constant colour area light
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            for (u32 li = 0; li < num_light_entities; ++li)
             {
+                size_t n = light_entities[li];
                 if (num_lights >= e_scene_limits::max_forward_lights)
                     break;
 
@@ -1703,8 +2285,9 @@ namespace put
                 ++num_area_lights;
             }
             // textured / shader / animated area light
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            for (u32 li = 0; li < num_light_entities; ++li)
             {
+                size_t n = light_entities[li];
                 if (num_lights >= e_scene_limits::max_forward_lights)
                     break;
 
@@ -1749,8 +2332,11 @@ namespace put
             }
 
             // Distance field shadows
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            u32* sdf_entities = get_component_entities(scene, e_cmp::sdf_shadow);
+            u32  num_sdf_entities = sb_count(sdf_entities);
+            for (u32 si = 0; si < num_sdf_entities; ++si)
             {
+                size_t n = sdf_entities[si];
                 if (!(scene->entities[n] & e_cmp::sdf_shadow))
                     continue;
 
@@ -1768,8 +2354,9 @@ namespace put
             u32 num_shadow_maps = 0;
             u32 num_omni_shadow_maps = 0;
             u32 num_gi_maps = 0;
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            for (u32 li = 0; li < num_light_entities; ++li)
             {
+                size_t n = light_entities[li];
                 if (!(scene->entities[n] & e_cmp::light))
                     continue;
 
@@ -1837,126 +2424,7 @@ namespace put
                 }
             }
 
-            // update pre skinned vertex buffers
-            for (size_t n = 0; n < scene->num_entities; ++n)
-            {
-                if (!(scene->entities[n] & e_cmp::pre_skinned))
-                    continue;
-                
-                u32 cbuffer = -1;
-                cmp_geometry& geom = scene->geometries[n];
-                cmp_geometry& pos_geom = scene->position_geometries[n];
-                
-                if(scene->entities[n] & e_cmp::sub_geometry)
-                {
-                    // sub geom share bones with parent
-                    u32 p = scene->parents[n];
-                    cbuffer = scene->geometries[p].p_skin->bone_cbuffer;
-                }
-                else
-                {
-                    // create bone cbuffer
-                    static mat4 bb[85];
-                    if (geom.p_skin->bone_cbuffer == PEN_INVALID_HANDLE)
-                    {
-                        pen::buffer_creation_params bcp;
-                        bcp.usage_flags = PEN_USAGE_DYNAMIC;
-                        bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
-                        bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
-                        bcp.buffer_size = sizeof(mat4) * 85;
-                        bcp.data = nullptr;
-
-                        geom.p_skin->bone_cbuffer = pen::renderer_create_buffer(bcp);
-                    }
-
-                    // update bone cbuffer
-                    u32 rjr = scene->anim_controller_v2[n].root_joint_ref;
-                    s32 joints_offset = ecs::get_index_from_ref(scene, rjr);
-                    joints_offset += geom.p_skin->bone_offset;
-                    
-                    for (u32 i = 0; i < geom.p_skin->num_joints; ++i)
-                        bb[i] = scene->world_matrices[joints_offset + i] * geom.p_skin->joint_bind_matrices[i];
-
-                    pen::renderer_update_buffer(geom.p_skin->bone_cbuffer, bb, sizeof(bb));
-                    
-                    cbuffer = geom.p_skin->bone_cbuffer;
-                }
-                
-                // bind shaders, skin position and full vertex buffer
-                static u32 shader = pmfx::load_shader("forward_render");
-            
-                static hash_id id_pre_skin[] = {
-                    PEN_HASH("pre_skin"),
-                    PEN_HASH("pre_skin_position")
-                };
-                
-                u32 pre_skin_target[2] = {
-                    geom.vertex_buffer,
-                    pos_geom.vertex_buffer
-                };
-
-                for(u32 b = 0; b < 2; ++b)
-                {
-                    // set pre skin technique
-                    pmfx::set_technique_perm(shader, id_pre_skin[b]);
-                    
-                    // bind stream out targets
-                    cmp_pre_skin& pre_skin = scene->pre_skin[n];
-                    pen::renderer_set_stream_out_target(pre_skin_target[b]);
-                    
-                    pen::renderer_set_vertex_buffer(pre_skin.vertex_buffer, 0, pre_skin.vertex_size, 0);
-                    pen::renderer_set_constant_buffer(cbuffer, 2, pen::CBUFFER_BIND_VS);
-
-                    // render point list
-                    pen::renderer_draw(pre_skin.num_verts, 0, PEN_PT_POINTLIST);
-                    pen::renderer_set_stream_out_target(0);
-                }
-            }
-            
-            // update skinning buffers
-            for (size_t n = 0; n < scene->num_entities; ++n)
-            {
-                if (scene->entities[n] & e_cmp::pre_skinned)
-                    continue;
-                    
-                if (scene->entities[n] & e_cmp::skinned)
-                {
-                    // sub geom share bones with parent
-                    if(scene->entities[n] & e_cmp::sub_geometry)
-                    {
-                        u32 p = scene->parents[n];
-                        scene->bone_cbuffer[n] = scene->bone_cbuffer[p];
-                        continue;
-                    }
-                    
-                    static mat4 bb[85];
-                    cmp_geometry* p_geom = &scene->geometries[n];
-                    if (!scene->bone_cbuffer[n])
-                    {
-                        pen::buffer_creation_params bcp;
-                        bcp.usage_flags = PEN_USAGE_DYNAMIC;
-                        bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
-                        bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
-                        bcp.buffer_size = sizeof(mat4) * 85;
-                        bcp.data = nullptr;
-
-                        scene->bone_cbuffer[n] = pen::renderer_create_buffer(bcp);
-                    }
-                    
-                    u32 rjr = scene->anim_controller_v2[n].root_joint_ref;
-                    s32 joints_offset = ecs::get_index_from_ref(scene, rjr);
-                    joints_offset += p_geom->p_skin->bone_offset;
-                    
-                    for (u32 i = 0; i < p_geom->p_skin->num_joints; ++i)
-                    {
-                        mat4& joint_matrix = scene->world_matrices[joints_offset + i];
-                        mat4& bind_matrix = p_geom->p_skin->joint_bind_matrices[i];
-                        bb[i] = joint_matrix * bind_matrix;
-                    }
-
-                    pen::renderer_update_buffer(scene->bone_cbuffer[n], bb, sizeof(bb));
-                }
-            }
+            update_skinning(scene);
 
             // update draw call data
             for (size_t n = 0; n < scene->num_entities; ++n)
@@ -1992,13 +2460,20 @@ namespace put
 
                 scene->draw_call_data[n].world_matrix_inv_transpose = invt;
 
-                // todo mark dirty?
-                pen::renderer_update_buffer(scene->cbuffer[n], &scene->draw_call_data[n], sizeof(cmp_draw_call));
+                // sub allocated each frame, rendering this frame binds the new handle and offset
+                pen::dynamic_cbuffer cb = pen::renderer_alloc_dynamic_cbuffer(sizeof(cmp_draw_call));
+                memcpy(cb.cpu_ptr, &scene->draw_call_data[n], sizeof(cmp_draw_call));
+
+                scene->cbuffer[n] = cb.handle;
+                scene->cbuffer_offset[n] = cb.offset;
             }
 
             // update instance buffers
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            u32* master_entities = get_component_entities(scene, e_cmp::master_instance);
+            u32  num_master_entities = sb_count(master_entities);
+            for (u32 mi = 0; mi < num_master_entities; ++mi)
             {
+                size_t n = master_entities[mi];
                 if (!(scene->entities[n] & e_cmp::master_instance))
                     continue;
                     
@@ -2009,9 +2484,6 @@ namespace put
 
                 u32 instance_data_size = master.num_instances * master.instance_stride;
                 pen::renderer_update_buffer(master.instance_buffer, &scene->draw_call_data[n + 1], instance_data_size);
-
-                // stride over sub instances
-                n += scene->master_instances[n].num_instances;
             }
 
             // update physics running 1 frame behind to allow the sets to take effect
@@ -2529,6 +3001,8 @@ namespace put
             for (u32 n = zero_offset; n < zero_offset + num_nodes; ++n)
                 scene->parents[n] += zero_offset;
 
+            reindex_scene(scene);
+
             // read specialisations
             for (u32 n = zero_offset; n < zero_offset + num_nodes; ++n)
             {
@@ -2595,7 +3069,7 @@ namespace put
                         dev_ui::log_level(dev_ui::console_level::error, "[error] geometry - cannot find pmm file: %s",
                                           filename.c_str());
 
-                        scene->entities[n] &= ~e_cmp::geometry;
+                        remove_entity_flags(scene, n, e_cmp::geometry);
                         error = true;
                     }
                 }
@@ -2735,7 +3209,7 @@ namespace put
 
             ifs.close();
 
-            initialise_free_list(scene);
+            rebuild_free_ranges(scene);
 
             // cleanup
             sb_free(component_sizes);
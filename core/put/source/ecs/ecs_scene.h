@@ -11,6 +11,7 @@
 
 #include "data_struct.h"
 #include "pen.h"
+#include "threads.h"
 
 #include "maths/maths.h"
 #include "maths/quat.h"
@@ -83,6 +84,7 @@ namespace put
         }
 
         static const f32 k_dir_light_offset = 1000000.0f;
+        static const u32 k_max_bones = 85; // size of the bone cbuffer in the skinning shaders
         namespace e_light_type
         {
             enum light_type_t
@@ -193,11 +195,22 @@ namespace put
         {
             u32  num_joints;
             mat4 bind_shape_matrix;
-            mat4 joint_bind_matrices[85];
-            u32  bone_cbuffer = PEN_INVALID_HANDLE;
+            mat4 joint_bind_matrices[k_max_bones];
             u32  bone_offset = 0;
         };
 
+        // bone matrices for a skinned or pre-skinned entity packed into ecs_scene::bone_palette
+        // sub geometry shares the palette of its parent
+        struct skin_palette
+        {
+            u32 entity;
+            u32 joints_offset; // entity index of the first joint
+            u32 num_joints;
+            u32 offset;  // in matrices 4 aligned, into ecs_scene::bone_palette and bone_buffer
+            b32 dirty;   // joints moved this frame and palette needs uploading
+            u32 cbuffer; // own buffer without PEN_CAPS_CONSTANT_BUFFER_OFFSET, kept while the palette exists
+        };
+
         // contains handles and data to re-create a material from scratch
         // material resources could be re-used created and shared
         struct material_resource
@@ -402,6 +415,74 @@ namespace put
             free_node_list* prev;
         };
 
+        // segment tree over entity slots, each node stores the longest run of free slots in its range
+        // and the free runs touching its left and right edges. gives lowest address first fit of contiguous
+        // ranges, allocate and free in o(log n)
+        struct free_range_node
+        {
+            u32 prefix;
+            u32 suffix;
+            u32 longest;
+            u32 pending; // lazy assignment to children
+        };
+
+        struct free_range_tree
+        {
+            free_range_node* nodes = nullptr;
+            u32              leaves = 0; // power of 2 >= soa_size
+        };
+
+        // sorted lists of entity indices per e_cmp flag so systems only visit members instead of testing flags
+        // on every entity. flag changes made through set / add / remove_entity_flags queue the entity in dirty,
+        // the lists are patched for those entities only when refreshed in update_scene
+        struct component_index
+        {
+            u64* flags = nullptr;
+            u32  size = 0;
+            u32  num_entities = 0;
+            u32* entities[64] = {0};
+            u32* dirty = nullptr;
+            b32  rebuild = 0;
+        };
+
+        // entity mutations recorded from any thread into a buffer per thread, applied at the sync point in update_scene
+        namespace e_entity_cmd
+        {
+            enum entity_cmd_t
+            {
+                spawn,
+                set_component,
+                destroy,
+                reparent
+            };
+        }
+
+        struct entity_cmd
+        {
+            u32 type;
+            u32 entity;      // entity index or deferred entity handle
+            u32 arg;         // component index for set_component, parent for reparent
+            u32 data_offset; // into entity_cmd_buffer::data
+            u32 data_size;
+            u64 cmp_flags;   // or'd into entities by set_component
+        };
+
+        struct entity_cmd_buffer
+        {
+            entity_cmd* cmds = nullptr;
+            u8*         data = nullptr;
+            u32*        spawned = nullptr; // entity indices of the spawns resolved by the last apply
+            u32         num_spawns = 0;
+        };
+
+        struct entity_cmd_queue
+        {
+            static const u32 k_max_buffers = 32;
+
+            entity_cmd_buffer buffers[k_max_buffers]; // indexed by pen::jobs_get_thread_index
+            pen::mutex*       lock = nullptr;         // buffer 0 is shared by all threads outside the worker pool
+        };
+
         template <typename T>
         struct cmp_array
         {
@@ -492,7 +573,7 @@ namespace put
             cmp_array<cmp_geometry>             position_geometries;
             cmp_array<u32>                      cbuffer;
             cmp_array<cmp_draw_call>            draw_call_data;
-            cmp_array<free_node_list>           free_list;
+            cmp_array<free_node_list>           free_list; // unused, kept to preserve the scene file layout
             cmp_array<cmp_material>             materials;
             cmp_array<cmp_material_data>        material_data;
             cmp_array<material_resource>        material_resources;
@@ -510,6 +591,8 @@ namespace put
             cmp_array<u32>                      bone_cbuffer;
             cmp_array<ecs_ref>                  ref_slot;
             cmp_array<quat>                     additive_rotation;
+            cmp_array<u32>                      cbuffer_offset; // draw constants in cbuffer, from the dynamic ring
+            cmp_array<u32>                      bone_cbuffer_offset; // palette in bone_cbuffer, bytes
 
             // num base components calculates value based on its address - entities address.
             u32 num_base_components;
@@ -522,7 +605,9 @@ namespace put
             // scene Data
             size_t           num_entities = 0;
             u32              soa_size = 0;
-            free_node_list*  free_list_head = nullptr;
+            free_range_tree  free_ranges;
+            component_index  cmp_index;
+            entity_cmd_queue cmd_queue;
             free_node_list*  ref_free_list_head = nullptr;
             ecs_ref*         ecs_refs = nullptr;
             u32              forward_light_buffer = PEN_INVALID_HANDLE;
@@ -536,6 +621,10 @@ namespace put
             extents          renderable_extents;
             extents          shadow_extent_constraints = {{0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 0.0f}};
             u32*             selection_list = nullptr;
+            skin_palette*    skin_palettes = nullptr;
+            mat4*            bone_palette = nullptr;
+            u32              bone_buffer = PEN_INVALID_HANDLE;
+            u32              bone_buffer_size = 0;
             u32              version = k_version;
             Str              filename = "";
 
@@ -570,14 +659,19 @@ namespace put
         void default_scene(ecs_scene* scene);
 
         void resize_scene_buffers(ecs_scene* scene, s32 size = 1024);
+        void update_component_index(ecs_scene* scene);
+        u32* get_component_entities(ecs_scene* scene, u64 cmp_flag); // sorted sb of entities with cmp_flag
+        void set_entity_flags(ecs_scene* scene, u32 entity, u64 flags);
+        void add_entity_flags(ecs_scene* scene, u32 entity, u64 flags);
+        void remove_entity_flags(ecs_scene* scene, u32 entity, u64 flags);
+        void reindex_entity(ecs_scene* scene, u32 entity); // entities[entity] was written directly or by memcpy
+        void reindex_scene(ecs_scene* scene);              // rebuild all lists on the next refresh, after loads etc
         void zero_entity_components(ecs_scene* scene, u32 node_index);
 
         void delete_entity(ecs_scene* scene, u32 node_index);
         void delete_entity_first_pass(ecs_scene* scene, u32 node_index);
         void delete_entity_second_pass(ecs_scene* scene, u32 node_index);
 
-        void    initialise_free_list(ecs_scene* scene);
-
         void            register_ecs_extension(ecs_scene* scene, const ecs_extension& ext);
         void            unregister_ecs_extensions(ecs_scene* scene);
         ecs_extension*  get_ecs_extension(ecs_scene* scene, hash_id id);
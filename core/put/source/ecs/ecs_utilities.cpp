@@ -5,6 +5,7 @@
 #include "dev_ui.h"
 #include <fstream>
 
+#include "ecs/ecs_commands.h"
 #include "ecs/ecs_editor.h"
 #include "ecs/ecs_resources.h"
 #include "ecs/ecs_utilities.h"
@@ -88,13 +89,257 @@ namespace put
             }
         }
         
+        namespace
+        {
+            enum free_range_state
+            {
+                k_range_none = 0,
+                k_range_free = 1,
+                k_range_allocated = 2
+            };
+
+            void range_apply(free_range_tree& t, u32 node, u32 len, u32 state)
+            {
+                u32 run = state == k_range_free ? len : 0;
+
+                free_range_node& n = t.nodes[node];
+                n.prefix = run;
+                n.suffix = run;
+                n.longest = run;
+                n.pending = state;
+            }
+
+            void range_push(free_range_tree& t, u32 node, u32 len)
+            {
+                u32 state = t.nodes[node].pending;
+                if (state == k_range_none)
+                    return;
+
+                range_apply(t, node * 2, len / 2, state);
+                range_apply(t, node * 2 + 1, len / 2, state);
+                t.nodes[node].pending = k_range_none;
+            }
+
+            void range_pull(free_range_tree& t, u32 node, u32 len)
+            {
+                u32                    half = len / 2;
+                const free_range_node& l = t.nodes[node * 2];
+                const free_range_node& r = t.nodes[node * 2 + 1];
+
+                free_range_node& n = t.nodes[node];
+                n.prefix = l.prefix == half ? half + r.prefix : l.prefix;
+                n.suffix = r.suffix == half ? half + l.suffix : r.suffix;
+                n.longest = std::max<u32>(std::max<u32>(l.longest, r.longest), l.suffix + r.prefix);
+            }
+
+            void range_build(free_range_tree& t, const ecs_scene* scene, u32 node, u32 nl, u32 nr)
+            {
+                t.nodes[node].pending = k_range_none;
+
+                if (nr - nl == 1)
+                {
+                    // padding past the soa is free, allocations check they fit inside soa_size
+                    bool allocated = nl < scene->soa_size && (scene->entities[nl] & e_cmp::allocated);
+                    range_apply(t, node, 1, allocated ? k_range_allocated : k_range_free);
+                    t.nodes[node].pending = k_range_none;
+                    return;
+                }
+
+                u32 mid = (nl + nr) / 2;
+                range_build(t, scene, node * 2, nl, mid);
+                range_build(t, scene, node * 2 + 1, mid, nr);
+                range_pull(t, node, nr - nl);
+            }
+
+            void range_assign(free_range_tree& t, u32 node, u32 nl, u32 nr, u32 l, u32 r, u32 state)
+            {
+                if (r <= nl || nr <= l)
+                    return;
+
+                if (l <= nl && nr <= r)
+                {
+                    range_apply(t, node, nr - nl, state);
+                    return;
+                }
+
+                range_push(t, node, nr - nl);
+
+                u32 mid = (nl + nr) / 2;
+                range_assign(t, node * 2, nl, mid, l, r, state);
+                range_assign(t, node * 2 + 1, mid, nr, l, r, state);
+                range_pull(t, node, nr - nl);
+            }
+
+            // lowest start of num free slots, node must contain a long enough run
+            u32 range_find_first(free_range_tree& t, u32 node, u32 nl, u32 nr, u32 num)
+            {
+                if (nr - nl == 1)
+                    return nl;
+
+                range_push(t, node, nr - nl);
+
+                u32                    mid = (nl + nr) / 2;
+                const free_range_node& l = t.nodes[node * 2];
+                const free_range_node& r = t.nodes[node * 2 + 1];
+
+                if (l.longest >= num)
+                    return range_find_first(t, node * 2, nl, mid, num);
+
+                // run straddles the middle
+                if (l.suffix + r.prefix >= num)
+                    return mid - l.suffix;
+
+                return range_find_first(t, node * 2 + 1, mid, nr, num);
+            }
+
+            // lowest index >= from which is free or allocated, -1 if there is none
+            u32 range_find_from(free_range_tree& t, u32 node, u32 nl, u32 nr, u32 from, bool free)
+            {
+                if (nr <= from)
+                    return -1;
+
+                const free_range_node& n = t.nodes[node];
+                if (free && n.longest == 0)
+                    return -1;
+
+                if (!free && n.longest == nr - nl)
+                    return -1;
+
+                if (nr - nl == 1)
+                    return nl;
+
+                range_push(t, node, nr - nl);
+
+                u32 mid = (nl + nr) / 2;
+                u32 i = range_find_from(t, node * 2, nl, mid, from, free);
+                if (i != PEN_INVALID_HANDLE)
+                    return i;
+
+                return range_find_from(t, node * 2 + 1, mid, nr, from, free);
+            }
+
+            bool range_is_free(free_range_tree& t, u32 node, u32 nl, u32 nr, u32 l, u32 r)
+            {
+                if (r <= nl || nr <= l)
+                    return true;
+
+                if (l <= nl && nr <= r)
+                    return t.nodes[node].longest == nr - nl;
+
+                range_push(t, node, nr - nl);
+
+                u32 mid = (nl + nr) / 2;
+                return range_is_free(t, node * 2, nl, mid, l, r) && range_is_free(t, node * 2 + 1, mid, nr, l, r);
+            }
+
+            void set_range_state(ecs_scene* scene, u32 start, u32 num, u32 state)
+            {
+                free_range_tree& t = scene->free_ranges;
+                range_assign(t, 1, 0, t.leaves, start, start + num, state);
+            }
+
+            // finds the lowest contiguous free range of num entities, growing the soa when there is no space
+            u32 find_free_range(ecs_scene* scene, u32 num)
+            {
+                for (;;)
+                {
+                    free_range_tree& t = scene->free_ranges;
+                    if (t.nodes && t.nodes[1].longest >= num)
+                    {
+                        // a run which crosses soa_size means there is no run inside it
+                        u32 start = range_find_first(t, 1, 0, t.leaves, num);
+                        if (start + num <= scene->soa_size)
+                            return start;
+                    }
+
+                    resize_scene_buffers(scene, std::max<u32>(scene->soa_size, num));
+                }
+            }
+
+            void allocate_entity_range(ecs_scene* scene, u32 start, u32 num)
+            {
+                for (u32 i = start; i < start + num; ++i)
+                {
+                    scene->ref_slot[i] = allocate_ref(scene, i);
+                    add_entity_flags(scene, i, e_cmp::allocated);
+                }
+
+                set_range_state(scene, start, num, k_range_allocated);
+                scene->num_entities = std::max<u32>(start + num, scene->num_entities);
+            }
+        } // namespace
+
+        void rebuild_free_ranges(ecs_scene* scene)
+        {
+            free_range_tree& t = scene->free_ranges;
+
+            u32 leaves = 1;
+            while (leaves < scene->soa_size)
+                leaves *= 2;
+
+            if (leaves != t.leaves)
+            {
+                t.nodes = (free_range_node*)pen::memory_realloc(t.nodes, sizeof(free_range_node) * leaves * 2);
+                t.leaves = leaves;
+            }
+
+            range_build(t, scene, 1, 0, leaves);
+        }
+
+        void free_entity_range(ecs_scene* scene, u32 start, u32 num)
+        {
+            if (!scene->free_ranges.nodes)
+                return;
+
+            for (u32 i = start; i < start + num; ++i)
+                remove_entity_flags(scene, i, e_cmp::allocated);
+
+            set_range_state(scene, start, num, k_range_free);
+        }
+
+        u32 get_last_entity(ecs_scene* scene)
+        {
+            free_range_tree& t = scene->free_ranges;
+            if (!t.nodes)
+                return -1;
+
+            u32 trailing = t.nodes[1].suffix;
+            if (trailing >= t.leaves)
+                return -1;
+
+            return t.leaves - trailing - 1;
+        }
+
         void insert_new_entities(ecs_scene* scene, s32 pos, s32 num)
         {
+            free_range_tree& t = scene->free_ranges;
+
+            // there is already a gap at pos, no need to move anything
+            if ((u32)(pos + num) <= scene->soa_size && range_is_free(t, 1, 0, t.leaves, pos, pos + num))
+            {
+                for (u32 i = 0; i < scene->num_components; ++i)
+                {
+                    generic_cmp_array& cmp = scene->get_component_array(i);
+                    memset(cmp[pos], 0x00, cmp.size * num);
+                }
+
+                for (s32 i = pos; i < pos + num; ++i)
+                    reindex_entity(scene, i);
+
+                allocate_entity_range(scene, pos, num);
+
+                for (s32 i = pos; i < pos + num; ++i)
+                    scene->parents[i] = i;
+
+                scene->flags |= e_scene_flags::invalidate_scene_tree;
+                return;
+            }
+
             u32 shift_count = scene->num_entities - pos;
             
             // inserts new entites at pos moving entities downward to make space
             u32 max_num = scene->num_entities + num;
-            if (max_num >= scene->soa_size || !scene->free_list_head)
+            if (max_num >= scene->soa_size)
                 resize_scene_buffers(scene, max_num * 2);
             
             scene->num_entities = max_num;
@@ -105,6 +350,7 @@ namespace put
                 generic_cmp_array& cmp = scene->get_component_array(i);
                 memmove(cmp[pos+num], cmp[pos], cmp.size*shift_count);
             }
+            reindex_scene(scene);
             
             // fix refs
             for (u32 i = pos+num; i < scene->num_entities; ++i)
@@ -125,125 +371,47 @@ namespace put
             for(s32 i = pos; i < pos+num; ++i)
             {
                 scene->ref_slot[i] = allocate_ref(scene, i);
-                scene->entities[i] |= e_cmp::allocated;
+                add_entity_flags(scene, i, e_cmp::allocated);
                 scene->parents[i] = i;
             }
 
-            //fully update free list
-            initialise_free_list(scene);
+            // everything after pos moved
+            rebuild_free_ranges(scene);
             scene->flags |= e_scene_flags::invalidate_scene_tree;
         }
 
         void get_new_entities_append(ecs_scene* scene, s32 num, s32& start, s32& end)
         {
-            // o(1) - appends a bunch of nodes on the end
+            // o(log n) - appends a bunch of nodes on the end
             u32 max_num = scene->num_entities + num;
-            if (max_num >= scene->soa_size || !scene->free_list_head)
+            if (max_num >= scene->soa_size)
                 resize_scene_buffers(scene, max_num * 2);
 
             start = scene->num_entities;
             end = start + num;
 
-            // iterate over nodes flagging allocated
-            for (s32 i = start; i < end; ++i)
-            {
-                scene->ref_slot[i] = allocate_ref(scene, i);
-                scene->entities[i] |= e_cmp::allocated;
-            }
-
-            scene->free_list_head = scene->free_list[end].next;
-
-            if (scene->free_list[start].prev)
-            {
-                // remove chunk from the free list
-                scene->free_list[start].prev = scene->free_list[end].next;
-            }
-            else
-            {
-                // if we are at the head
-                scene->free_list_head = scene->free_list[end].next;
-            }
-
-            scene->num_entities = end;
+            allocate_entity_range(scene, start, num);
         }
 
         void get_new_entities_contiguous(ecs_scene* scene, s32 num, s32& start, s32& end)
         {
-            // o(n) - has to find contiguous nodes within the free list, and worst case will allocate more mem and append the
-            // new nodes
-            u32 max_num = scene->num_entities + num;
-            if (max_num >= scene->soa_size || !scene->free_list_head)
-                resize_scene_buffers(scene, max_num * 2);
-
-            free_node_list* fnl_iter = scene->free_list_head;
-            free_node_list* fnl_start = fnl_iter;
-
-            s32 count = num;
-
-            // find contiguous nodes
-            for (;;)
-            {
-                if (!fnl_iter->next)
-                    break;
-
-                s32 diff = fnl_iter->next->node - fnl_iter->node;
-
-                fnl_iter = fnl_iter->next;
-
-                if (diff == 1)
-                {
-                    count--;
-
-                    if (count == 0)
-                        break;
-                }
-                else
-                {
-                    fnl_start = fnl_iter;
-                    count = num;
-                }
-            }
-
-            if (count == 0)
-            {
-                start = fnl_start->node;
-                end = start + num;
-
-                // iterate over nodes allocating
-                fnl_iter = fnl_start;
-                for (s32 i = 0; i < num + 1; ++i)
-                {
-                    scene->ref_slot[fnl_iter->node] = allocate_ref(scene, fnl_iter->node);
-                    scene->entities[fnl_iter->node] |= e_cmp::allocated;
-                    
-                    scene->free_list_head = fnl_iter;
-                    fnl_iter = fnl_iter->next;
-                }
+            // o(log n) - lowest address first fit, worst case will allocate more mem and append the new nodes
+            start = find_free_range(scene, num);
+            end = start + num;
 
-                scene->num_entities = std::max<u32>(end, scene->num_entities);
-            }
+            allocate_entity_range(scene, start, num);
         }
 
         u32 get_next_entity(ecs_scene* scene)
         {
-            if (!scene->free_list_head)
-                resize_scene_buffers(scene);
-
-            return scene->free_list_head->node;
+            return find_free_range(scene, 1);
         }
 
         u32 get_new_entity(ecs_scene* scene)
         {
-            // o(1) using free list
-
-            if (!scene->free_list_head)
-                resize_scene_buffers(scene, scene->soa_size * 2);
-
-            u32 ii = 0;
-            ii = scene->free_list_head->node;
-            scene->free_list_head = scene->free_list_head->next;
-
-            u32 i = ii;
+            // o(log n) using the free range tree
+            u32 i = find_free_range(scene, 1);
+            set_range_state(scene, i, 1, k_range_allocated);
 
             scene->flags |= e_scene_flags::invalidate_scene_tree;
 
@@ -258,7 +426,7 @@ namespace put
             
             // allocate
             scene->ref_slot[i] = allocate_ref(scene, i);
-            scene->entities[i] = e_cmp::allocated;
+            set_entity_flags(scene, i, e_cmp::allocated);
             
             return i;
         }
@@ -417,16 +585,83 @@ namespace put
 
         void trim_entities(ecs_scene* scene)
         {
-            u32 new_num = scene->num_entities;
-            for (u32 n = scene->num_entities - 1; n >= 0; --n)
+            scene->num_entities = get_last_entity(scene) + 1;
+        }
+
+        bool compact_entities(ecs_scene* scene, u32 max_moves)
+        {
+            free_range_tree& t = scene->free_ranges;
+            if (!t.nodes)
+                return true;
+
+            u32 moved = 0;
+            while (moved < max_moves)
             {
-                if (scene->entities[n] & e_cmp::allocated)
-                    break;
+                u32 last = get_last_entity(scene);
+                u32 hole = range_find_from(t, 1, 0, t.leaves, 0, true);
+
+                if (last == PEN_INVALID_HANDLE || hole == PEN_INVALID_HANDLE || hole > last)
+                {
+                    trim_entities(scene);
+                    return true;
+                }
+
+                // slide the next allocated block down into the hole, relative order is kept so parents stay above
+                // children and contiguous ranges (instances, rigs) stay contiguous
+                u32 src = range_find_from(t, 1, 0, t.leaves, hole, false);
+                u32 block_end = std::min<u32>(range_find_from(t, 1, 0, t.leaves, src, true), last + 1);
+                u32 num = std::min<u32>(block_end - src, max_moves - moved);
+                u32 delta = src - hole;
+
+                for (u32 i = 0; i < scene->num_components; ++i)
+                {
+                    generic_cmp_array& cmp = scene->get_component_array(i);
+                    memmove(cmp[hole], cmp[src], cmp.size * num);
+
+                    u32 vacated = std::max<u32>(hole + num, src);
+                    memset(cmp[vacated], 0x00, cmp.size * (src + num - vacated));
+                }
+
+                for (u32 i = hole; i < src + num; ++i)
+                    reindex_entity(scene, i);
+
+                // refs and parents which point into the moved block, parents are always at a lower index
+                for (u32 i = hole; i < hole + num; ++i)
+                    scene->ecs_refs[scene->ref_slot[i]] = i;
+
+                for (u32 i = hole; i < scene->num_entities; ++i)
+                {
+                    u32& p = scene->parents[i];
+                    if (p >= src && p < src + num)
+                        p -= delta;
+                }
+
+                u32 num_selected = sb_count(scene->selection_list);
+                for (u32 s = 0; s < num_selected; ++s)
+                {
+                    u32& e = scene->selection_list[s];
+                    if (e >= src && e < src + num)
+                        e -= delta;
+                }
+
+                if (scene->selected_index >= (s32)src && scene->selected_index < (s32)(src + num))
+                    scene->selected_index -= (s32)delta;
+
+                remap_deferred_entities(scene, src, num, hole);
+
+                // unallocated vacated slots still have parent == self
+                u32 vacated = std::max<u32>(hole + num, src);
+                for (u32 i = vacated; i < src + num; ++i)
+                    scene->parents[i] = i;
+
+                set_range_state(scene, hole, num, k_range_allocated);
+                set_range_state(scene, vacated, src + num - vacated, k_range_free);
 
-                new_num--;
+                scene->flags |= e_scene_flags::invalidate_scene_tree;
+                moved += num;
             }
 
-            scene->num_entities = new_num;
+            return false;
         }
 
         void clone_selection_hierarchical(ecs_scene* scene, u32** selection_list, const c8* suffix)
@@ -496,7 +731,7 @@ namespace put
             if (scene->entities[master] & e_cmp::master_instance)
                 return;
 
-            scene->entities[master] |= e_cmp::master_instance;
+            add_entity_flags(scene, master, e_cmp::master_instance);
 
             scene->master_instances[master].num_instances = num_nodes;
             scene->master_instances[master].instance_stride = sizeof(cmp_draw_call);
@@ -661,7 +896,7 @@ namespace put
             u32 nn = parent;
 
             // instantiate
-            scene->entities[nn] |= e_cmp::geometry;
+            add_entity_flags(scene, nn, e_cmp::geometry);
             scene->geometries[nn].vertex_buffer = pen::renderer_create_buffer(vbcp);
             scene->geometries[nn].index_buffer = pen::renderer_create_buffer(ibcp);
             scene->geometries[nn].index_type = index_type;
@@ -763,7 +998,7 @@ namespace put
             sb_push(controller.anim_instance_ids, anim->id_name);
 
             // todo validate
-            scene->entities[node_index] |= e_cmp::anim_controller;
+            add_entity_flags(scene, node_index, e_cmp::anim_controller);
             return anim_index;
         }
     } // namespace ecs
@@ -40,10 +40,17 @@ namespace put
         u32*    get_children_of_type(ecs_scene* scene, u32 parent, u32 cmp_flags);
         
         u32     get_next_entity(ecs_scene* scene); // gets next entity index
-        u32     get_new_entity(ecs_scene* scene);  // allocates a new entity at the next index o(1)
-        void    get_new_entities_contiguous(ecs_scene* scene, s32 num, s32& start, s32& end); // finds contiguous space o(n)
-        void    get_new_entities_append(ecs_scene* scene, s32 num, s32& start, s32& end);     // appends them on the end o(1)
-        void    insert_new_entities(ecs_scene* scene, s32 pos, s32 num);
+        u32     get_new_entity(ecs_scene* scene);  // allocates a new entity at the lowest free index o(log n)
+        void    get_new_entities_contiguous(ecs_scene* scene, s32 num, s32& start, s32& end); // lowest contiguous space o(log n)
+        void    get_new_entities_append(ecs_scene* scene, s32 num, s32& start, s32& end);     // appends them on the end o(log n)
+        void    insert_new_entities(ecs_scene* scene, s32 pos, s32 num); // o(log n) if pos is free, otherwise shifts o(n)
+        void    free_entity_range(ecs_scene* scene, u32 start, u32 num); // returns slots to the allocator o(log n)
+        void    rebuild_free_ranges(ecs_scene* scene); // rebuild the allocator from allocated flags o(n)
+        u32     get_last_entity(ecs_scene* scene); // last allocated entity index or -1 if empty o(1)
+        
+        // stable compaction closing gaps in the soa, moves at most max_moves entities per call so it can be
+        // amortised over frames. entity indices change, hold ecs_ref to keep track. returns true when compact
+        bool    compact_entities(ecs_scene* scene, u32 max_moves = -1);
         u32     clone_entity(ecs_scene* scene, u32 src, s32 dst = -1, s32 parent = -1,
                              clone_mode mode = e_clone_mode::instantiate, vec3f offset = vec3f::zero(),
                              const c8* suffix = "_cloned");
@@ -53,7 +60,7 @@ namespace put
         void    bake_entities_to_vb(ecs_scene* scene, u32 parent, u32* node_list);
         void    set_entity_parent(ecs_scene* scene, u32 parent, u32 child);
         void    set_entity_parent_validate(ecs_scene* scene, u32& parent, u32& child);
-        void    trim_entities(ecs_scene* scene); // trim entites setting num_entities to the last allocated
+        void    trim_entities(ecs_scene* scene); // trim entites setting num_entities to the last allocated o(1)
         u32     bind_animation_to_rig(ecs_scene* scene, anim_handle anim_handle, u32 node_index, u32 flags = 0);
         void    tree_to_entity_index_list(const scene_tree& tree, s32 start_node, std::vector<s32>& list_out);
         void    build_scene_tree(ecs_scene* scene, s32 start_node, scene_tree& tree_out);
@@ -3,7 +3,9 @@
 // License: https://github.com/polymonster/pmtech/blob/master/license.md
 
 #include "loader.h"
+#include "block_compressor.h"
 #include "dev_ui.h"
+#include "mip_generator.h"
 
 #include "console.h"
 #include "data_struct.h"
@@ -17,8 +19,10 @@
 #include "renderer.h"
 #include "str/Str.h"
 #include "str_utilities.h"
+#include "threads.h"
 #include "timer.h"
 
+#include <algorithm>
 #include <fstream>
 #include <vector>
 
@@ -35,6 +39,7 @@ using namespace put;
 #define DXGI_BC3_UNORM 77
 #define DXGI_BC4_UNORM 80
 #define DXGI_BC5_UNORM 83
+#define DXGI_BC7_UNORM 98
 
 namespace
 {
@@ -46,6 +51,13 @@ namespace
         DDS_DX10 = PEN_FOURCC('D', 'X', '1', '0')
     };
 
+    enum dx10_resource_dimension
+    {
+        DX10_TEXTURE2D = 3,
+        DX10_TEXTURE3D = 4,
+        DX10_MISC_TEXTURECUBE = 0x4
+    };
+
     enum compression_format
     {
         BC1 = PEN_FOURCC('D', 'X', 'T', '1'),
@@ -142,14 +154,21 @@ namespace
         pen::texture_creation_params tcp;
     };
 
+    struct watch_input
+    {
+        Str     name;
+        hash_id id_data_file;
+        u32     watch;
+    };
+
     struct file_watch
     {
-        hash_id              id_name;
-        Str                  filename;
-        pen::json            dependencies;
-        bool                 invalidated = false;
-        std::vector<hash_id> changes;
-        u32                  rebuild_ts = 0;
+        hash_id                  id_name;
+        Str                      filename;
+        u32                      dep_watch = PEN_INVALID_HANDLE;
+        std::vector<watch_input> inputs; // parsed from the dependencies "files" once per build
+        bool                     invalidated = false;
+        std::vector<hash_id>     changes;
 
         void (*build_callback)();
         void (*hotload_callback)(std::vector<hash_id>& dirty);
@@ -164,7 +183,7 @@ namespace
         if (compressed)
         {
             u32 block_width = max<u32>(1, ((width + 3) / 4));
-            u32 block_height = max<u32>(1, ((width + 3) / 4));
+            u32 block_height = max<u32>(1, ((height + 3) / 4));
             return block_width * block_height * block_size;
         }
 
@@ -210,6 +229,10 @@ namespace
                 block_size = 16;
                 compressed = true;
                 return PEN_TEX_FORMAT_BC5_UNORM;
+            case DXGI_BC7_UNORM:
+                block_size = 16;
+                compressed = true;
+                return PEN_TEX_FORMAT_BC7_UNORM;
         }
 
         PEN_ASSERT_MSG(0, "Unsupported Image Format");
@@ -271,7 +294,7 @@ namespace
             }
         }
 
-        // supported formats are RGBA, BC1-BC5
+        // supported formats are RGBA, BC1-BC5, BC7 with a dx10 header
         PEN_ASSERT_MSG(0, "Unsupported Image Format");
         return 0;
     }
@@ -296,28 +319,55 @@ namespace
                 pf.b_mask = 0xffffffff;
                 pf.rgb_bit_count = 32;
                 break;
+            case PEN_TEX_FORMAT_BC1_UNORM:
+                pf.flags |= DDPF_FOURCC;
+                pf.four_cc = BC1;
+                break;
+            case PEN_TEX_FORMAT_BC2_UNORM:
+                pf.flags |= DDPF_FOURCC;
+                pf.four_cc = BC2;
+                break;
+            case PEN_TEX_FORMAT_BC3_UNORM:
+                pf.flags |= DDPF_FOURCC;
+                pf.four_cc = BC3;
+                break;
+            case PEN_TEX_FORMAT_BC4_UNORM:
+                pf.flags |= DDPF_FOURCC;
+                pf.four_cc = BC4;
+                break;
+            case PEN_TEX_FORMAT_BC5_UNORM:
+                pf.flags |= DDPF_FOURCC;
+                pf.four_cc = BC5;
+                break;
+            case PEN_TEX_FORMAT_BC7_UNORM:
+                pf.flags |= DDPF_FOURCC;
+                pf.four_cc = DDS_DX10;
+                break;
         }
 
         return pf;
     }
 
-    u32 load_texture_internal(const c8* filename, hash_id hh, pen::texture_creation_params& tcp)
+    u32 calc_chain_size(const pen::texture_creation_params& tcp, u32 first_mip, u32 end_mip)
     {
-        // load a texture file from disk.
-        void* file_data = nullptr;
-        u32   file_data_size = 0;
-
-        u32 pen_err = pen::filesystem_read_file_to_buffer(filename, &file_data, file_data_size);
+        // bytes of mips [first_mip, end_mip) for a single array slice
+        bool compressed = tcp.pixels_per_block > 1;
 
-        if (pen_err != PEN_ERR_OK)
+        u32 size = 0;
+        for (u32 m = first_mip; m < end_mip; ++m)
         {
-            dev_console_log_level(dev_ui::console_level::error, "[error] texture - unabled to find file: %s", filename);
-            pen::memory_free(file_data);
-            return 0;
+            u32 mip_width = max<u32>(tcp.width >> m, 1);
+            u32 mip_height = max<u32>(tcp.height >> m, 1);
+            size += calc_level_size(mip_width, mip_height, compressed, tcp.block_size);
         }
 
-        // parse dds header
-        dds_header* ddsh = (dds_header*)file_data;
+        return size;
+    }
+
+    u32 parse_dds_header(const u8* header, pen::texture_creation_params& tcp)
+    {
+        // fills out texture_creation_params without data and returns the offset of the image data in the file
+        dds_header* ddsh = (dds_header*)header;
 
         bool dx10_header_present;
         bool compressed;
@@ -325,16 +375,16 @@ namespace
 
         u32 format = dds_pixel_format_to_texture_format(ddsh, compressed, block_size, dx10_header_present);
 
-        u8* top_image_start = (u8*)file_data + sizeof(dds_header);
+        u32 data_offset = sizeof(dds_header);
         u32 array_size = 1;
         if (dx10_header_present)
         {
-            dx10_header* dxh = (dx10_header*)top_image_start;
+            dx10_header* dxh = (dx10_header*)(header + data_offset);
 
             format = dxgi_format_to_texture_format(dxh, compressed, block_size);
 
             array_size = dxh->array_size;
-            top_image_start += sizeof(dx10_header);
+            data_offset += sizeof(dx10_header);
         }
 
         // fill out texture_creation_params
@@ -352,6 +402,7 @@ namespace
         tcp.block_size = block_size;
         tcp.pixels_per_block = compressed ? 4 : 1;
         tcp.collection_type = array_size > 1 ? pen::TEXTURE_COLLECTION_ARRAY : pen::TEXTURE_COLLECTION_NONE;
+        tcp.data = nullptr;
 
         if (ddsh->caps & DDSCAPS_COMPLEX)
         {
@@ -368,46 +419,379 @@ namespace
             }
         }
 
-        // calculate total data size
-        tcp.data_size = 0;
+        // faces / slices / depths each with a full mip chain
+        tcp.data_size = calc_chain_size(tcp, 0, tcp.num_mips) * tcp.num_arrays;
 
-        // faces / slices / depths
-        for (u32 a = 0; a < tcp.num_arrays; ++a)
+        return data_offset;
+    }
+
+    u32 load_texture_internal(const c8* filename, hash_id hh, pen::texture_creation_params& tcp)
+    {
+        // load a texture file from disk.
+        void* file_data = nullptr;
+        u32   file_data_size = 0;
+
+        u32 pen_err = pen::filesystem_read_file_to_buffer(filename, &file_data, file_data_size);
+
+        if (pen_err != PEN_ERR_OK)
         {
-            // top level
-            u32 data_size = calc_level_size(tcp.width, tcp.height, compressed, block_size);
+            dev_console_log_level(dev_ui::console_level::error, "[error] texture - unabled to find file: %s", filename);
+            pen::memory_free(file_data);
+            return 0;
+        }
+
+        // create from the file contents in place, the renderer takes its own copy
+        u32 data_offset = parse_dds_header((u8*)file_data, tcp);
+        tcp.data = (u8*)file_data + data_offset;
 
-            // mips
-            u32 ext_data_size = 0;
+        // files without mips get a generated chain, dds has no srgb formats here so colour is filtered as stored
+        void* mip_data = nullptr;
+        if (put::generate_mips(tcp, e_mip_filter::box))
+            mip_data = tcp.data;
 
-            u32 mip_width = tcp.width >> 1;
-            u32 mip_height = tcp.height >> 1;
+        u32 texture_index = pen::renderer_create_texture(tcp);
 
-            for (s32 i = 0; i < tcp.num_mips - 1; ++i)
+        pen::memory_free(mip_data);
+        pen::memory_free(file_data);
+        tcp.data = nullptr;
+
+        return texture_index;
+    }
+
+    //
+    // Texture streaming
+    //
+
+    static const u32 k_stream_tail_size = 64;     // mips this size and smaller are created at load and stay resident
+    static const u32 k_stream_max_loads = 4;      // reads in flight on the io thread
+    static const u32 k_stream_unused_frames = 60; // frames without use before mips may be evicted
+
+    struct streamed_texture
+    {
+        Str                          filename;
+        Str                          path; // resolved for the platform, read on the io thread
+        u32                          handle = 0;
+        pen::texture_creation_params tcp;             // full mip chain, data is null
+        u32                          data_offset = 0; // of the first slice in the file
+        u32                          slice_size = 0;  // full mip chain of a single slice
+        u32                          tail_mip = 0;    // first mip of the resident tail
+
+        // tail of all slices, kept to evict without reading the file
+        void* tail_data = nullptr;
+        u32   tail_data_size = 0;
+
+        u32   resident_mip = 0;
+        u32   generation = 0; // changes on hot load, loads for an old file are discarded
+        bool  loading = false;
+        a_u32 screen_size = {0}; // largest size in pixels reported since the last update
+        u32   wanted_mip = 0;
+        u32   wanted_size = 0;
+        u32   last_used_frame = 0;
+    };
+
+    struct stream_load
+    {
+        streamed_texture* st;
+        const c8*         path;
+        u32               generation;
+        u32               top_mip;
+        u32               file_offset;  // of top_mip in the first slice
+        u32               slice_stride; // bytes between slices in the file
+        u32               chunk_size;   // bytes read from each slice
+        u32               num_slices;
+        u64               reserved; // bytes added to the budget when the load completes
+        void*             data;
+    };
+
+    struct texture_streamer
+    {
+        std::vector<streamed_texture*> textures;
+        std::vector<u32>               lookup; // texture handle to index in textures
+        pen::ring_buffer<stream_load>  requests;
+        pen::ring_buffer<stream_load>  completed;
+        pen::semaphore*                sem_request = nullptr;
+        u64                            budget = 256 * 1024 * 1024;
+        u64                            resident_bytes = 0;
+        u64                            pending_bytes = 0; // reserved by loads in flight
+        u32                            loads_in_flight = 0;
+        u32                            frame = 0;
+        u32                            num_loads = 0;
+        u32                            num_evictions = 0;
+    };
+    texture_streamer s_streamer;
+
+    u64 stream_resident_bytes(const streamed_texture* st, u32 top_mip)
+    {
+        return (u64)calc_chain_size(st->tcp, top_mip, st->tcp.num_mips) * st->tcp.num_arrays;
+    }
+
+    void read_stream_load(stream_load& load)
+    {
+        // the chain from top_mip down is contiguous at the end of each slice
+        load.data = nullptr;
+
+        FILE* fp = fopen(load.path, "rb");
+        if (!fp)
+            return;
+
+        u8*  data = (u8*)pen::memory_alloc(load.chunk_size * load.num_slices);
+        bool ok = true;
+        for (u32 a = 0; a < load.num_slices && ok; ++a)
+        {
+            ok = fseek(fp, (long)(load.file_offset + a * load.slice_stride), SEEK_SET) == 0;
+            ok = ok && fread(data + a * load.chunk_size, 1, load.chunk_size, fp) == load.chunk_size;
+        }
+
+        fclose(fp);
+
+        if (!ok)
+        {
+            pen::memory_free(data);
+            return;
+        }
+
+        load.data = data;
+    }
+
+    void* stream_thread(void* params)
+    {
+        for (;;)
+        {
+            pen::semaphore_wait(s_streamer.sem_request);
+
+            for (stream_load* req = s_streamer.requests.get(); req; req = s_streamer.requests.get())
             {
-                ext_data_size += calc_level_size(mip_width, mip_height, compressed, block_size);
+                stream_load load = *req;
+                read_stream_load(load);
+                s_streamer.completed.put(load);
+            }
+        }
+
+        return PEN_THREAD_OK;
+    }
+
+    bool stream_init()
+    {
+        s_streamer.requests.create(k_stream_max_loads * 2);
+        s_streamer.completed.create(k_stream_max_loads * 2);
+
+#if !PEN_SINGLE_THREADED
+        s_streamer.sem_request = pen::semaphore_create(0, k_stream_max_loads);
+        pen::thread_create(stream_thread, 64 * 1024, nullptr, pen::e_thread_start_flags::detached);
+#endif
+        return true;
+    }
+
+    void stream_init_once()
+    {
+        static bool initialised = stream_init();
+        PEN_UNUSED(initialised);
+    }
+
+    streamed_texture* get_streamed_texture(u32 handle)
+    {
+        if (handle >= s_streamer.lookup.size() || !is_valid(s_streamer.lookup[handle]))
+            return nullptr;
+
+        return s_streamer.textures[s_streamer.lookup[handle]];
+    }
+
+    u32 create_stream_texture(const streamed_texture* st, u32 top_mip, void* data, u32 data_size)
+    {
+        pen::texture_creation_params tcp = st->tcp;
+        tcp.width = max<u32>(tcp.width >> top_mip, 1);
+        tcp.height = max<u32>(tcp.height >> top_mip, 1);
+        tcp.num_mips = tcp.num_mips - top_mip;
+        tcp.data = data;
+        tcp.data_size = data_size;
+
+        return pen::renderer_create_texture(tcp);
+    }
+
+    u32 create_stream_tail(streamed_texture* st)
+    {
+        // reads the header and the mip tail, returns an invalid handle if the texture is not worth streaming
+        Str   path = pen::os_path_for_resource(st->filename.c_str());
+        FILE* fp = fopen(path.c_str(), "rb");
+        if (!fp)
+            return PEN_INVALID_HANDLE;
+
+        u8  header[sizeof(dds_header) + sizeof(dx10_header)] = {0};
+        u32 header_size = (u32)fread(header, 1, sizeof(header), fp);
 
-                mip_width = mip_width > 1 ? mip_width >> 1 : 1;
-                mip_height = mip_height > 1 ? mip_height >> 1 : 1;
+        pen::texture_creation_params tcp;
+        u32                          data_offset = 0;
+        if (header_size >= sizeof(dds_header))
+            data_offset = parse_dds_header(header, tcp);
+
+        u32 top_size = max<u32>(tcp.width, tcp.height);
+        if (!data_offset || tcp.collection_type == pen::TEXTURE_COLLECTION_VOLUME || tcp.num_mips <= 1 ||
+            top_size <= k_stream_tail_size)
+        {
+            fclose(fp);
+            return PEN_INVALID_HANDLE;
+        }
+
+        u32 tail_mip = 0;
+        while ((top_size >> tail_mip) > k_stream_tail_size && tail_mip < (u32)tcp.num_mips - 1)
+            ++tail_mip;
+
+        // loads in flight read the path on the io thread, it is the same file when hot loading
+        if (st->path.empty())
+            st->path = path;
+
+        st->tcp = tcp;
+        st->data_offset = data_offset;
+        st->slice_size = calc_chain_size(tcp, 0, tcp.num_mips);
+        st->tail_mip = tail_mip;
+        st->resident_mip = tail_mip;
+        st->wanted_mip = tail_mip;
+        st->generation++;
+
+        pen::memory_free(st->tail_data);
+        st->tail_data = nullptr;
+        st->tail_data_size = 0;
+        fclose(fp);
+
+        stream_load load;
+        load.path = path.c_str();
+        load.top_mip = tail_mip;
+        load.file_offset = data_offset + calc_chain_size(tcp, 0, tail_mip);
+        load.slice_stride = st->slice_size;
+        load.chunk_size = calc_chain_size(tcp, tail_mip, tcp.num_mips);
+        load.num_slices = tcp.num_arrays;
+        read_stream_load(load);
+
+        if (!load.data)
+            return PEN_INVALID_HANDLE;
+
+        st->tail_data = load.data;
+        st->tail_data_size = load.chunk_size * load.num_slices;
+
+        return create_stream_texture(st, tail_mip, st->tail_data, st->tail_data_size);
+    }
+
+    void issue_stream_load(streamed_texture* st, u32 top_mip)
+    {
+        stream_load load;
+        load.st = st;
+        load.path = st->path.c_str();
+        load.generation = st->generation;
+        load.top_mip = top_mip;
+        load.file_offset = st->data_offset + calc_chain_size(st->tcp, 0, top_mip);
+        load.slice_stride = st->slice_size;
+        load.chunk_size = st->slice_size - calc_chain_size(st->tcp, 0, top_mip);
+        load.num_slices = st->tcp.num_arrays;
+        load.reserved = stream_resident_bytes(st, top_mip) - stream_resident_bytes(st, st->resident_mip);
+        load.data = nullptr;
+
+        st->loading = true;
+        s_streamer.pending_bytes += load.reserved;
+        s_streamer.loads_in_flight++;
+
+#if PEN_SINGLE_THREADED
+        read_stream_load(load);
+        s_streamer.completed.put(load);
+#else
+        s_streamer.requests.put(load);
+        pen::semaphore_post(s_streamer.sem_request, 1);
+#endif
+    }
+
+    void complete_stream_load(stream_load& load)
+    {
+        streamed_texture* st = load.st;
+
+        s_streamer.pending_bytes -= load.reserved;
+        s_streamer.loads_in_flight--;
+        st->loading = false;
+
+        // file was hot loaded while reading, or the read failed
+        if (load.generation != st->generation || !load.data)
+        {
+            pen::memory_free(load.data);
+            return;
+        }
+
+        u32 data_size = load.chunk_size * load.num_slices;
+        u32 new_handle = create_stream_texture(st, load.top_mip, load.data, data_size);
+        pen::renderer_replace_resource(st->handle, new_handle, pen::RESOURCE_TEXTURE);
+        pen::memory_free(load.data);
+
+        s_streamer.resident_bytes += load.reserved;
+        st->resident_mip = load.top_mip;
+        s_streamer.num_loads++;
+    }
+
+    void evict_stream_texture(streamed_texture* st)
+    {
+        // back to the tail kept in memory, no read required
+        u32 new_handle = create_stream_texture(st, st->tail_mip, st->tail_data, st->tail_data_size);
+        pen::renderer_replace_resource(st->handle, new_handle, pen::RESOURCE_TEXTURE);
+
+        u64 evicted = stream_resident_bytes(st, st->resident_mip) - stream_resident_bytes(st, st->tail_mip);
+        s_streamer.resident_bytes -= evicted;
+        st->resident_mip = st->tail_mip;
+        st->wanted_mip = st->tail_mip;
+        s_streamer.num_evictions++;
+    }
+
+    bool make_stream_room(u64 bytes)
+    {
+        // evict least recently used textures which have not been seen for a while until the load fits
+        while (s_streamer.resident_bytes + s_streamer.pending_bytes + bytes > s_streamer.budget)
+        {
+            streamed_texture* lru = nullptr;
+            for (auto* st : s_streamer.textures)
+            {
+                if (st->loading || st->resident_mip >= st->tail_mip)
+                    continue;
+
+                if (s_streamer.frame - st->last_used_frame < k_stream_unused_frames)
+                    continue;
+
+                if (!lru || st->last_used_frame < lru->last_used_frame)
+                    lru = st;
             }
 
-            tcp.data_size += data_size + ext_data_size;
+            if (!lru)
+                return false;
+
+            evict_stream_texture(lru);
         }
 
-        // allocate mem and copy
-        tcp.data = pen::memory_alloc(tcp.data_size);
+        return true;
+    }
 
-        // copy texture data into the tcp storage
-        memcpy(tcp.data, top_image_start, tcp.data_size);
+    u32 restream_texture(streamed_texture* st)
+    {
+        // hot loaded, start again from the tail of the new file
+        s_streamer.resident_bytes -= stream_resident_bytes(st, st->resident_mip);
 
-        // free the files contents
-        pen::memory_free(file_data);
+        u32 handle = create_stream_tail(st);
+        if (is_valid(handle))
+        {
+            s_streamer.resident_bytes += stream_resident_bytes(st, st->resident_mip);
+            return handle;
+        }
 
-        u32 texture_index = pen::renderer_create_texture(tcp);
+        // no longer worth streaming, it is loaded in full and left alone
+        st->generation++;
+        st->tail_mip = 0;
+        st->resident_mip = 0;
+        st->wanted_mip = 0;
+        return PEN_INVALID_HANDLE;
+    }
 
-        pen::memory_free(tcp.data);
+    u32 stream_mip_for_size(const streamed_texture* st, u32 screen_size)
+    {
+        // smallest mip which is at least as large as the texture appears on screen
+        u32 top_size = max<u32>(st->tcp.width, st->tcp.height);
+        u32 mip = 0;
+        while (mip < st->tail_mip && (top_size >> (mip + 1)) >= screen_size)
+            ++mip;
 
-        return texture_index;
+        return mip;
     }
 
     //
@@ -429,18 +813,23 @@ namespace
     };
 
     pen::ring_buffer<hot_loader_cmd> s_hot_loader_cmd_buffer;
+    pen::job*                        s_hot_loader_job = nullptr;
 
     void* hot_loader_thread(void* params)
     {
         pen::job_thread_params* job_params = (pen::job_thread_params*)params;
 
         pen::job* p_thread_info = job_params->job_info;
+        p_thread_info->blocks_on_consume = true;
         pen::semaphore_post(p_thread_info->p_sem_continue, 1);
 
         s_hot_loader_cmd_buffer.create(32);
 
         for (;;)
         {
+            // sleeps until a cmd is put or the thread is asked to exit
+            pen::semaphore_wait(p_thread_info->p_sem_consume);
+
             hot_loader_cmd* cmd = s_hot_loader_cmd_buffer.get();
             while (cmd)
             {
@@ -463,9 +852,6 @@ namespace
 
             if (pen::semaphore_try_wait(p_thread_info->p_sem_exit))
                 break;
-
-            // plenty of sleep
-            pen::thread_sleep_ms(16);
         }
 
         pen::semaphore_post(p_thread_info->p_sem_continue, 1);
@@ -473,6 +859,78 @@ namespace
         return PEN_THREAD_OK;
     }
 
+    void unwatch_inputs(file_watch* fw)
+    {
+        for (auto& in : fw->inputs)
+            pen::filesystem_watch_remove(in.watch);
+
+        fw->inputs.clear();
+    }
+
+    void input_changed(const c8* filename, void* user_data)
+    {
+        file_watch* fw = (file_watch*)user_data;
+        if (fw->invalidated)
+            return;
+
+        // inputs older than the last build are already up to date
+        u32 dep_ts = 0;
+        u32 input_ts = 0;
+        Str dep_path = pen::os_path_for_resource(fw->filename.c_str());
+        if (pen::filesystem_getmtime(dep_path.c_str(), dep_ts) != PEN_ERR_OK)
+            return;
+
+        if (pen::filesystem_getmtime(filename, input_ts) != PEN_ERR_OK || input_ts <= dep_ts)
+            return;
+
+        dev_console_log("[file watcher] input file %s has changed", filename);
+
+        for (auto& in : fw->inputs)
+            if (in.name == filename)
+                fw->changes.push_back(in.id_data_file);
+
+        fw->build_callback();
+        fw->invalidated = true;
+    }
+
+    void watch_inputs(file_watch* fw)
+    {
+        unwatch_inputs(fw);
+
+        pen::json deps = pen::json::load_from_file(fw->filename.c_str());
+        pen::json files = deps["files"];
+        s32       num_files = files.size();
+        for (s32 i = 0; i < num_files; ++i)
+        {
+            pen::json outputs = files[i];
+            s32       num_inputs = outputs.size();
+            for (s32 j = 0; j < num_inputs; ++j)
+            {
+                pen::json   input = outputs[j];
+                watch_input in;
+                in.name = input["name"].as_str();
+                in.id_data_file = PEN_HASH(input["data_file"].as_str().c_str());
+                in.watch = pen::filesystem_watch_add(in.name.c_str(), input_changed, fw);
+                fw->inputs.push_back(in);
+            }
+        }
+    }
+
+    void dependencies_changed(const c8* filename, void* user_data)
+    {
+        // pmbuild writes the dependencies last, so a change here means a rebuild has completed
+        file_watch* fw = (file_watch*)user_data;
+        if (!fw->invalidated)
+            return;
+
+        watch_inputs(fw);
+
+        dev_console_log("[file watcher] rebuild for %s complete", fw->filename.c_str());
+        fw->hotload_callback(fw->changes);
+        fw->changes.clear();
+        fw->invalidated = false;
+    }
+
     void texture_build()
     {
         Str build_cmd = get_build_cmd();
@@ -488,7 +946,17 @@ namespace
             {
                 if (tr.id_name == d)
                 {
-                    u32 new_handle = load_texture_internal(tr.filename.c_str(), tr.id_name, tr.tcp);
+                    u32               new_handle = PEN_INVALID_HANDLE;
+                    streamed_texture* st = get_streamed_texture(tr.handle);
+                    if (st)
+                    {
+                        new_handle = restream_texture(st);
+                        tr.tcp = st->tcp;
+                    }
+
+                    if (!is_valid(new_handle))
+                        new_handle = load_texture_internal(tr.filename.c_str(), tr.id_name, tr.tcp);
+
                     pen::renderer_replace_resource(tr.handle, new_handle, pen::RESOURCE_TEXTURE);
                 }
             }
@@ -502,7 +970,8 @@ namespace put
     {
         PEN_HOTLOADING_ENABLED;
 
-        pen::jobs_create_job(hot_loader_thread, 1024 * 1024, nullptr, pen::e_thread_start_flags::detached);
+        s_hot_loader_job =
+            pen::jobs_create_job(hot_loader_thread, 1024 * 1024, nullptr, pen::e_thread_start_flags::detached);
 
         pen::json pmbuild_config = pen::json::load_from_file("data/pmbuild_config.json");
         s_pmbuild_cmd = pmbuild_config["pmbuild"].as_str();
@@ -527,6 +996,8 @@ namespace put
             memcpy(cmd.cmdline, cmdline.c_str(), len);
             cmd.cmdline[len] = '\0';
             s_hot_loader_cmd_buffer.put(cmd);
+            if (s_hot_loader_job)
+                pen::semaphore_post(s_hot_loader_job->p_sem_consume, 1);
 
             // wait 10 seconds
             s_timeout = 1000.0f * 10.0f;
@@ -539,8 +1010,15 @@ namespace put
         return s_pmbuild_cmd;
     }
 
-    void save_texture(const c8* filename, const texture_info& info)
+    void save_texture(const c8* filename, const texture_info& tcp, u32 compress_format, bc_preset compress_preset)
     {
+        // optionally block compress a copy, formats which can not be compressed are saved as they are
+        texture_info info = tcp;
+        if (compress_format && can_compress_texture(tcp, compress_format))
+            compress_texture(info, compress_format, compress_preset);
+
+        bool compressed = info.pixels_per_block > 1;
+
         // dds header
         dds_header hdr = {0};
         hdr.magic = 0x20534444;
@@ -554,6 +1032,12 @@ namespace put
         hdr.depth = 1;
         hdr.pitch_or_linear_size = (info.width * info.block_size + 7) / 8;
 
+        if (compressed)
+        {
+            hdr.flags |= DDS_LINEARSIZE;
+            hdr.pitch_or_linear_size = calc_level_size(info.width, info.height, true, info.block_size);
+        }
+
         // conditional flags
         if (info.num_mips > 1)
         {
@@ -583,9 +1067,31 @@ namespace put
         std::ofstream ofs(filename, std::ofstream::binary);
 
         ofs.write((const c8*)&hdr, sizeof(dds_header));
+
+        // formats without a four cc
+        if (pf.four_cc == DDS_DX10)
+        {
+            dx10_header dxh = {0};
+            dxh.dxgi_format = DXGI_BC7_UNORM;
+            dxh.array_size = 1;
+            dxh.resource_dimension = DX10_TEXTURE2D;
+
+            if (info.collection_type == pen::TEXTURE_COLLECTION_VOLUME)
+                dxh.resource_dimension = DX10_TEXTURE3D;
+            else if (info.collection_type == pen::TEXTURE_COLLECTION_CUBE)
+                dxh.misc_flag = DX10_MISC_TEXTURECUBE;
+            else if (info.collection_type == pen::TEXTURE_COLLECTION_ARRAY)
+                dxh.array_size = info.num_arrays;
+
+            ofs.write((const c8*)&dxh, sizeof(dx10_header));
+        }
+
         ofs.write((const c8*)info.data, info.data_size);
 
         ofs.close();
+
+        if (info.data != tcp.data)
+            pen::memory_free(info.data);
     }
 
     u32 load_texture(const c8* filename)
@@ -606,6 +1112,113 @@ namespace put
         return texture_index;
     }
 
+    u32 load_texture_streamed(const c8* filename)
+    {
+        // check for existing
+        hash_id hh = PEN_HASH(filename);
+        for (auto& t : k_texture_references)
+            if (t.id_name == hh)
+                return t.handle;
+
+        stream_init_once();
+
+        streamed_texture* st = new streamed_texture();
+        st->filename = filename;
+
+        u32 texture_index = create_stream_tail(st);
+        if (!is_valid(texture_index))
+        {
+            delete st;
+            return load_texture(filename);
+        }
+
+        add_file_watcher(filename, texture_build, texture_hotload);
+
+        st->handle = texture_index;
+        st->last_used_frame = s_streamer.frame;
+        s_streamer.resident_bytes += stream_resident_bytes(st, st->resident_mip);
+
+        if (texture_index >= s_streamer.lookup.size())
+            s_streamer.lookup.resize(texture_index + 1, PEN_INVALID_HANDLE);
+
+        s_streamer.lookup[texture_index] = (u32)s_streamer.textures.size();
+        s_streamer.textures.push_back(st);
+
+        k_texture_references.push_back({hh, filename, texture_index, st->tcp});
+
+        return texture_index;
+    }
+
+    void stream_texture_usage(u32 handle, f32 screen_size)
+    {
+        streamed_texture* st = get_streamed_texture(handle);
+        if (!st)
+            return;
+
+        // keep the largest size reported, views may be recorded on several threads
+        u32 size = (u32)screen_size + 1;
+        u32 current = st->screen_size.load();
+        while (current < size && !st->screen_size.compare_exchange_weak(current, size))
+        {
+        }
+    }
+
+    void set_texture_streaming_budget(u64 bytes)
+    {
+        s_streamer.budget = bytes;
+    }
+
+    void update_texture_streaming()
+    {
+        if (s_streamer.textures.empty())
+            return;
+
+        s_streamer.frame++;
+
+        // swap in mips read since the last update
+        for (stream_load* done = s_streamer.completed.get(); done; done = s_streamer.completed.get())
+        {
+            stream_load load = *done;
+            complete_stream_load(load);
+        }
+
+        // textures which want more mips than they have, largest on screen first
+        static std::vector<streamed_texture*> s_upgrades;
+        s_upgrades.clear();
+
+        for (auto* st : s_streamer.textures)
+        {
+            u32 size = st->screen_size.exchange(0);
+            if (size)
+            {
+                st->last_used_frame = s_streamer.frame;
+                st->wanted_size = size;
+                st->wanted_mip = stream_mip_for_size(st, size);
+            }
+
+            if (st->loading || st->wanted_mip >= st->resident_mip)
+                continue;
+
+            if (s_streamer.frame - st->last_used_frame < k_stream_unused_frames)
+                s_upgrades.push_back(st);
+        }
+
+        std::sort(s_upgrades.begin(), s_upgrades.end(),
+                  [](const streamed_texture* a, const streamed_texture* b) { return a->wanted_size > b->wanted_size; });
+
+        for (auto* st : s_upgrades)
+        {
+            if (s_streamer.loads_in_flight >= k_stream_max_loads)
+                break;
+
+            u64 bytes = stream_resident_bytes(st, st->wanted_mip) - stream_resident_bytes(st, st->resident_mip);
+            if (!make_stream_room(bytes))
+                break;
+
+            issue_stream_load(st, st->wanted_mip);
+        }
+    }
+
     Str get_texture_filename(u32 handle)
     {
         for (auto& t : k_texture_references)
@@ -632,6 +1245,20 @@ namespace put
 
     void texture_browser_ui()
     {
+        if (!s_streamer.textures.empty())
+        {
+            f32 mb = 1.0f / (1024.0f * 1024.0f);
+            ImGui::Text("Streaming: %u textures, %.1f / %.1f MB, %u loads, %u evictions",
+                        (u32)s_streamer.textures.size(), (f32)s_streamer.resident_bytes * mb,
+                        (f32)s_streamer.budget * mb, s_streamer.num_loads, s_streamer.num_evictions);
+        }
+
+        if (ImGui::CollapsingHeader("Mip Generation"))
+            mip_generator_ui();
+
+        if (ImGui::CollapsingHeader("Block Compression"))
+            block_compressor_ui();
+
         ImGui::Columns(4);
 
         for (auto& t : k_texture_references)
@@ -647,6 +1274,8 @@ namespace put
 
     void add_file_watcher(const c8* filename, void (*build_callback)(), void (*hotload_callback)(std::vector<hash_id>& dirty))
     {
+        PEN_HOTLOADING_ENABLED;
+
         Str     fn = filename;
         hash_id id_name = PEN_HASH(fn.c_str());
 
@@ -665,12 +1294,15 @@ namespace put
 
         // add new
         file_watch* fw = new file_watch();
-        fw->dependencies = pen::json::load_from_file(fn.c_str());
         fw->filename = fn;
         fw->id_name = id_name;
         fw->hotload_callback = hotload_callback;
         fw->build_callback = build_callback;
 
+        Str dep_path = pen::os_path_for_resource(fn.c_str());
+        fw->dep_watch = pen::filesystem_watch_add(dep_path.c_str(), dependencies_changed, fw);
+        watch_inputs(fw);
+
         k_file_watches.push_back(fw);
     }
 
@@ -681,64 +1313,7 @@ namespace put
         // print build cmd to console first time init
         get_build_cmd();
 
-        for (auto* fw : k_file_watches)
-        {
-            if (fw->invalidated)
-            {
-                u32 dep_ts;
-                Str fn = pen::os_path_for_resource(fw->filename.c_str());
-                if (pen::filesystem_getmtime(fn.c_str(), dep_ts) == PEN_ERR_OK)
-                {
-                    if (dep_ts >= fw->rebuild_ts)
-                    {
-                        fw->dependencies = pen::json::load_from_file(fw->filename.c_str());
-
-                        // rebuild has succeeded
-                        dev_console_log("[file watcher] rebuild for %s complete", fw->filename.c_str());
-                        fw->hotload_callback(fw->changes);
-                        fw->changes.clear();
-                        fw->invalidated = false;
-                    }
-                }
-            }
-            else
-            {
-                pen::json files = fw->dependencies["files"];
-                s32       num_files = files.size();
-                for (s32 i = 0; i < num_files; ++i)
-                {
-                    pen::json outputs = files[i];
-                    s32       num_inputs = outputs.size();
-                    u32       current_ts = 0;
-
-                    Str fn = pen::os_path_for_resource(fw->filename.c_str());
-                    if (pen::filesystem_getmtime(fn.c_str(), current_ts) == PEN_ERR_OK)
-                    {
-                        for (s32 j = 0; j < num_inputs; ++j)
-                        {
-                            Str ifn = outputs[j]["name"].as_str();
-                            u32 input_ts = 0;
-                            if (pen::filesystem_getmtime(ifn.c_str(), input_ts) == PEN_ERR_OK)
-                            {
-                                if (!fw->invalidated)
-                                {
-                                    if (input_ts > current_ts)
-                                    {
-                                        dev_console_log("[file watcher] input file %s has changed", ifn.c_str());
-
-                                        Str data_file = outputs[j]["data_file"].as_str();
-                                        fw->changes.push_back(PEN_HASH(data_file.c_str()));
-                                        fw->rebuild_ts = input_ts;
-
-                                        fw->build_callback();
-                                        fw->invalidated = true;
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
+        // callbacks are only made for files which have changed since the last batch
+        pen::filesystem_watch_dispatch();
     }
 } // namespace put
@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include "block_compressor.h"
 #include "pen.h"
 #include "renderer.h"
 #include "str/Str.h"
@@ -15,11 +16,22 @@ namespace put
 
     // Textures
     u32  load_texture(const c8* filename);
-    void save_texture(const c8* filename, const texture_info& tcp);
+    void save_texture(const c8* filename, const texture_info& tcp, u32 compress_format = 0,
+                      bc_preset compress_preset = e_bc_preset::normal); // compress_format: bc format or 0 for none
     void get_texture_info(u32 handle, texture_info& info);
     Str  get_texture_filename(u32 handle);
     void texture_browser_ui();
 
+    // Texture streaming
+    // Streamed textures are created with only their smallest mips, larger mips are read on an io thread in order of the
+    // screen size reported with stream_texture_usage and swapped in by update_texture_streaming. Textures which have
+    // not been used recently are evicted back to their smallest mips to stay within the budget. Volume textures and
+    // textures with no mips to stream are loaded in full.
+    u32  load_texture_streamed(const c8* filename);
+    void stream_texture_usage(u32 handle, f32 screen_size); // size in pixels, safe to call from render jobs
+    void update_texture_streaming();
+    void set_texture_streaming_budget(u64 bytes);
+
     // Hot loading
     void init_hot_loader();
     void poll_hot_loader();
@@ -0,0 +1,925 @@
+// mip_generator.cpp
+// Copyright 2014 - 2023 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+#include "mip_generator.h"
+
+#include "dev_ui.h"
+
+#include "console.h"
+#include "data_struct.h"
+#include "memory.h"
+#include "threads.h"
+#include "timer.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+#if __SSE2__ || __AVX2__ || __AVX__
+#include <immintrin.h>
+#define MIP_SIMD_SSE 1
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MIP_SIMD_NEON 1
+#endif
+
+namespace put
+{
+    namespace
+    {
+        static const u32 k_max_mips = 32;
+        static const u32 k_kaiser_taps = 6;
+        static const u32 k_parallel_texels = 64 * 1024; // levels smaller than this are generated on the calling thread
+        static const u32 k_grain_texels = 16 * 1024;    // texels written by each job
+
+        struct mip_format
+        {
+            u32  channels;   // floats per texel while filtering
+            u32  texel_size; // bytes
+            bool unorm8;
+            bool half;
+        };
+
+        struct mip_level
+        {
+            u32 width;
+            u32 height;
+            u32 depth;  // volumes only, 1 otherwise
+            u32 offset; // from the start of each slice chain
+        };
+
+        struct mip_chain
+        {
+            mip_level levels[k_max_mips];
+            u32       num_mips;
+            u32       num_slices; // array slices or cube faces, volumes are a single slice
+            u32       slice_size; // bytes of a full chain for one slice
+            bool      volume;
+        };
+
+        struct mip_job
+        {
+            u8*              data;
+            const mip_chain* chain;
+            mip_format       mf;
+            u32              level; // generated from level - 1
+            mip_filter       filter;
+            u32              flags;
+            f32**            scratch; // indexed by pen::jobs_get_thread_index
+        };
+
+        struct mip_tables
+        {
+            f32 unorm_to_float[256];
+            f32 srgb_to_linear[256];
+            f32 srgb_thresholds[255]; // linear values at which the encoded srgb byte increments
+            f32 kaiser[k_kaiser_taps];
+        };
+        mip_tables s_tables;
+
+        static const f32 k_box_weights[2] = {0.5f, 0.5f};
+
+        f32 srgb_to_linear(f32 c)
+        {
+            return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+        }
+
+        f64 bessel_i0(f64 x)
+        {
+            // power series, converges quickly for the small arguments of the window
+            f64 sum = 1.0;
+            f64 term = 1.0;
+            for (u32 k = 1; k < 32; ++k)
+            {
+                f64 t = x / (2.0 * k);
+                term *= t * t;
+                sum += term;
+            }
+
+            return sum;
+        }
+
+        bool init_tables()
+        {
+            for (u32 i = 0; i < 256; ++i)
+            {
+                s_tables.unorm_to_float[i] = (f32)i / 255.0f;
+                s_tables.srgb_to_linear[i] = srgb_to_linear((f32)i / 255.0f);
+            }
+
+            for (u32 i = 0; i < 255; ++i)
+                s_tables.srgb_thresholds[i] = srgb_to_linear(((f32)i + 0.5f) / 255.0f);
+
+            // taps at source texels 2x-2 .. 2x+3, +-0.25, 0.75 and 1.25 destination texels from the centre
+            static const f64 pi = 3.14159265358979323846;
+            static const f64 alpha = 4.0;
+            static const f64 width = 1.5;
+
+            f64 w[k_kaiser_taps];
+            f64 sum = 0.0;
+            for (u32 i = 0; i < k_kaiser_taps; ++i)
+            {
+                f64 t = ((f64)i - 2.5) * 0.5;
+                f64 r = t / width;
+                f64 sinc = sin(pi * t) / (pi * t);
+                f64 window = bessel_i0(alpha * sqrt(std::max(1.0 - r * r, 0.0))) / bessel_i0(alpha);
+
+                w[i] = sinc * window;
+                sum += w[i];
+            }
+
+            for (u32 i = 0; i < k_kaiser_taps; ++i)
+                s_tables.kaiser[i] = (f32)(w[i] / sum);
+
+            return true;
+        }
+
+        bool get_mip_format(u32 format, mip_format& mf)
+        {
+            switch (format)
+            {
+                case PEN_TEX_FORMAT_RGBA8_UNORM:
+                case PEN_TEX_FORMAT_BGRA8_UNORM:
+                    mf = {4, 4, true, false};
+                    return true;
+                case PEN_TEX_FORMAT_R32_FLOAT:
+                    mf = {1, 4, false, false};
+                    return true;
+                case PEN_TEX_FORMAT_R32G32B32A32_FLOAT:
+                    mf = {4, 16, false, false};
+                    return true;
+                case PEN_TEX_FORMAT_R16_FLOAT:
+                    mf = {1, 2, false, true};
+                    return true;
+                case PEN_TEX_FORMAT_R16G16B16A16_FLOAT:
+                    mf = {4, 8, false, true};
+                    return true;
+            }
+
+            return false;
+        }
+
+        const c8* get_format_name(u32 format)
+        {
+            switch (format)
+            {
+                case PEN_TEX_FORMAT_RGBA8_UNORM:
+                    return "RGBA8";
+                case PEN_TEX_FORMAT_BGRA8_UNORM:
+                    return "BGRA8";
+                case PEN_TEX_FORMAT_R32_FLOAT:
+                    return "R32F";
+                case PEN_TEX_FORMAT_R32G32B32A32_FLOAT:
+                    return "RGBA32F";
+                case PEN_TEX_FORMAT_R16_FLOAT:
+                    return "R16F";
+                case PEN_TEX_FORMAT_R16G16B16A16_FLOAT:
+                    return "RGBA16F";
+            }
+
+            return "unknown";
+        }
+
+        void build_chain(const pen::texture_creation_params& tcp, u32 num_mips, u32 texel_size, mip_chain& chain)
+        {
+            chain.volume = tcp.collection_type == pen::TEXTURE_COLLECTION_VOLUME;
+            chain.num_mips = num_mips;
+            chain.num_slices = chain.volume ? 1 : tcp.num_arrays;
+
+            u32 offset = 0;
+            for (u32 m = 0; m < num_mips; ++m)
+            {
+                mip_level& l = chain.levels[m];
+                l.width = std::max<u32>(tcp.width >> m, 1);
+                l.height = std::max<u32>(tcp.height >> m, 1);
+                l.depth = chain.volume ? std::max<u32>(tcp.num_arrays >> m, 1) : 1;
+                l.offset = offset;
+
+                offset += l.width * l.height * l.depth * texel_size;
+            }
+
+            chain.slice_size = offset;
+        }
+
+        //
+        // decode and encode rows to and from f32
+        //
+
+        void decode_unorm8(const u8* src, u32 texels, f32* out, bool srgb, bool simd)
+        {
+            u32 i = 0;
+            if (srgb)
+            {
+                const f32* rgb = s_tables.srgb_to_linear;
+                const f32* a = s_tables.unorm_to_float;
+                for (; i < texels; ++i)
+                {
+                    out[i * 4 + 0] = rgb[src[i * 4 + 0]];
+                    out[i * 4 + 1] = rgb[src[i * 4 + 1]];
+                    out[i * 4 + 2] = rgb[src[i * 4 + 2]];
+                    out[i * 4 + 3] = a[src[i * 4 + 3]];
+                }
+                return;
+            }
+
+            u32 n = texels * 4;
+            if (simd)
+            {
+#if MIP_SIMD_SSE
+                __m128  scale = _mm_set1_ps(1.0f / 255.0f);
+                __m128i zero = _mm_setzero_si128();
+                for (; i + 16 <= n; i += 16)
+                {
+                    __m128i b = _mm_loadu_si128((const __m128i*)(src + i));
+                    __m128i lo = _mm_unpacklo_epi8(b, zero);
+                    __m128i hi = _mm_unpackhi_epi8(b, zero);
+
+                    __m128 f0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero));
+                    __m128 f1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero));
+                    __m128 f2 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero));
+                    __m128 f3 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero));
+
+                    _mm_storeu_ps(out + i + 0, _mm_mul_ps(f0, scale));
+                    _mm_storeu_ps(out + i + 4, _mm_mul_ps(f1, scale));
+                    _mm_storeu_ps(out + i + 8, _mm_mul_ps(f2, scale));
+                    _mm_storeu_ps(out + i + 12, _mm_mul_ps(f3, scale));
+                }
+#elif MIP_SIMD_NEON
+                for (; i + 16 <= n; i += 16)
+                {
+                    uint8x16_t b = vld1q_u8(src + i);
+                    uint16x8_t lo = vmovl_u8(vget_low_u8(b));
+                    uint16x8_t hi = vmovl_u8(vget_high_u8(b));
+
+                    vst1q_f32(out + i + 0, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(lo))), 1.0f / 255.0f));
+                    vst1q_f32(out + i + 4, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(lo))), 1.0f / 255.0f));
+                    vst1q_f32(out + i + 8, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(hi))), 1.0f / 255.0f));
+                    vst1q_f32(out + i + 12, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(hi))), 1.0f / 255.0f));
+                }
+#endif
+            }
+
+            for (; i < n; ++i)
+                out[i] = s_tables.unorm_to_float[src[i]];
+        }
+
+        u8 linear_to_srgb8(f32 v)
+        {
+            // count the thresholds below v with a binary search, exact rounding without pow
+            const f32* t = s_tables.srgb_thresholds;
+
+            u32 r = 0;
+            for (u32 step = 128; step > 0; step >>= 1)
+                if (r + step <= 255 && t[r + step - 1] <= v)
+                    r += step;
+
+            return (u8)r;
+        }
+
+        void encode_unorm8(const f32* in, u32 texels, u8* dst, bool srgb, bool simd)
+        {
+            u32 i = 0;
+            if (srgb)
+            {
+                for (; i < texels; ++i)
+                {
+                    dst[i * 4 + 0] = linear_to_srgb8(in[i * 4 + 0]);
+                    dst[i * 4 + 1] = linear_to_srgb8(in[i * 4 + 1]);
+                    dst[i * 4 + 2] = linear_to_srgb8(in[i * 4 + 2]);
+                    dst[i * 4 + 3] = (u8)(std::min(std::max(in[i * 4 + 3], 0.0f), 1.0f) * 255.0f + 0.5f);
+                }
+                return;
+            }
+
+            u32 n = texels * 4;
+            if (simd)
+            {
+#if MIP_SIMD_SSE
+                __m128 zero = _mm_setzero_ps();
+                __m128 one = _mm_set1_ps(1.0f);
+                __m128 scale = _mm_set1_ps(255.0f);
+                __m128 round = _mm_set1_ps(0.5f);
+                for (; i + 16 <= n; i += 16)
+                {
+                    // round half up with truncation to match the scalar path
+                    __m128i v[4];
+                    for (u32 j = 0; j < 4; ++j)
+                    {
+                        __m128 f = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + j * 4), zero), one);
+                        v[j] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(f, scale), round));
+                    }
+
+                    __m128i lo = _mm_packs_epi32(v[0], v[1]);
+                    __m128i hi = _mm_packs_epi32(v[2], v[3]);
+                    _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+                }
+#elif MIP_SIMD_NEON
+                float32x4_t zero = vdupq_n_f32(0.0f);
+                float32x4_t one = vdupq_n_f32(1.0f);
+                float32x4_t round = vdupq_n_f32(0.5f);
+                for (; i + 8 <= n; i += 8)
+                {
+                    float32x4_t f0 = vminq_f32(vmaxq_f32(vld1q_f32(in + i), zero), one);
+                    float32x4_t f1 = vminq_f32(vmaxq_f32(vld1q_f32(in + i + 4), zero), one);
+                    uint32x4_t  u0 = vcvtq_u32_f32(vmlaq_n_f32(round, f0, 255.0f));
+                    uint32x4_t  u1 = vcvtq_u32_f32(vmlaq_n_f32(round, f1, 255.0f));
+                    vst1_u8(dst + i, vqmovn_u16(vcombine_u16(vmovn_u32(u0), vmovn_u32(u1))));
+                }
+#endif
+            }
+
+            for (; i < n; ++i)
+                dst[i] = (u8)(std::min(std::max(in[i], 0.0f), 1.0f) * 255.0f + 0.5f);
+        }
+
+        void decode_half(const f16* src, u32 n, f32* out, bool simd)
+        {
+            u32 i = 0;
+#if __F16C__
+            if (simd)
+                for (; i + 4 <= n; i += 4)
+                    _mm_storeu_ps(out + i, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)(src + i))));
+#endif
+            for (; i < n; ++i)
+                out[i] = half_to_float(src[i]);
+        }
+
+        void encode_half(const f32* in, u32 n, f16* dst, bool simd)
+        {
+            u32 i = 0;
+#if __F16C__
+            if (simd)
+                for (; i + 4 <= n; i += 4)
+                    _mm_storel_epi64((__m128i*)(dst + i), _mm_cvtps_ph(_mm_loadu_ps(in + i), 0));
+#endif
+            for (; i < n; ++i)
+                dst[i] = float_to_half(in[i]);
+        }
+
+        const f32* decode_row(const mip_job& job, const u8* row, u32 width, f32* out)
+        {
+            bool simd = !(job.flags & e_mip_flags::scalar);
+            u32  n = width * job.mf.channels;
+
+            if (job.mf.unorm8)
+                decode_unorm8(row, width, out, job.flags & e_mip_flags::srgb, simd);
+            else if (job.mf.half)
+                decode_half((const f16*)row, n, out, simd);
+            else
+                return (const f32*)row; // 32 bit float rows are filtered in place
+
+            return out;
+        }
+
+        void encode_row(const mip_job& job, const f32* in, u32 width, u8* row)
+        {
+            bool simd = !(job.flags & e_mip_flags::scalar);
+
+            if (job.mf.unorm8)
+                encode_unorm8(in, width, row, job.flags & e_mip_flags::srgb, simd);
+            else if (job.mf.half)
+                encode_half(in, width * job.mf.channels, (f16*)row, simd);
+        }
+
+        //
+        // horizontal filters, downsample a row to half width
+        //
+
+        u32 downsample_pairs_simd(const f32* src, f32* dst, u32 dst_w, u32 ch, bool use_max)
+        {
+            // returns the first texel not written
+            u32 x = 0;
+#if __AVX2__
+            __m256 half8 = _mm256_set1_ps(0.5f);
+            if (ch == 4)
+            {
+                for (; x + 2 <= dst_w; x += 2)
+                {
+                    __m256 a = _mm256_loadu_ps(src + x * 8);       // texels 0 1
+                    __m256 b = _mm256_loadu_ps(src + x * 8 + 8);   // texels 2 3
+                    __m256 l = _mm256_permute2f128_ps(a, b, 0x20); // texels 0 2
+                    __m256 r = _mm256_permute2f128_ps(a, b, 0x31); // texels 1 3
+                    __m256 o = use_max ? _mm256_max_ps(l, r) : _mm256_mul_ps(_mm256_add_ps(l, r), half8);
+                    _mm256_storeu_ps(dst + x * 4, o);
+                }
+            }
+            else
+            {
+                for (; x + 8 <= dst_w; x += 8)
+                {
+                    __m256 a = _mm256_loadu_ps(src + x * 2);
+                    __m256 b = _mm256_loadu_ps(src + x * 2 + 8);
+                    __m256 l = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+                    __m256 r = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+                    __m256 o = use_max ? _mm256_max_ps(l, r) : _mm256_mul_ps(_mm256_add_ps(l, r), half8);
+
+                    // shuffles stay within 128 bit lanes, outputs are in pairs ordered 0 2 1 3
+                    o = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(o), _MM_SHUFFLE(3, 1, 2, 0)));
+                    _mm256_storeu_ps(dst + x, o);
+                }
+            }
+#endif
+#if MIP_SIMD_SSE
+            __m128 half = _mm_set1_ps(0.5f);
+            if (ch == 4)
+            {
+                for (; x < dst_w; ++x)
+                {
+                    __m128 a = _mm_loadu_ps(src + x * 8);
+                    __m128 b = _mm_loadu_ps(src + x * 8 + 4);
+                    __m128 o = use_max ? _mm_max_ps(a, b) : _mm_mul_ps(_mm_add_ps(a, b), half);
+                    _mm_storeu_ps(dst + x * 4, o);
+                }
+            }
+            else
+            {
+                for (; x + 4 <= dst_w; x += 4)
+                {
+                    __m128 a = _mm_loadu_ps(src + x * 2);
+                    __m128 b = _mm_loadu_ps(src + x * 2 + 4);
+                    __m128 l = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+                    __m128 r = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+                    __m128 o = use_max ? _mm_max_ps(l, r) : _mm_mul_ps(_mm_add_ps(l, r), half);
+                    _mm_storeu_ps(dst + x, o);
+                }
+            }
+#elif MIP_SIMD_NEON
+            if (ch == 4)
+            {
+                for (; x < dst_w; ++x)
+                {
+                    float32x4_t a = vld1q_f32(src + x * 8);
+                    float32x4_t b = vld1q_f32(src + x * 8 + 4);
+                    float32x4_t o = use_max ? vmaxq_f32(a, b) : vmulq_n_f32(vaddq_f32(a, b), 0.5f);
+                    vst1q_f32(dst + x * 4, o);
+                }
+            }
+            else
+            {
+                for (; x + 4 <= dst_w; x += 4)
+                {
+                    float32x4x2_t v = vld2q_f32(src + x * 2); // deinterleaves even and odd texels
+                    float32x4_t   o = use_max ? vmaxq_f32(v.val[0], v.val[1])
+                                              : vmulq_n_f32(vaddq_f32(v.val[0], v.val[1]), 0.5f);
+                    vst1q_f32(dst + x, o);
+                }
+            }
+#endif
+            return x;
+        }
+
+        void downsample_pairs(const f32* src, f32* dst, u32 src_w, u32 dst_w, u32 ch, bool use_max, bool simd)
+        {
+            if (src_w == 1)
+            {
+                memcpy(dst, src, ch * sizeof(f32));
+                return;
+            }
+
+            u32 x = simd ? downsample_pairs_simd(src, dst, dst_w, ch, use_max) : 0;
+            for (; x < dst_w; ++x)
+            {
+                const f32* a = src + x * 2 * ch;
+                const f32* b = a + ch;
+                for (u32 c = 0; c < ch; ++c)
+                    dst[x * ch + c] = use_max ? std::max(a[c], b[c]) : (a[c] + b[c]) * 0.5f;
+            }
+        }
+
+        u32 downsample_kaiser_simd(const f32* src, f32* dst, u32 x, u32 x_end, u32 ch)
+        {
+            // interior texels only, all taps in range. returns the first texel not written
+            const f32* k = s_tables.kaiser;
+#if __AVX2__
+            if (ch == 4)
+            {
+                for (; x + 2 <= x_end; x += 2)
+                {
+                    __m256 o = _mm256_setzero_ps();
+                    for (u32 t = 0; t < k_kaiser_taps; ++t)
+                    {
+                        const f32* s = src + (x * 2 + t - 2) * 4;
+                        __m256     v = _mm256_castps128_ps256(_mm_loadu_ps(s));
+                        v = _mm256_insertf128_ps(v, _mm_loadu_ps(s + 8), 1); // tap for texel x + 1
+                        o = _mm256_add_ps(o, _mm256_mul_ps(v, _mm256_set1_ps(k[t])));
+                    }
+                    _mm256_storeu_ps(dst + x * 4, o);
+                }
+            }
+#endif
+#if MIP_SIMD_SSE
+            if (ch == 4)
+            {
+                for (; x < x_end; ++x)
+                {
+                    __m128 o = _mm_setzero_ps();
+                    for (u32 t = 0; t < k_kaiser_taps; ++t)
+                        o = _mm_add_ps(o, _mm_mul_ps(_mm_loadu_ps(src + (x * 2 + t - 2) * 4), _mm_set1_ps(k[t])));
+                    _mm_storeu_ps(dst + x * 4, o);
+                }
+            }
+            else
+            {
+                // 4 outputs read 8 texels from each tap, keep a texel of margin past x_end
+                for (; x + 5 <= x_end; x += 4)
+                {
+                    __m128 o = _mm_setzero_ps();
+                    for (u32 t = 0; t < k_kaiser_taps; ++t)
+                    {
+                        const f32* s = src + x * 2 + t - 2;
+                        __m128     v = _mm_shuffle_ps(_mm_loadu_ps(s), _mm_loadu_ps(s + 4), _MM_SHUFFLE(2, 0, 2, 0));
+                        o = _mm_add_ps(o, _mm_mul_ps(v, _mm_set1_ps(k[t])));
+                    }
+                    _mm_storeu_ps(dst + x, o);
+                }
+            }
+#elif MIP_SIMD_NEON
+            if (ch == 4)
+            {
+                for (; x < x_end; ++x)
+                {
+                    float32x4_t o = vdupq_n_f32(0.0f);
+                    for (u32 t = 0; t < k_kaiser_taps; ++t)
+                        o = vmlaq_n_f32(o, vld1q_f32(src + (x * 2 + t - 2) * 4), k[t]);
+                    vst1q_f32(dst + x * 4, o);
+                }
+            }
+            else
+            {
+                for (; x + 5 <= x_end; x += 4)
+                {
+                    float32x4_t o = vdupq_n_f32(0.0f);
+                    for (u32 t = 0; t < k_kaiser_taps; ++t)
+                        o = vmlaq_n_f32(o, vld2q_f32(src + x * 2 + t - 2).val[0], k[t]);
+                    vst1q_f32(dst + x, o);
+                }
+            }
+#endif
+            return x;
+        }
+
+        void downsample_kaiser_clamped(const f32* src, f32* dst, u32 x, u32 src_w, u32 ch)
+        {
+            const f32* k = s_tables.kaiser;
+            for (u32 c = 0; c < ch; ++c)
+            {
+                f32 o = 0.0f;
+                for (u32 t = 0; t < k_kaiser_taps; ++t)
+                {
+                    s32 sx = std::min<s32>(std::max<s32>((s32)(x * 2 + t) - 2, 0), (s32)src_w - 1);
+                    o += src[sx * ch + c] * k[t];
+                }
+                dst[x * ch + c] = o;
+            }
+        }
+
+        void downsample_kaiser(const f32* src, f32* dst, u32 src_w, u32 dst_w, u32 ch, bool simd)
+        {
+            const f32* k = s_tables.kaiser;
+
+            // texels [x_begin, x_end) have all taps in range, taps past the edges clamp
+            u32 x_begin = std::min<u32>(1, dst_w);
+            u32 x_end = src_w >= 4 ? std::min<u32>(dst_w, (src_w - 4) / 2 + 1) : 0;
+            x_end = std::max<u32>(x_end, x_begin);
+
+            for (u32 x = 0; x < x_begin; ++x)
+                downsample_kaiser_clamped(src, dst, x, src_w, ch);
+
+            u32 x = simd ? downsample_kaiser_simd(src, dst, x_begin, x_end, ch) : x_begin;
+            for (; x < x_end; ++x)
+            {
+                for (u32 c = 0; c < ch; ++c)
+                {
+                    f32 o = 0.0f;
+                    for (u32 t = 0; t < k_kaiser_taps; ++t)
+                        o += src[(x * 2 + t - 2) * ch + c] * k[t];
+                    dst[x * ch + c] = o;
+                }
+            }
+
+            for (x = x_end; x < dst_w; ++x)
+                downsample_kaiser_clamped(src, dst, x, src_w, ch);
+        }
+
+        //
+        // vertical and depth taps, accumulate horizontally filtered rows
+        //
+
+        void accumulate_row(f32* acc, const f32* row, f32 w, u32 n, bool use_max, bool simd)
+        {
+            u32 i = 0;
+            if (simd)
+            {
+#if __AVX2__
+                __m256 w8 = _mm256_set1_ps(w);
+                for (; i + 8 <= n; i += 8)
+                {
+                    __m256 a = _mm256_loadu_ps(acc + i);
+                    __m256 r = _mm256_loadu_ps(row + i);
+#if __FMA__
+                    a = use_max ? _mm256_max_ps(a, r) : _mm256_fmadd_ps(r, w8, a);
+#else
+                    a = use_max ? _mm256_max_ps(a, r) : _mm256_add_ps(a, _mm256_mul_ps(r, w8));
+#endif
+                    _mm256_storeu_ps(acc + i, a);
+                }
+#endif
+#if MIP_SIMD_SSE
+                __m128 w4 = _mm_set1_ps(w);
+                for (; i + 4 <= n; i += 4)
+                {
+                    __m128 a = _mm_loadu_ps(acc + i);
+                    __m128 r = _mm_loadu_ps(row + i);
+                    a = use_max ? _mm_max_ps(a, r) : _mm_add_ps(a, _mm_mul_ps(r, w4));
+                    _mm_storeu_ps(acc + i, a);
+                }
+#elif MIP_SIMD_NEON
+                for (; i + 4 <= n; i += 4)
+                {
+                    float32x4_t a = vld1q_f32(acc + i);
+                    float32x4_t r = vld1q_f32(row + i);
+                    a = use_max ? vmaxq_f32(a, r) : vmlaq_n_f32(a, r, w);
+                    vst1q_f32(acc + i, a);
+                }
+#endif
+            }
+
+            for (; i < n; ++i)
+                acc[i] = use_max ? std::max(acc[i], row[i]) : acc[i] + row[i] * w;
+        }
+
+        u32 clamp_tap(u32 dst_coord, s32 tap, u32 src_size)
+        {
+            return (u32)std::min<s32>(std::max<s32>((s32)dst_coord * 2 + tap, 0), (s32)src_size - 1);
+        }
+
+        void generate_rows(u32 start, u32 end, void* user_data)
+        {
+            const mip_job&   job = *(const mip_job*)user_data;
+            const mip_chain& chain = *job.chain;
+            const mip_level& sl = chain.levels[job.level - 1];
+            const mip_level& dl = chain.levels[job.level];
+
+            u32  ch = job.mf.channels;
+            u32  ts = job.mf.texel_size;
+            u32  n = dl.width * ch;
+            bool simd = !(job.flags & e_mip_flags::scalar);
+            bool use_max = job.filter == e_mip_filter::max;
+            bool kaiser = job.filter == e_mip_filter::kaiser;
+            bool in_place = !job.mf.unorm8 && !job.mf.half;
+
+            // taps are 2x-2 .. 2x+3 for kaiser and 2x, 2x+1 otherwise, along each axis
+            const f32* weights = kaiser ? s_tables.kaiser : k_box_weights;
+            u32        num_taps = kaiser ? k_kaiser_taps : 2;
+            s32        first_tap = kaiser ? -2 : 0;
+            u32        num_depth_taps = chain.volume ? num_taps : 1;
+
+            // source rows are decoded, filtered to half width then weighted into the output row
+            f32* decoded = job.scratch[pen::jobs_get_thread_index()];
+            f32* filtered = decoded + sl.width * ch;
+            f32* acc = filtered + n;
+
+            for (u32 i = start; i < end; ++i)
+            {
+                u32 y = i % dl.height;
+                u32 z = (i / dl.height) % dl.depth;
+                u32 s = i / (dl.height * dl.depth);
+
+                u8* slice = job.data + s * chain.slice_size;
+                u8* dst_row = slice + dl.offset + (z * dl.height + y) * dl.width * ts;
+
+                // 32 bit float levels accumulate straight into the destination
+                f32* out = in_place ? (f32*)dst_row : acc;
+                if (!use_max)
+                    memset(out, 0, n * sizeof(f32));
+
+                bool first = true;
+                for (u32 tz = 0; tz < num_depth_taps; ++tz)
+                {
+                    u32 sz = chain.volume ? clamp_tap(z, first_tap + (s32)tz, sl.depth) : 0;
+                    f32 wz = chain.volume ? weights[tz] : 1.0f;
+
+                    for (u32 ty = 0; ty < num_taps; ++ty)
+                    {
+                        u32       sy = clamp_tap(y, first_tap + (s32)ty, sl.height);
+                        const u8* src_row = slice + sl.offset + (sz * sl.height + sy) * sl.width * ts;
+                        const f32* src = decode_row(job, src_row, sl.width, decoded);
+
+                        if (kaiser)
+                            downsample_kaiser(src, filtered, sl.width, dl.width, ch, simd);
+                        else
+                            downsample_pairs(src, filtered, sl.width, dl.width, ch, use_max, simd);
+
+                        if (use_max && first)
+                            memcpy(out, filtered, n * sizeof(f32));
+                        else
+                            accumulate_row(out, filtered, wz * weights[ty], n, use_max, simd);
+
+                        first = false;
+                    }
+                }
+
+                if (!in_place)
+                    encode_row(job, out, dl.width, dst_row);
+            }
+        }
+    } // namespace
+
+    u32 calc_mip_count(const pen::texture_creation_params& tcp)
+    {
+        u32 size = std::max<u32>(tcp.width, tcp.height);
+        if (tcp.collection_type == pen::TEXTURE_COLLECTION_VOLUME)
+            size = std::max<u32>(size, tcp.num_arrays);
+
+        u32 num_mips = 1;
+        while (size > 1)
+        {
+            size >>= 1;
+            num_mips++;
+        }
+
+        return num_mips;
+    }
+
+    bool can_generate_mips(const pen::texture_creation_params& tcp)
+    {
+        mip_format mf;
+        return tcp.num_mips <= 1 && tcp.data && tcp.pixels_per_block <= 1 && get_mip_format(tcp.format, mf) &&
+               calc_mip_count(tcp) > 1;
+    }
+
+    bool generate_mips(pen::texture_creation_params& tcp, mip_filter filter, u32 flags)
+    {
+        static bool initialised = init_tables();
+        PEN_UNUSED(initialised);
+
+        if (!can_generate_mips(tcp))
+            return false;
+
+        mip_format mf;
+        get_mip_format(tcp.format, mf);
+
+        mip_chain chain;
+        build_chain(tcp, calc_mip_count(tcp), mf.texel_size, chain);
+
+        // copy the top level of each slice into its chain
+        u8* data = (u8*)pen::memory_alloc(chain.slice_size * chain.num_slices);
+        u32 top_size = chain.levels[0].width * chain.levels[0].height * chain.levels[0].depth * mf.texel_size;
+        for (u32 s = 0; s < chain.num_slices; ++s)
+            memcpy(data + s * chain.slice_size, (const u8*)tcp.data + s * top_size, top_size);
+
+        // scratch for each thread which can run jobs, rows of the largest generated level
+        u32   num_threads = pen::jobs_get_num_workers() + 1;
+        u32   scratch_floats = (chain.levels[0].width + chain.levels[1].width * 2) * mf.channels;
+        f32*  scratch_mem = (f32*)pen::memory_alloc(scratch_floats * num_threads * sizeof(f32));
+        f32** scratch = (f32**)pen::memory_alloc(num_threads * sizeof(f32*));
+        for (u32 t = 0; t < num_threads; ++t)
+            scratch[t] = scratch_mem + t * scratch_floats;
+
+        mip_job job;
+        job.data = data;
+        job.chain = &chain;
+        job.mf = mf;
+        job.filter = filter;
+        job.flags = flags;
+        job.scratch = scratch;
+
+        // each level reads the previous, levels run in order with their rows split across the worker pool
+        for (u32 m = 1; m < chain.num_mips; ++m)
+        {
+            const mip_level& l = chain.levels[m];
+            job.level = m;
+
+            u32 num_rows = chain.num_slices * l.depth * l.height;
+            u32 num_texels = num_rows * l.width;
+
+            if ((flags & e_mip_flags::single_threaded) || num_texels < k_parallel_texels)
+                generate_rows(0, num_rows, &job);
+            else
+                pen::jobs_parallel_for(num_rows, std::max<u32>(k_grain_texels / l.width, 1), generate_rows, &job);
+        }
+
+        pen::memory_free(scratch);
+        pen::memory_free(scratch_mem);
+
+        tcp.data = data;
+        tcp.data_size = chain.slice_size * chain.num_slices;
+        tcp.num_mips = chain.num_mips;
+
+        return true;
+    }
+
+    mip_benchmark_result* benchmark_mip_generation(u32 size, u32 iterations)
+    {
+        static const u32 formats[] = {PEN_TEX_FORMAT_RGBA8_UNORM, PEN_TEX_FORMAT_R32_FLOAT,
+                                      PEN_TEX_FORMAT_R16G16B16A16_FLOAT};
+        static const u32 modes[] = {e_mip_flags::scalar | e_mip_flags::single_threaded, e_mip_flags::single_threaded,
+                                    0};
+
+        pen::timer*           timer = pen::timer_create();
+        mip_benchmark_result* results = nullptr;
+
+        for (u32 format : formats)
+        {
+            mip_format mf;
+            get_mip_format(format, mf);
+
+            pen::texture_creation_params tcp = {};
+            tcp.width = size;
+            tcp.height = size;
+            tcp.num_mips = 1;
+            tcp.num_arrays = 1;
+            tcp.format = format;
+            tcp.block_size = mf.texel_size;
+            tcp.pixels_per_block = 1;
+            tcp.collection_type = pen::TEXTURE_COLLECTION_NONE;
+            tcp.data_size = size * size * mf.texel_size;
+
+            // noise, so nothing is shortcut for uniform data
+            u8* top = (u8*)pen::memory_alloc(tcp.data_size);
+            u32 seed = 0x9e3779b9;
+            for (u32 i = 0; i < tcp.data_size; ++i)
+            {
+                seed = seed * 1664525 + 1013904223;
+                top[i] = (u8)(seed >> 24);
+            }
+
+            // keep floats finite and in a sane range
+            if (format == PEN_TEX_FORMAT_R32_FLOAT)
+                for (u32 i = 0; i < size * size; ++i)
+                    ((f32*)top)[i] = (f32)top[i * 4] / 255.0f;
+            else if (format == PEN_TEX_FORMAT_R16G16B16A16_FLOAT)
+                for (u32 i = 0; i < size * size * 4; ++i)
+                    ((f16*)top)[i] = float_to_half((f32)top[i * 2] / 255.0f);
+
+            for (u32 filter = 0; filter < e_mip_filter::max; ++filter)
+            {
+                for (u32 mode : modes)
+                {
+                    u32 flags = mode | (format == PEN_TEX_FORMAT_RGBA8_UNORM ? e_mip_flags::srgb : 0);
+
+                    mip_benchmark_result r;
+                    r.format = format;
+                    r.filter = (mip_filter)filter;
+                    r.flags = flags;
+
+                    u64 texels = 0;
+                    for (u32 i = 0; i < iterations; ++i)
+                    {
+                        pen::texture_creation_params gen = tcp;
+                        gen.data = top;
+
+                        pen::timer_start(timer);
+                        generate_mips(gen, (mip_filter)filter, flags);
+                        r.ms += pen::timer_elapsed_ms(timer);
+
+                        texels += (gen.data_size - tcp.data_size) / mf.texel_size;
+                        pen::memory_free(gen.data);
+                    }
+
+                    r.ms /= (f64)std::max<u32>(iterations, 1);
+                    r.mtexels_per_sec = r.ms > 0.0 ? (f64)texels / (r.ms * (f64)iterations * 1000.0) : 0.0;
+                    sb_push(results, r);
+                }
+            }
+
+            pen::memory_free(top);
+        }
+
+        pen::timer_destroy(timer);
+        return results;
+    }
+
+    void mip_generator_ui()
+    {
+        static mip_benchmark_result* s_results = nullptr;
+        static s32                   s_size = 2048;
+
+        ImGui::InputInt("Benchmark Size", &s_size);
+        s_size = std::min<s32>(std::max<s32>(s_size, 2), 8192);
+
+        if (ImGui::Button("Benchmark Mip Generation"))
+        {
+            sb_free(s_results);
+            s_results = benchmark_mip_generation((u32)s_size, 4);
+        }
+
+        static const c8* filter_names[] = {"box", "kaiser", "max"};
+
+        u32 num_results = sb_count(s_results);
+        for (u32 i = 0; i < num_results; ++i)
+        {
+            const mip_benchmark_result& r = s_results[i];
+
+            const c8* mode = "simd threaded";
+            if (r.flags & e_mip_flags::scalar)
+                mode = "scalar";
+            else if (r.flags & e_mip_flags::single_threaded)
+                mode = "simd";
+
+            ImGui::Text("%-8s %-7s %-14s %8.2f ms %8.1f Mtexels/s", get_format_name(r.format), filter_names[r.filter],
+                        mode, r.ms, r.mtexels_per_sec);
+        }
+    }
+} // namespace put
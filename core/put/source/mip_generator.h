@@ -0,0 +1,58 @@
+// mip_generator.h
+// Copyright 2014 - 2023 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Cpu mip chain generation for 2d, array, cube and volume textures in rgba8, bgra8, r32f and rgba16f.
+// Each level is split by slice and row across the job worker pool, rows are filtered with sse, avx2 or neon kernels
+// where available. Arrays and cubes are laid out slice by slice each with a full chain, volumes level by level each
+// with all of its depth slices, matching dds files and the renderer. Odd dimensions round down.
+
+#pragma once
+
+#include "renderer.h"
+#include "types.h"
+
+namespace put
+{
+    namespace e_mip_filter
+    {
+        enum mip_filter_t
+        {
+            box,    // 2x2 average, 2x2x2 for volumes
+            kaiser, // 6 tap kaiser windowed sinc, sharper than box with less aliasing
+            max,    // component wise max, keeps thin features and occupancy in voxel volumes
+            COUNT
+        };
+    }
+    typedef e_mip_filter::mip_filter_t mip_filter;
+
+    namespace e_mip_flags
+    {
+        enum mip_flags_t
+        {
+            srgb = 1 << 0,            // rgb of 8 bit formats are converted to linear to filter, alpha is linear
+            single_threaded = 1 << 1, // run on the calling thread only
+            scalar = 1 << 2           // skip simd kernels, for comparison
+        };
+    }
+
+    struct mip_benchmark_result
+    {
+        u32        format = 0;
+        mip_filter filter = e_mip_filter::box;
+        u32        flags = 0;
+        f64        ms = 0.0;
+        f64        mtexels_per_sec = 0.0; // texels written to all generated levels
+    };
+
+    // replaces tcp.data with a newly allocated full chain generated from the top level, the input data is not freed.
+    // returns false and leaves tcp unchanged for unsupported formats or when tcp already has mips.
+    bool generate_mips(pen::texture_creation_params& tcp, mip_filter filter = e_mip_filter::box, u32 flags = 0);
+    bool can_generate_mips(const pen::texture_creation_params& tcp);
+    u32  calc_mip_count(const pen::texture_creation_params& tcp); // full chain down to 1x1(x1)
+
+    // generates mips for a size x size texture of each format and filter, with and without simd and threading.
+    // results is a stretchy buffer, call sb_free when done.
+    mip_benchmark_result* benchmark_mip_generation(u32 size, u32 iterations);
+    void                  mip_generator_ui();
+} // namespace put
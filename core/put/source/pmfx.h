@@ -11,6 +11,8 @@
 
 #include "str/Str.h"
 
+#include <atomic>
+
 static const hash_id ID_VERTEX_CLASS_INSTANCED = PEN_HASH("_instanced");
 static const hash_id ID_VERTEX_CLASS_SKINNED = PEN_HASH("_skinned");
 static const hash_id ID_VERTEX_CLASS_BASIC = PEN_HASH("");
@@ -76,11 +78,20 @@ namespace put
         ecs::ecs_scene* scene = nullptr;
     };
 
+    namespace e_svr_flags
+    {
+        enum svr_flags_t
+        {
+            parallel = 1 << 0 // can be called concurrently for different views and array slices
+        };
+    }
+
     typedef void (*svr_render_function)(const scene_view&);
     struct scene_view_renderer
     {
         Str     name;
         hash_id id_name = 0;
+        u32     flags = 0;
 
         svr_render_function render_function = nullptr;
     };
@@ -171,7 +182,9 @@ namespace put
                 aux = 1 << 1,
                 aux_used = 1 << 2,
                 write_only = 1 << 3,
-                resolve = 1 << 4
+                resolve = 1 << 4,
+                transient = 1 << 5, // overwritten before it is read each frame, memory is pooled with other transients
+                aliased = 1 << 6    // shares the handle and memory of a transient target with a disjoint lifetime
             };
         }
 
@@ -232,13 +245,35 @@ namespace put
             u32 widget = e_permutation_widget::checkbox;
         };
 
+        // techniques are loaded lazily by whichever recording thread uses them first, the flag is stored with release
+        // ordering after the technique is written and read with acquire. copies only carry the value
+        struct technique_loaded_flag
+        {
+            std::atomic<bool> value;
+
+            technique_loaded_flag() : value(false)
+            {
+            }
+
+            technique_loaded_flag(const technique_loaded_flag& other)
+                : value(other.value.load(std::memory_order_relaxed))
+            {
+            }
+
+            technique_loaded_flag& operator=(const technique_loaded_flag& other)
+            {
+                value.store(other.value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                return *this;
+            }
+        };
+
         struct shader_program
         {
-            hash_id   id_name;
-            hash_id   id_sub_type;
-            Str       name;
-            bool      loaded = false;
-            pen::json info;
+            hash_id               id_name;
+            hash_id               id_sub_type;
+            Str                   name;
+            technique_loaded_flag loaded;
+            pen::json             info;
 
             u32 vertex_shader;
             u32 pixel_shader;
@@ -289,6 +324,63 @@ namespace put
             const c8* format = nullptr;
         };
 
+        namespace e_rg_state
+        {
+            enum rg_state_t
+            {
+                undefined,
+                render_target,
+                depth_target,
+                shader_read
+            };
+        }
+        typedef e_rg_state::rg_state_t rg_state;
+
+        namespace e_rg_pass_flags
+        {
+            enum rg_pass_flags_t
+            {
+                culled = 1 << 0,       // outputs are never consumed, the pass is skipped
+                post_process = 1 << 1, // pass is part of a views post process chain
+                abstract = 1 << 2,
+                compute = 1 << 3
+            };
+        }
+
+        struct rg_transition
+        {
+            u32 handle;
+            u32 before; // e_rg_state
+            u32 after;
+        };
+
+        struct rg_pass
+        {
+            Str     name;
+            hash_id id_name = 0;
+            u32     flags = 0;
+            u32     first_transition = 0; // index into render_graph::transitions, applied before the pass
+            u32     num_transitions = 0;
+            u32     resolve_mask = 0; // targets to resolve after the pass, colour by index and depth at pen::MAX_MRT
+            u32     mips_mask = 0;    // targets to generate mips for after the pass, same layout as resolve_mask
+        };
+
+        // views compiled into passes in execution order, with read and write edges from targets, sampler bindings and
+        // post process chains. passes whose outputs are never read are culled and resolves or mip generation is only
+        // planned for targets which are sampled. targets which are overwritten before they are read each frame share
+        // memory when their lifetimes do not overlap. passes, transitions are stretchy buffers valid until the next
+        // compile.
+        struct render_graph
+        {
+            rg_pass*       passes = nullptr;
+            rg_transition* transitions = nullptr;
+            u32            num_culled = 0;
+            u32            num_transient = 0;
+            u32            num_aliased = 0;
+            u64            transient_bytes = 0; // memory of transient targets without aliasing
+            u64            saved_bytes = 0;     // memory released by aliasing transient targets
+        };
+
         // pmfx renderer ---------------------------------------------------------------------------------------------------
 
         void init(const c8* filename);
@@ -311,7 +403,8 @@ namespace put
 
         camera*              get_camera(hash_id id_name);
         camera**             get_cameras(); // call sb_free on return value when done
-        const render_target* get_render_target(hash_id h);
+        const render_target* get_render_target(hash_id h); // targets read here are kept alive in the render graph
+        const render_graph&  get_render_graph();
         void                 get_render_target_dimensions(const render_target* rt, f32& w, f32& h);
         u32                  get_render_state(hash_id id_name, u32 type);
         Str                  get_render_state_name(u32 handle);
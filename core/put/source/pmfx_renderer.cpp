@@ -20,9 +20,12 @@
 #include "pen_string.h"
 #include "renderer_shared.h"
 #include "str_utilities.h"
+#include "threads.h"
 #include "timer.h"
 
+#include <algorithm>
 #include <fstream>
+#include <unordered_map>
 
 #include "shader_structs/post_process.h"
 
@@ -64,7 +67,8 @@ namespace
             generate_mips = (1 << 5),   // generate mip maps for the render target after resolving
             compute = (1<<6),           // runs a compute job instead of render job
             cubemap_array = (1<<7),
-            jitter = 1<<8               // apply jitter to the camera for taa
+            jitter = 1<<8,              // apply jitter to the camera for taa
+            parallel = 1<<9             // every render function can record concurrently with other views and slices
         };
     }
 
@@ -277,6 +281,8 @@ namespace
         u32 cbuffer_filter = PEN_INVALID_HANDLE;
         u32 cbuffer_technique = PEN_INVALID_HANDLE;
         u32 stencil_ref = 0; // is 8bit but 32bit here for alignment
+        u32 clear_mask = 0;  // targets cleared by the view, colour by index and depth at pen::MAX_MRT
+        u32 blend = 0;       // blends or masks writes to its colour targets
 
         // shader and technique
         u32     pmfx_shader;
@@ -296,10 +302,17 @@ namespace
         std::vector<Str>         post_process_chain;
         std::vector<view_params> post_process_views;
 
+        // from the render graph, views rendered outside of it resolve all targets
+        u32 resolve_mask = 0xffffffff;
+        u32 mips_mask = 0xffffffff;
+
         // for debug
         bool stash_output = false;
         u32  stashed_output_rt = PEN_INVALID_HANDLE;
         f32  stashed_rt_aspect = 0.0f;
+
+        // rendered on one thread since the graph was compiled, so render functions have created their resources
+        bool warm = false;
     };
 
     struct edited_post_process
@@ -369,11 +382,48 @@ namespace
     std::vector<texture_creation_params> s_render_target_tcp;
     std::vector<const c8*>               s_render_target_names;
     std::vector<render_state>            s_render_states;
+    std::unordered_map<u64, u32>         s_render_state_lookup;      // (type, id_name) to index in s_render_states
+    std::unordered_map<u64, u32>         s_render_state_hash_lookup; // (type, hash) of the creation params
     std::vector<sampler_binding>         s_sampler_bindings;
     std::vector<filter_kernel>           s_filter_kernels;
     geometry_utility                     s_geometry;
     std::vector<Str>                     s_script_files;
     bool                                 s_reload = false;
+    render_graph                         s_render_graph;
+    std::vector<view_params*>            s_render_graph_views;          // view for each pass in s_render_graph
+    std::vector<hash_id>                 s_external_reads;              // targets read through get_render_target
+    bool                                 s_render_graph_dirty = false;
+    bool                                 s_render_graph_discover = false; // compile without culling to find reads
+
+    struct transient_targets
+    {
+        bool applied = false; // aliasing is planned once per load
+        u32  num_transient = 0;
+        u32  num_aliased = 0;
+        u64  transient_bytes = 0;
+        u64  saved_bytes = 0;
+    };
+    transient_targets s_transients;
+
+    // consecutive passes of parallel views are recorded into a command list per array slice across the job workers,
+    // each slice gets a copy of the view camera set up as it would be when rendering serially.
+    struct record_task
+    {
+        view_params* view;
+        u32          slice;
+        put::camera  camera;
+    };
+
+    struct parallel_recording
+    {
+        bool                     enabled = true;
+        std::vector<record_task> tasks;
+        std::vector<u32>         cmd_lists;
+        u32                      recorded = 0;      // slices recorded in parallel last frame
+        f64                      serial_ms = 0.0;   // smoothed cpu time of render with and without parallel recording
+        f64                      parallel_ms = 0.0;
+    };
+    parallel_recording s_parallel;
 
     // ids
 } // namespace
@@ -479,36 +529,74 @@ namespace put
             return res;
         }
 
+        u64 render_state_key(hash_id id, u32 type)
+        {
+            return ((u64)type << 32) | (u64)id;
+        }
+
+        void add_render_state(const render_state& rs)
+        {
+            // the first state added with a name or hash is the one found, same as searching in order
+            u32 index = (u32)s_render_states.size();
+            s_render_states.push_back(rs);
+
+            s_render_state_lookup.emplace(render_state_key(rs.id_name, rs.type), index);
+            s_render_state_hash_lookup.emplace(render_state_key(rs.hash, rs.type), index);
+        }
+
+        void rebuild_render_state_lookup()
+        {
+            s_render_state_lookup.clear();
+            s_render_state_hash_lookup.clear();
+
+            u32 num = (u32)s_render_states.size();
+            for (u32 i = 0; i < num; ++i)
+            {
+                const render_state& rs = s_render_states[i];
+                s_render_state_lookup.emplace(render_state_key(rs.id_name, rs.type), i);
+                s_render_state_hash_lookup.emplace(render_state_key(rs.hash, rs.type), i);
+            }
+        }
+
         render_state* get_state_by_hash(hash_id hash, u32 type)
         {
-            size_t num = s_render_states.size();
-            for (s32 i = 0; i < num; ++i)
-                if (s_render_states[i].hash == hash && s_render_states[i].type == type)
-                    return &s_render_states[i];
+            auto it = s_render_state_hash_lookup.find(render_state_key(hash, type));
+            if (it == s_render_state_hash_lookup.end())
+                return nullptr;
 
-            return nullptr;
+            return &s_render_states[it->second];
         }
 
         render_state* _get_render_state(hash_id id_name, u32 type)
         {
-            size_t num = s_render_states.size();
-            for (s32 i = 0; i < num; ++i)
-                if (s_render_states[i].type == type)
-                    if (s_render_states[i].id_name == id_name)
-                        return &s_render_states[i];
+            auto it = s_render_state_lookup.find(render_state_key(id_name, type));
+            if (it == s_render_state_lookup.end())
+                return nullptr;
+
+            return &s_render_states[it->second];
+        }
+
+        const render_target* _get_render_target(hash_id h)
+        {
+            size_t num = s_render_targets.size();
+            for (u32 i = 0; i < num; ++i)
+            {
+                if (s_render_targets[i].id_name == h)
+                {
+                    return &s_render_targets[i];
+                }
+            }
 
             return nullptr;
         }
 
         u32 get_render_state(hash_id id_name, u32 type)
         {
-            size_t num = s_render_states.size();
-            for (s32 i = 0; i < num; ++i)
-                if (s_render_states[i].type == type)
-                    if (s_render_states[i].id_name == id_name)
-                        return s_render_states[i].handle;
+            render_state* rs = _get_render_state(id_name, type);
+            if (!rs)
+                return 0;
 
-            return 0;
+            return rs->handle;
         }
 
         Str get_render_state_name(u32 handle)
@@ -602,7 +690,7 @@ namespace put
 
                 // texture id and handle from render targets.. todo add global textures
                 sb.id_texture = binding["texture"].as_hash_id();
-                const render_target* rt = get_render_target(sb.id_texture);
+                const render_target* rt = _get_render_target(sb.id_texture);
 
                 if (!rt)
                 {
@@ -691,7 +779,7 @@ namespace put
                     rs.handle = pen::renderer_create_sampler(scp);
                 }
 
-                s_render_states.push_back(rs);
+                add_render_state(rs);
             }
         }
 
@@ -736,7 +824,7 @@ namespace put
                     rs.handle = pen::renderer_create_raster_state(rcp);
                 }
 
-                s_render_states.push_back(rs);
+                add_render_state(rs);
             }
         }
 
@@ -789,11 +877,12 @@ namespace put
                 render_state rs;
                 rs.name = state.name();
                 rs.id_name = PEN_HASH(state.name().c_str());
+                rs.hash = 0;
                 rs.type = e_render_state::blend;
                 rs.handle = pen::renderer_create_blend_state(bcp);
                 rs.copy = false;
 
-                s_render_states.push_back(rs);
+                add_render_state(rs);
             }
         }
 
@@ -872,7 +961,7 @@ namespace put
                     rs.handle = pen::renderer_create_depth_stencil_state(dscp);
                 }
 
-                s_render_states.push_back(rs);
+                add_render_state(rs);
             }
         }
 
@@ -1043,7 +1132,7 @@ namespace put
                 rs.handle = pen::renderer_create_blend_state(bcp);
             }
 
-            s_render_states.push_back(rs);
+            add_render_state(rs);
 
             return rs.handle;
         }
@@ -1281,16 +1370,19 @@ namespace put
 
         const render_target* get_render_target(hash_id h)
         {
-            size_t num = s_render_targets.size();
-            for (u32 i = 0; i < num; ++i)
+            // reads from outside of pmfx are not visible to the render graph, keep the producers of these targets
+            const render_target* rt = _get_render_target(h);
+            if (std::find(s_external_reads.begin(), s_external_reads.end(), h) == s_external_reads.end())
             {
-                if (s_render_targets[i].id_name == h)
-                {
-                    return &s_render_targets[i];
-                }
+                s_external_reads.push_back(h);
+                s_render_graph_dirty = true;
+
+                // contents of transient targets do not persist, reload to give it its own memory
+                if (rt && (rt->flags & e_rt_flags::transient))
+                    s_reload = true;
             }
 
-            return nullptr;
+            return rt;
         }
 
         void resize_render_target(hash_id target, const rt_resize_params& params)
@@ -1312,6 +1404,13 @@ namespace put
                 }
             }
 
+            // transient targets share memory, keep this one out of aliasing and reload to give it its own
+            if (current_target->flags & e_rt_flags::transient)
+            {
+                get_render_target(target);
+                s_reload = true;
+            }
+
             s32 new_format = current_target->format;
             u32 format_index = 0;
 
@@ -1423,7 +1522,7 @@ namespace put
                     if (s_views[i].id_render_target[j] == 0)
                         continue;
 
-                    const render_target* rt = get_render_target(s_views[i].id_render_target[j]);
+                    const render_target* rt = _get_render_target(s_views[i].id_render_target[j]);
 
                     if (!first)
                     {
@@ -1532,6 +1631,7 @@ namespace put
                     if (new_view.id_render_target[t] == rt_id)
                     {
                         cs_info.num_colour_targets++;
+                        new_view.clear_mask |= 1 << t;
 
                         pen::json colour_f = jmrt["clear_colour_f"];
                         if (colour_f.size() == 4)
@@ -1561,6 +1661,12 @@ namespace put
             }
 
             new_view.clear_state = pen::renderer_create_clear_state(cs_info);
+
+            if (clear_flags & PEN_CLEAR_COLOUR_BUFFER)
+                new_view.clear_mask |= (1 << num_targets) - 1;
+
+            if (clear_flags & PEN_CLEAR_DEPTH_BUFFER)
+                new_view.clear_mask |= 1 << pen::MAX_MRT;
         }
 
         void parse_views(pen::json& j_views, const pen::json& all_views, std::vector<view_params>& view_array,
@@ -1764,6 +1870,7 @@ namespace put
 
                 new_view.blend_state =
                     create_blend_state(view.name().c_str(), blend_state, colour_write_mask, alpha_to_coverage);
+                new_view.blend = blend_state.type() != JSMN_UNDEFINED || colour_write_mask.type() != JSMN_UNDEFINED;
 
                 // scene
                 Str scene_str = view["scene"].as_str();
@@ -1856,6 +1963,7 @@ namespace put
 
                 // scene views
                 pen::json scene_views = view["scene_views"];
+                u32       svr_flags = e_svr_flags::parallel;
                 for (u32 ii = 0; ii < scene_views.size(); ++ii)
                 {
                     hash_id id = scene_views[ii].as_hash_id();
@@ -1866,6 +1974,7 @@ namespace put
                         {
                             found = true;
                             new_view.render_functions.push_back(sv.render_function);
+                            svr_flags &= sv.flags;
                         }
                     }
 
@@ -1880,6 +1989,9 @@ namespace put
                 if (scene_views.size() > 0)
                     new_view.view_flags |= e_view_flags::scene_view;
 
+                if (svr_flags & e_svr_flags::parallel)
+                    new_view.view_flags |= e_view_flags::parallel;
+
                 // sampler bindings
                 parse_sampler_bindings(view, new_view);
 
@@ -2533,6 +2645,9 @@ namespace put
 
             // rebake material handles
             ecs::bake_material_handles();
+
+            s_render_graph_dirty = true;
+            s_render_graph_discover = true;
         }
 
         void pmfx_config_build()
@@ -2587,6 +2702,16 @@ namespace put
             for (s32 i = s_render_states.size() - 1; i >= 0; --i)
                 if (s_render_states[i].type != e_render_state::sampler)
                     s_render_states.erase(s_render_states.begin() + i);
+
+            rebuild_render_state_lookup();
+        }
+
+        void release_render_graph()
+        {
+            sb_free(s_render_graph.passes);
+            sb_free(s_render_graph.transitions);
+            s_render_graph = render_graph();
+            s_render_graph_views.clear();
         }
 
         void release_script_resources()
@@ -2623,6 +2748,10 @@ namespace put
                 if (rt.id_name == k_id_main_depth)
                     continue;
 
+                // handle is owned by another transient target
+                if (rt.flags & e_rt_flags::aliased)
+                    continue;
+
                 pen::renderer_release_render_target(rt.handle);
             }
 
@@ -2642,6 +2771,8 @@ namespace put
             s_virtual_rt.clear();
             s_partial_blend_states.clear();
 
+            release_render_graph();
+            s_transients = transient_targets();
             clear_render_states();
         }
 
@@ -2649,6 +2780,10 @@ namespace put
         {
             release_script_resources();
 
+            for (u32 cl : s_parallel.cmd_lists)
+                pen::renderer_release_cmd_list(cl);
+            s_parallel.cmd_lists.clear();
+
             // clear vectors of remaining stuff
             s_scene_view_renderers.clear();
         }
@@ -2794,6 +2929,13 @@ namespace put
                 v.render_functions[rf](sv);
         }
 
+        bool needs_resolve(const view_params& v)
+        {
+            bool resolve = (v.view_flags & e_view_flags::resolve) && v.resolve_mask;
+            bool mips = (v.view_flags & e_view_flags::generate_mips) && v.mips_mask;
+            return resolve || mips;
+        }
+
         void resolve_view_targets(view_params& v)
         {
             static u32 pmfx_resolve = pmfx::load_shader("msaa_resolve");
@@ -2822,7 +2964,7 @@ namespace put
             {
                 for (u32 i = 0; i < v.num_colour_targets; ++i)
                 {
-                    if (v.resolve_method[i] == 0)
+                    if (v.resolve_method[i] == 0 || !(v.resolve_mask & (1 << i)))
                         continue;
 
                     pmfx::set_technique_perm(pmfx_resolve, v.resolve_method[i]);
@@ -2830,7 +2972,7 @@ namespace put
                 }
 
                 // resolve depth
-                if (is_valid_non_null(v.depth_target))
+                if (is_valid_non_null(v.depth_target) && (v.resolve_mask & (1 << pen::MAX_MRT)))
                 {
                     pmfx::set_technique_perm(pmfx_resolve, v.depth_resolve_method);
                     pen::renderer_resolve_target(v.depth_target, pen::RESOLVE_CUSTOM);
@@ -2841,9 +2983,10 @@ namespace put
             if (v.view_flags & e_view_flags::generate_mips)
             {
                 for (u32 i = 0; i < v.num_colour_targets; ++i)
-                    pen::renderer_resolve_target(v.render_targets[i], pen::RESOLVE_GENERATE_MIPS);
+                    if (v.mips_mask & (1 << i))
+                        pen::renderer_resolve_target(v.render_targets[i], pen::RESOLVE_GENERATE_MIPS);
 
-                if (is_valid_non_null(v.depth_target))
+                if (is_valid_non_null(v.depth_target) && (v.mips_mask & (1 << pen::MAX_MRT)))
                     pen::renderer_resolve_target(v.depth_target, pen::RESOLVE_GENERATE_MIPS);
             }
 
@@ -2853,7 +2996,47 @@ namespace put
                 pen::renderer_set_texture(0, 0, i, pen::TEXTURE_BIND_PS | pen::TEXTURE_BIND_VS);
         }
 
-        void render_view(view_params& v)
+        bool view_renders(const view_params& v)
+        {
+            // caps based exclusion
+            const pen::renderer_info& ri = pen::renderer_get_info();
+            if (v.view_flags & e_view_flags::cubemap_array)
+                if (!(ri.caps & PEN_CAPS_TEXTURE_CUBE_ARRAY))
+                    return false;
+
+            // early out.. nothing to render
+            if (v.num_colour_targets == 0 && v.depth_target == PEN_INVALID_HANDLE)
+                return false;
+
+            return true;
+        }
+
+        void get_view_viewport(const view_params& v, pen::viewport& vp, pen::viewport& vvp)
+        {
+            vp = {0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f};
+            get_rt_viewport(v.rt_width, v.rt_height, v.rt_ratio, v.viewport, vp);
+
+            // we need the literal size not ratio
+            vvp = _renderer_resolve_viewport_ratio(vp);
+        }
+
+        void set_view_camera_slice(view_params& v, u32 array_index, const pen::viewport& vvp)
+        {
+            // set jitter
+            if (v.view_flags & e_view_flags::jitter)
+            {
+                v.camera->jitter = halton(pen::_renderer_frame_index());
+                v.camera->jitter /= vec2f(vvp.width, vvp.height);
+                v.camera->flags |= e_camera_flags::apply_jitter;
+            }
+
+            // cubemap face render
+            if (v.view_flags & e_view_flags::cubemap)
+                put::camera_set_cubemap_face(v.camera, array_index);
+        }
+
+        // renders every array slice, or only slice with the camera already set up for it when recording in parallel
+        void render_view(view_params& v, u32 slice = PEN_INVALID_HANDLE, put::camera* slice_camera = nullptr)
         {
             // compute doesnt need render pipeline setup
             if (v.view_flags & e_view_flags::compute)
@@ -2872,22 +3055,14 @@ namespace put
                 for (s32 rf = 0; rf < v.render_functions.size(); ++rf)
                     v.render_functions[rf](sv);
 
-                if (v.view_flags & (e_view_flags::resolve | e_view_flags::generate_mips))
+                if (needs_resolve(v))
                     resolve_view_targets(v);
 
                 return;
             }
 
-            // caps based exclusion
-            const pen::renderer_info& ri = pen::renderer_get_info();
-            if (v.view_flags & e_view_flags::cubemap_array)
-                if (!(ri.caps & PEN_CAPS_TEXTURE_CUBE_ARRAY))
-                    return;
-
             // render pipeline
-
-            // early out.. nothing to render
-            if (v.num_colour_targets == 0 && v.depth_target == PEN_INVALID_HANDLE)
+            if (!view_renders(v))
                 return;
 
             static u32 cb_2d = PEN_INVALID_HANDLE;
@@ -2919,16 +3094,13 @@ namespace put
                 pen::renderer_set_texture(0, 0, i, pen::TEXTURE_BIND_PS | pen::TEXTURE_BIND_VS);
 
             // render state
-            pen::viewport vp = {0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f};
-            get_rt_viewport(v.rt_width, v.rt_height, v.rt_ratio, v.viewport, vp);
+            pen::viewport vp, vvp;
+            get_view_viewport(v, vp, vvp);
             pen::renderer_set_depth_stencil_state(v.depth_stencil_state);
             pen::renderer_set_stencil_ref(v.stencil_ref);
             pen::renderer_set_raster_state(v.raster_state);
             pen::renderer_set_blend_state(v.blend_state);
 
-            // we need the literal size not ratio
-            pen::viewport vvp = _renderer_resolve_viewport_ratio(vp);
-
             // create 2d view proj matrix
             f32 W = 2.0f / vvp.width;
             f32 H = 2.0f / vvp.height;
@@ -2950,7 +3122,9 @@ namespace put
             sv.permutation = v.technique_permutation;
 
             // render passes.. multi pass for cubemaps or arrays
-            for (u32 a = 0; a < v.num_arrays; ++a)
+            u32 first = is_valid(slice) ? slice : 0;
+            u32 last = is_valid(slice) ? slice + 1 : v.num_arrays;
+            for (u32 a = first; a < last; ++a)
             {
                 sv.array_index = a;
                 sv.num_arrays = v.num_arrays;
@@ -2958,28 +3132,28 @@ namespace put
                 // generate 3d view proj matrix
                 if (v.camera)
                 {
-                    // set jitter
-                    if (v.view_flags & e_view_flags::jitter)
+                    put::camera* cam = slice_camera;
+                    if (!cam)
                     {
-                        v.camera->jitter = halton(pen::_renderer_frame_index());
-                        v.camera->jitter /= vec2f(vvp.width, vvp.height);
-                        v.camera->flags |= e_camera_flags::apply_jitter;
+                        set_view_camera_slice(v, a, vvp);
+                        cam = v.camera;
                     }
 
-                    // cubemap face render
-                    if (v.view_flags & e_view_flags::cubemap)
-                        put::camera_set_cubemap_face(v.camera, a);
-
-                    put::camera_update_shader_constants(v.camera);
-                    sv.cb_view = v.camera->cbuffer;
+                    put::camera_update_shader_constants(cam);
+                    sv.camera = cam;
+                    sv.cb_view = cam->cbuffer;
                 }
                 else
                 {
-                    // orthogonal projections (directional shadow maps)
-                    static put::camera c;
+                    // orthogonal projections (directional shadow maps), a copy as slices may record concurrently
+                    static put::camera ortho;
+                    put::camera        c = ortho;
                     put::camera_create_orthographic(&c, vvp.x, vvp.width, vvp.y, vvp.height, 0.0f, 1.0f);
                     put::camera_update_shader_constants(&c);
                     sv.cb_view = c.cbuffer;
+
+                    if (!is_valid(ortho.cbuffer))
+                        ortho.cbuffer = c.cbuffer;
                 }
 
                 // bind targets before samplers..
@@ -3043,7 +3217,11 @@ namespace put
                     v.render_functions[rf](sv);
             }
 
-            if (v.view_flags & (e_view_flags::resolve | e_view_flags::generate_mips))
+            // slices are submitted in order, the last one finishes the view
+            if (last < v.num_arrays)
+                return;
+
+            if (needs_resolve(v))
                 resolve_view_targets(v);
 
             // for debug
@@ -3062,40 +3240,689 @@ namespace put
             }
         }
 
-        void render_post_process(view_params& v)
+        namespace
         {
-            virtual_rt_reset();
+            struct rg_node
+            {
+                view_params*     view;
+                u32              flags;
+                std::vector<u32> reads;
+                std::vector<u32> writes;
+            };
 
-            for (auto& v : v.post_process_views)
+            const c8* k_rg_state_names[] = {"undefined", "render_target", "depth_target", "shader_read"};
+
+            bool rg_contains(const std::vector<u32>& handles, u32 h)
             {
-                // default to fs quad
-                if (v.render_functions.empty())
-                    v.render_functions.push_back(&fullscreen_quad);
+                return std::find(handles.begin(), handles.end(), h) != handles.end();
+            }
 
-                render_view(v);
+            void rg_add(std::vector<u32>& handles, u32 h)
+            {
+                if (!rg_contains(handles, h))
+                    handles.push_back(h);
             }
-        }
 
-        void render()
+            rg_node rg_make_node(view_params& v, u32 flags)
+            {
+                rg_node n;
+                n.view = &v;
+                n.flags = flags;
+
+                if (v.view_flags & e_view_flags::abstract)
+                    n.flags |= e_rg_pass_flags::abstract;
+
+                if (v.view_flags & e_view_flags::compute)
+                    n.flags |= e_rg_pass_flags::compute;
+
+                for (u32 i = 0; i < v.num_colour_targets; ++i)
+                    if (is_valid_non_null(v.render_targets[i]))
+                        rg_add(n.writes, v.render_targets[i]);
+
+                if (is_valid_non_null(v.depth_target))
+                    rg_add(n.writes, v.depth_target);
+
+                for (auto& sb : v.sampler_bindings)
+                    if (is_valid_non_null(sb.handle))
+                        rg_add(n.reads, sb.handle);
+
+                for (u32 i = 0; i < e_pmfx_constants::max_technique_sampler_bindings; ++i)
+                    if (is_valid_non_null(v.technique_samplers.sb[i].handle))
+                        rg_add(n.reads, v.technique_samplers.sb[i].handle);
+
+                return n;
+            }
+
+            u32 rg_targets_mask(const view_params& v, const std::vector<u32>& handles)
+            {
+                u32 mask = 0;
+                for (u32 i = 0; i < v.num_colour_targets; ++i)
+                    if (rg_contains(handles, v.render_targets[i]))
+                        mask |= 1 << i;
+
+                if (is_valid_non_null(v.depth_target) && rg_contains(handles, v.depth_target))
+                    mask |= 1 << pen::MAX_MRT;
+
+                return mask;
+            }
+
+            void rg_transition_target(std::vector<rg_transition>& states, u32 handle, u32 state, bool emit)
+            {
+                // back buffers are transitioned by the backend on present
+                if (handle == PEN_BACK_BUFFER_COLOUR || handle == PEN_BACK_BUFFER_DEPTH)
+                    return;
+
+                rg_transition* ts = nullptr;
+                for (auto& t : states)
+                    if (t.handle == handle)
+                        ts = &t;
+
+                if (!ts)
+                {
+                    states.push_back({handle, e_rg_state::undefined, e_rg_state::undefined});
+                    ts = &states.back();
+                }
+
+                if (ts->after == state)
+                    return;
+
+                if (emit)
+                {
+                    rg_transition t = {handle, ts->after, state};
+                    sb_push(s_render_graph.transitions, t);
+                }
+
+                ts->after = state;
+            }
+
+            const c8* rg_target_name(u32 handle)
+            {
+                for (auto& rt : s_render_targets)
+                    if (rt.handle == handle)
+                        return rt.name.c_str();
+
+                return "unknown";
+            }
+
+            u64 rg_target_size(const render_target& rt)
+            {
+                f32 w, h;
+                get_rt_dimensions(rt.width, rt.height, rt.ratio, w, h);
+
+                u64 byte_size = 0;
+                for (s32 f = 0; f < PEN_ARRAY_SIZE(rt_format); ++f)
+                {
+                    if (rt_format[f].format == rt.format)
+                    {
+                        byte_size = rt_format[f].block_size / 8;
+                        break;
+                    }
+                }
+
+                // msaa targets have a resolve surface, mip chains add a third
+                u64 size = byte_size * (u64)w * (u64)h * rt.samples;
+                if (rt.samples > 1)
+                    size += byte_size * (u64)w * (u64)h;
+
+                if (rt.num_mips > 1)
+                    size += size / 3;
+
+                return size * std::max<u32>(rt.num_arrays, 1);
+            }
+
+            bool rg_compatible(const render_target& a, const render_target& b)
+            {
+                bool match = a.width == b.width && a.height == b.height && a.depth == b.depth && a.ratio == b.ratio;
+                match &= a.format == b.format && a.samples == b.samples && a.num_mips == b.num_mips;
+                match &= a.num_arrays == b.num_arrays && a.collection == b.collection && a.bind_flags == b.bind_flags;
+                return match;
+            }
+
+            bool rg_overwrites(const rg_node& n, u32 h)
+            {
+                // the target is fully written by the pass before anything reads it, by a clear or an opaque
+                // fullscreen post process
+                const view_params& v = *n.view;
+                if (rg_contains(n.reads, h))
+                    return false;
+
+                const f32* vp = v.viewport;
+                if (vp[0] != 0.0f || vp[1] != 0.0f || vp[2] != 1.0f || vp[3] != 1.0f)
+                    return false;
+
+                u32  mask = v.clear_mask;
+                bool quad = v.render_functions.size() == 1 && v.render_functions[0] == &fullscreen_quad;
+                if ((n.flags & e_rg_pass_flags::post_process) && quad && !v.blend)
+                    mask |= (1 << v.num_colour_targets) - 1;
+
+                for (u32 t = 0; t < v.num_colour_targets; ++t)
+                    if (v.render_targets[t] == h && (mask & (1 << t)))
+                        return true;
+
+                return v.depth_target == h && (mask & (1 << pen::MAX_MRT));
+            }
+
+            void rg_remap_handle(u32& handle, u32 from, u32 to)
+            {
+                if (handle == from)
+                    handle = to;
+            }
+
+            void rg_remap_view(view_params& v, u32 from, u32 to)
+            {
+                for (u32 i = 0; i < pen::MAX_MRT; ++i)
+                    rg_remap_handle(v.render_targets[i], from, to);
+
+                rg_remap_handle(v.depth_target, from, to);
+
+                for (auto& sb : v.sampler_bindings)
+                    rg_remap_handle(sb.handle, from, to);
+
+                for (u32 i = 0; i < e_pmfx_constants::max_technique_sampler_bindings; ++i)
+                    rg_remap_handle(v.technique_samplers.sb[i].handle, from, to);
+
+                for (auto& pv : v.post_process_views)
+                    rg_remap_view(pv, from, to);
+            }
+
+            struct rg_lifetime
+            {
+                u32  handle;
+                u32  first; // live pass indices
+                u32  last;
+                bool transient;
+            };
+
+            struct rg_slot
+            {
+                u32 rt_index; // target which owns the memory
+                u32 last;
+            };
+
+            void alias_transient_targets(const std::vector<rg_node>& nodes, const std::vector<u8>& live,
+                                         const std::vector<u32>& pinned)
+            {
+                // lifetimes over live passes, targets touched by culled passes are left alone as they become live
+                // again if anything reads their outputs
+                std::vector<rg_lifetime> lifetimes;
+                std::vector<u32>         excluded = pinned;
+                for (u32 i = 0; i < (u32)nodes.size(); ++i)
+                {
+                    const rg_node& n = nodes[i];
+
+                    std::vector<u32> handles = n.writes;
+                    for (u32 h : n.reads)
+                        rg_add(handles, h);
+
+                    for (u32 h : handles)
+                    {
+                        if (!live[i])
+                        {
+                            rg_add(excluded, h);
+                            continue;
+                        }
+
+                        rg_lifetime* lt = nullptr;
+                        for (auto& l : lifetimes)
+                            if (l.handle == h)
+                                lt = &l;
+
+                        if (lt)
+                            lt->last = i;
+                        else
+                            lifetimes.push_back({h, i, i, rg_overwrites(n, h)});
+                    }
+                }
+
+                // greedy first fit in order of first use, a slot can be reused once its last user has finished
+                std::vector<rg_slot> slots;
+                for (auto& lt : lifetimes)
+                {
+                    if (!lt.transient || rg_contains(excluded, lt.handle))
+                        continue;
+
+                    u32 rt_index = PEN_INVALID_HANDLE;
+                    for (u32 i = 0; i < (u32)s_render_targets.size(); ++i)
+                    {
+                        if (s_render_targets[i].handle == lt.handle)
+                        {
+                            rt_index = i;
+                            break;
+                        }
+                    }
+
+                    if (!is_valid(rt_index) || (s_render_targets[rt_index].flags & e_rt_flags::write_only))
+                        continue;
+
+                    render_target& rt = s_render_targets[rt_index];
+                    u64            bytes = rg_target_size(rt);
+
+                    rt.flags |= e_rt_flags::transient;
+                    s_transients.num_transient++;
+                    s_transients.transient_bytes += bytes;
+
+                    rg_slot* slot = nullptr;
+                    for (auto& sl : slots)
+                    {
+                        if (sl.last < lt.first && rg_compatible(s_render_targets[sl.rt_index], rt))
+                        {
+                            slot = &sl;
+                            break;
+                        }
+                    }
+
+                    if (!slot)
+                    {
+                        slots.push_back({rt_index, lt.last});
+                        continue;
+                    }
+
+                    // take the slot owners handle and release our own memory
+                    u32 owner = s_render_targets[slot->rt_index].handle;
+                    for (auto& v : s_views)
+                        rg_remap_view(v, rt.handle, owner);
+
+                    pen::renderer_release_render_target(rt.handle);
+                    rt.handle = owner;
+                    rt.flags |= e_rt_flags::aliased;
+                    slot->last = lt.last;
+
+                    s_transients.num_aliased++;
+                    s_transients.saved_bytes += bytes;
+                }
+            }
+        } // namespace
+
+        void compile_render_graph(bool cull)
         {
-            reload();
+            release_render_graph();
+
+            // resolves and targets may change, render each view on one thread again first
+            for (auto& v : s_views)
+                v.warm = false;
+
+            // passes in execution order, post process chains follow their input view
+            std::vector<rg_node> nodes;
+            std::vector<u32>     consumed; // targets read or loaded by live passes or read from outside the graph
+            std::vector<u32>     sampled;  // targets read through samplers, these need resolves and mips
+            std::vector<u32>     external; // targets read by render functions, which the graph cannot see
 
             for (auto& v : s_views)
             {
                 if (v.view_flags & e_view_flags::template_view)
+                {
+                    // rendered from elsewhere, anything it touches is in use
+                    rg_node t = rg_make_node(v, 0);
+                    for (u32 h : t.reads)
+                    {
+                        rg_add(consumed, h);
+                        rg_add(sampled, h);
+                    }
+
+                    for (u32 h : t.writes)
+                        rg_add(consumed, h);
+
                     continue;
+                }
 
-                if (v.view_flags & e_view_flags::abstract)
+                nodes.push_back(rg_make_node(v, 0));
+
+                if ((v.view_flags & e_view_flags::abstract) || !(v.post_process_flags & e_pp_flags::enabled))
+                    continue;
+
+                for (auto& pv : v.post_process_views)
                 {
-                    render_abstract_view(v);
+                    // default to fs quad
+                    if (pv.render_functions.empty())
+                        pv.render_functions.push_back(&fullscreen_quad);
+
+                    nodes.push_back(rg_make_node(pv, e_rg_pass_flags::post_process));
                 }
-                else
+            }
+
+            // back buffers, cpu read backs and targets read from outside of pmfx are the roots, they and anything
+            // template views touch are pinned and never share memory
+            size_t num_rt = s_render_targets.size();
+            for (size_t i = 0; i < num_rt; ++i)
+            {
+                const render_target& rt = s_render_targets[i];
+
+                bool root = rt.id_name == k_id_main_colour || rt.id_name == k_id_main_depth;
+                if (i < s_render_target_tcp.size())
+                    root |= (s_render_target_tcp[i].cpu_access_flags & PEN_CPU_ACCESS_READ) != 0;
+
+                if (std::find(s_external_reads.begin(), s_external_reads.end(), rt.id_name) != s_external_reads.end())
+                {
+                    root = true;
+                    rg_add(sampled, rt.handle);
+                    rg_add(external, rt.handle);
+                }
+
+                if (root)
+                    rg_add(consumed, rt.handle);
+            }
+
+            std::vector<u32> pinned = consumed;
+
+            // walk back from the roots until nothing changes, a pass may read a target written by a later pass in
+            // the previous frame. bound targets are loaded so count as consumed, which keeps passes that accumulate.
+            size_t          num_nodes = nodes.size();
+            std::vector<u8> live(num_nodes, cull ? 0 : 1);
+            std::vector<u8> visited(num_nodes, 0);
+            bool            changed = true;
+            while (changed)
+            {
+                changed = false;
+                for (s32 i = (s32)num_nodes - 1; i >= 0; --i)
+                {
+                    rg_node& n = nodes[i];
+
+                    // abstract and compute views can have side effects outside of targets
+                    if (n.flags & (e_rg_pass_flags::abstract | e_rg_pass_flags::compute))
+                        live[i] = 1;
+
+                    for (u32 h : n.writes)
+                        if (rg_contains(consumed, h))
+                            live[i] = 1;
+
+                    if (!live[i] || visited[i])
+                        continue;
+
+                    for (u32 h : n.reads)
+                    {
+                        rg_add(consumed, h);
+                        rg_add(sampled, h);
+                    }
+
+                    for (u32 h : n.writes)
+                        rg_add(consumed, h);
+
+                    visited[i] = 1;
+                    changed = true;
+                }
+            }
+
+            // alias transient targets once per load after the first frame has found reads from render functions,
+            // handles are merged into the views so compile again with them
+            if (cull && !s_transients.applied)
+            {
+                s_transients.applied = true;
+                alias_transient_targets(nodes, live, pinned);
+                compile_render_graph(cull);
+                return;
+            }
+
+            // resolve points, when not culling resolve everything so the first frame has valid reads. culled views
+            // keep all, in case they are rendered by render_view
+            for (size_t i = 0; i < num_nodes; ++i)
+            {
+                view_params& v = *nodes[i].view;
+                u32          mask = cull && live[i] ? rg_targets_mask(v, sampled) : 0xffffffff;
+
+                v.resolve_mask = (v.view_flags & e_view_flags::resolve) ? mask : 0;
+                v.mips_mask = (v.view_flags & e_view_flags::generate_mips) ? mask : 0;
+            }
+
+            // track target states over two frames, the first finds the state targets end a frame in so the second
+            // can plan transitions across the frame boundary. targets written for render functions to read become
+            // shader reads before the next pass
+            std::vector<rg_transition> states;
+            std::vector<u32>           pending;
+            for (u32 f = 0; f < 2; ++f)
+            {
+                bool emit = f == 1;
+                for (size_t i = 0; i < num_nodes; ++i)
                 {
+                    rg_node&     n = nodes[i];
+                    view_params& v = *n.view;
+
+                    rg_pass p;
+                    p.name = v.name;
+                    p.id_name = v.id_name;
+                    p.flags = n.flags;
+                    p.first_transition = sb_count(s_render_graph.transitions);
+
+                    if (live[i])
+                    {
+                        for (u32 h : pending)
+                            rg_transition_target(states, h, e_rg_state::shader_read, emit);
+
+                        pending.clear();
+
+                        for (u32 h : n.reads)
+                            rg_transition_target(states, h, e_rg_state::shader_read, emit);
+
+                        for (u32 t = 0; t < v.num_colour_targets; ++t)
+                            rg_transition_target(states, v.render_targets[t], e_rg_state::render_target, emit);
+
+                        if (is_valid_non_null(v.depth_target))
+                            rg_transition_target(states, v.depth_target, e_rg_state::depth_target, emit);
+
+                        for (u32 h : n.writes)
+                            if (rg_contains(external, h))
+                                rg_add(pending, h);
+
+                        p.resolve_mask = v.resolve_mask;
+                        p.mips_mask = v.mips_mask;
+                    }
+                    else
+                    {
+                        p.flags |= e_rg_pass_flags::culled;
+                    }
+
+                    if (!emit)
+                        continue;
+
+                    p.num_transitions = sb_count(s_render_graph.transitions) - p.first_transition;
+                    sb_push(s_render_graph.passes, p);
+                    s_render_graph_views.push_back(n.view);
+
+                    if (!live[i])
+                        s_render_graph.num_culled++;
+                }
+            }
+
+            s_render_graph.num_transient = s_transients.num_transient;
+            s_render_graph.num_aliased = s_transients.num_aliased;
+            s_render_graph.transient_bytes = s_transients.transient_bytes;
+            s_render_graph.saved_bytes = s_transients.saved_bytes;
+        }
+
+        const render_graph& get_render_graph()
+        {
+            return s_render_graph;
+        }
+
+        bool can_record_parallel(const rg_pass& p, const view_params& v)
+        {
+            if (p.flags & (e_rg_pass_flags::post_process | e_rg_pass_flags::abstract | e_rg_pass_flags::compute))
+                return false;
+
+            if (p.flags & e_rg_pass_flags::culled)
+                return true;
+
+            if (!(v.view_flags & e_view_flags::parallel) || !v.warm || v.stash_output)
+                return false;
+
+            // slice cameras are copies, they must share a cbuffer which already exists
+            return !v.camera || is_valid(v.camera->cbuffer);
+        }
+
+        void record_slices_job(u32 start, u32 end, void* user_data)
+        {
+            for (u32 t = start; t < end; ++t)
+            {
+                record_task& rt = s_parallel.tasks[t];
+
+                pen::renderer_begin_cmd_list(s_parallel.cmd_lists[t]);
+                render_view(*rt.view, rt.slice, rt.view->camera ? &rt.camera : nullptr);
+                pen::renderer_end_cmd_list();
+            }
+        }
+
+        void record_parallel(u32 first_pass, u32 end_pass)
+        {
+            std::vector<record_task>& tasks = s_parallel.tasks;
+            tasks.clear();
+
+            // cameras are moved through the slices in pass order here, as the serial path would
+            for (u32 i = first_pass; i < end_pass; ++i)
+            {
+                view_params& v = *s_render_graph_views[i];
+                if ((s_render_graph.passes[i].flags & e_rg_pass_flags::culled) || !view_renders(v))
+                    continue;
+
+                pen::viewport vp, vvp;
+                get_view_viewport(v, vp, vvp);
+
+                for (u32 a = 0; a < v.num_arrays; ++a)
+                {
+                    record_task t;
+                    t.view = &v;
+                    t.slice = a;
+
+                    if (v.camera)
+                    {
+                        set_view_camera_slice(v, a, vvp);
+                        t.camera = *v.camera;
+
+                        // consumed by camera_update_shader_constants on the copy
+                        v.camera->flags &= ~e_camera_flags::apply_jitter;
+                    }
+
+                    tasks.push_back(t);
+                }
+            }
+
+            u32 num_tasks = (u32)tasks.size();
+            while (s_parallel.cmd_lists.size() < num_tasks)
+                s_parallel.cmd_lists.push_back(pen::renderer_create_cmd_list());
+
+            pen::jobs_parallel_for(num_tasks, 1, record_slices_job, nullptr);
+
+            // submit in graph order, cameras are left as the last slice to use them updated them
+            for (u32 t = 0; t < num_tasks; ++t)
+            {
+                pen::renderer_submit_cmd_list(s_parallel.cmd_lists[t]);
+
+                if (tasks[t].view->camera)
+                    *tasks[t].view->camera = tasks[t].camera;
+            }
+
+            s_parallel.recorded += num_tasks;
+        }
+
+        void render()
+        {
+            reload();
+
+            bool compiled = s_render_graph_dirty;
+            if (s_render_graph_dirty)
+            {
+                compile_render_graph(!s_render_graph_discover);
+                s_render_graph_dirty = false;
+            }
+
+            f64 start_ms = pen::get_time_ms();
+            s_parallel.recorded = 0;
+
+            u32 num_passes = sb_count(s_render_graph.passes);
+            for (u32 i = 0; i < num_passes;)
+            {
+                // runs of independent passes, they only depend on each other through the gpu and submit in order
+                u32 end = i;
+                while (s_parallel.enabled && end < num_passes &&
+                       can_record_parallel(s_render_graph.passes[end], *s_render_graph_views[end]))
+                    ++end;
+
+                if (end > i)
+                {
+                    record_parallel(i, end);
+                    i = end;
+                    continue;
+                }
+
+                const rg_pass& p = s_render_graph.passes[i];
+                view_params&   v = *s_render_graph_views[i];
+
+                // start of a post process chain
+                if (p.flags & e_rg_pass_flags::post_process)
+                    if (i == 0 || !(s_render_graph.passes[i - 1].flags & e_rg_pass_flags::post_process))
+                        virtual_rt_reset();
+
+                ++i;
+                if (p.flags & e_rg_pass_flags::culled)
+                    continue;
+
+                if (p.flags & e_rg_pass_flags::abstract)
+                    render_abstract_view(v);
+                else
                     render_view(v);
 
-                    if (v.post_process_flags & e_pp_flags::enabled)
-                        render_post_process(v);
+                v.warm = true;
+            }
+
+            // frames which compile include first time setup, leave them out of the timings
+            if (!compiled)
+            {
+                f64  ms = pen::get_time_ms() - start_ms;
+                f64& avg = s_parallel.enabled ? s_parallel.parallel_ms : s_parallel.serial_ms;
+                avg = avg > 0.0 ? avg + (ms - avg) * 0.05 : ms;
+            }
+
+            // the first frame after a load renders every pass, so targets read by render functions are found
+            if (s_render_graph_discover)
+            {
+                s_render_graph_discover = false;
+                s_render_graph_dirty = true;
+            }
+
+            // swap in streamed texture mips and request more from the sizes reported by this frames views
+            put::update_texture_streaming();
+        }
+
+        void render_graph_ui()
+        {
+            u32 num_passes = sb_count(s_render_graph.passes);
+            ImGui::Text("Passes: %u, Culled: %u", num_passes, s_render_graph.num_culled);
+
+            // toggle to compare, both timings are kept
+            ImGui::Checkbox("Parallel Recording", &s_parallel.enabled);
+            u32 workers = pen::jobs_get_num_workers();
+            ImGui::Text("Recorded in parallel: %u slices, %u workers", s_parallel.recorded, workers);
+            ImGui::Text("Render CPU: serial %.2f ms, parallel %.2f ms", s_parallel.serial_ms, s_parallel.parallel_ms);
+            if (s_parallel.serial_ms > 0.0 && s_parallel.parallel_ms > 0.0)
+                ImGui::Text("Speedup: %.2fx", s_parallel.serial_ms / s_parallel.parallel_ms);
+
+            const render_graph& rg = s_render_graph;
+            f32                 transient_mb = (f32)rg.transient_bytes / 1024.0f / 1024.0f;
+            f32                 saved_mb = (f32)rg.saved_bytes / 1024.0f / 1024.0f;
+            ImGui::Text("Transient Targets: %u (%.2f mb)", rg.num_transient, transient_mb);
+            ImGui::Text("Aliased: %u, Saved: %.2f mb per frame", rg.num_aliased, saved_mb);
+
+            for (u32 i = 0; i < num_passes; ++i)
+            {
+                const rg_pass& p = s_render_graph.passes[i];
+                if (p.flags & e_rg_pass_flags::culled)
+                {
+                    ImGui::TextDisabled("%s (culled)", p.name.c_str());
+                    continue;
+                }
+
+                ImGui::Text("%s", p.name.c_str());
+
+                for (u32 t = 0; t < p.num_transitions; ++t)
+                {
+                    const rg_transition& rt = s_render_graph.transitions[p.first_transition + t];
+                    ImGui::Text("    %s: %s -> %s", rg_target_name(rt.handle), k_rg_state_names[rt.before],
+                                k_rg_state_names[rt.after]);
                 }
+
+                if (p.resolve_mask)
+                    ImGui::Text("    resolve: 0x%x", p.resolve_mask);
+
+                if (p.mips_mask)
+                    ImGui::Text("    generate mips: 0x%x", p.mips_mask);
             }
         }
 
@@ -3128,6 +3955,11 @@ namespace put
             }
 
             ImGui::Text("Size: %f (mb)", (f32)image_size / 1024.0f / 1024.0f);
+
+            if (rt.flags & e_rt_flags::aliased)
+                ImGui::Text("Transient, aliases an earlier target");
+            else if (rt.flags & e_rt_flags::transient)
+                ImGui::Text("Transient");
         }
 
         void view_info_ui(const view_params& v)
@@ -3137,20 +3969,20 @@ namespace put
 
             for (u32 i = 0; i < v.num_colour_targets; ++i)
             {
-                const render_target* rt = get_render_target(v.id_render_target[i]);
+                const render_target* rt = _get_render_target(v.id_render_target[i]);
                 ImGui::Text("colour target %i: %s (%i)", i, rt->name.c_str(), v.render_targets[i]);
             }
 
             if (is_valid(v.depth_target) && v.depth_target)
             {
-                const render_target* rt = get_render_target(v.id_depth_target);
+                const render_target* rt = _get_render_target(v.id_depth_target);
                 ImGui::Text("depth target: %s (%i)", rt->name.c_str(), v.depth_target);
             }
 
             int isb = 0;
             for (auto& sb : v.sampler_bindings)
             {
-                const render_target* rt = get_render_target(sb.id_texture);
+                const render_target* rt = _get_render_target(sb.id_texture);
                 ImGui::Text("input sampler %i: %s (%i)", isb, rt->name.c_str(), sb.handle);
                 ++isb;
             }
@@ -3533,6 +4365,9 @@ namespace put
 
                     render_target& rt = s_render_targets[current_render_target];
 
+                    // keep the producer of a target being viewed from being culled
+                    get_render_target(rt.id_name);
+
                     f32 w, h;
                     get_rt_dimensions(rt.width, rt.height, rt.ratio, w, h);
 
@@ -3592,6 +4427,11 @@ namespace put
                     pp_ui();
                 }
 
+                if (ImGui::CollapsingHeader("Render Graph"))
+                {
+                    render_graph_ui();
+                }
+
                 ImGui::End();
             }
         }
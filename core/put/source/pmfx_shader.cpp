@@ -2,6 +2,7 @@
 // Copyright 2014 - 2023 Alex Dixon.
 // License: https://github.com/polymonster/pmtech/blob/master/license.md
 
+#include <unordered_map>
 #include <vector>
 
 #include "dev_ui.h"
@@ -20,6 +21,7 @@
 #include "pen_json.h"
 #include "pen_string.h"
 #include "renderer.h"
+#include "threads.h"
 
 using namespace put;
 using namespace pmfx;
@@ -42,10 +44,22 @@ namespace
         pen::json       info;
         u32             info_timestamp = 0;
         shader_program* techniques = nullptr;
-        u32             rebuild_ts = 0;
+        u32*            watches = nullptr; // file watches on the info and its input files
+        bool            reload = false;
     };
 
-    pmfx_shader*  s_pmfx_list = nullptr;
+    // technique resolution without scanning, masks are shared by the permutations of a technique
+    struct technique_lookup
+    {
+        std::unordered_map<hash_id, u32> option_masks; // technique id to the permutation bits it accepts
+        std::unordered_map<u64, u32>     indices;      // (technique id, masked permutation) to technique index
+    };
+    static const u32 k_mixed_option_masks = 0xffffffff; // permutations disagree on the mask, resolve by search
+
+    pmfx_shader*                     s_pmfx_list = nullptr;
+    std::vector<technique_lookup>    s_technique_lookups; // parallel to s_pmfx_list
+    std::unordered_map<hash_id, u32> s_pmfx_lookup;       // id_filename to index in s_pmfx_list
+    bool                             s_reload_pending = false;
     const char**  s_shader_names = nullptr;
     const char*** s_technique_names = nullptr;
     hash_id**     s_technique_id_names = nullptr;
@@ -582,12 +596,23 @@ namespace put
 
         void lazy_load_shader_technique(shader_program& t, u32 shader)
         {
+            if (t.loaded.value.load(std::memory_order_acquire))
+                return;
+
+            // views may be recorded on several threads, the first to use a technique loads it
+            static pen::mutex* s_load_mutex = pen::mutex_create();
+            pen::mutex_lock(s_load_mutex);
+
             auto& s = s_pmfx_list[shader];
-            if (!t.loaded)
+            if (!t.loaded.value.load(std::memory_order_relaxed))
             {
                 t = load_shader_technique(s.filename.c_str(), t.info, s.info);
-                t.loaded = true;
+
+                // publish once every other member is written
+                t.loaded.value.store(true, std::memory_order_release);
             }
+
+            pen::mutex_unlock(s_load_mutex);
         }
 
         void initialise_constant_defaults(u32 shader, u32 technique_index, f32* data)
@@ -707,6 +732,9 @@ namespace put
 
         void set_technique(u32 shader, u32 technique_index)
         {
+            if (shader >= (u32)sb_count(s_pmfx_list))
+                return;
+
             if (technique_index >= (u32)sb_count(s_pmfx_list[shader].techniques))
                 return;
 
@@ -746,7 +774,12 @@ namespace put
             return true;
         }
 
-        u32 get_technique_index_perm(u32 shader, hash_id id_technique, u32 permutation)
+        u64 technique_key(hash_id id_technique, u32 permutation)
+        {
+            return ((u64)permutation << 32) | (u64)id_technique;
+        }
+
+        u32 find_technique_index(u32 shader, hash_id id_technique, u32 permutation)
         {
             u32 num_techniques = sb_count(s_pmfx_list[shader].techniques);
             for (u32 i = 0; i < num_techniques; ++i)
@@ -761,14 +794,66 @@ namespace put
                 if (t.permutation_id != masked_permutation)
                     continue;
 
-                lazy_load_shader_technique(t, shader);
-
                 return i;
             }
 
             return PEN_INVALID_HANDLE;
         }
 
+        void build_technique_lookup(u32 shader)
+        {
+            if (shader >= (u32)s_technique_lookups.size())
+                s_technique_lookups.resize(shader + 1);
+
+            technique_lookup& tl = s_technique_lookups[shader];
+            tl.option_masks.clear();
+            tl.indices.clear();
+
+            // first match wins, as it would when searching in order
+            u32 num_techniques = sb_count(s_pmfx_list[shader].techniques);
+            for (u32 i = 0; i < num_techniques; ++i)
+            {
+                auto& t = s_pmfx_list[shader].techniques[i];
+
+                auto mask = tl.option_masks.emplace(t.id_name, t.permutation_option_mask);
+                if (!mask.second && mask.first->second != t.permutation_option_mask)
+                    mask.first->second = k_mixed_option_masks;
+
+                tl.indices.emplace(technique_key(t.id_name, t.permutation_id), i);
+            }
+        }
+
+        u32 get_technique_index_perm(u32 shader, hash_id id_technique, u32 permutation)
+        {
+            if (shader >= (u32)s_technique_lookups.size())
+                return PEN_INVALID_HANDLE;
+
+            const technique_lookup& tl = s_technique_lookups[shader];
+
+            auto mask = tl.option_masks.find(id_technique);
+            if (mask == tl.option_masks.end())
+                return PEN_INVALID_HANDLE;
+
+            u32 index = PEN_INVALID_HANDLE;
+            if (mask->second == k_mixed_option_masks)
+            {
+                index = find_technique_index(shader, id_technique, permutation);
+            }
+            else
+            {
+                auto ti = tl.indices.find(technique_key(id_technique, permutation & mask->second));
+                if (ti != tl.indices.end())
+                    index = ti->second;
+            }
+
+            if (!is_valid(index))
+                return PEN_INVALID_HANDLE;
+
+            lazy_load_shader_technique(s_pmfx_list[shader].techniques[index], shader);
+
+            return index;
+        }
+
         Str get_pmfx_info_filename(const c8* pmfx_filename)
         {
             Str fn = "data/pmfx/";
@@ -783,6 +868,23 @@ namespace put
         {
             s_pmfx_list[shader].filename = nullptr;
 
+            auto lookup = s_pmfx_lookup.find(s_pmfx_list[shader].id_filename);
+            if (lookup != s_pmfx_lookup.end() && lookup->second == shader)
+                s_pmfx_lookup.erase(lookup);
+
+            if (shader < (u32)s_technique_lookups.size())
+            {
+                s_technique_lookups[shader].option_masks.clear();
+                s_technique_lookups[shader].indices.clear();
+            }
+
+            u32 num_watches = sb_count(s_pmfx_list[shader].watches);
+            for (u32 i = 0; i < num_watches; ++i)
+                pen::filesystem_watch_remove(s_pmfx_list[shader].watches[i]);
+
+            sb_free(s_pmfx_list[shader].watches);
+            s_pmfx_list[shader].watches = nullptr;
+
             u32 num_techniques = sb_count(s_pmfx_list[shader].techniques);
 
             for (u32 i = 0; i < num_techniques; ++i)
@@ -805,6 +907,67 @@ namespace put
             return true;
         }
 
+        void shader_input_changed(const c8* filename, void* user_data)
+        {
+            auto& pmfx_set = s_pmfx_list[(u32)(size_t)user_data];
+            if (pmfx_set.invalidated)
+                return;
+
+            // inputs older than the info file were built already
+            u32 info_ts = 0;
+            u32 input_ts = 0;
+            Str info_fn = pen::os_path_for_resource(get_pmfx_info_filename(pmfx_set.filename.c_str()).c_str());
+            if (pen::filesystem_getmtime(info_fn.c_str(), info_ts) != PEN_ERR_OK)
+                return;
+
+            if (pen::filesystem_getmtime(filename, input_ts) != PEN_ERR_OK || input_ts <= info_ts)
+                return;
+
+            Str shader_compiler_str = put::get_build_cmd();
+            shader_compiler_str.append("-pmfx");
+
+            put::trigger_hot_loader(shader_compiler_str);
+            pmfx_set.invalidated = true;
+        }
+
+        void shader_info_changed(const c8* filename, void* user_data)
+        {
+            // the info file is written once compilation is complete
+            auto& pmfx_set = s_pmfx_list[(u32)(size_t)user_data];
+            if (!pmfx_set.invalidated || !pmfx_ready(pmfx_set.filename.c_str()))
+                return;
+
+            pmfx_set.invalidated = false;
+            pmfx_set.reload = true;
+            s_reload_pending = true;
+        }
+
+        void watch_shader(u32 shader)
+        {
+            PEN_HOTLOADING_ENABLED;
+
+            auto& pmfx_set = s_pmfx_list[shader];
+            void* user_data = (void*)(size_t)shader;
+
+            Str info_fn = pen::os_path_for_resource(get_pmfx_info_filename(pmfx_set.filename.c_str()).c_str());
+            sb_push(pmfx_set.watches, pen::filesystem_watch_add(info_fn.c_str(), shader_info_changed, user_data));
+
+            pen::json files = pmfx_set.info["files"];
+            s32       num_files = files.size();
+            for (s32 i = 0; i < num_files; ++i)
+            {
+                Str fn = files[i]["name"].as_str();
+                sb_push(pmfx_set.watches, pen::filesystem_watch_add(fn.c_str(), shader_input_changed, user_data));
+            }
+        }
+
+        void register_shader(u32 shader)
+        {
+            s_pmfx_lookup.emplace(s_pmfx_list[shader].id_filename, shader);
+            build_technique_lookup(shader);
+            watch_shader(shader);
+        }
+
         pmfx_shader load_internal(const c8* filename)
         {
             // load info file for description
@@ -847,12 +1010,9 @@ namespace put
 
             u32 num_pmfx = sb_count(s_pmfx_list);
 
-            ph = 0;
-            for (u32 i = 0; i < num_pmfx; ++i)
-                if (s_pmfx_list[i].filename == pmfx_name)
-                    return ph;
-                else
-                    ph++;
+            auto existing = s_pmfx_lookup.find(PEN_HASH(pmfx_name));
+            if (existing != s_pmfx_lookup.end() && s_pmfx_list[existing->second].filename == pmfx_name)
+                return existing->second;
 
             pmfx_shader new_pmfx = load_internal(pmfx_name);
 
@@ -867,6 +1027,7 @@ namespace put
                 if (p.filename.length() == 0)
                 {
                     p = new_pmfx;
+                    register_shader(ph);
                     return ph;
                 }
 
@@ -874,6 +1035,7 @@ namespace put
             }
 
             sb_push(s_pmfx_list, new_pmfx);
+            register_shader(ph);
 
             generate_name_lists();
 
@@ -882,104 +1044,41 @@ namespace put
 
         u32 get_shader_handle(hash_id id_filename)
         {
-            u32 num_pmfx = sb_count(s_pmfx_list);
-
-            u32 ph = 0;
-            // for (auto& p : s_pmfx_list)
-            for (u32 i = 0; i < num_pmfx; ++i)
-                if (s_pmfx_list[i].id_filename == id_filename)
-                    return ph;
-                else
-                    ph++;
+            auto existing = s_pmfx_lookup.find(id_filename);
+            if (existing == s_pmfx_lookup.end())
+                return PEN_INVALID_HANDLE;
 
-            return PEN_INVALID_HANDLE;
+            return existing->second;
         }
 
         void poll_for_changes()
         {
             PEN_HOTLOADING_ENABLED;
 
-            Str shader_compiler_str = put::get_build_cmd();
-            shader_compiler_str.append("-pmfx");
+            // callbacks invalidate shaders whose inputs change and flag them for reload once compiled
+            pen::filesystem_watch_dispatch();
 
-            u32 current_counter = 0;
+            if (!s_reload_pending)
+                return;
 
-            u32  num_pmfx = sb_count(s_pmfx_list);
-            u32* reload_list = nullptr;
+            s_reload_pending = false;
 
+            u32 num_pmfx = sb_count(s_pmfx_list);
             for (u32 i = 0; i < num_pmfx; ++i)
             {
                 auto& pmfx_set = s_pmfx_list[i];
+                if (!pmfx_set.reload)
+                    continue;
 
-                if (pmfx_set.invalidated)
-                {
-                    Str fn = pen::os_path_for_resource(get_pmfx_info_filename(pmfx_set.filename.c_str()).c_str());
-
-                    u32       current_ts;
-                    pen_error err = pen::filesystem_getmtime(fn.c_str(), current_ts);
-
-                    // wait until info is newer than the current info file,
-                    // to know compilation is completed.
-                    if (err == PEN_ERR_OK && current_ts > pmfx_set.rebuild_ts)
-                    {
-                        bool complete = pmfx_ready(pmfx_set.filename.c_str());
-                        if (complete)
-                        {
-                            sb_push(reload_list, i);
-                            pmfx_set.invalidated = false;
-                        }
-                    }
-                }
-                else
-                {
-                    pen::json files = pmfx_set.info["files"];
-
-                    s32 num_files = files.size();
-                    for (s32 i = 0; i < num_files; ++i)
-                    {
-                        pen::json file = files[i];
-                        Str       fn = file["name"].as_str();
-
-                        u32 dep_ts = 0;
-                        Str fn2 = pen::os_path_for_resource(get_pmfx_info_filename(pmfx_set.filename.c_str()).c_str());
-
-                        if (pen::filesystem_getmtime(fn2.c_str(), dep_ts) == PEN_ERR_OK)
-                        {
-                            u32 input_ts = 0;
-                            if (pen::filesystem_getmtime(fn.c_str(), input_ts) == PEN_ERR_OK)
-                            {
-                                if (input_ts > dep_ts)
-                                {
-                                    put::trigger_hot_loader(shader_compiler_str);
-                                    pmfx_set.invalidated = true;
-                                    pmfx_set.rebuild_ts = dep_ts;
-                                }
-                            }
-                        }
-                    }
-                }
-
-                current_counter++;
+                pmfx_shader pmfx_new = load_internal(pmfx_set.filename.c_str());
+                release_shader(i);
+                pmfx_set = pmfx_new;
+                register_shader(i);
             }
 
-            u32 num_reload = sb_count(reload_list);
-            if (num_reload)
-            {
-                // load modified
-                for (u32 i = 0; i < num_reload; ++i)
-                {
-                    auto&       pmfx_set = s_pmfx_list[reload_list[i]];
-                    pmfx_shader pmfx_new = load_internal(pmfx_set.filename.c_str());
-                    release_shader(current_counter);
-                    pmfx_set = pmfx_new;
-                }
-
-                // fixup resources / references
-                ecs::bake_material_handles();
-                generate_name_lists();
-
-                sb_free(reload_list);
-            }
+            // fixup resources / references
+            ecs::bake_material_handles();
+            generate_name_lists();
         }
 
         bool has_technique_permutations(u32 shader, u32 technique_index)
@@ -0,0 +1,630 @@
+// sdf_generator.cpp
+// Copyright 2014 - 2023 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+#include "sdf_generator.h"
+
+#include "threads.h"
+
+#include <algorithm>
+#include <math.h>
+#include <vector>
+
+namespace put
+{
+    namespace
+    {
+        static const u32 k_leaf_triangles = 4;
+        static const u32 k_brick_size = 8; // cells per side of the bricks the band is found in
+        static const s32 k_no_seed = -1;
+
+        struct sdf_triangle
+        {
+            vec3f v0;
+            vec3f v1;
+            vec3f v2;
+        };
+
+        struct sdf_bvh_node
+        {
+            vec3f min;
+            vec3f max;
+            u32   first; // children first and first + 1 for inner nodes, first triangle for leaves
+            u32   count; // 0 for inner nodes
+        };
+
+        struct sdf_seed
+        {
+            vec3f closest;
+            u32   triangle;
+        };
+
+        struct sdf_context
+        {
+            const sdf_params*         params;
+            f32*                      phi;
+            std::vector<sdf_triangle> triangles; // in bvh leaf order
+            std::vector<sdf_bvh_node> nodes;
+            std::vector<sdf_seed>     seeds;
+            std::vector<u32>          slice_seeds; // first seed of each slice, then the total
+            s32*                      grid[2];     // triangle per band cell, then seed per cell ping ponged by flooding
+            u32                       src;
+            s32                       step;
+            u32                       bricks[3];
+
+            std::vector<std::vector<u32>> scratch; // per thread
+        };
+
+        bool cancelled(const sdf_context& ctx)
+        {
+            return ctx.params->cancel && *ctx.params->cancel;
+        }
+
+        void add_progress(const sdf_context& ctx, u32 amount)
+        {
+            if (ctx.params->progress)
+                ctx.params->progress->completed += amount;
+        }
+
+        u32 cell_index(const sdf_params& p, u32 i, u32 j, u32 k)
+        {
+            return (k * p.nj + j) * p.ni + i;
+        }
+
+        vec3f cell_pos(const sdf_params& p, u32 i, u32 j, u32 k)
+        {
+            return p.origin + vec3f((f32)i, (f32)j, (f32)k) * p.dx;
+        }
+
+        vec3f closest_point_on_triangle(const vec3f& p, const sdf_triangle& t)
+        {
+            // voronoi regions of the vertices, edges and face
+            vec3f ab = t.v1 - t.v0;
+            vec3f ac = t.v2 - t.v0;
+            vec3f ap = p - t.v0;
+
+            f32 d1 = dot(ab, ap);
+            f32 d2 = dot(ac, ap);
+            if (d1 <= 0.0f && d2 <= 0.0f)
+                return t.v0;
+
+            vec3f bp = p - t.v1;
+            f32   d3 = dot(ab, bp);
+            f32   d4 = dot(ac, bp);
+            if (d3 >= 0.0f && d4 <= d3)
+                return t.v1;
+
+            f32 vc = d1 * d4 - d3 * d2;
+            if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+                return t.v0 + ab * (d1 / (d1 - d3));
+
+            vec3f cp = p - t.v2;
+            f32   d5 = dot(ab, cp);
+            f32   d6 = dot(ac, cp);
+            if (d6 >= 0.0f && d5 <= d6)
+                return t.v2;
+
+            f32 vb = d5 * d2 - d1 * d6;
+            if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+                return t.v0 + ac * (d2 / (d2 - d6));
+
+            f32 va = d3 * d6 - d5 * d4;
+            if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+                return t.v1 + (t.v2 - t.v1) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+            f32 denom = va + vb + vc;
+            if (fabsf(denom) < 1e-30f)
+                return t.v0; // degenerate
+
+            f32 inv = 1.0f / denom;
+            return t.v0 + ab * (vb * inv) + ac * (vc * inv);
+        }
+
+        bool aabb_overlap(const vec3f& amin, const vec3f& amax, const vec3f& bmin, const vec3f& bmax)
+        {
+            return amin.x <= bmax.x && amax.x >= bmin.x && amin.y <= bmax.y && amax.y >= bmin.y && amin.z <= bmax.z &&
+                   amax.z >= bmin.z;
+        }
+
+        //
+        // bvh
+        //
+
+        void build_bvh(sdf_context& ctx)
+        {
+            // median split on the longest axis of the centroids, leaves hold up to k_leaf_triangles
+            const sdf_params& p = *ctx.params;
+
+            std::vector<sdf_triangle> tris(p.num_triangles);
+            std::vector<vec3f>        centroids(p.num_triangles);
+            std::vector<u32>          order(p.num_triangles);
+            for (u32 t = 0; t < p.num_triangles; ++t)
+            {
+                tris[t] = {p.vertices[p.indices[t * 3 + 0]], p.vertices[p.indices[t * 3 + 1]],
+                           p.vertices[p.indices[t * 3 + 2]]};
+                centroids[t] = (tris[t].v0 + tris[t].v1 + tris[t].v2) / 3.0f;
+                order[t] = t;
+            }
+
+            struct build_item
+            {
+                u32 node;
+                u32 start;
+                u32 end;
+            };
+
+            ctx.nodes.reserve(p.num_triangles / k_leaf_triangles * 2 + 1);
+            ctx.nodes.push_back(sdf_bvh_node());
+
+            std::vector<build_item> stack;
+            stack.push_back({0, 0, p.num_triangles});
+            while (!stack.empty())
+            {
+                build_item item = stack.back();
+                stack.pop_back();
+
+                vec3f bmin = vec3f(FLT_MAX), bmax = vec3f(-FLT_MAX);
+                vec3f cmin = vec3f(FLT_MAX), cmax = vec3f(-FLT_MAX);
+                for (u32 i = item.start; i < item.end; ++i)
+                {
+                    const sdf_triangle& t = tris[order[i]];
+                    bmin = min_union(bmin, min_union(t.v0, min_union(t.v1, t.v2)));
+                    bmax = max_union(bmax, max_union(t.v0, max_union(t.v1, t.v2)));
+                    cmin = min_union(cmin, centroids[order[i]]);
+                    cmax = max_union(cmax, centroids[order[i]]);
+                }
+
+                sdf_bvh_node& node = ctx.nodes[item.node];
+                node.min = bmin;
+                node.max = bmax;
+
+                u32 count = item.end - item.start;
+                if (count <= k_leaf_triangles)
+                {
+                    node.first = item.start;
+                    node.count = count;
+                    continue;
+                }
+
+                vec3f extent = cmax - cmin;
+                u32   axis = 0;
+                if (extent.y > extent.x)
+                    axis = 1;
+                if (extent.z > extent[axis])
+                    axis = 2;
+
+                u32 mid = item.start + count / 2;
+                std::nth_element(order.begin() + item.start, order.begin() + mid, order.begin() + item.end,
+                                 [&](u32 a, u32 b) { return centroids[a][axis] < centroids[b][axis]; });
+
+                u32 left = (u32)ctx.nodes.size();
+                node.first = left;
+                node.count = 0;
+
+                // node is invalidated by the push
+                ctx.nodes.push_back(sdf_bvh_node());
+                ctx.nodes.push_back(sdf_bvh_node());
+
+                stack.push_back({left, item.start, mid});
+                stack.push_back({left + 1, mid, item.end});
+            }
+
+            ctx.triangles.resize(p.num_triangles);
+            for (u32 i = 0; i < p.num_triangles; ++i)
+                ctx.triangles[i] = tris[order[i]];
+        }
+
+        void gather_triangles(const sdf_context& ctx, const vec3f& qmin, const vec3f& qmax, std::vector<u32>& out)
+        {
+            // all triangles with bounds overlapping the query box
+            out.clear();
+
+            u32 stack[64];
+            u32 sp = 0;
+            stack[sp++] = 0;
+            while (sp)
+            {
+                const sdf_bvh_node& node = ctx.nodes[stack[--sp]];
+                if (!aabb_overlap(node.min, node.max, qmin, qmax))
+                    continue;
+
+                if (node.count == 0)
+                {
+                    stack[sp++] = node.first;
+                    stack[sp++] = node.first + 1;
+                    continue;
+                }
+
+                for (u32 t = node.first; t < node.first + node.count; ++t)
+                {
+                    const sdf_triangle& tri = ctx.triangles[t];
+                    vec3f               tmin = min_union(tri.v0, min_union(tri.v1, tri.v2));
+                    vec3f               tmax = max_union(tri.v0, max_union(tri.v1, tri.v2));
+                    if (aabb_overlap(tmin, tmax, qmin, qmax))
+                        out.push_back(t);
+                }
+            }
+        }
+
+        //
+        // passes
+        //
+
+        void find_band(u32 start, u32 end, void* user_data)
+        {
+            // cells within the band get their closest triangle, bricks with no triangles nearby are skipped quickly
+            sdf_context&      ctx = *(sdf_context*)user_data;
+            const sdf_params& p = *ctx.params;
+            std::vector<u32>& tris = ctx.scratch[pen::jobs_get_thread_index()];
+
+            f32 band = (f32)p.exact_band * p.dx * 1.7320508f;
+            f32 band2 = band * band;
+
+            for (u32 b = start; b < end; ++b)
+            {
+                if (cancelled(ctx))
+                    return;
+
+                u32 bi = b % ctx.bricks[0];
+                u32 bj = (b / ctx.bricks[0]) % ctx.bricks[1];
+                u32 bk = b / (ctx.bricks[0] * ctx.bricks[1]);
+
+                u32 i0 = bi * k_brick_size, i1 = std::min(i0 + k_brick_size, p.ni);
+                u32 j0 = bj * k_brick_size, j1 = std::min(j0 + k_brick_size, p.nj);
+                u32 k0 = bk * k_brick_size, k1 = std::min(k0 + k_brick_size, p.nk);
+
+                vec3f qmin = cell_pos(p, i0, j0, k0) - vec3f(band);
+                vec3f qmax = cell_pos(p, i1 - 1, j1 - 1, k1 - 1) + vec3f(band);
+                gather_triangles(ctx, qmin, qmax, tris);
+
+                for (u32 k = k0; k < k1; ++k)
+                {
+                    for (u32 j = j0; j < j1; ++j)
+                    {
+                        for (u32 i = i0; i < i1; ++i)
+                        {
+                            vec3f pos = cell_pos(p, i, j, k);
+                            f32   best = band2;
+                            s32   best_tri = k_no_seed;
+                            for (u32 t : tris)
+                            {
+                                f32 d2 = mag2(pos - closest_point_on_triangle(pos, ctx.triangles[t]));
+                                if (d2 <= best)
+                                {
+                                    best = d2;
+                                    best_tri = (s32)t;
+                                }
+                            }
+
+                            ctx.grid[0][cell_index(p, i, j, k)] = best_tri;
+                        }
+                    }
+                }
+            }
+
+            add_progress(ctx, end - start);
+        }
+
+        void count_seeds(u32 start, u32 end, void* user_data)
+        {
+            sdf_context&      ctx = *(sdf_context*)user_data;
+            const sdf_params& p = *ctx.params;
+
+            u32 slice = p.ni * p.nj;
+            for (u32 k = start; k < end; ++k)
+            {
+                const s32* cells = ctx.grid[0] + k * slice;
+
+                u32 count = 0;
+                for (u32 c = 0; c < slice; ++c)
+                    if (cells[c] != k_no_seed)
+                        count++;
+
+                ctx.slice_seeds[k + 1] = count;
+            }
+        }
+
+        void write_seeds(u32 start, u32 end, void* user_data)
+        {
+            // seeds are written in cell order at each slice's offset so the output does not depend on scheduling
+            sdf_context&      ctx = *(sdf_context*)user_data;
+            const sdf_params& p = *ctx.params;
+
+            for (u32 k = start; k < end; ++k)
+            {
+                u32 seed = ctx.slice_seeds[k];
+                for (u32 j = 0; j < p.nj; ++j)
+                {
+                    for (u32 i = 0; i < p.ni; ++i)
+                    {
+                        u32 c = cell_index(p, i, j, k);
+                        s32 t = ctx.grid[0][c];
+                        if (t == k_no_seed)
+                        {
+                            ctx.grid[1][c] = k_no_seed;
+                            continue;
+                        }
+
+                        vec3f pos = cell_pos(p, i, j, k);
+                        ctx.seeds[seed] = {closest_point_on_triangle(pos, ctx.triangles[t]), (u32)t};
+                        ctx.grid[1][c] = (s32)seed++;
+                    }
+                }
+            }
+        }
+
+        void flood_step(u32 start, u32 end, void* user_data)
+        {
+            // each cell takes the closest seed of its own and the 26 cells step away
+            sdf_context&      ctx = *(sdf_context*)user_data;
+            const sdf_params& p = *ctx.params;
+            const s32*        src = ctx.grid[ctx.src];
+            s32*              dst = ctx.grid[ctx.src ^ 1];
+            s32               step = ctx.step;
+
+            if (cancelled(ctx))
+                return;
+
+            for (u32 k = start; k < end; ++k)
+            {
+                for (u32 j = 0; j < p.nj; ++j)
+                {
+                    for (u32 i = 0; i < p.ni; ++i)
+                    {
+                        vec3f pos = cell_pos(p, i, j, k);
+                        u32   c = cell_index(p, i, j, k);
+                        s32   best = src[c];
+                        f32   best_d2 = best != k_no_seed ? mag2(pos - ctx.seeds[best].closest) : FLT_MAX;
+
+                        for (s32 dk = -step; dk <= step; dk += step)
+                        {
+                            s32 nk = (s32)k + dk;
+                            if (nk < 0 || nk >= (s32)p.nk)
+                                continue;
+
+                            for (s32 dj = -step; dj <= step; dj += step)
+                            {
+                                s32 nj = (s32)j + dj;
+                                if (nj < 0 || nj >= (s32)p.nj)
+                                    continue;
+
+                                for (s32 di = -step; di <= step; di += step)
+                                {
+                                    s32 ni = (s32)i + di;
+                                    if (ni < 0 || ni >= (s32)p.ni)
+                                        continue;
+
+                                    s32 s = src[cell_index(p, ni, nj, nk)];
+                                    if (s == k_no_seed || s == best)
+                                        continue;
+
+                                    f32 d2 = mag2(pos - ctx.seeds[s].closest);
+                                    if (d2 < best_d2 || (d2 == best_d2 && s < best))
+                                    {
+                                        best_d2 = d2;
+                                        best = s;
+                                    }
+                                }
+                            }
+                        }
+
+                        dst[c] = best;
+                    }
+                }
+            }
+
+            add_progress(ctx, end - start);
+        }
+
+        // twice the signed area of (0, 0), (x1, y1), (x2, y2) with simulation of simplicity for exact zeros,
+        // so rays through shared edges and vertices count one crossing
+        s32 orientation(f64 x1, f64 y1, f64 x2, f64 y2, f64& twice_signed_area)
+        {
+            twice_signed_area = y1 * x2 - x1 * y2;
+            if (twice_signed_area > 0)
+                return 1;
+            else if (twice_signed_area < 0)
+                return -1;
+            else if (y2 > y1)
+                return 1;
+            else if (y2 < y1)
+                return -1;
+            else if (x1 > x2)
+                return 1;
+            else if (x1 < x2)
+                return -1;
+
+            return 0;
+        }
+
+        bool point_in_triangle_2d(f64 x0, f64 y0, f64 x1, f64 y1, f64 x2, f64 y2, f64 x3, f64 y3, f64& a, f64& b,
+                                  f64& c)
+        {
+            x1 -= x0;
+            x2 -= x0;
+            x3 -= x0;
+            y1 -= y0;
+            y2 -= y0;
+            y3 -= y0;
+
+            s32 sign_a = orientation(x2, y2, x3, y3, a);
+            if (sign_a == 0)
+                return false;
+
+            if (orientation(x3, y3, x1, y1, b) != sign_a)
+                return false;
+
+            if (orientation(x1, y1, x2, y2, c) != sign_a)
+                return false;
+
+            f64 sum = a + b + c;
+            a /= sum;
+            b /= sum;
+            c /= sum;
+            return true;
+        }
+
+        void resolve(u32 start, u32 end, void* user_data)
+        {
+            // distance to the triangle of each cell's seed, then the sign from the parity of crossings along +x
+            sdf_context&      ctx = *(sdf_context*)user_data;
+            const sdf_params& p = *ctx.params;
+            const s32*        seeds = ctx.grid[ctx.src];
+            std::vector<u32>& tris = ctx.scratch[pen::jobs_get_thread_index()];
+
+            f32 far_distance = (f32)(p.ni + p.nj + p.nk) * p.dx;
+
+            std::vector<s32> crossings;
+            for (u32 k = start; k < end; ++k)
+            {
+                if (cancelled(ctx))
+                    return;
+
+                for (u32 j = 0; j < p.nj; ++j)
+                {
+                    f32* row = ctx.phi + cell_index(p, 0, j, k);
+                    for (u32 i = 0; i < p.ni; ++i)
+                    {
+                        s32 s = seeds[cell_index(p, i, j, k)];
+                        if (s == k_no_seed)
+                        {
+                            row[i] = far_distance;
+                            continue;
+                        }
+
+                        vec3f pos = cell_pos(p, i, j, k);
+                        const sdf_triangle& tri = ctx.triangles[ctx.seeds[s].triangle];
+                        row[i] = sqrtf(mag2(pos - closest_point_on_triangle(pos, tri)));
+                    }
+
+                    // crossings in (i - 1, i] are counted at i, everything before the grid at 0
+                    vec3f rmin = vec3f(-FLT_MAX, cell_pos(p, 0, j, k).y, cell_pos(p, 0, j, k).z);
+                    vec3f rmax = vec3f(FLT_MAX, rmin.y, rmin.z);
+                    gather_triangles(ctx, rmin, rmax, tris);
+
+                    crossings.clear();
+                    for (u32 t : tris)
+                    {
+                        const sdf_triangle& tri = ctx.triangles[t];
+
+                        f64 fi[3], fj[3], fk[3];
+                        const vec3f* v[3] = {&tri.v0, &tri.v1, &tri.v2};
+                        for (u32 n = 0; n < 3; ++n)
+                        {
+                            fi[n] = ((f64)v[n]->x - p.origin.x) / p.dx;
+                            fj[n] = ((f64)v[n]->y - p.origin.y) / p.dx;
+                            fk[n] = ((f64)v[n]->z - p.origin.z) / p.dx;
+                        }
+
+                        f64 a, b, c;
+                        if (!point_in_triangle_2d(j, k, fj[0], fk[0], fj[1], fk[1], fj[2], fk[2], a, b, c))
+                            continue;
+
+                        s32 interval = (s32)ceil(a * fi[0] + b * fi[1] + c * fi[2]);
+                        if (interval < (s32)p.ni)
+                            crossings.push_back(std::max(interval, 0));
+                    }
+
+                    std::sort(crossings.begin(), crossings.end());
+
+                    u32 count = 0;
+                    u32 next = 0;
+                    for (u32 i = 0; i < p.ni; ++i)
+                    {
+                        while (next < crossings.size() && crossings[next] <= (s32)i)
+                        {
+                            ++count;
+                            ++next;
+                        }
+
+                        if (count & 1)
+                            row[i] = -row[i];
+                    }
+                }
+            }
+
+            add_progress(ctx, end - start);
+        }
+    } // namespace
+
+    f32 get_sdf_progress(const sdf_progress& progress)
+    {
+        u32 total = progress.total;
+        return total ? std::min((f32)progress.completed / (f32)total, 1.0f) : 0.0f;
+    }
+
+    bool generate_sdf(const sdf_params& params, f32* phi)
+    {
+        const sdf_params& p = params;
+        u32               num_cells = p.ni * p.nj * p.nk;
+        if (num_cells == 0)
+            return true;
+
+        sdf_context ctx;
+        ctx.params = &params;
+        ctx.phi = phi;
+        ctx.scratch.resize(pen::jobs_get_num_workers() + 1);
+
+        ctx.bricks[0] = (p.ni + k_brick_size - 1) / k_brick_size;
+        ctx.bricks[1] = (p.nj + k_brick_size - 1) / k_brick_size;
+        ctx.bricks[2] = (p.nk + k_brick_size - 1) / k_brick_size;
+
+        u32 num_bricks = ctx.bricks[0] * ctx.bricks[1] * ctx.bricks[2];
+
+        // flooding halves the step from half the largest dimension down to 1, then repeats 1 to fix up the stragglers
+        u32 num_steps = 1;
+        for (u32 s = std::max(p.ni, std::max(p.nj, p.nk)) / 2; s >= 1; s /= 2)
+            num_steps++;
+
+        if (p.progress)
+        {
+            p.progress->completed = 0;
+            p.progress->total = num_bricks + p.nk * (num_steps + 1);
+        }
+
+        if (p.num_triangles == 0)
+        {
+            f32 far_distance = (f32)(p.ni + p.nj + p.nk) * p.dx;
+            std::fill(phi, phi + num_cells, far_distance);
+            return true;
+        }
+
+        build_bvh(ctx);
+
+        std::vector<s32> grid(num_cells * 2);
+        ctx.grid[0] = grid.data();
+        ctx.grid[1] = grid.data() + num_cells;
+
+        pen::jobs_parallel_for(num_bricks, 1, find_band, &ctx);
+        if (cancelled(ctx))
+            return false;
+
+        // compact the band into seeds, counted per slice then offset by a prefix sum
+        ctx.slice_seeds.resize(p.nk + 1);
+        pen::jobs_parallel_for(p.nk, 1, count_seeds, &ctx);
+
+        ctx.slice_seeds[0] = 0;
+        for (u32 k = 0; k < p.nk; ++k)
+            ctx.slice_seeds[k + 1] += ctx.slice_seeds[k];
+
+        ctx.seeds.resize(ctx.slice_seeds[p.nk]);
+        pen::jobs_parallel_for(p.nk, 1, write_seeds, &ctx);
+
+        ctx.src = 1;
+        for (u32 s = 0; s < num_steps; ++s)
+        {
+            u32 half = std::max(p.ni, std::max(p.nj, p.nk)) >> (s + 1);
+            ctx.step = (s32)std::max<u32>(half, 1);
+
+            pen::jobs_parallel_for(p.nk, 1, flood_step, &ctx);
+            if (cancelled(ctx))
+                return false;
+
+            ctx.src ^= 1;
+        }
+
+        pen::jobs_parallel_for(p.nk, 1, resolve, &ctx);
+
+        return !cancelled(ctx);
+    }
+} // namespace put
@@ -0,0 +1,46 @@
+// sdf_generator.h
+// Copyright 2014 - 2023 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Signed distance fields from triangle meshes. Triangles are sorted into a bvh, cells within exact_band cells of the
+// surface find their closest triangle exactly, then the closest surface points are jump flooded out across the rest
+// of the grid and each cell is measured against the triangle it was given. Signs come from counting crossings of a ray
+// along +x through each row of cells, so meshes need to be closed for signs to be valid. Every pass is split across
+// the job worker pool and checks for cancellation between chunks of work.
+
+#pragma once
+
+#include "types.h"
+
+#include "maths/vec.h"
+
+#include <atomic>
+
+namespace put
+{
+    struct sdf_progress
+    {
+        a_u32 completed = {0};
+        a_u32 total = {0};
+    };
+
+    struct sdf_params
+    {
+        const vec3f*             vertices = nullptr;
+        const u32*               indices = nullptr; // 3 per triangle
+        u32                      num_triangles = 0;
+        vec3f                    origin;            // position of cell (0, 0, 0)
+        f32                      dx = 1.0f;         // cell size
+        u32                      ni = 0;
+        u32                      nj = 0;
+        u32                      nk = 0;
+        u32                      exact_band = 1;    // cells from the surface that are always exact
+        const std::atomic<bool>* cancel = nullptr;  // optional, polled from the workers
+        sdf_progress*            progress = nullptr; // optional
+    };
+
+    // writes ni * nj * nk distances to phi with x changing fastest, negative inside.
+    // returns false when cancelled, phi is then incomplete.
+    bool generate_sdf(const sdf_params& params, f32* phi);
+    f32  get_sdf_progress(const sdf_progress& progress); // 0 - 1
+} // namespace put
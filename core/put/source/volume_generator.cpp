@@ -11,9 +11,12 @@
 #include "ecs/ecs_resources.h"
 #include "ecs/ecs_scene.h"
 #include "ecs/ecs_utilities.h"
+#include "mip_generator.h"
 #include "pmfx.h"
+#include "sdf_generator.h"
 #include "str_utilities.h"
 #include "timer.h"
+#include "voxeliser.h"
 
 #include "console.h"
 #include "data_struct.h"
@@ -21,28 +24,11 @@
 #include "memory.h"
 #include "pen.h"
 
-#include "sdf_gen/makelevelset3.h"
-
-#define PEN_SIMD 0
-#if PEN_SIMD
-#include <emmintrin.h>
-#include <tmmintrin.h>
-#include <xmmintrin.h>
-#endif
-
 #include <fstream>
 
-u8 temp[16];
-#define SIMD_PRINT_u8(V)                                                                                                     \
-    memcpy(temp, &V, 16);                                                                                                    \
-    for (u32 i = 0; i < 16; ++i)                                                                                             \
-        printf("%i ", (u32)temp[i]);                                                                                         \
-    printf("\n");
-
-// Progress / Cancellation
-extern mls_progress g_mls_progress;
-std::atomic<bool>   g_cancel_volume_job;
-std::atomic<bool>   g_cancel_handled;
+// Cancellation
+std::atomic<bool> g_cancel_volume_job;
+std::atomic<bool> g_cancel_handled;
 
 namespace put
 {
@@ -102,6 +88,7 @@ namespace put
             s32  volume_type = VOLUME_RASTERISED_TEXELS;
             s32  capture_data = 0;
             bool generate_mips = true;
+            bool cpu_voxelise = false;     // conservative voxelise scene triangles on the cpu instead of rasterising
         };
 
         struct generated_volume
@@ -116,6 +103,7 @@ namespace put
         struct vgt_rasteriser_job
         {
             vgt_options options;
+            ecs_scene*  scene;
             void**      volume_slices[k_num_axes] = {0};
             s32         current_slice = 0;
             s32         current_requested_slice = -1;
@@ -124,6 +112,7 @@ namespace put
             extents     visible_extents;
             extents     current_slice_aabb;
             bool        rasterise_in_progress = false;
+            bool        cpu_job = false; // raster_voxelise_cpu was started and update waits on it
             a_u32       combine_in_progress;
             a_u32       combine_position;
             u32         block_size;
@@ -156,7 +145,8 @@ namespace put
             s32         capture_type = 0;
             u32         generated_volume_index;
         };
-        static vgt_sdf_job s_sdf_job;
+        static vgt_sdf_job  s_sdf_job;
+        static sdf_progress s_sdf_progress;
 
         static put::camera       s_volume_raster_ortho;
         static generated_volume* s_generated_volumes;
@@ -272,81 +262,93 @@ namespace put
             current_slice++;
         }
 
-        void* raster_voxel_combine(void* params)
+        struct scene_triangles
         {
-            pen::job_thread_params* job_params = (pen::job_thread_params*)params;
-            vgt_rasteriser_job*     rasteriser_job = (vgt_rasteriser_job*)job_params->user_data;
-            pen::job*               p_thread_info = job_params->job_info;
-            pen::semaphore_post(p_thread_info->p_sem_continue, 1);
-
-            u32&    volume_dim = rasteriser_job->dimension;
-            void*** volume_slices = rasteriser_job->volume_slices;
-
-            // create a simple 3d texture
-            rasteriser_job->block_size = 4;
-            rasteriser_job->data_size = volume_dim * volume_dim * volume_dim * rasteriser_job->block_size;
-
-            u8* volume_data = (u8*)pen::memory_alloc(rasteriser_job->data_size);
-            u32 row_pitch = volume_dim * rasteriser_job->block_size;
-            u32 slice_pitch = volume_dim * row_pitch;
+            std::vector<vec3f> vertices;
+            std::vector<u32>   indices; // 3 per triangle
+            std::vector<vec4f> colours; // m_albedo of the triangles material, white when it has none
+            extents            bounds = {vec3f(FLT_MAX), vec3f(-FLT_MAX)};
+        };
 
-            rasteriser_job->combine_position = 0;
+        void gather_scene_triangles(ecs_scene* scene, s32 capture_type, scene_triangles& st)
+        {
+            static hash_id id_albedo = PEN_HASH("m_albedo");
 
-            for (u32 z = 0; z < volume_dim; ++z)
+            for (u32 n = 0; n < scene->soa_size; ++n)
             {
-                if (g_cancel_volume_job)
-                    break;
+                if (!(scene->entities[n] & e_cmp::geometry))
+                    continue;
 
-                u8* slice_mem[6] = {0};
-                for (u32 a = 0; a < 6; ++a)
+                if (capture_type == CAPTURE_SELECTED)
                 {
-                    slice_mem[a] = (u8*)volume_slices[a][z];
-                }
+                    if (!(scene->state_flags[n] & e_state::selected) &&
+                        !(scene->state_flags[n] & e_state::child_selected))
+                        continue;
 
-                for (u32 y = 0; y < volume_dim; ++y)
+                    st.bounds.min = min_union(st.bounds.min, scene->bounding_volumes[n].transformed_min_extents);
+                    st.bounds.max = max_union(st.bounds.max, scene->bounding_volumes[n].transformed_max_extents);
+                }
+                else
                 {
-                    for (u32 x = 0; x < volume_dim; ++x)
-                    {
-                        rasteriser_job->combine_position++;
+                    st.bounds = scene->renderable_extents;
+                }
 
-                        u32 offset = z * slice_pitch + y * row_pitch + x * rasteriser_job->block_size;
+                geometry_resource* gr = get_geometry_resource(scene->id_geometry[n]);
+                pmm_renderable&    r = gr->renderable[e_pmm_renderable::position_only];
 
-                        u8 rgba[4] = {0};
+                vec4f* vertex_positions = (vec4f*)r.cpu_vertex_buffer;
 
-                        for (u32 a = 0; a < 6; ++a)
-                        {
-                            u8* tex = get_texel(a, x, y, z);
+                if (!r.cpu_index_buffer || !vertex_positions)
+                {
+                    dev_console_log_level(dev_ui::console_level::error,
+                                          "[error] mesh %s does not have cpu vertex / triangle data",
+                                          scene->names[n].c_str());
 
-                            if (!tex)
-                                continue;
+                    continue;
+                }
 
-                            if (tex[3] > 8)
-                                for (u32 p = 0; p < 4; ++p)
-                                    rgba[p] = tex[p];
-                        }
+                vec4f albedo = vec4f::one();
+                if (scene->entities[n] & e_cmp::material)
+                {
+                    cmp_material&             mat = scene->materials[n];
+                    pmfx::technique_constant* tc =
+                        pmfx::get_technique_constant(id_albedo, mat.shader, mat.technique_index);
+                    if (tc)
+                        memcpy(albedo.v, &scene->material_data[n].data[tc->cb_offset], sizeof(vec4f));
+                }
 
-                        volume_data[offset + 0] = rgba[2];
-                        volume_data[offset + 1] = rgba[1];
-                        volume_data[offset + 2] = rgba[0];
-                        volume_data[offset + 3] = rgba[3];
-                    }
+                u32 index_offset = st.vertices.size();
+                for (u32 i = 0; i < r.num_vertices; ++i)
+                {
+                    vec3f tv = scene->world_matrices[n].transform_vector((vec3f)vertex_positions[i].xyz);
+                    st.vertices.push_back(tv);
                 }
-            }
 
-            if (g_cancel_volume_job)
-            {
-                pen::memory_free(volume_data);
-                g_cancel_handled = true;
+                for (u32 i = 0; i < r.num_indices; i += 3)
+                {
+                    if (r.index_type == PEN_FORMAT_R32_UINT)
+                    {
+                        u32* indices = (u32*)r.cpu_index_buffer;
+                        for (u32 v = 0; v < 3; ++v)
+                            st.indices.push_back(index_offset + indices[i + v]);
+                    }
+                    else
+                    {
+                        u16* indices = (u16*)r.cpu_index_buffer;
+                        for (u32 v = 0; v < 3; ++v)
+                            st.indices.push_back(index_offset + (u32)indices[i + v]);
+                    }
 
-                pen::semaphore_post(p_thread_info->p_sem_continue, 1);
-                pen::semaphore_post(p_thread_info->p_sem_terminated, 1);
-                return PEN_THREAD_OK;
+                    st.colours.push_back(albedo);
+                }
             }
+        }
 
-            // with the 3d texture now initialised, dilate colour edges so we can use bilinear
-            u32 bs = rasteriser_job->block_size;
-            u32 rp = row_pitch;
-            u32 sp = slice_pitch;
+        void dilate_volume(u8* volume_data, u32 volume_dim)
+        {
+            u32 bs = 4;
+            u32 rp = volume_dim * bs;
+            u32 sp = volume_dim * rp;
 
             static vec3i nb[] = {
                 {-1, -1, 0}, {-1, -1, 1}, {-1, -1, -1}, {0, -1, 0}, {0, -1, 1}, {0, -1, -1}, {1, -1, 0},
@@ -386,461 +388,162 @@ namespace put
                     }
                 }
             }
-
-            // create texture
-            generated_volume gv =
-                create_volume_from_data(volume_dim, s_rasteriser_job.block_size, s_rasteriser_job.data_size,
-                                        PEN_TEX_FORMAT_BGRA8_UNORM, volume_data, s_rasteriser_job.options.generate_mips);
-
-            pen::memory_free(volume_data); // mem is now owned by gv.tcp
-
-            sb_push(s_generated_volumes, gv);
-
-            rasteriser_job->generated_volume_index = sb_count(s_generated_volumes) - 1;
-            rasteriser_job->combine_in_progress = 2;
-
-            pen::semaphore_post(p_thread_info->p_sem_continue, 1);
-            pen::semaphore_post(p_thread_info->p_sem_terminated, 1);
-            return PEN_THREAD_OK;
         }
 
-        void generate_mips_r32f_simd(pen::texture_creation_params& tcp)
+        void* raster_voxel_combine(void* params)
         {
-#if PEN_SIMD
-            // calc num mips
-            u32              num_mips = 1;
-            u32              data_size = 0;
-            static const u32 block_size = 4;
-
-            vec3ui m = vec3ui(tcp.width, tcp.height, tcp.num_arrays);
-
-            while (m.x > 1 && m.y > 1 && m.z > 1)
-            {
-                data_size += m.x * m.y * m.z * block_size;
-
-                num_mips++;
-
-                m /= vec3ui(2, 2, 2);
-                m = max_union(m, vec3ui::one());
-            }
-
-            data_size += block_size; // final mip
-
-            // offsets
-            vec3ui offsets[] = {vec3ui(0, 0, 0), vec3ui(0, 1, 0), vec3ui(0, 0, 1), vec3ui(0, 1, 1)};
-
-            u8* data = (u8*)pen::memory_alloc_align(data_size, 16);
-            memcpy(data, tcp.data, tcp.data_size);
+            pen::job_thread_params* job_params = (pen::job_thread_params*)params;
+            vgt_rasteriser_job*     rasteriser_job = (vgt_rasteriser_job*)job_params->user_data;
+            pen::job*               p_thread_info = job_params->job_info;
+            pen::semaphore_post(p_thread_info->p_sem_continue, 1);
 
-            m = vec3ui(tcp.width, tcp.height, tcp.num_arrays);
+            u32&    volume_dim = rasteriser_job->dimension;
+            void*** volume_slices = rasteriser_job->volume_slices;
 
-            u8* prev_level = (u8*)data;
-            u8* cur_level = prev_level + tcp.data_size;
+            // create a simple 3d texture
+            rasteriser_job->block_size = 4;
+            rasteriser_job->data_size = volume_dim * volume_dim * volume_dim * rasteriser_job->block_size;
 
-            __m128 vrecip = _mm_set1_ps(1.0f / 8.0f);
-            __m128 r00, r01, r10, r11;
-            __m128 d00, d01, d10, d11;
+            u8* volume_data = (u8*)pen::memory_alloc(rasteriser_job->data_size);
+            u32 row_pitch = volume_dim * rasteriser_job->block_size;
+            u32 slice_pitch = volume_dim * row_pitch;
 
-            u32 p_offset[4];
+            rasteriser_job->combine_position = 0;
 
-            for (u32 i = 0; i < num_mips - 1; ++i)
+            for (u32 z = 0; z < volume_dim; ++z)
             {
-                u32 p_rp = m.x * block_size; // prev row pitch
-                u32 p_sp = p_rp * m.y;       // prev slice pitch
-
-                m /= vec3ui(2, 2, 2);
-                m = max_union(m, vec3ui::one());
-
-                u32 c_rp = m.x * block_size; // cur row pitch
-                u32 c_sp = c_rp * m.y;       // cur slice pitch
-
-                u32 block_copy_size = std::min<u32>(m.x * 4, 16);
-                u32 block_offset = block_copy_size < 16 ? 0 : 16;
+                if (g_cancel_volume_job)
+                    break;
 
-                for (u32 z = 0; z < m.z; ++z)
+                u8* slice_mem[6] = {0};
+                for (u32 a = 0; a < 6; ++a)
                 {
-                    for (u32 y = 0; y < m.y; ++y)
-                    {
-                        for (u32 x = 0; x < m.x; x += 4)
-                        {
-                            vec3ui vobase = vec3ui(x * 2, y * 2, z * 2);
-                            vec3ui vo = vobase;
-                            p_offset[0] = p_sp * vo.z + p_rp * vo.y + block_size * vo.x;
-
-                            vo = vobase + offsets[1];
-                            p_offset[1] = p_sp * vo.z + p_rp * vo.y + block_size * vo.x;
-
-                            vo = vobase + offsets[2];
-                            p_offset[2] = p_sp * vo.z + p_rp * vo.y + block_size * vo.x;
-
-                            vo = vobase + offsets[3];
-                            p_offset[3] = p_sp * vo.z + p_rp * vo.y + block_size * vo.x;
-
-                            memcpy(&r00, &prev_level[p_offset[0]], block_copy_size);
-                            memcpy(&r01, &prev_level[p_offset[0] + block_offset], block_copy_size);
-                            memcpy(&r10, &prev_level[p_offset[1]], block_copy_size);
-                            memcpy(&r11, &prev_level[p_offset[1] + block_offset], block_copy_size);
-
-                            memcpy(&d00, &prev_level[p_offset[2]], block_copy_size);
-                            memcpy(&d01, &prev_level[p_offset[2] + block_offset], block_copy_size);
-                            memcpy(&d10, &prev_level[p_offset[3]], block_copy_size);
-                            memcpy(&d11, &prev_level[p_offset[3] + block_offset], block_copy_size);
-
-                            __m128 x0 = _mm_shuffle_ps(r00, r01, _MM_SHUFFLE(2, 0, 2, 0));
-                            __m128 x1 = _mm_shuffle_ps(r00, r01, _MM_SHUFFLE(3, 1, 3, 1));
-                            __m128 x2 = _mm_shuffle_ps(r10, r11, _MM_SHUFFLE(2, 0, 2, 0));
-                            __m128 x3 = _mm_shuffle_ps(r10, r11, _MM_SHUFFLE(3, 1, 3, 1));
-                            __m128 x4 = _mm_shuffle_ps(d00, d01, _MM_SHUFFLE(2, 0, 2, 0));
-                            __m128 x5 = _mm_shuffle_ps(d00, d01, _MM_SHUFFLE(3, 1, 3, 1));
-                            __m128 x6 = _mm_shuffle_ps(d10, d11, _MM_SHUFFLE(2, 0, 2, 0));
-                            __m128 x7 = _mm_shuffle_ps(d10, d11, _MM_SHUFFLE(3, 1, 3, 1));
-
-                            __m128 output = _mm_add_ps(x0, x1);
-                            output = _mm_add_ps(output, x2);
-                            output = _mm_add_ps(output, x3);
-                            output = _mm_add_ps(output, x4);
-                            output = _mm_add_ps(output, x5);
-                            output = _mm_add_ps(output, x6);
-                            output = _mm_add_ps(output, x7);
-                            output = _mm_mul_ps(output, vrecip);
-
-                            u32 c_offset = c_sp * z + c_rp * y + block_size * x;
-                            memcpy(&cur_level[c_offset], &output, block_copy_size);
-                        }
-                    }
+                    slice_mem[a] = (u8*)volume_slices[a][z];
                 }
 
-                prev_level = cur_level;
-                cur_level += c_sp * m.z;
-            }
-
-            tcp.num_mips = num_mips;
-            tcp.data_size = data_size;
-
-            tcp.data = data;
-#endif
-        }
-
-        void generate_mips_rgba8_simd(pen::texture_creation_params& tcp)
-        {
-#if PEN_SIMD
-            // calc num mips
-            u32              num_mips = 1;
-            u32              data_size = 0;
-            static const u32 block_size = 4;
-
-            vec3ui m = vec3ui(tcp.width, tcp.height, tcp.num_arrays);
-
-            while (m.x > 1 && m.y > 1 && m.z > 1)
-            {
-                data_size += m.x * m.y * m.z * block_size;
-
-                num_mips++;
-
-                m /= vec3ui(2, 2, 2);
-                m = max_union(m, vec3ui::one());
-            }
-
-            data_size += block_size; // final mip
-
-            // offsets
-            vec3ui offsets[] = {vec3ui(0, 0, 0), vec3ui(0, 1, 0), vec3ui(0, 0, 1), vec3ui(0, 1, 1)};
-
-            u8* data = (u8*)pen::memory_alloc(data_size);
-            memcpy(data, tcp.data, tcp.data_size);
-
-            m = vec3ui(tcp.width, tcp.height, tcp.num_arrays);
-
-            u8* prev_level = (u8*)data;
-            u8* cur_level = prev_level + tcp.data_size;
-
-            u32 p_offset[4];
-
-            __m128i r00, r01, r10, r11;
-            __m128i d00, d01, d10, d11;
-
-            uint8_t aumask[16] = {4, 5, 6, 7, 12, 13, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80};
-            uint8_t bumask[16] = {0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 4, 5, 6, 7, 12, 13, 14, 15};
-            uint8_t cumask[16] = {0, 1, 2, 3, 8, 9, 10, 11, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80};
-            uint8_t dumask[16] = {0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0, 1, 2, 3, 8, 9, 10, 11};
-
-            uint8_t u00[16] = {1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4};
-            uint8_t u01[16] = {5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7, 8, 8, 8, 8};
-
-            uint8_t u10[16];
-            uint8_t u11[16];
-
-            uint8_t ud00[16];
-            uint8_t ud01[16];
-
-            uint8_t ud10[16];
-            uint8_t ud11[16];
-
-            for (u32 i = 0; i < 16; ++i)
-            {
-                u10[i] = u00[i] + 10;
-                u11[i] = u01[i] + 10;
-
-                ud00[i] = u00[i] + 20;
-                ud01[i] = u01[i] + 20;
-
-                ud10[i] = u00[i] + 30;
-                ud11[i] = u01[i] + 30;
-            }
-
-            __m128i am, bm, cm, dm;
-
-            memcpy(&am, &aumask, 16);
-            memcpy(&bm, &bumask, 16);
-            memcpy(&cm, &cumask, 16);
-            memcpy(&dm, &dumask, 16);
-
-            for (u32 i = 0; i < num_mips - 1; ++i)
-            {
-                u32 p_rp = m.x * block_size; // prev row pitch
-                u32 p_sp = p_rp * m.y;       // prev slice pitch
-
-                m /= vec3ui(2, 2, 2);
-                m = max_union(m, vec3ui::one());
-
-                u32 c_rp = m.x * block_size; // cur row pitch
-                u32 c_sp = c_rp * m.y;       // cur slice pitch
-
-                u32 block_copy_size = std::min<u32>(m.x * 4, 16);
-                u32 block_offset = block_copy_size < 16 ? 0 : 16;
-
-                for (u32 z = 0; z < m.z; ++z)
+                for (u32 y = 0; y < volume_dim; ++y)
                 {
-                    for (u32 y = 0; y < m.y; ++y)
+                    for (u32 x = 0; x < volume_dim; ++x)
                     {
-                        for (u32 x = 0; x < m.x; x += 4)
-                        {
-                            vec3ui vobase = vec3ui(x * 2, y * 2, z * 2);
-                            vec3ui vo = vobase;
-                            p_offset[0] = p_sp * vo.z + p_rp * vo.y + block_size * vo.x;
-
-                            vo = vobase + offsets[1];
-                            p_offset[1] = p_sp * vo.z + p_rp * vo.y + block_size * vo.x;
-
-                            vo = vobase + offsets[2];
-                            p_offset[2] = p_sp * vo.z + p_rp * vo.y + block_size * vo.x;
-
-                            vo = vobase + offsets[3];
-                            p_offset[3] = p_sp * vo.z + p_rp * vo.y + block_size * vo.x;
-
-                            memcpy(&r00, &prev_level[p_offset[0]], block_copy_size);
-                            memcpy(&r01, &prev_level[p_offset[0] + block_offset], block_copy_size);
-                            memcpy(&r10, &prev_level[p_offset[1]], block_copy_size);
-                            memcpy(&r11, &prev_level[p_offset[1] + block_offset], block_copy_size);
-
-                            memcpy(&d00, &prev_level[p_offset[2]], block_copy_size);
-                            memcpy(&d01, &prev_level[p_offset[2] + block_offset], block_copy_size);
-                            memcpy(&d10, &prev_level[p_offset[3]], block_copy_size);
-                            memcpy(&d11, &prev_level[p_offset[3] + block_offset], block_copy_size);
-
-                            // max of 4x4 rgba block
-                            __m128i x0 = _mm_max_epu8(r00, r10);
-                            x0 = _mm_max_epu8(x0, d00);
-                            x0 = _mm_max_epu8(x0, d10);
-
-                            __m128i x1 = _mm_max_epu8(r01, r11);
-                            x1 = _mm_max_epu8(x1, d01);
-                            x1 = _mm_max_epu8(x1, d11);
-
-                            // shuffle and interleave
-                            __m128i v0 = _mm_shuffle_epi8(x0, am);
-                            __m128i v1 = _mm_shuffle_epi8(x0, cm);
-                            __m128i y0 = _mm_shuffle_epi8(x1, bm);
-                            __m128i y1 = _mm_shuffle_epi8(x1, dm);
-
-                            __m128i vv = _mm_max_epu8(v0, v1);
-                            __m128i yy = _mm_max_epu8(y0, y1);
-                            __m128i output = _mm_max_epu8(vv, yy);
-
-                            u32 c_offset = c_sp * z + c_rp * y + block_size * x;
-                            memcpy(&cur_level[c_offset], &output, block_copy_size);
-                        }
-                    }
-                }
-
-                prev_level = cur_level;
-                cur_level += c_sp * m.z;
-            }
-
-            tcp.num_mips = num_mips;
-            tcp.data_size = data_size;
-
-            tcp.data = data;
-#endif
-        }
-
-        void generate_mips_r32f(pen::texture_creation_params& tcp)
-        {
-            // calc num mips
-            u32              num_mips = 1;
-            u32              data_size = 0;
-            static const u32 block_size = 4;
-
-            vec3ui m = vec3ui(tcp.width, tcp.height, tcp.num_arrays);
-
-            while (m.x > 1 && m.y > 1 && m.z > 1)
-            {
-                data_size += m.x * m.y * m.z * block_size;
-
-                num_mips++;
-
-                m /= vec3ui(2, 2, 2);
-                m = max_union(m, vec3ui::one());
-            }
-
-            data_size += block_size;
-
-            // offsets
-            vec3ui offsets[] = {vec3ui(0, 0, 0),
-
-                                vec3ui(1, 0, 0), vec3ui(0, 1, 0), vec3ui(1, 1, 0),
-
-                                vec3ui(0, 0, 1), vec3ui(1, 0, 1), vec3ui(0, 1, 1), vec3ui(1, 1, 1)};
-
-            u8* data = (u8*)pen::memory_alloc(data_size);
-            memcpy(data, tcp.data, tcp.data_size);
-
-            m = vec3ui(tcp.width, tcp.height, tcp.num_arrays);
-
-            u8* prev_level = (u8*)data;
-            u8* cur_level = prev_level + tcp.data_size;
-
-            for (u32 i = 0; i < num_mips - 1; ++i)
-            {
-                u32 p_rp = m.x * block_size; // prev row pitch
-                u32 p_sp = p_rp * m.y;       // prev slice pitch
+                        rasteriser_job->combine_position++;
 
-                m /= vec3ui(2, 2, 2);
-                m = max_union(m, vec3ui::one());
+                        u32 offset = z * slice_pitch + y * row_pitch + x * rasteriser_job->block_size;
 
-                u32 c_rp = m.x * block_size; // cur row pitch
-                u32 c_sp = c_rp * m.y;       // cur slice pitch
+                        u8 rgba[4] = {0};
 
-                for (u32 z = 0; z < m.z; ++z)
-                {
-                    for (u32 y = 0; y < m.y; ++y)
-                    {
-                        for (u32 x = 0; x < m.x; ++x)
+                        for (u32 a = 0; a < 6; ++a)
                         {
-                            u32 c_offset = c_sp * z + c_rp * y + block_size * x;
-
-                            f32 texel = 0.0f;
-
-                            for (u32 o = 0; o < PEN_ARRAY_SIZE(offsets); ++o)
-                            {
-                                vec3ui vo = vec3ui(x * 2, y * 2, z * 2) + offsets[o];
-
-                                u32 p_offset = p_sp * vo.z + p_rp * vo.y + block_size * vo.x;
+                            u8* tex = get_texel(a, x, y, z);
 
-                                f32* ft = (f32*)&prev_level[p_offset];
-                                texel += *ft;
-                            }
+                            if (!tex)
+                                continue;
 
-                            texel /= PEN_ARRAY_SIZE(offsets);
-                            memcpy(&cur_level[c_offset], &texel, sizeof(f32));
+                            if (tex[3] > 8)
+                                for (u32 p = 0; p < 4; ++p)
+                                    rgba[p] = tex[p];
                         }
+
+                        volume_data[offset + 0] = rgba[2];
+                        volume_data[offset + 1] = rgba[1];
+                        volume_data[offset + 2] = rgba[0];
+                        volume_data[offset + 3] = rgba[3];
                     }
                 }
-
-                prev_level = cur_level;
-                cur_level += c_sp * m.z;
             }
 
-            tcp.num_mips = num_mips;
-            tcp.data_size = data_size;
-
-            tcp.data = data;
-        }
-
-        void generate_mips_rgba8(pen::texture_creation_params& tcp)
-        {
-            // calc num mips
-            u32              num_mips = 1;
-            u32              data_size = 0;
-            static const u32 block_size = 4;
-
-            vec3ui m = vec3ui(tcp.width, tcp.height, tcp.num_arrays);
-
-            while (m.x > 1 && m.y > 1 && m.z > 1)
+            if (g_cancel_volume_job)
             {
-                data_size += m.x * m.y * m.z * block_size;
-
-                num_mips++;
+                pen::memory_free(volume_data);
+                g_cancel_handled = true;
 
-                m /= vec3ui(2, 2, 2);
-                m = max_union(m, vec3ui::one());
+                pen::semaphore_post(p_thread_info->p_sem_continue, 1);
+                pen::semaphore_post(p_thread_info->p_sem_terminated, 1);
+                return PEN_THREAD_OK;
             }
 
-            data_size += block_size;
-
-            // offsets
-            vec3ui offsets[] = {vec3ui(0, 0, 0),
+            // with the 3d texture now initialised, dilate colour edges so we can use bilinear
+            dilate_volume(volume_data, volume_dim);
 
-                                vec3ui(1, 0, 0), vec3ui(0, 1, 0), vec3ui(1, 1, 0),
+            // create texture
+            generated_volume gv =
+                create_volume_from_data(volume_dim, s_rasteriser_job.block_size, s_rasteriser_job.data_size,
+                                        PEN_TEX_FORMAT_BGRA8_UNORM, volume_data, s_rasteriser_job.options.generate_mips);
 
-                                vec3ui(0, 0, 1), vec3ui(1, 0, 1), vec3ui(0, 1, 1), vec3ui(1, 1, 1)};
+            pen::memory_free(volume_data); // mem is now owned by gv.tcp
 
-            u8* data = (u8*)pen::memory_alloc(data_size);
-            memcpy(data, tcp.data, tcp.data_size);
+            sb_push(s_generated_volumes, gv);
 
-            m = vec3ui(tcp.width, tcp.height, tcp.num_arrays);
+            rasteriser_job->generated_volume_index = sb_count(s_generated_volumes) - 1;
+            rasteriser_job->combine_in_progress = 2;
 
-            u8* prev_level = (u8*)data;
-            u8* cur_level = prev_level + tcp.data_size;
+            pen::semaphore_post(p_thread_info->p_sem_continue, 1);
+            pen::semaphore_post(p_thread_info->p_sem_terminated, 1);
+            return PEN_THREAD_OK;
+        }
 
-            for (u32 i = 0; i < num_mips - 1; ++i)
-            {
-                u32 p_rp = m.x * block_size; // prev row pitch
-                u32 p_sp = p_rp * m.y;       // prev slice pitch
+        void* raster_voxelise_cpu(void* params)
+        {
+            pen::job_thread_params* job_params = (pen::job_thread_params*)params;
+            vgt_rasteriser_job*     rasteriser_job = (vgt_rasteriser_job*)job_params->user_data;
+            pen::job*               p_thread_info = job_params->job_info;
+            pen::semaphore_post(p_thread_info->p_sem_continue, 1);
 
-                m /= vec3ui(2, 2, 2);
-                m = max_union(m, vec3ui::one());
+            u32 volume_dim = rasteriser_job->dimension;
 
-                u32 c_rp = m.x * block_size; // cur row pitch
-                u32 c_sp = c_rp * m.y;       // cur slice pitch
+            rasteriser_job->block_size = 4;
+            rasteriser_job->data_size = volume_dim * volume_dim * volume_dim * rasteriser_job->block_size;
 
-                for (u32 z = 0; z < m.z; ++z)
-                {
-                    for (u32 y = 0; y < m.y; ++y)
-                    {
-                        for (u32 x = 0; x < m.x; ++x)
-                        {
-                            u32 c_offset = c_sp * z + c_rp * y + block_size * x;
+            u8* volume_data = (u8*)pen::memory_alloc(rasteriser_job->data_size);
+            memset(volume_data, 0x0, rasteriser_job->data_size);
+
+            scene_triangles st;
+            gather_scene_triangles(rasteriser_job->scene, rasteriser_job->capture_type, st);
+
+            // cells span the visible extents exactly, conservative overlap already captures the boundary texels
+            voxelise_params vp;
+            vp.vertices = st.vertices.data();
+            vp.indices = st.indices.data();
+            vp.colours = st.colours.data();
+            vp.num_triangles = (u32)st.indices.size() / 3;
+            vp.min = rasteriser_job->visible_extents.min;
+            vp.max = rasteriser_job->visible_extents.max;
+            vp.ni = volume_dim;
+            vp.nj = volume_dim;
+            vp.nk = volume_dim;
+            vp.cancel = &g_cancel_volume_job;
+            vp.progress = &rasteriser_job->combine_position;
+
+            // baked lighting and custom captures need the gpu, they fall back to albedo
+            bool normals = rasteriser_job->options.capture_data == CAPTURE_NORMALS;
+            if (!voxelise(vp, normals ? nullptr : volume_data, normals ? volume_data : nullptr))
+            {
+                pen::memory_free(volume_data);
 
-                            u8 rgba[4] = {0};
+                rasteriser_job->rasterise_in_progress = false;
+                rasteriser_job->combine_in_progress = 0;
+                g_cancel_handled = true;
 
-                            for (u32 o = 0; o < PEN_ARRAY_SIZE(offsets); ++o)
-                            {
-                                vec3ui vo = vec3ui(x * 2, y * 2, z * 2) + offsets[o];
+                pen::semaphore_post(p_thread_info->p_sem_continue, 1);
+                pen::semaphore_post(p_thread_info->p_sem_terminated, 1);
+                return PEN_THREAD_OK;
+            }
 
-                                u32 p_offset = p_sp * vo.z + p_rp * vo.y + block_size * vo.x;
+            dilate_volume(volume_data, volume_dim);
 
-                                for (u32 r = 0; r < 4; ++r)
-                                    rgba[r] = max<u8>(prev_level[p_offset + r], rgba[r]);
-                            }
+            generated_volume gv =
+                create_volume_from_data(volume_dim, rasteriser_job->block_size, rasteriser_job->data_size,
+                                        PEN_TEX_FORMAT_BGRA8_UNORM, volume_data, rasteriser_job->options.generate_mips);
 
-                            for (u32 r = 0; r < 4; ++r)
-                            {
-                                // rgba[r] /= PEN_ARRAY_SIZE(offsets);
-                                cur_level[c_offset + r] = rgba[r];
-                            }
-                        }
-                    }
-                }
+            pen::memory_free(volume_data); // mem is now owned by gv.tcp
 
-                prev_level = cur_level;
-                cur_level += c_sp * m.z;
-            }
+            sb_push(s_generated_volumes, gv);
 
-            tcp.num_mips = num_mips;
-            tcp.data_size = data_size;
+            rasteriser_job->generated_volume_index = sb_count(s_generated_volumes) - 1;
+            rasteriser_job->combine_in_progress = 2;
 
-            tcp.data = data;
+            pen::semaphore_post(p_thread_info->p_sem_continue, 1);
+            pen::semaphore_post(p_thread_info->p_sem_terminated, 1);
+            return PEN_THREAD_OK;
         }
 
         generated_volume create_volume_from_data(u32 volume_dim, u32 block_size, u32 data_size, u32 tex_format,
@@ -890,32 +593,10 @@ namespace put
 
             if (generate_mips)
             {
-                // Mips will create their own copy of mem
-                switch (tex_format)
-                {
-                    case PEN_TEX_FORMAT_BGRA8_UNORM:
-                    {
-#if PEN_SIMD
-                        generate_mips_rgba8_simd(tcp);
-
-#else
-                        generate_mips_rgba8(tcp);
-#endif
-                    }
-                    break;
-                    case PEN_TEX_FORMAT_R32_FLOAT:
-                    {
-#if PEN_SIMD
-                        generate_mips_r32f_simd(tcp);
-#else
-                        generate_mips_r32f(tcp);
-#endif
-                    }
-                    break;
-                    default:
-                        PEN_ASSERT(0); // un-implemented mip map gen fucntion
-                        break;
-                }
+                // mips are generated into their own copy of mem, albedo keeps the max so thin geometry stays solid
+                mip_filter filter = tex_format == PEN_TEX_FORMAT_BGRA8_UNORM ? e_mip_filter::max : e_mip_filter::box;
+                if (!put::generate_mips(tcp, filter))
+                    PEN_ASSERT(0); // un-implemented mip map gen format
             }
             else
             {
@@ -971,7 +652,7 @@ namespace put
             scene->transforms[new_prim].rotation = quat();
             scene->transforms[new_prim].scale = scale;
             scene->transforms[new_prim].translation = pos;
-            scene->entities[new_prim] |= e_cmp::transform | e_cmp::volume;
+            add_entity_flags(scene, new_prim, e_cmp::transform | e_cmp::volume);
             scene->parents[new_prim] = new_prim;
             scene->samplers[new_prim].sb[0].handle = gv.texture;
             scene->samplers[new_prim].sb[0].sampler_unit = e_texture::volume;
@@ -992,10 +673,14 @@ namespace put
             // clean up
             for (u32 a = 0; a < 6; ++a)
             {
+                if (!s_rasteriser_job.volume_slices[a])
+                    continue;
+
                 for (u32 s = 0; s < s_rasteriser_job.dimension; ++s)
                     pen::memory_free(s_rasteriser_job.volume_slices[a][s]);
 
                 pen::memory_free(s_rasteriser_job.volume_slices[a]);
+                s_rasteriser_job.volume_slices[a] = nullptr;
             }
 
             // completed
@@ -1005,6 +690,27 @@ namespace put
 
         void volume_rasteriser_update(ecs_controller& ecsc, ecs_scene* scene, f32 dt)
         {
+            // cpu voxelisation runs on its own job which handles cancellation, wait for it to finish
+            if (s_rasteriser_job.cpu_job)
+            {
+                if (!s_rasteriser_job.rasterise_in_progress)
+                {
+                    // cancelled, the job has cleaned up after itself
+                    s_rasteriser_job.cpu_job = false;
+                }
+                else if (s_rasteriser_job.combine_in_progress == 2)
+                {
+                    volume_raster_completed(scene);
+                    s_rasteriser_job.cpu_job = false;
+
+                    // finished before the job could see the cancel
+                    if (g_cancel_volume_job)
+                        g_cancel_handled = true;
+                }
+
+                return;
+            }
+
             if (g_cancel_volume_job)
             {
                 s_rasteriser_job.rasterise_in_progress = 0;
@@ -1116,78 +822,11 @@ namespace put
             u32 data_size = volume_dim * volume_dim * volume_dim * block_size;
 
             u8* volume_data = (u8*)pen::memory_alloc(data_size);
-            u32 row_pitch = volume_dim * block_size;
-            u32 slice_pitch = volume_dim * row_pitch;
-
-            std::vector<vec3f>  vertices;
-            std::vector<vec3ui> triangles;
 
-            extents ve = {vec3f(FLT_MAX), vec3f(-FLT_MAX)};
+            scene_triangles st;
+            gather_scene_triangles(sdf_job->scene, sdf_job->capture_type, st);
 
-            u32 index_offset = 0;
-
-            for (u32 n = 0; n < sdf_job->scene->soa_size; ++n)
-            {
-                if (sdf_job->scene->entities[n] & e_cmp::geometry)
-                {
-                    if (s_sdf_job.capture_type == CAPTURE_SELECTED)
-                    {
-                        if (!(sdf_job->scene->state_flags[n] & e_state::selected) &&
-                            !(sdf_job->scene->state_flags[n] & e_state::child_selected))
-                            continue;
-
-                        ve.min = min_union(ve.min, sdf_job->scene->bounding_volumes[n].transformed_min_extents);
-                        ve.max = max_union(ve.max, sdf_job->scene->bounding_volumes[n].transformed_max_extents);
-                    }
-                    else
-                    {
-                        ve = s_sdf_job.scene->renderable_extents;
-                    }
-
-                    geometry_resource* gr = get_geometry_resource(sdf_job->scene->id_geometry[n]);
-                    pmm_renderable&    r = gr->renderable[e_pmm_renderable::position_only];
-
-                    vec4f* vertex_positions = (vec4f*)r.cpu_vertex_buffer;
-
-                    if (!r.cpu_index_buffer || !vertex_positions)
-                    {
-                        dev_console_log_level(dev_ui::console_level::error,
-                                              "[error] mesh %s does not have cpu vertex / triangle data",
-                                              sdf_job->scene->names[n].c_str());
-
-                        continue;
-                    }
-
-                    index_offset = vertices.size();
-                    for (u32 i = 0; i < r.num_vertices; ++i)
-                    {
-                        vec3f tv = sdf_job->scene->world_matrices[n].transform_vector((vec3f)vertex_positions[i].xyz);
-                        vertices.push_back(tv);
-                    }
-
-                    for (u32 i = 0; i < r.num_indices; i += 3)
-                    {
-                        if (r.index_type == PEN_FORMAT_R32_UINT)
-                        {
-                            u32* indices = (u32*)r.cpu_index_buffer;
-                            u32  i0, i1, i2;
-                            i0 = index_offset + indices[i + 0];
-                            i1 = index_offset + indices[i + 1];
-                            i2 = index_offset + indices[i + 2];
-                            triangles.push_back(vec3ui(i0, i1, i2));
-                        }
-                        else
-                        {
-                            u16* indices = (u16*)r.cpu_index_buffer;
-                            u32  i0, i1, i2;
-                            i0 = index_offset + (u32)indices[i + 0];
-                            i1 = index_offset + (u32)indices[i + 1];
-                            i2 = index_offset + (u32)indices[i + 2];
-                            triangles.push_back(vec3ui(i0, i1, i2));
-                        }
-                    }
-                }
-            }
+            extents ve = st.bounds;
 
             s_sdf_job.scene_extents = ve;
 
@@ -1202,7 +841,7 @@ namespace put
             sdf_job->volume_dim = volume_dim;
             sdf_job->data_size = data_size;
 
-            if (triangles.size() > 0)
+            if (st.indices.size() > 0)
             {
                 f32 dx = component_wise_max(scene_dimension) / (f32)volume_dim;
 
@@ -1211,14 +850,23 @@ namespace put
 
                 vec3f grid_origin = centre - vec3f(component_wise_max(scene_dimension) / 2.0f);
 
-                Array3f phi_grid;
-                make_level_set3(triangles, vertices, grid_origin, dx, volume_dim, volume_dim, volume_dim, phi_grid);
-
-                if (g_cancel_volume_job)
+                // block size is 4 for both formats, distances are written straight into the volume as f32
+                sdf_params sp;
+                sp.vertices = st.vertices.data();
+                sp.indices = st.indices.data();
+                sp.num_triangles = (u32)st.indices.size() / 3;
+                sp.origin = grid_origin;
+                sp.dx = dx;
+                sp.ni = volume_dim;
+                sp.nj = volume_dim;
+                sp.nk = volume_dim;
+                sp.cancel = &g_cancel_volume_job;
+                sp.progress = &s_sdf_progress;
+
+                f32* phi = (f32*)volume_data;
+                if (!generate_sdf(sp, phi))
                 {
                     s_sdf_job.generate_in_progress = false;
-                    g_mls_progress.sweeps = 0;
-                    g_mls_progress.triangles = 0;
                     pen::memory_free(volume_data);
                     g_cancel_handled = true;
 
@@ -1227,25 +875,10 @@ namespace put
                     return PEN_THREAD_OK;
                 }
 
-                for (u32 z = 0; z < volume_dim; ++z)
-                {
-                    for (u32 y = 0; y < volume_dim; ++y)
-                    {
-                        for (u32 x = 0; x < volume_dim; ++x)
-                        {
-                            u32 offset = z * slice_pitch + y * row_pitch + x * block_size;
-
-                            f32* f = (f32*)(&volume_data[offset + 0]);
-
-                            // non water tight meshes signs cannot be trusted
-                            f32 tsf = phi_grid(x, y, z);
-                            if (!sdf_job->trust_sign)
-                                tsf = fabs(tsf);
-
-                            *f = tsf;
-                        }
-                    }
-                }
+                // non water tight meshes signs cannot be trusted
+                if (!sdf_job->trust_sign)
+                    for (u32 i = 0; i < volume_dim * volume_dim * volume_dim; ++i)
+                        phi[i] = fabs(phi[i]);
             }
             else
             {
@@ -1293,6 +926,7 @@ namespace put
             static const c8* capture_data_names[] = {"Albedo", "Normals", "Baked Lighting", "Occupancy", "Custom"};
 
             ImGui::Combo("Capture", &s_options.capture_data, capture_data_names, PEN_ARRAY_SIZE(capture_data_names));
+            ImGui::Checkbox("CPU Voxelise", &s_options.cpu_voxelise);
 
             static u32* hidden_entities = nullptr;
 
@@ -1315,6 +949,9 @@ namespace put
                             if (!(s_main_scene->state_flags[n] & e_state::selected) &&
                                 !(s_main_scene->state_flags[n] & e_state::child_selected))
                             {
+                                if (s_options.cpu_voxelise)
+                                    continue;
+
                                 s_main_scene->state_flags[n] |= e_state::hidden;
                                 sb_push(hidden_entities, n);
                             }
@@ -1340,6 +977,30 @@ namespace put
                     s_rasteriser_job.current_axis = 0;
                     s_rasteriser_job.current_slice = 0;
 
+                    if (s_options.cpu_voxelise)
+                    {
+                        // skips straight to combine, progress is counted in cells voxelised
+                        s_rasteriser_job.scene = s_main_scene;
+                        s_rasteriser_job.combine_position = 0;
+                        s_rasteriser_job.combine_in_progress = 1;
+                        s_rasteriser_job.rasterise_in_progress = true;
+
+                        // triangles and cells are heap allocated, so the job only needs a regular stack
+                        pen::job* job = pen::jobs_create_job(raster_voxelise_cpu, 1024 * 1024, &s_rasteriser_job,
+                                                             pen::e_thread_start_flags::detached);
+                        if (job)
+                        {
+                            s_rasteriser_job.cpu_job = true;
+                        }
+                        else
+                        {
+                            PEN_LOG("[volume generator] unable to start cpu voxelise job");
+                            s_rasteriser_job.rasterise_in_progress = false;
+                            s_rasteriser_job.combine_in_progress = 0;
+                        }
+                        return;
+                    }
+
                     // allocate cpu mem for rasterised slices
                     for (u32 a = 0; a < 6; ++a)
                     {
@@ -1458,7 +1119,7 @@ namespace put
 
                 ImGui::SameLine();
 
-                ImGui::ProgressBar((g_mls_progress.triangles + g_mls_progress.sweeps) * 0.5f, ImVec2(-1, 0));
+                ImGui::ProgressBar(get_sdf_progress(s_sdf_progress), ImVec2(-1, 0));
 
                 if (s_sdf_job.generate_in_progress == 2)
                 {
@@ -1489,7 +1150,7 @@ namespace put
                     s_main_scene->transforms[new_prim].rotation = quat();
                     s_main_scene->transforms[new_prim].scale = scale;
                     s_main_scene->transforms[new_prim].translation = pos;
-                    s_main_scene->entities[new_prim] |= e_cmp::transform | e_cmp::sdf_shadow;
+                    add_entity_flags(s_main_scene, new_prim, e_cmp::transform | e_cmp::sdf_shadow);
                     s_main_scene->parents[new_prim] = new_prim;
                     s_main_scene->samplers[new_prim].sb[0].sampler_unit = e_texture::volume;
                     s_main_scene->samplers[new_prim].sb[0].handle = gv.texture;
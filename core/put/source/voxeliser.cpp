@@ -0,0 +1,354 @@
+// voxeliser.cpp
+// Copyright 2014 - 2023 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+#include "voxeliser.h"
+
+#include "threads.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#if __SSE2__ || __AVX2__ || __AVX__
+#include <immintrin.h>
+#define VOX_SIMD_SSE 1
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define VOX_SIMD_NEON 1
+#endif
+
+namespace put
+{
+    namespace
+    {
+        static const u32 k_accum_floats = 8; // rgba sum, normal sum, count
+
+        struct edge_2d
+        {
+            f32 nu;
+            f32 nv;
+            f32 d;
+        };
+
+        // triangle / box overlap set up once per triangle, a box at p with size dp overlaps when p is between the
+        // planes and inside the 3 edges of each of the xy, zx and yz projections
+        struct vox_triangle
+        {
+            vec3f   n;
+            f32     d1;
+            f32     d2;
+            edge_2d xy[3];
+            edge_2d zx[3];
+            edge_2d yz[3];
+            u32     i0, i1, j0, j1; // cell bounds
+            vec3f   normal;        // normalised
+        };
+
+        struct vox_context
+        {
+            const voxelise_params*    params;
+            u8*                       albedo;
+            u8*                       normals;
+            vec3f                     dp;
+            std::vector<vox_triangle> triangles;
+            std::vector<u32>          bins; // triangles of each slice
+            std::vector<u32>          bin_start;
+            bool                      simd;
+
+            std::vector<std::vector<f32>> scratch; // per thread accumulation of a slice
+        };
+
+        bool cancelled(const vox_context& ctx)
+        {
+            return ctx.params->cancel && *ctx.params->cancel;
+        }
+
+        u32 cell_coord(f32 v, f32 min, f32 dp, u32 n)
+        {
+            s32 c = (s32)floorf((v - min) / dp);
+            return (u32)std::min<s32>(std::max<s32>(c, 0), (s32)n - 1);
+        }
+
+        void setup_edges(const f32* u, const f32* v, f32 sign, f32 du, f32 dv, edge_2d* edges)
+        {
+            for (u32 e = 0; e < 3; ++e)
+            {
+                u32 next = (e + 1) % 3;
+                f32 nu = -(v[next] - v[e]) * sign;
+                f32 nv = (u[next] - u[e]) * sign;
+
+                edges[e].nu = nu;
+                edges[e].nv = nv;
+                edges[e].d = -(nu * u[e] + nv * v[e]) + std::max(0.0f, du * nu) + std::max(0.0f, dv * nv);
+            }
+        }
+
+        vox_triangle setup_triangle(const vec3f& v0, const vec3f& v1, const vec3f& v2, const vec3f& dp)
+        {
+            vox_triangle t;
+
+            t.n = cross(v1 - v0, v2 - v0);
+
+            f32 len = sqrtf(dot(t.n, t.n));
+            t.normal = len > 0.0f ? t.n / len : vec3f(0.0f, 1.0f, 0.0f);
+
+            // critical point, the box corner furthest along -n
+            vec3f c = vec3f(t.n.x > 0.0f ? 0.0f : dp.x, t.n.y > 0.0f ? 0.0f : dp.y, t.n.z > 0.0f ? 0.0f : dp.z);
+            t.d1 = dot(t.n, c - v0);
+            t.d2 = dot(t.n, (dp - c) - v0);
+
+            f32 x[3] = {v0.x, v1.x, v2.x};
+            f32 y[3] = {v0.y, v1.y, v2.y};
+            f32 z[3] = {v0.z, v1.z, v2.z};
+
+            setup_edges(x, y, t.n.z >= 0.0f ? 1.0f : -1.0f, dp.x, dp.y, t.xy);
+            setup_edges(z, x, t.n.y >= 0.0f ? 1.0f : -1.0f, dp.z, dp.x, t.zx);
+            setup_edges(y, z, t.n.x >= 0.0f ? 1.0f : -1.0f, dp.y, dp.z, t.yz);
+
+            return t;
+        }
+
+        bool edges_pass(const edge_2d* edges, f32 u, f32 v)
+        {
+            for (u32 e = 0; e < 3; ++e)
+                if (edges[e].nu * u + edges[e].nv * v + edges[e].d < 0.0f)
+                    return false;
+
+            return true;
+        }
+
+        u32 overlap_row(const vox_triangle& t, f32 x, f32 dx, f32 y, f32 z, u32 count, bool simd)
+        {
+            // bit per cell for up to 4 cells starting at x along the row at y, z
+            f32 plane_yz = t.n.y * y + t.n.z * z;
+            u32 mask = 0;
+
+            if (simd)
+            {
+#if VOX_SIMD_SSE
+                __m128 px = _mm_add_ps(_mm_set1_ps(x), _mm_mul_ps(_mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f), _mm_set1_ps(dx)));
+                __m128 zero = _mm_setzero_ps();
+
+                __m128 np = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.n.x), px), _mm_set1_ps(plane_yz));
+                __m128 a = _mm_add_ps(np, _mm_set1_ps(t.d1));
+                __m128 b = _mm_add_ps(np, _mm_set1_ps(t.d2));
+                __m128 pass = _mm_cmple_ps(_mm_mul_ps(a, b), zero);
+
+                for (u32 e = 0; e < 3; ++e)
+                {
+                    __m128 exy = _mm_mul_ps(_mm_set1_ps(t.xy[e].nu), px);
+                    exy = _mm_add_ps(exy, _mm_set1_ps(t.xy[e].nv * y + t.xy[e].d));
+                    pass = _mm_and_ps(pass, _mm_cmpge_ps(exy, zero));
+
+                    __m128 ezx = _mm_mul_ps(_mm_set1_ps(t.zx[e].nv), px);
+                    ezx = _mm_add_ps(ezx, _mm_set1_ps(t.zx[e].nu * z + t.zx[e].d));
+                    pass = _mm_and_ps(pass, _mm_cmpge_ps(ezx, zero));
+                }
+
+                return (u32)_mm_movemask_ps(pass) & ((1 << count) - 1);
+#elif VOX_SIMD_NEON
+                static const f32 lanes[4] = {0.0f, 1.0f, 2.0f, 3.0f};
+                float32x4_t      px = vmlaq_n_f32(vdupq_n_f32(x), vld1q_f32(lanes), dx);
+                float32x4_t      zero = vdupq_n_f32(0.0f);
+
+                float32x4_t np = vmlaq_n_f32(vdupq_n_f32(plane_yz), px, t.n.x);
+                float32x4_t a = vaddq_f32(np, vdupq_n_f32(t.d1));
+                float32x4_t b = vaddq_f32(np, vdupq_n_f32(t.d2));
+                uint32x4_t  pass = vcleq_f32(vmulq_f32(a, b), zero);
+
+                for (u32 e = 0; e < 3; ++e)
+                {
+                    float32x4_t exy = vmlaq_n_f32(vdupq_n_f32(t.xy[e].nv * y + t.xy[e].d), px, t.xy[e].nu);
+                    pass = vandq_u32(pass, vcgeq_f32(exy, zero));
+
+                    float32x4_t ezx = vmlaq_n_f32(vdupq_n_f32(t.zx[e].nu * z + t.zx[e].d), px, t.zx[e].nv);
+                    pass = vandq_u32(pass, vcgeq_f32(ezx, zero));
+                }
+
+                u32 bits[4];
+                vst1q_u32(bits, pass);
+                for (u32 i = 0; i < count; ++i)
+                    mask |= (bits[i] & 1) << i;
+
+                return mask;
+#endif
+            }
+
+            for (u32 i = 0; i < count; ++i)
+            {
+                f32 cx = x + dx * (f32)i;
+                f32 np = t.n.x * cx + plane_yz;
+                if ((np + t.d1) * (np + t.d2) > 0.0f)
+                    continue;
+
+                if (!edges_pass(t.xy, cx, y) || !edges_pass(t.zx, z, cx))
+                    continue;
+
+                mask |= 1 << i;
+            }
+
+            return mask;
+        }
+
+        u8 unorm8(f32 v)
+        {
+            return (u8)(std::min(std::max(v, 0.0f), 1.0f) * 255.0f + 0.5f);
+        }
+
+        void voxelise_slices(u32 start, u32 end, void* user_data)
+        {
+            vox_context&           ctx = *(vox_context*)user_data;
+            const voxelise_params& p = *ctx.params;
+            std::vector<f32>&      accum = ctx.scratch[pen::jobs_get_thread_index()];
+
+            u32 slice_cells = p.ni * p.nj;
+            accum.resize(slice_cells * k_accum_floats);
+
+            for (u32 k = start; k < end; ++k)
+            {
+                if (cancelled(ctx))
+                    return;
+
+                std::fill(accum.begin(), accum.end(), 0.0f);
+
+                f32 z = p.min.z + ctx.dp.z * (f32)k;
+                for (u32 b = ctx.bin_start[k]; b < ctx.bin_start[k + 1]; ++b)
+                {
+                    u32                 ti = ctx.bins[b];
+                    const vox_triangle& t = ctx.triangles[ti];
+                    vec4f colour = p.colours ? p.colours[ti] : vec4f(1.0f, 1.0f, 1.0f, 1.0f);
+
+                    for (u32 j = t.j0; j <= t.j1; ++j)
+                    {
+                        // the yz projection does not change along a row
+                        f32 y = p.min.y + ctx.dp.y * (f32)j;
+                        if (!edges_pass(t.yz, y, z))
+                            continue;
+
+                        for (u32 i = t.i0; i <= t.i1; i += 4)
+                        {
+                            u32 count = std::min<u32>(4, t.i1 + 1 - i);
+                            f32 x = p.min.x + ctx.dp.x * (f32)i;
+                            u32 mask = overlap_row(t, x, ctx.dp.x, y, z, count, ctx.simd);
+
+                            for (u32 n = 0; n < count; ++n)
+                            {
+                                if (!(mask & (1 << n)))
+                                    continue;
+
+                                f32* a = &accum[(j * p.ni + i + n) * k_accum_floats];
+                                for (u32 ch = 0; ch < 4; ++ch)
+                                    a[ch] += colour[ch];
+                                for (u32 ch = 0; ch < 3; ++ch)
+                                    a[4 + ch] += t.normal[ch];
+                                a[7] += 1.0f;
+                            }
+                        }
+                    }
+                }
+
+                // resolve the slice, bgra8
+                for (u32 c = 0; c < slice_cells; ++c)
+                {
+                    const f32* a = &accum[c * k_accum_floats];
+                    u8*        alb = ctx.albedo ? ctx.albedo + ((size_t)k * slice_cells + c) * 4 : nullptr;
+                    u8*        nrm = ctx.normals ? ctx.normals + ((size_t)k * slice_cells + c) * 4 : nullptr;
+
+                    if (a[7] == 0.0f)
+                    {
+                        if (alb)
+                            memset(alb, 0, 4);
+                        if (nrm)
+                            memset(nrm, 0, 4);
+                        continue;
+                    }
+
+                    if (alb)
+                    {
+                        f32 inv = 1.0f / a[7];
+                        alb[0] = unorm8(a[2] * inv);
+                        alb[1] = unorm8(a[1] * inv);
+                        alb[2] = unorm8(a[0] * inv);
+                        alb[3] = 255;
+                    }
+
+                    if (nrm)
+                    {
+                        vec3f n = vec3f(a[4], a[5], a[6]);
+                        f32   len = sqrtf(dot(n, n));
+                        n = len > 0.0f ? n / len : vec3f(0.0f, 1.0f, 0.0f);
+
+                        nrm[0] = unorm8(n.z * 0.5f + 0.5f);
+                        nrm[1] = unorm8(n.y * 0.5f + 0.5f);
+                        nrm[2] = unorm8(n.x * 0.5f + 0.5f);
+                        nrm[3] = 255;
+                    }
+                }
+
+                if (p.progress)
+                    *p.progress += slice_cells;
+            }
+        }
+    } // namespace
+
+    bool voxelise(const voxelise_params& params, u8* albedo, u8* normals)
+    {
+        const voxelise_params& p = params;
+        if (p.ni == 0 || p.nj == 0 || p.nk == 0)
+            return true;
+
+        vox_context ctx;
+        ctx.params = &params;
+        ctx.albedo = albedo;
+        ctx.normals = normals;
+        ctx.dp = (p.max - p.min) / vec3f((f32)p.ni, (f32)p.nj, (f32)p.nk);
+        ctx.simd = !(p.flags & e_voxelise_flags::scalar);
+        ctx.scratch.resize(pen::jobs_get_num_workers() + 1);
+
+        // set up triangles and bin them into the slices their bounds cover, counted first then filled in order
+        ctx.triangles.resize(p.num_triangles);
+        ctx.bin_start.assign(p.nk + 1, 0);
+
+        std::vector<u32> k_range(p.num_triangles * 2);
+        for (u32 t = 0; t < p.num_triangles; ++t)
+        {
+            const vec3f& v0 = p.vertices[p.indices[t * 3 + 0]];
+            const vec3f& v1 = p.vertices[p.indices[t * 3 + 1]];
+            const vec3f& v2 = p.vertices[p.indices[t * 3 + 2]];
+
+            vox_triangle& vt = ctx.triangles[t];
+            vt = setup_triangle(v0, v1, v2, ctx.dp);
+
+            vec3f tmin = min_union(v0, min_union(v1, v2));
+            vec3f tmax = max_union(v0, max_union(v1, v2));
+            vt.i0 = cell_coord(tmin.x, p.min.x, ctx.dp.x, p.ni);
+            vt.i1 = cell_coord(tmax.x, p.min.x, ctx.dp.x, p.ni);
+            vt.j0 = cell_coord(tmin.y, p.min.y, ctx.dp.y, p.nj);
+            vt.j1 = cell_coord(tmax.y, p.min.y, ctx.dp.y, p.nj);
+
+            k_range[t * 2 + 0] = cell_coord(tmin.z, p.min.z, ctx.dp.z, p.nk);
+            k_range[t * 2 + 1] = cell_coord(tmax.z, p.min.z, ctx.dp.z, p.nk);
+
+            for (u32 k = k_range[t * 2]; k <= k_range[t * 2 + 1]; ++k)
+                ctx.bin_start[k + 1]++;
+        }
+
+        for (u32 k = 0; k < p.nk; ++k)
+            ctx.bin_start[k + 1] += ctx.bin_start[k];
+
+        ctx.bins.resize(ctx.bin_start[p.nk]);
+        std::vector<u32> fill(ctx.bin_start.begin(), ctx.bin_start.end() - 1);
+        for (u32 t = 0; t < p.num_triangles; ++t)
+            for (u32 k = k_range[t * 2]; k <= k_range[t * 2 + 1]; ++k)
+                ctx.bins[fill[k]++] = t;
+
+        if (p.flags & e_voxelise_flags::single_threaded)
+            voxelise_slices(0, p.nk, &ctx);
+        else
+            pen::jobs_parallel_for(p.nk, 1, voxelise_slices, &ctx);
+
+        return !cancelled(ctx);
+    }
+} // namespace put
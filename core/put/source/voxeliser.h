@@ -0,0 +1,48 @@
+// voxeliser.h
+// Copyright 2014 - 2023 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Conservative cpu voxelisation of triangle meshes, every cell a triangle touches is filled. Triangles are binned
+// into the z slices they cover and slices are voxelised across the job worker pool, triangle / box overlap is tested
+// for 4 cells of a row at a time with sse or neon. Needs no renderer so it can run headless in build tools.
+
+#pragma once
+
+#include "types.h"
+
+#include "maths/vec.h"
+
+#include <atomic>
+
+namespace put
+{
+    namespace e_voxelise_flags
+    {
+        enum voxelise_flags_t
+        {
+            single_threaded = 1 << 0, // run on the calling thread only
+            scalar = 1 << 1           // skip simd overlap tests, for comparison
+        };
+    }
+
+    struct voxelise_params
+    {
+        const vec3f*             vertices = nullptr;
+        const u32*               indices = nullptr; // 3 per triangle
+        const vec4f*             colours = nullptr; // optional, per triangle 0 - 1, white when null
+        u32                      num_triangles = 0;
+        vec3f                    min;               // bounds of the grid, cells may be non uniform
+        vec3f                    max;
+        u32                      ni = 0;
+        u32                      nj = 0;
+        u32                      nk = 0;
+        u32                      flags = 0;
+        const std::atomic<bool>* cancel = nullptr;   // optional, polled between slices
+        a_u32*                   progress = nullptr; // optional, incremented by the cells of each finished slice
+    };
+
+    // writes bgra8 cells with x changing fastest to albedo and normals, either can be null. filled cells have alpha
+    // 255, albedo is the average colour of the triangles touching the cell and normals the sum of their face normals
+    // normalised and encoded as n * 0.5 + 0.5. empty cells are 0. returns false when cancelled.
+    bool voxelise(const voxelise_params& params, u8* albedo, u8* normals);
+} // namespace put
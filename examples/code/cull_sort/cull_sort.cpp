@@ -39,7 +39,7 @@ void example_setup(ecs::ecs_scene* scene, camera& cam)
     scene->transforms[light].translation = vec3f::zero();
     scene->transforms[light].rotation = quat();
     scene->transforms[light].scale = vec3f::one();
-    scene->entities[light] |= e_cmp::light;
+    add_entity_flags(scene, light, e_cmp::light);
     scene->entities[light] |= e_cmp::transform;
 
     // add some spheres
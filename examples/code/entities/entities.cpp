@@ -41,7 +41,7 @@ void example_setup(ecs_scene* scene, camera& cam)
     scene->transforms[light].translation = vec3f::zero();
     scene->transforms[light].rotation = quat();
     scene->transforms[light].scale = vec3f::one();
-    scene->entities[light] |= e_cmp::light;
+    add_entity_flags(scene, light, e_cmp::light);
     scene->entities[light] |= e_cmp::transform;
 
     light = get_new_entity(scene);
@@ -54,7 +54,7 @@ void example_setup(ecs_scene* scene, camera& cam)
     scene->transforms[light].translation = vec3f::zero();
     scene->transforms[light].rotation = quat();
     scene->transforms[light].scale = vec3f::one();
-    scene->entities[light] |= e_cmp::light;
+    add_entity_flags(scene, light, e_cmp::light);
     scene->entities[light] |= e_cmp::transform;
 
     light = get_new_entity(scene);
@@ -67,7 +67,7 @@ void example_setup(ecs_scene* scene, camera& cam)
     scene->transforms[light].translation = vec3f::zero();
     scene->transforms[light].rotation = quat();
     scene->transforms[light].scale = vec3f::one();
-    scene->entities[light] |= e_cmp::light;
+    add_entity_flags(scene, light, e_cmp::light);
     scene->entities[light] |= e_cmp::transform;
 
     light = get_new_entity(scene);
@@ -80,7 +80,7 @@ void example_setup(ecs_scene* scene, camera& cam)
     scene->transforms[light].translation = vec3f::zero();
     scene->transforms[light].rotation = quat();
     scene->transforms[light].scale = vec3f::one();
-    scene->entities[light] |= e_cmp::light;
+    add_entity_flags(scene, light, e_cmp::light);
     scene->entities[light] |= e_cmp::transform;
 
     //floor for shadow casting
@@ -169,9 +169,9 @@ void example_setup(ecs_scene* scene, camera& cam)
 
             scene->bounding_volumes[new_prim] = scene->bounding_volumes[master_node];
 
-            scene->entities[new_prim] |= e_cmp::geometry;
-            scene->entities[new_prim] |= e_cmp::material;
-            scene->entities[new_prim] |= e_cmp::sub_instance;
+            add_entity_flags(scene, new_prim, e_cmp::geometry);
+            add_entity_flags(scene, new_prim, e_cmp::material);
+            add_entity_flags(scene, new_prim, e_cmp::sub_instance);
 
             scene->draw_call_data[new_prim].v2 = vec4f::white();
 
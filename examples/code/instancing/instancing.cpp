@@ -35,7 +35,7 @@ void example_setup(ecs_scene* scene, camera& cam)
     scene->transforms[light].translation = vec3f::zero();
     scene->transforms[light].rotation = quat();
     scene->transforms[light].scale = vec3f::one();
-    scene->entities[light] |= e_cmp::light;
+    add_entity_flags(scene, light, e_cmp::light);
     scene->entities[light] |= e_cmp::transform;
 
     f32 spacing = 4.0f;
@@ -90,10 +90,10 @@ void example_setup(ecs_scene* scene, camera& cam)
 
                 scene->bounding_volumes[new_prim] = scene->bounding_volumes[master_node];
 
-                scene->entities[new_prim] |= e_cmp::geometry;
-                scene->entities[new_prim] |= e_cmp::material;
+                add_entity_flags(scene, new_prim, e_cmp::geometry);
+                add_entity_flags(scene, new_prim, e_cmp::material);
 
-                scene->entities[new_prim] |= e_cmp::sub_instance;
+                add_entity_flags(scene, new_prim, e_cmp::sub_instance);
 
                 vec3f hsv = vec3f((f32)(rand() % RAND_MAX) / (f32)RAND_MAX, 1.0f, 1.0f);
                 vec3f rgb = maths::hsv_to_rgb(hsv);
@@ -76,7 +76,7 @@ void example_update(ecs::ecs_scene* scene, camera& cam, f32 dt)
     {
         if (i >= lights_end)
         {
-            scene->entities[i] &= ~e_cmp::light;
+            remove_entity_flags(scene, i, e_cmp::light);
             continue;
         }
 
@@ -96,7 +96,7 @@ void example_update(ecs::ecs_scene* scene, camera& cam, f32 dt)
             }
         }
 
-        scene->entities[i] |= e_cmp::light;
+        add_entity_flags(scene, i, e_cmp::light);
         scene->lights[i].radius = light_radius;
 
         dir_index++;
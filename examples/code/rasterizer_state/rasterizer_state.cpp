@@ -40,7 +40,8 @@ void render_raster_states(const scene_view& view)
 
         pmfx::set_technique_perm(view.pmfx_shader, view.id_technique, 0);
         pen::renderer_set_constant_buffer(view.cb_view, 0, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
-        pen::renderer_set_constant_buffer(scene->cbuffer[ci], 1, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
+        pen::renderer_set_constant_buffer(scene->cbuffer[ci], 1, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS,
+                                          scene->cbuffer_offset[ci]);
         pen::renderer_set_constant_buffer(scene->materials[ci].material_cbuffer, 7,
                                           pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
 
@@ -109,7 +110,7 @@ void example_setup(ecs::ecs_scene* scene, camera& cam)
     scene->transforms[light].translation = vec3f::zero();
     scene->transforms[light].rotation = quat();
     scene->transforms[light].scale = vec3f::one();
-    scene->entities[light] |= e_cmp::light;
+    add_entity_flags(scene, light, e_cmp::light);
     scene->entities[light] |= e_cmp::transform;
 
     // add a few cubes
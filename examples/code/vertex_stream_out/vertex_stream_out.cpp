@@ -45,7 +45,7 @@ void example_setup(ecs_scene* scene, camera& cam)
         scene->transforms[light].translation = light_pos[l];
         scene->transforms[light].rotation = quat();
         scene->transforms[light].scale = vec3f::one();
-        scene->entities[light] |= e_cmp::light;
+        add_entity_flags(scene, light, e_cmp::light);
         scene->entities[light] |= e_cmp::transform;
     }
 
@@ -78,7 +78,7 @@ void example_setup(ecs_scene* scene, camera& cam)
     bind_animation_to_rig(scene, ah, skinned_char);
 
     // remove the geometry flag from the skinned character as we just want to use it as vertex stream out
-    scene->entities[skinned_char] &= ~e_cmp::geometry;
+    remove_entity_flags(scene, skinned_char, e_cmp::geometry);
 
     // in order to instance stuff we must have a contiguous list of nodes.
     // this node aliases the geometry and materials from the skinned_char root node
@@ -89,12 +89,13 @@ void example_setup(ecs_scene* scene, camera& cam)
     scene->transforms[master_node].scale = vec3f::one();
     scene->parents[master_node] = master_node;
 
-    scene->entities[master_node] |= (e_cmp::transform | e_cmp::geometry | e_cmp::material);
+    add_entity_flags(scene, master_node, e_cmp::transform | e_cmp::geometry | e_cmp::material);
 
     scene->geometries[master_node] = scene->geometries[skinned_char];
     scene->materials[master_node] = scene->materials[skinned_char];
     scene->material_resources[master_node] = scene->material_resources[skinned_char];
     scene->cbuffer[master_node] = scene->cbuffer[skinned_char];
+    scene->cbuffer_offset[master_node] = scene->cbuffer_offset[skinned_char];
 
     s32 num = 20;
 
@@ -126,9 +127,9 @@ void example_setup(ecs_scene* scene, camera& cam)
             scene->parents[new_prim] = skinned_char;
 
             scene->entities[new_prim] |= e_cmp::transform;
-            scene->entities[new_prim] |= e_cmp::geometry;
-            scene->entities[new_prim] |= e_cmp::material;
-            scene->entities[new_prim] |= e_cmp::sub_instance;
+            add_entity_flags(scene, new_prim, e_cmp::geometry);
+            add_entity_flags(scene, new_prim, e_cmp::material);
+            add_entity_flags(scene, new_prim, e_cmp::sub_instance);
 
             scene->draw_call_data[new_prim].v2 = vec4f(0.5f, 0.5f, 0.5f, 1.0f - roughness);
 
@@ -0,0 +1,551 @@
+#include "ecs/ecs_cull.h"
+#include "ecs/ecs_resources.h"
+#include "ecs/ecs_scene.h"
+#include "ecs/ecs_utilities.h"
+
+#include "camera.h"
+#include "console.h"
+#include "data_struct.h"
+#include "file_system.h"
+#include "null/renderer_null.h"
+#include "os.h"
+#include "pen.h"
+#include "pmfx.h"
+#include "renderer.h"
+#include "threads.h"
+#include "timer.h"
+
+#include <fstream>
+
+using namespace pen;
+using namespace put;
+using namespace ecs;
+
+// Headless benchmark of the ecs hot paths, built against the null renderer so render functions can be measured
+// by the commands they produce without a gpu. Results are written as json to track regressions between releases.
+
+namespace physics
+{
+    extern void* physics_thread_main(void* params);
+}
+
+namespace
+{
+    struct bench_params
+    {
+        u32 entities = 10000;
+        u32 depth = 4;
+        u32 lights = 16;
+        u32 rigs = 8;
+        u32 joints = 32;
+        u32 frames = 60;
+        u32 churn = 10000;
+        Str output = "";
+    };
+
+    struct bench_sample
+    {
+        f64 total_ms = 0.0;
+        f64 min_ms = FLT_MAX;
+        f64 max_ms = 0.0;
+        u32 count = 0;
+    };
+
+    Str*         s_args = nullptr;
+    bench_params s_params;
+    u32          s_rand = 0x9e3779b9;
+
+    u32 bench_rand()
+    {
+        // deterministic xorshift so results are comparable run to run
+        s_rand ^= s_rand << 13;
+        s_rand ^= s_rand >> 17;
+        s_rand ^= s_rand << 5;
+        return s_rand;
+    }
+
+    f32 bench_rand_f32(f32 lo, f32 hi)
+    {
+        return lo + (hi - lo) * ((f32)(bench_rand() & 0xffff) / 65535.0f);
+    }
+
+    void add_sample(bench_sample& s, f64 ms)
+    {
+        s.total_ms += ms;
+        s.min_ms = std::min<f64>(s.min_ms, ms);
+        s.max_ms = std::max<f64>(s.max_ms, ms);
+        s.count++;
+    }
+
+    void write_sample(Str& json, const c8* name, const bench_sample& s)
+    {
+        f64 mean = s.count ? s.total_ms / (f64)s.count : 0.0;
+        f64 mn = s.count ? s.min_ms : 0.0;
+        json.appendf("\"%s\": {\"count\": %u, \"mean_ms\": %.4f, \"min_ms\": %.4f, \"max_ms\": %.4f}", name, s.count, mean,
+                     mn, s.max_ms);
+    }
+
+    void write_renderer_stats(Str& json, const c8* name, const null_renderer_stats& rs, u32 frames)
+    {
+        f64 d = (f64)std::max<u32>(frames, 1);
+        json.appendf("\"%s\": {", name);
+        json.appendf("\"commands\": %.1f, ", rs.commands / d);
+        json.appendf("\"draws\": %.1f, ", (rs.draws + rs.draws_indexed + rs.draws_instanced) / d);
+        json.appendf("\"shader_binds\": %.1f, ", rs.shader_binds / d);
+        json.appendf("\"vertex_buffer_binds\": %.1f, ", rs.vertex_buffer_binds / d);
+        json.appendf("\"index_buffer_binds\": %.1f, ", rs.index_buffer_binds / d);
+        json.appendf("\"constant_buffer_binds\": %.1f, ", rs.constant_buffer_binds / d);
+        json.appendf("\"texture_binds\": %.1f, ", rs.texture_binds / d);
+        json.appendf("\"state_binds\": %.1f, ", rs.state_binds / d);
+        json.appendf("\"buffer_updates\": %.1f, ", rs.buffer_updates / d);
+        json.appendf("\"buffer_update_bytes\": %.1f", rs.buffer_update_bytes / d);
+        json.append("}");
+    }
+
+    // run the commands produced since the last flush through the null renderer on this thread
+    const null_renderer_stats& flush_commands()
+    {
+        null_renderer_reset_stats();
+        pen::renderer_present();
+        pen::renderer_dispatch();
+        pen::renderer_new_frame();
+        return null_renderer_get_stats();
+    }
+
+    void show_help()
+    {
+        PEN_LOG("ecs_bench help");
+        PEN_LOG("    -help <show this dialog>");
+        PEN_LOG("    -entities <number of renderable entities> (default 10000)");
+        PEN_LOG("    -depth <hierarchy depth> (default 4)");
+        PEN_LOG("    -lights <number of lights> (default 16)");
+        PEN_LOG("    -rigs <number of skinned rigs> (default 8)");
+        PEN_LOG("    -joints <joints per rig, max 85> (default 32)");
+        PEN_LOG("    -frames <frames to average> (default 60)");
+        PEN_LOG("    -churn <entity delete / allocate operations> (default 10000)");
+        PEN_LOG("    -o (optional) <output json file>, prints to stdout if not supplied.");
+    }
+
+    bool parse_args()
+    {
+        u32 argc = sb_count(s_args);
+        for (u32 i = 0; i < argc; ++i)
+        {
+            if (s_args[i] == "-help")
+                return false;
+
+            if (i + 1 >= argc)
+                break;
+
+            const c8* v = s_args[i + 1].c_str();
+            if (s_args[i] == "-entities")
+                s_params.entities = atoi(v);
+            else if (s_args[i] == "-depth")
+                s_params.depth = std::max<u32>(atoi(v), 1);
+            else if (s_args[i] == "-lights")
+                s_params.lights = atoi(v);
+            else if (s_args[i] == "-rigs")
+                s_params.rigs = atoi(v);
+            else if (s_args[i] == "-joints")
+                s_params.joints = std::min<u32>(std::max<u32>(atoi(v), 1), 85);
+            else if (s_args[i] == "-frames")
+                s_params.frames = std::max<u32>(atoi(v), 1);
+            else if (s_args[i] == "-churn")
+                s_params.churn = atoi(v);
+            else if (s_args[i] == "-o")
+                s_params.output = v;
+        }
+
+        return true;
+    }
+
+    void setup_renderable(ecs_scene* scene, u32 e, u32 parent, geometry_resource* geom, material_resource* mat)
+    {
+        scene->names[e] = "";
+        scene->names[e].appendf("bench_%i", e);
+        scene->id_name[e] = PEN_HASH(scene->names[e].c_str());
+        scene->parents[e] = parent;
+
+        scene->transforms[e].translation = vec3f(bench_rand_f32(-500.0f, 500.0f), bench_rand_f32(-50.0f, 50.0f),
+                                                 bench_rand_f32(-500.0f, 500.0f));
+        scene->transforms[e].rotation = quat();
+        scene->transforms[e].scale = vec3f::one();
+        scene->entities[e] |= e_cmp::transform;
+
+        instantiate_geometry(geom, scene, e);
+        instantiate_material(mat, scene, e);
+        instantiate_model_cbuffer(scene, e);
+    }
+
+    void create_bench_scene(ecs_scene* scene)
+    {
+        clear_scene(scene);
+
+        material_resource* mat = get_material_resource(PEN_HASH("default_material"));
+        geometry_resource* cube = get_geometry_resource(PEN_HASH("cube"));
+
+        // renderables in chains of depth, parents are always before children
+        s32 start, end;
+        get_new_entities_append(scene, s_params.entities, start, end);
+        for (s32 e = start; e < end; ++e)
+        {
+            u32 parent = ((e - start) % s_params.depth) == 0 ? e : e - 1;
+            setup_renderable(scene, e, parent, cube, mat);
+        }
+
+        // lights, mix of types
+        for (u32 i = 0; i < s_params.lights; ++i)
+        {
+            u32 l = get_new_entity(scene);
+
+            scene->lights[l].type = i == 0 ? e_light_type::dir : (i % 2 ? e_light_type::point : e_light_type::spot);
+            instantiate_light(scene, l);
+
+            scene->lights[l].radius = bench_rand_f32(10.0f, 50.0f);
+            scene->lights[l].direction = normalize(vec3f(0.5f, 1.0f, 0.2f));
+            scene->transforms[l].translation = vec3f(bench_rand_f32(-500.0f, 500.0f), 20.0f, bench_rand_f32(-500.0f, 500.0f));
+            scene->transforms[l].rotation = quat();
+        }
+
+        // skinned rigs, a cube with a synthetic skin followed by a chain of joints
+        if (s_params.rigs)
+        {
+            cmp_skin* skin = new cmp_skin();
+            skin->num_joints = s_params.joints;
+            skin->bind_shape_matrix = mat4::create_identity();
+            for (u32 j = 0; j < s_params.joints; ++j)
+                skin->joint_bind_matrices[j] = mat4::create_identity();
+
+            geometry_resource* skinned = new geometry_resource(*cube);
+            skinned->geometry_name = "bench_skinned_cube";
+            skinned->hash = PEN_HASH("bench_skinned_cube");
+            skinned->p_skin = skin;
+            add_geometry_resource(skinned);
+
+            for (u32 r = 0; r < s_params.rigs; ++r)
+            {
+                get_new_entities_append(scene, s_params.joints + 1, start, end);
+
+                setup_renderable(scene, start, start, skinned, mat);
+
+                for (s32 j = start + 1; j < end; ++j)
+                {
+                    scene->names[j] = "";
+                    scene->names[j].appendf("bench_joint_%i", j);
+                    scene->parents[j] = j - 1;
+                    scene->transforms[j].translation = vec3f(0.0f, 1.0f, 0.0f);
+                    scene->transforms[j].rotation = quat();
+                    scene->transforms[j].scale = vec3f::one();
+                    add_entity_flags(scene, j, e_cmp::bone | e_cmp::transform);
+                }
+
+                instantiate_anim_controller_v2(scene, start);
+            }
+        }
+
+        // settle transforms and create lazy resources before timing
+        update_scene(scene, 1.0f / 60.0f);
+        flush_commands();
+    }
+
+    void bench_update_scene(ecs_scene* scene, Str& json)
+    {
+        bench_sample        sample;
+        null_renderer_stats totals;
+        pen::timer*         timer = pen::timer_create();
+
+        for (u32 f = 0; f < s_params.frames; ++f)
+        {
+            // keep animating so the transform and skinning paths do real work
+            u32 ne = (u32)scene->num_entities;
+            for (u32 n = 0; n < ne; n += 7)
+                if (scene->entities[n] & e_cmp::allocated)
+                    scene->entities[n] |= e_cmp::transform;
+
+            pen::timer_start(timer);
+            update_scene(scene, 1.0f / 60.0f);
+            add_sample(sample, pen::timer_elapsed_ms(timer));
+
+            const null_renderer_stats& rs = flush_commands();
+            totals.commands += rs.commands;
+            totals.buffer_updates += rs.buffer_updates;
+            totals.buffer_update_bytes += rs.buffer_update_bytes;
+        }
+
+        json.append("\"update_scene\": {");
+        write_sample(json, "time", sample);
+        json.append(", ");
+        write_renderer_stats(json, "per_frame", totals, s_params.frames);
+        json.append("}");
+
+        pen::timer_destroy(timer);
+    }
+
+    void bench_cull(ecs_scene* scene, camera* cam, Str& json)
+    {
+        bench_sample filter, aabb_scalar, aabb, sphere_scalar, sphere;
+        pen::timer*  timer = pen::timer_create();
+        u32          visible = 0;
+
+        for (u32 f = 0; f < s_params.frames; ++f)
+        {
+            u32* filtered = nullptr;
+            u32* culled = nullptr;
+
+            pen::timer_start(timer);
+            filter_entities_scalar(scene, &filtered);
+            add_sample(filter, pen::timer_elapsed_ms(timer));
+
+            pen::timer_start(timer);
+            frustum_cull_aabb_scalar(scene, cam, filtered, &culled);
+            add_sample(aabb_scalar, pen::timer_elapsed_ms(timer));
+            sb_clear(culled);
+
+            pen::timer_start(timer);
+            frustum_cull_aabb(scene, cam, filtered, &culled);
+            add_sample(aabb, pen::timer_elapsed_ms(timer));
+            visible = sb_count(culled);
+            sb_clear(culled);
+
+            pen::timer_start(timer);
+            frustum_cull_sphere_scalar(scene, cam, filtered, &culled);
+            add_sample(sphere_scalar, pen::timer_elapsed_ms(timer));
+            sb_clear(culled);
+
+            pen::timer_start(timer);
+            frustum_cull_sphere(scene, cam, filtered, &culled);
+            add_sample(sphere, pen::timer_elapsed_ms(timer));
+            sb_clear(culled);
+
+            sb_free(filtered);
+        }
+
+        json.append("\"cull\": {");
+        json.appendf("\"visible\": %u, ", visible);
+        write_sample(json, "filter_entities", filter);
+        json.append(", ");
+        write_sample(json, "frustum_cull_aabb_scalar", aabb_scalar);
+        json.append(", ");
+        write_sample(json, "frustum_cull_aabb", aabb);
+        json.append(", ");
+        write_sample(json, "frustum_cull_sphere_scalar", sphere_scalar);
+        json.append(", ");
+        write_sample(json, "frustum_cull_sphere", sphere);
+        json.append("}");
+
+        pen::timer_destroy(timer);
+    }
+
+    void bench_render_scene_view(ecs_scene* scene, camera* cam, Str& json)
+    {
+        scene_view view;
+        view.scene = scene;
+        view.camera = cam;
+        view.cb_view = cam->cbuffer;
+        view.render_flags = pmfx::e_scene_render_flags::forward_lit;
+
+        bench_sample        sample;
+        null_renderer_stats totals;
+        pen::timer*         timer = pen::timer_create();
+
+        for (u32 f = 0; f < s_params.frames; ++f)
+        {
+            pen::timer_start(timer);
+            render_scene_view(view);
+            add_sample(sample, pen::timer_elapsed_ms(timer));
+
+            const null_renderer_stats& rs = flush_commands();
+            totals.commands += rs.commands;
+            totals.draws += rs.draws;
+            totals.draws_indexed += rs.draws_indexed;
+            totals.draws_instanced += rs.draws_instanced;
+            totals.shader_binds += rs.shader_binds;
+            totals.vertex_buffer_binds += rs.vertex_buffer_binds;
+            totals.index_buffer_binds += rs.index_buffer_binds;
+            totals.constant_buffer_binds += rs.constant_buffer_binds;
+            totals.texture_binds += rs.texture_binds;
+            totals.state_binds += rs.state_binds;
+            totals.buffer_updates += rs.buffer_updates;
+            totals.buffer_update_bytes += rs.buffer_update_bytes;
+        }
+
+        json.append("\"render_scene_view\": {");
+        write_sample(json, "time", sample);
+        json.append(", ");
+        write_renderer_stats(json, "per_frame", totals, s_params.frames);
+        json.append("}");
+
+        pen::timer_destroy(timer);
+    }
+
+    void bench_save_load(ecs_scene* scene, Str& json)
+    {
+        static const c8* k_filename = "ecs_bench.pms";
+
+        pen::timer* timer = pen::timer_create();
+        u32         num_entities = (u32)scene->num_entities;
+
+        pen::timer_start(timer);
+        save_scene(k_filename, scene);
+        f64 save_ms = pen::timer_elapsed_ms(timer);
+
+        pen::timer_start(timer);
+        load_scene(k_filename, scene);
+        f64 load_ms = pen::timer_elapsed_ms(timer);
+
+        flush_commands();
+
+        json.appendf("\"save_load\": {\"entities\": %u, \"save_ms\": %.4f, \"load_ms\": %.4f}", num_entities, save_ms,
+                     load_ms);
+
+        pen::timer_destroy(timer);
+    }
+
+    void bench_entity_churn(ecs_scene* scene, Str& json)
+    {
+        // churn a pool of leaf entities through delete and contiguous allocation to stress the free ranges
+        u32 pool = std::max<u32>(s_params.churn / 4, 64);
+
+        s32 start, end;
+        get_new_entities_append(scene, pool, start, end);
+
+        u32* live = nullptr;
+        for (s32 i = start; i < end; ++i)
+            sb_push(live, i);
+
+        pen::timer*  timer = pen::timer_create();
+        bench_sample del, alloc;
+        u32          ops = 0;
+
+        while (ops < s_params.churn)
+        {
+            // delete a random batch
+            u32 batch = 1 + bench_rand() % 16;
+            pen::timer_start(timer);
+            for (u32 b = 0; b < batch && sb_count(live) > 1; ++b)
+            {
+                u32 i = bench_rand() % sb_count(live);
+                delete_entity(scene, live[i]);
+                live[i] = sb_last(live);
+                stb__sbn(live)--;
+            }
+            add_sample(del, pen::timer_elapsed_ms(timer));
+
+            // refill with a contiguous range of a random size
+            u32 num = 1 + bench_rand() % 16;
+            pen::timer_start(timer);
+            get_new_entities_contiguous(scene, num, start, end);
+            add_sample(alloc, pen::timer_elapsed_ms(timer));
+
+            for (s32 i = start; i < end; ++i)
+                sb_push(live, i);
+
+            ops += batch + num;
+        }
+
+        u32 entities_before = (u32)scene->num_entities;
+
+        pen::timer_start(timer);
+        compact_entities(scene);
+        f64 compact_ms = pen::timer_elapsed_ms(timer);
+
+        flush_commands();
+
+        json.append("\"entity_churn\": {");
+        json.appendf("\"ops\": %u, \"num_entities_before_compact\": %u, \"num_entities_after_compact\": %u, ", ops,
+                     entities_before, (u32)scene->num_entities);
+        write_sample(json, "delete_batch", del);
+        json.append(", ");
+        write_sample(json, "allocate_contiguous", alloc);
+        json.appendf(", \"compact_ms\": %.4f}", compact_ms);
+
+        sb_free(live);
+        pen::timer_destroy(timer);
+    }
+} // namespace
+
+namespace pen
+{
+    pen_creation_params pen_entry(int argc, char** argv)
+    {
+        // unpack args
+        for (s32 i = 0; i < argc; ++i)
+            sb_push(s_args, argv[i]);
+
+        pen::pen_creation_params p;
+        p.window_width = 1280;
+        p.window_height = 720;
+        p.window_title = "ecs_bench";
+        p.user_thread_function = user_entry;
+        p.flags = pen::e_pen_create_flags::console_app;
+        return p;
+    }
+} // namespace pen
+
+void* pen::user_entry(void* params)
+{
+    // unpack the params passed to the thread and signal to the engine it ok to proceed
+    pen::job_thread_params* job_params = (pen::job_thread_params*)params;
+    pen::job*               p_thread_info = job_params->job_info;
+    pen::semaphore_post(p_thread_info->p_sem_continue, 1);
+
+    if (!parse_args())
+    {
+        show_help();
+    }
+    else
+    {
+        // no render thread in console apps, commands are dispatched to the null renderer from this thread
+        pen::renderer_init(nullptr, false, 1 << 20);
+        pen::jobs_create_job(physics::physics_thread_main, 1024 * 10, nullptr, pen::e_thread_start_flags::detached);
+
+        ecs::simd_init();
+        ecs::create_geometry_primitives();
+
+        ecs_scene* scene = ecs::create_scene("ecs_bench");
+
+        camera cam;
+        camera_create_perspective(&cam, 60.0f, 16.0f / 9.0f, 0.1f, 1000.0f);
+        camera_update_look_at(&cam, vec3f(0.0f, 100.0f, 600.0f), vec3f::zero());
+        camera_update_shader_constants(&cam);
+
+        create_bench_scene(scene);
+
+        Str json = "{";
+        json.appendf("\"params\": {\"entities\": %u, \"depth\": %u, \"lights\": %u, \"rigs\": %u, \"joints\": %u, "
+                     "\"frames\": %u, \"churn\": %u}, ",
+                     s_params.entities, s_params.depth, s_params.lights, s_params.rigs, s_params.joints, s_params.frames,
+                     s_params.churn);
+        json.appendf("\"num_entities\": %u, \"workers\": %u, ", (u32)scene->num_entities, pen::jobs_get_num_workers());
+
+        bench_update_scene(scene, json);
+        json.append(", ");
+        bench_cull(scene, &cam, json);
+        json.append(", ");
+        bench_render_scene_view(scene, &cam, json);
+        json.append(", ");
+        bench_entity_churn(scene, json);
+        json.append(", ");
+        bench_save_load(scene, json);
+        json.append("}\n");
+
+        if (s_params.output.empty())
+        {
+            printf("%s", json.c_str());
+        }
+        else
+        {
+            std::ofstream ofs(s_params.output.c_str());
+            ofs << json.c_str();
+            ofs.close();
+
+            PEN_LOG("ecs_bench: written %s", s_params.output.c_str());
+        }
+    }
+
+    // signal to the engine the thread has finished
+    pen::os_terminate(0);
+    pen::semaphore_post(p_thread_info->p_sem_terminated, 1);
+
+    return PEN_THREAD_OK;
+}
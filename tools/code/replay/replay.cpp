@@ -0,0 +1,257 @@
+#include "console.h"
+#include "data_struct.h"
+#include "os.h"
+#include "pen.h"
+#include "renderer.h"
+#include "threads.h"
+#include "timer.h"
+
+#include <fstream>
+
+using namespace pen;
+
+// Replays a command stream captured with -capture through the renderer backend this tool is built with, so backend
+// changes can be benchmarked, and backends compared, on identical frames. Frames are submitted as fast as possible
+// or at the pacing they were captured with, results are written as json.
+
+namespace
+{
+    void*  user_setup(void* params);
+    loop_t user_update();
+
+    struct replay_params
+    {
+        Str  capture = "";
+        Str  output = "";
+        u32  loops = 1;
+        bool paced = false;
+    };
+
+    struct replay_sample
+    {
+        f64 total_ms = 0.0;
+        f64 min_ms = FLT_MAX;
+        f64 max_ms = 0.0;
+        u32 count = 0;
+    };
+
+    Str*                    s_args = nullptr;
+    replay_params           s_params;
+    capture_info            s_info;
+    bool                    s_open = false;
+    pen::job_thread_params* s_job_params;
+    pen::job*               s_thread_info;
+    pen::timer*             s_frame_timer;
+    pen::timer*             s_pace_timer;
+    u32                     s_frame = 0;
+    u32                     s_loop = 0;
+    u32                     s_commands = 0;
+    replay_sample           s_cpu;
+    replay_sample           s_gpu;
+
+    void add_sample(replay_sample& s, f64 ms)
+    {
+        s.total_ms += ms;
+        s.min_ms = std::min<f64>(s.min_ms, ms);
+        s.max_ms = std::max<f64>(s.max_ms, ms);
+        s.count++;
+    }
+
+    void write_sample(Str& json, const c8* name, const replay_sample& s)
+    {
+        f64 avg = s.count ? s.total_ms / (f64)s.count : 0.0;
+        f64 mn = s.count ? s.min_ms : 0.0;
+        json.appendf("\"%s\": {\"avg_ms\": %.4f, \"min_ms\": %.4f, \"max_ms\": %.4f}", name, avg, mn, s.max_ms);
+    }
+
+    void show_help()
+    {
+        PEN_LOG("replay help");
+        PEN_LOG("    -help <show this dialog>");
+        PEN_LOG("    -capture <capture file written by an app run with -capture>");
+        PEN_LOG("    -paced (optional) <wait between frames to match the capture, default is as fast as possible>");
+        PEN_LOG("    -loops <times to replay the captured frames, resources they create are recreated> (default 1)");
+        PEN_LOG("    -o (optional) <output json file>, prints to stdout if not supplied.");
+    }
+
+    bool parse_args()
+    {
+        u32 argc = sb_count(s_args);
+        for (u32 i = 0; i < argc; ++i)
+        {
+            if (s_args[i] == "-help")
+                return false;
+
+            if (s_args[i] == "-paced")
+                s_params.paced = true;
+
+            if (i + 1 >= argc)
+                break;
+
+            const c8* v = s_args[i + 1].c_str();
+            if (s_args[i] == "-capture")
+                s_params.capture = v;
+            else if (s_args[i] == "-loops")
+                s_params.loops = std::max<u32>(atoi(v), 1);
+            else if (s_args[i] == "-o")
+                s_params.output = v;
+        }
+
+        return !s_params.capture.empty();
+    }
+
+    void write_results()
+    {
+        const renderer_info& ri = renderer_get_info();
+
+        Str json = "{";
+        json.appendf("\"capture\": \"%s\", \"renderer\": \"%s\", \"api_version\": \"%s\", ", s_params.capture.c_str(),
+                     ri.renderer, ri.api_version);
+        json.appendf("\"frames\": %u, \"start_frame\": %u, \"loops\": %u, \"paced\": %s, \"commands\": %u, ",
+                     s_info.num_frames, s_info.start_frame, s_params.loops, s_params.paced ? "true" : "false",
+                     s_commands);
+        write_sample(json, "cpu", s_cpu);
+        json.append(", ");
+        write_sample(json, "gpu", s_gpu);
+        json.append("}\n");
+
+        if (s_params.output.empty())
+        {
+            printf("%s", json.c_str());
+        }
+        else
+        {
+            std::ofstream ofs(s_params.output.c_str());
+            ofs << json.c_str();
+            ofs.close();
+
+            PEN_LOG("replay: written %s", s_params.output.c_str());
+        }
+    }
+
+    void release_loop_resources()
+    {
+        renderer_replay_end_loop();
+
+        // the next loop recreates them with the same handles, so wait for the deferred releases to complete
+        do
+        {
+            pen::renderer_new_frame();
+            pen::renderer_present();
+            pen::renderer_consume_cmd_buffer();
+        } while (pen::renderer_get_stats().pending_releases > 0);
+    }
+
+    void pace_frame()
+    {
+        // wait out the time between this frames present and the previous one in the capture
+        if (!s_params.paced || s_frame <= s_info.start_frame)
+            return;
+
+        f64 target_ms = renderer_replay_frame_time_ms(s_frame) - renderer_replay_frame_time_ms(s_frame - 1);
+        while (pen::timer_elapsed_ms(s_pace_timer) < target_ms)
+            pen::thread_sleep_ms(0);
+    }
+} // namespace
+
+namespace pen
+{
+    pen_creation_params pen_entry(int argc, char** argv)
+    {
+        // unpack args
+        for (s32 i = 0; i < argc; ++i)
+            sb_push(s_args, argv[i]);
+
+        // the capture has to be replayed at the size it was captured
+        s_open = parse_args() && renderer_replay_open(s_params.capture.c_str(), s_info);
+
+        pen::pen_creation_params p;
+        p.window_width = s_open ? s_info.width : 1280;
+        p.window_height = s_open ? s_info.height : 720;
+        p.window_title = "replay";
+        p.user_thread_function = user_setup;
+        p.flags = pen::e_pen_create_flags::renderer;
+        p.max_renderer_commands = 1 << 20;
+        return p;
+    }
+} // namespace pen
+
+namespace
+{
+    void* user_setup(void* params)
+    {
+        // unpack the params passed to the thread and signal to the engine it ok to proceed
+        s_job_params = (pen::job_thread_params*)params;
+        s_thread_info = s_job_params->job_info;
+        pen::semaphore_post(s_thread_info->p_sem_continue, 1);
+
+        if (!s_open)
+        {
+            show_help();
+            pen::os_terminate(1);
+            pen::semaphore_post(s_thread_info->p_sem_terminated, 1);
+            return PEN_THREAD_OK;
+        }
+
+        s_frame_timer = pen::timer_create();
+        s_pace_timer = pen::timer_create();
+
+        pen_main_loop(user_update);
+        return PEN_THREAD_OK;
+    }
+
+    loop_t user_update()
+    {
+        bool measure = s_frame >= s_info.start_frame;
+
+        pace_frame();
+
+        pen::timer_start(s_pace_timer);
+        pen::timer_start(s_frame_timer);
+
+        u32 commands = renderer_replay_frame(s_frame);
+        pen::renderer_consume_cmd_buffer();
+
+        if (measure)
+        {
+            f32 cpu_ms, gpu_ms;
+            pen::renderer_get_present_time(cpu_ms, gpu_ms);
+
+            add_sample(s_cpu, pen::timer_elapsed_ms(s_frame_timer));
+            add_sample(s_gpu, gpu_ms);
+            s_commands += commands;
+        }
+
+        // frames before start_frame create resources once, loops repeat the captured frames
+        s_frame++;
+        if (s_frame >= s_info.num_frames)
+        {
+            release_loop_resources();
+
+            s_loop++;
+            s_frame = s_info.start_frame;
+        }
+
+        bool done = s_loop >= s_params.loops;
+        if (done || pen::semaphore_try_wait(s_thread_info->p_sem_exit))
+        {
+            if (done)
+                write_results();
+
+            // flush the last frame before the capture data is released
+            pen::renderer_new_frame();
+            pen::renderer_present();
+            pen::renderer_consume_cmd_buffer();
+
+            renderer_replay_close();
+            pen::timer_destroy(s_frame_timer);
+            pen::timer_destroy(s_pace_timer);
+
+            pen::os_terminate(0);
+            pen::semaphore_post(s_thread_info->p_sem_terminated, 1);
+            pen_main_loop_exit();
+        }
+
+        pen_main_loop_continue();
+    }
+} // namespace
@@ -25,6 +25,14 @@ dofile "pmtech.lua"
 -- mesh optimiser
 create_app_example("mesh_opt", script_path())
 
+-- ecs benchmarks, reads draw stats from the null renderer
+if renderer_dir == "null" then
+	create_app_example("ecs_bench", script_path())
+end
+
+-- renderer command stream replay
+create_app_example("replay", script_path())
+
 -- dll to hot reload
 create_dll("live_lib", "live_lib", script_path())
 setup_live_lib("live_lib")